@@ -0,0 +1,171 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Scratch buffers kept across phases and frames.
+ *
+ * The phases draw their large per-frame arrays (packed keys, radix sort
+ * buffers, sorted inputs, lookup matches, kernel maps, masks, trace chunks)
+ * from the pool and give them back when done, so later phases and frames of
+ * similar size reuse the same memory instead of allocating and faulting it
+ * in again. Buffers are kept per element type, up to a total of limit()
+ * bytes; a buffer given back to a full pool is freed.
+ *
+ *   - take<T>(n) returns an empty vector with capacity of at least n, the
+ *     smallest kept one that fits or a new one. reserve() grows a vector the
+ *     same way, keeping its contents.
+ *   - take_block<T>(n) returns n default-initialized elements, for the fixed
+ *     size trace chunks.
+ *
+ * All members may be called concurrently.
+ */
+class BufferPool {
+public:
+    struct Stats {
+        uint64_t requests = 0;        // take, take_block and growing reserve calls
+        uint64_t reuses = 0;          // Served by a kept buffer
+        uint64_t allocations = 0;     // Served by a new allocation
+        uint64_t allocated_bytes = 0; // Size of those allocations
+        uint64_t kept_bytes = 0;      // Held for later requests
+        uint64_t dropped = 0;         // Buffers freed because the pool was full
+    };
+
+    explicit BufferPool(size_t limit_bytes);
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Pool shared by all phases (BUFFER_POOL_MB in the config)
+    static BufferPool& shared();
+
+    size_t limit() const;
+    // A lower limit frees every kept buffer; 0 disables reuse.
+    void set_limit(size_t limit_bytes);
+    void clear();
+    Stats stats() const;
+
+    template <typename T>
+    std::vector<T> take(size_t capacity) {
+        std::vector<T> buf;
+        if (capacity == 0) return buf;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++stats_.requests;
+            auto& kept = list<std::vector<T>>().kept;
+            auto best = kept.end();
+            for (auto it = kept.begin(); it != kept.end(); ++it) {
+                if (it->first >= capacity && (best == kept.end() || it->first < best->first)) best = it;
+            }
+            if (best != kept.end()) {
+                ++stats_.reuses;
+                stats_.kept_bytes -= best->first * sizeof(T);
+                buf = std::move(best->second);
+                *best = std::move(kept.back());
+                kept.pop_back();
+                return buf;
+            }
+            ++stats_.allocations;
+            stats_.allocated_bytes += capacity * sizeof(T);
+        }
+        buf.reserve(capacity);
+        return buf;
+    }
+
+    template <typename T>
+    void give(std::vector<T>&& buf) {
+        const size_t capacity = buf.capacity();
+        if (capacity == 0) return;
+        std::vector<T> dropped;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stats_.kept_bytes + capacity * sizeof(T) > limit_) {
+            ++stats_.dropped;
+            dropped = std::move(buf); // Freed outside the lock
+            return;
+        }
+        stats_.kept_bytes += capacity * sizeof(T);
+        buf.clear();
+        list<std::vector<T>>().kept.emplace_back(capacity, std::move(buf));
+    }
+
+    // Grows buf to a capacity of at least n through the pool, at least
+    // doubling it, and gives the old storage back.
+    template <typename T>
+    void reserve(std::vector<T>& buf, size_t n) {
+        if (buf.capacity() >= n) return;
+        std::vector<T> grown = take<T>(std::max(n, 2 * buf.capacity()));
+        grown.insert(grown.end(), std::make_move_iterator(buf.begin()), std::make_move_iterator(buf.end()));
+        give(std::move(buf));
+        buf = std::move(grown);
+    }
+
+    template <typename T>
+    std::unique_ptr<T[]> take_block(size_t n) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++stats_.requests;
+            auto& kept = list<std::unique_ptr<T[]>>().kept;
+            for (auto it = kept.begin(); it != kept.end(); ++it) {
+                if (it->first != n) continue;
+                ++stats_.reuses;
+                stats_.kept_bytes -= n * sizeof(T);
+                std::unique_ptr<T[]> block = std::move(it->second);
+                *it = std::move(kept.back());
+                kept.pop_back();
+                return block;
+            }
+            ++stats_.allocations;
+            stats_.allocated_bytes += n * sizeof(T);
+        }
+        return std::unique_ptr<T[]>(new T[n]);
+    }
+
+    // `n` is the size the block was taken with
+    template <typename T>
+    void give_block(std::unique_ptr<T[]>&& block, size_t n) {
+        if (!block) return;
+        std::unique_ptr<T[]> dropped;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stats_.kept_bytes + n * sizeof(T) > limit_) {
+            ++stats_.dropped;
+            dropped = std::move(block);
+            return;
+        }
+        stats_.kept_bytes += n * sizeof(T);
+        list<std::unique_ptr<T[]>>().kept.emplace_back(n, std::move(block));
+    }
+
+private:
+    struct ListBase {
+        virtual ~ListBase() = default;
+    };
+    // Kept buffers of one type, with their size in elements
+    template <typename Buf>
+    struct List : ListBase {
+        std::vector<std::pair<size_t, Buf>> kept;
+    };
+
+    template <typename Buf>
+    List<Buf>& list() {
+        std::unique_ptr<ListBase>& slot = lists_[std::type_index(typeid(Buf))];
+        if (!slot) slot = std::make_unique<List<Buf>>();
+        return static_cast<List<Buf>&>(*slot);
+    }
+
+    mutable std::mutex mutex_;
+    size_t limit_;
+    Stats stats_;
+    std::unordered_map<std::type_index, std::unique_ptr<ListBase>> lists_;
+};
+
+#endif // BUFFER_POOL_HPP
@@ -1,10 +1,12 @@
 #ifndef COORD_HPP
 #define COORD_HPP
 
+#include <cstddef>
 #include <cstdint>
 #include <iostream> // For std::ostream
 #include <string>   // Not strictly needed by declarations but often by users
 #include <tuple>    // For unpack functions
+#include <type_traits> // For std::common_type_t
 #include <vector>   // Required for std::vector if used in method signatures or returns
 
 // --- Packing/Unpacking Declarations ---
@@ -13,6 +15,42 @@ uint32_t pack32(int c1, int c2, int c3);
 std::tuple<int, int, int> unpack32(uint32_t key);
 std::tuple<int, int, int> unpack32s(uint32_t key); // For signed unpacking
 
+// 21-bit fields in a 63-bit key, same field order as pack32
+uint64_t pack64(int c1, int c2, int c3);
+std::tuple<int, int, int> unpack64(uint64_t key);
+std::tuple<int, int, int> unpack64s(uint64_t key); // For signed unpacking
+
+/**
+ * @brief Packing of one key width (KEY_BITS in the config).
+ *
+ * uint32_t keys hold three 10-bit fields (pack32), uint64_t keys three 21-bit
+ * fields (pack64). The mapping phases are templates on the key type with both
+ * widths compiled, so 32-bit keys run the same code as before.
+ */
+template <typename Key>
+struct KeyTraits;
+
+template <>
+struct KeyTraits<uint32_t> {
+    static constexpr int AXIS_BITS = 10;
+    static uint32_t pack(int x, int y, int z) { return pack32(x, y, z); }
+    static std::tuple<int, int, int> unpack_signed(uint32_t key) { return unpack32s(key); }
+};
+
+template <>
+struct KeyTraits<uint64_t> {
+    static constexpr int AXIS_BITS = 21;
+    static uint64_t pack(int x, int y, int z) { return pack64(x, y, z); }
+    static std::tuple<int, int, int> unpack_signed(uint64_t key) { return unpack64s(key); }
+};
+
+// True when v survives a signed round trip through a key field of Key
+template <typename Key>
+inline bool fits_key_field(int v) {
+    constexpr int half = 1 << (KeyTraits<Key>::AXIS_BITS - 1);
+    return v >= -half && v < half;
+}
+
 /**
  * @brief Represents a 3D coordinate.
  */
@@ -22,9 +60,23 @@ struct Coord3D {
     Coord3D(int x_ = 0, int y_ = 0, int z_ = 0);
 
     Coord3D quantized(int stride) const;
-    uint32_t to_key() const; // Uses pack32
-    static Coord3D from_key(uint32_t key); // Uses unpack32s
-    static Coord3D from_signed_key(uint32_t key); // Uses unpack32s
+
+    // Packed key of width Key; pack32 by default
+    template <typename Key = uint32_t>
+    Key to_key() const { return KeyTraits<Key>::pack(x, y, z); }
+
+    // The key type is never deduced from the argument: from_key(k) unpacks a
+    // 32-bit key, from_key<uint64_t>(k) a 64-bit one.
+    template <typename Key = uint32_t>
+    static Coord3D from_key(std::common_type_t<Key> key) {
+        auto [ux, uy, uz] = KeyTraits<Key>::unpack_signed(key); // Consistently use signed unpack for from_key
+        return Coord3D(ux, uy, uz);
+    }
+    template <typename Key = uint32_t>
+    static Coord3D from_signed_key(std::common_type_t<Key> key) {
+        auto [sx, sy, sz] = KeyTraits<Key>::unpack_signed(key);
+        return Coord3D(sx, sy, sz);
+    }
 
     Coord3D operator+(const Coord3D& other) const;
 
@@ -34,16 +86,48 @@ struct Coord3D {
 /**
  * @brief Represents a coordinate with an associated original index.
  */
-struct IndexedCoord {
+template <typename Key>
+struct BasicIndexedCoord {
     Coord3D coord;
     int orig_idx; 
-    uint32_t key_val; // Store the packed key
+    Key key_val; // Store the packed key
 
-    IndexedCoord(Coord3D c = Coord3D(), int idx = -1);
-    IndexedCoord(uint32_t k, int idx = -1); // Constructor from key
+    BasicIndexedCoord(Coord3D c = Coord3D(), int idx = -1)
+        : coord(c), orig_idx(idx), key_val(c.to_key<Key>()) {}
+    BasicIndexedCoord(Key k, int idx = -1) // Constructor from key
+        : coord(Coord3D::from_key<Key>(k)), orig_idx(idx), key_val(k) {}
 
-    uint32_t to_key() const;
-    static IndexedCoord from_key_and_index(uint32_t key, int idx);
+    Key to_key() const { return key_val; }
+    static BasicIndexedCoord from_key_and_index(Key key, int idx) {
+        return BasicIndexedCoord(key, idx); // Use the constructor that takes key and index
+    }
 };
 
+using IndexedCoord = BasicIndexedCoord<uint32_t>;
+using IndexedCoord64 = BasicIndexedCoord<uint64_t>;
+
+/**
+ * @brief Read-only view of consecutive indexed coordinates, such as one PVT
+ * tile of the sorted inputs. It does not own them, so it is only valid while
+ * the vector it points into is alive and unchanged.
+ */
+template <typename Key>
+struct BasicCoordSpan {
+    const BasicIndexedCoord<Key>* first = nullptr;
+    size_t count = 0;
+
+    BasicCoordSpan() = default;
+    BasicCoordSpan(const BasicIndexedCoord<Key>* data, size_t n) : first(data), count(n) {}
+    BasicCoordSpan(const std::vector<BasicIndexedCoord<Key>>& coords) // Whole vector
+        : first(coords.data()), count(coords.size()) {}
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const BasicIndexedCoord<Key>& operator[](size_t i) const { return first[i]; }
+    const BasicIndexedCoord<Key>* begin() const { return first; }
+    const BasicIndexedCoord<Key>* end() const { return first + count; }
+};
+
+using CoordSpan = BasicCoordSpan<uint32_t>;
+
 #endif // COORD_HPP
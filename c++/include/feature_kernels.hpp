@@ -0,0 +1,198 @@
+#ifndef FEATURE_KERNELS_HPP
+#define FEATURE_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// x86-64 GCC and Clang pick AVX-512F, AVX or SSE for accumulate_n at run time
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MINUET_FEATURE_DISPATCH 1
+#else
+#define MINUET_FEATURE_DISPATCH 0
+#endif
+
+/**
+ * @brief Feature kernels of the GTH and SCT workers (FEATURE_KERNELS "vector").
+ *
+ * A bulk copy or accumulate is valid up to where the source or destination
+ * vector ends. The workers compute that length once per bulk with
+ * clamp_span() and call these kernels on the whole span, so the loops carry
+ * no per-element bounds checks. Accumulation is element-wise, so the SIMD
+ * paths give exactly the results of the scalar loop.
+ *
+ * Common bulk sizes (multiples of 4 up to 64) go to accumulate_fixed<N>,
+ * unrolled into 4-wide SSE or NEON adds (8-wide with AVX at compile time).
+ * Other lengths go to accumulate_n, which on x86-64 uses the widest of
+ * AVX-512F, AVX and SSE that the CPU reports at run time, so a portable
+ * build (MINUET_NATIVE_ARCH=OFF) still gets the wide loops. Elsewhere it
+ * uses NEON or a plain loop.
+ */
+namespace feature_kernels {
+
+// Elements of [start, start + count) that lie below both sizes, i.e. the
+// prefix the scalar loop would touch.
+inline size_t clamp_span(uint64_t src_start, size_t src_size, uint64_t dst_start, size_t dst_size,
+                         size_t count) {
+    if (src_start >= src_size || dst_start >= dst_size) return 0;
+    uint64_t n = count;
+    if (src_size - src_start < n) n = src_size - src_start;
+    if (dst_size - dst_start < n) n = dst_size - dst_start;
+    return static_cast<size_t>(n);
+}
+
+inline void copy(float* dst, const float* src, size_t n) {
+    std::memcpy(dst, src, n * sizeof(float));
+}
+
+using AccumulateFn = void (*)(float* __restrict dst, const float* __restrict src, size_t n);
+
+namespace detail {
+
+inline void accumulate_scalar(float* __restrict dst, const float* __restrict src, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+#if MINUET_FEATURE_DISPATCH
+inline void accumulate_sse(float* __restrict dst, const float* __restrict src, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+    }
+    for (; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+__attribute__((target("avx"))) inline void accumulate_avx(float* __restrict dst, const float* __restrict src,
+                                                            size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+    }
+    for (; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+__attribute__((target("avx512f"))) inline void accumulate_avx512(float* __restrict dst,
+                                                                   const float* __restrict src, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_loadu_ps(dst + i), _mm512_loadu_ps(src + i)));
+    }
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+    }
+    for (; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+#endif
+
+#if defined(__ARM_NEON)
+inline void accumulate_neon(float* __restrict dst, const float* __restrict src, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), vld1q_f32(src + i)));
+    }
+    for (; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+#endif
+
+// One 4-wide add per group of 4 elements, expanded at compile time
+template <size_t... I>
+inline void accumulate_by_4(float* __restrict dst, const float* __restrict src, std::index_sequence<I...>) {
+#if defined(__SSE__)
+    (_mm_storeu_ps(dst + 4 * I, _mm_add_ps(_mm_loadu_ps(dst + 4 * I), _mm_loadu_ps(src + 4 * I))), ...);
+#elif defined(__ARM_NEON)
+    (vst1q_f32(dst + 4 * I, vaddq_f32(vld1q_f32(dst + 4 * I), vld1q_f32(src + 4 * I))), ...);
+#else
+    ((dst[4 * I] += src[4 * I], dst[4 * I + 1] += src[4 * I + 1], dst[4 * I + 2] += src[4 * I + 2],
+      dst[4 * I + 3] += src[4 * I + 3]),
+     ...);
+#endif
+}
+
+#if defined(__AVX__)
+template <size_t... I>
+inline void accumulate_by_8(float* __restrict dst, const float* __restrict src, std::index_sequence<I...>) {
+    (_mm256_storeu_ps(dst + 8 * I, _mm256_add_ps(_mm256_loadu_ps(dst + 8 * I), _mm256_loadu_ps(src + 8 * I))),
+     ...);
+}
+#endif
+
+} // namespace detail
+
+// Every accumulate_n variant this CPU can run, widest first, with its
+// instruction set; the first one is what accumulate_n uses.
+inline std::vector<std::pair<const char*, AccumulateFn>> accumulate_kernels() {
+    std::vector<std::pair<const char*, AccumulateFn>> kernels;
+#if MINUET_FEATURE_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) kernels.emplace_back("avx512f", detail::accumulate_avx512);
+    if (__builtin_cpu_supports("avx")) kernels.emplace_back("avx", detail::accumulate_avx);
+    kernels.emplace_back("sse", detail::accumulate_sse);
+#elif defined(__ARM_NEON)
+    kernels.emplace_back("neon", detail::accumulate_neon);
+#endif
+    kernels.emplace_back("scalar", detail::accumulate_scalar);
+    return kernels;
+}
+
+// dst[i] += src[i] for i < n
+inline void accumulate_n(float* __restrict dst, const float* __restrict src, size_t n) {
+    static const AccumulateFn kernel = accumulate_kernels().front().second; // Selected once per process
+    kernel(dst, src, n);
+}
+
+template <size_t N>
+inline void accumulate_fixed(float* __restrict dst, const float* __restrict src) {
+    static_assert(N % 4 == 0, "accumulate_fixed needs a multiple of 4 elements");
+#if defined(__AVX__)
+    if constexpr (N % 8 == 0) {
+        detail::accumulate_by_8(dst, src, std::make_index_sequence<N / 8>{});
+    } else {
+        detail::accumulate_by_4(dst, src, std::make_index_sequence<N / 4>{});
+    }
+#else
+    detail::accumulate_by_4(dst, src, std::make_index_sequence<N / 4>{});
+#endif
+}
+
+inline void accumulate(float* dst, const float* src, size_t n) {
+    switch (n) {
+        case 4: accumulate_fixed<4>(dst, src); break;
+        case 8: accumulate_fixed<8>(dst, src); break;
+        case 16: accumulate_fixed<16>(dst, src); break;
+        case 32: accumulate_fixed<32>(dst, src); break;
+        case 64: accumulate_fixed<64>(dst, src); break;
+        default: accumulate_n(dst, src, n); break;
+    }
+}
+
+// True for FEATURE_KERNELS "scalar" (the original per-element loops), false
+// for "vector". Throws std::invalid_argument for any other name.
+inline bool use_scalar(const std::string& name) {
+    if (name == "vector") return false;
+    if (name == "scalar") return true;
+    throw std::invalid_argument("Unknown FEATURE_KERNELS: '" + name + "' (expected vector or scalar)");
+}
+
+} // namespace feature_kernels
+
+#endif // FEATURE_KERNELS_HPP
@@ -0,0 +1,165 @@
+#ifndef FRAME_PIPELINE_HPP
+#define FRAME_PIPELINE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <variant>
+#include <vector>
+#include "coord.hpp"
+#include "gemm_grouping.hpp"
+#include "kernel_map.hpp"
+#include "minuet_config.hpp" // nlohmann::json
+#include "minuet_gather.hpp"
+#include "network.hpp"
+#include "profiler.hpp"
+#include "trace_context.hpp"
+
+/**
+ * @brief The traced phases of one frame, split into the pipeline stages.
+ *
+ *   - map(): RDX, QRY, PVT and LKP, then the GEMM grouping of every layer.
+ *   - gather_scatter(): the masks, GTH and SCT of every layer.
+ *   - finish(): closes or writes the traces and writes the kernel map,
+ *     gemms.bin.gz, metadata.bin.gz and checksums.json, then profile.json
+ *     (unless built with MINUET_PROFILING=OFF).
+ *
+ * Without a NETWORK the frame is one 3x3x3 layer at stride 1 whose files go
+ * to output_dir. With one, map() builds the kernel maps of all layers through
+ * a KernelMapCache (network.hpp), so map_trace holds only the lookups that
+ * were not reused, and every layer writes its gather and scatter traces,
+ * gemms, metadata and (for the layers that looked it up) kernel map to
+ * output_dir/<layer name>/. gather_scatter() writes all but the last layer
+ * as it goes, so the masks and traces of one layer are held at a time;
+ * finish() writes the last one and network.json, which lists the strides,
+ * point counts, channels and kernel map source of every layer.
+ *
+ * Each trace records into its own TraceContext, so the stages of different
+ * frames can run at the same time. The stages must run in order, and
+ * finish() exactly once. map(previous) maps incrementally from the frame
+ * kept in `previous` (see MappedFrame). Files go to output_dir, which is created if needed.
+ * input_keys are the packed keys of the input points at stride 1, as
+ * returned by read_point_cloud_keys or pack_coord_keys; their width picks the
+ * instantiation the mapping phases run with.
+ */
+using FrameKeys = std::variant<std::vector<uint32_t>, std::vector<uint64_t>>;
+
+/**
+ * @brief Sorted inputs and kernel map of the last frame mapped, kept for
+ * INCREMENTAL_MAPPING.
+ *
+ * FrameTrace::map(&previous) diffs its points against this frame and runs
+ * update_kernel_map instead of a full RDX/PVT/LKP when the neighborhood
+ * lookups are fewer than a full lookup, then replaces the kept frame by its
+ * own. An incremental frame renumbers the points of update_kernel_map by their
+ * position in the frame, as a full map numbers them, so both give the same
+ * outputs, and the kept frame carries that numbering to the next update.
+ * Frames of another key width are mapped in full.
+ */
+struct MappedFrame {
+    std::variant<std::monostate, std::vector<IndexedCoord>, std::vector<IndexedCoord64>> uniq_coords;
+    KernelMapCSR kmap;
+};
+
+class FrameTrace {
+public:
+    FrameTrace(std::string name, std::string output_dir, FrameKeys input_keys);
+
+    const std::string& name() const { return name_; }
+    const std::string& output_dir() const { return output_dir_; }
+
+    void map(MappedFrame* previous = nullptr);
+    void gather_scatter();
+    void finish();
+
+private:
+    // One convolution: its kernel map, GEMM groups, masks and traces
+    struct Layer {
+        NetworkLayer spec;
+        std::string prefix; // Its subdirectory ("<name>/"), empty without a NETWORK
+        uint32_t in_channels = 0;
+        LayerMap map;
+        GreedyGroupResult groups;
+        MasksResult masks;
+        std::unique_ptr<TraceContext> gather_ctx, scatter_ctx;
+    };
+
+    // Trace paths are output_dir_ + prefix + file name
+    std::string trace_file(const std::string& stem) const;
+    void begin_trace(const std::string& prefix, const std::string& stem, int sizeof_addr);
+    uint32_t end_trace(const std::string& prefix, const std::string& stem, int sizeof_addr);
+    // Ends the trace of ctx and records its checksum
+    void close_trace(TraceContext& ctx, const std::string& prefix, const std::string& stem, int sizeof_addr);
+    template <typename Key>
+    void map_keys(std::vector<Key> input_keys, MappedFrame* previous);
+    void write_layer_outputs(Layer& layer);
+    void write_network_json(const std::string& filename) const;
+
+    std::string name_;
+    std::string output_dir_; // Ends with '/'
+    FrameKeys input_keys_;
+
+    Profile profile_; // Shared by all contexts
+    std::unique_ptr<TraceContext> map_ctx_;
+    bool network_ = false; // Layers from NETWORK, each in its own subdirectory
+    std::vector<Layer> layers_;
+    size_t map_lookups_ = 0, maps_reused_ = 0; // Kernel map cache misses and hits
+    nlohmann::json checksums_;
+};
+
+// Blocking FIFO of at most `capacity` items between two pipeline stages.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity < 1 ? 1 : capacity) {}
+
+    // Blocks while the queue is full.
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [&] { return items_.size() < capacity_; });
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+    }
+
+    // Blocks until an item arrives; false once the queue is closed and empty.
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [&] { return !items_.empty() || closed_; });
+        if (items_.empty()) return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // No more pushes; pop drains the remaining items.
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    std::mutex mutex_;
+    std::condition_variable not_full_, not_empty_;
+    std::deque<T> items_;
+    bool closed_ = false;
+};
+
+/**
+ * @brief Traces every frame file into output_root/<file stem>/.
+ *
+ * PIPELINE_LOADERS threads parse frames ahead of the mapper. Loading, map(),
+ * gather_scatter() and finish() then run as a pipeline connected by queues
+ * of PIPELINE_DEPTH frames: frame N+1 is mapped while frame N gathers and
+ * frame N-1 is compressed. Parallel phases of concurrent stages take turns on
+ * the shared thread pool. A frame that fails is reported on std::cerr and skipped.
+ * Returns the number of frames that failed.
+ */
+size_t run_frame_pipeline(const std::vector<std::string>& frame_files, const std::string& output_root);
+
+#endif // FRAME_PIPELINE_HPP
@@ -0,0 +1,112 @@
+#ifndef GEMM_GROUPING_HPP
+#define GEMM_GROUPING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "kernel_map.hpp"
+
+// --- Structs and Functions for GEMM Grouping ---
+struct GemmInfo {
+    uint32_t num_offsets;
+    uint32_t gemm_M;
+    uint32_t slots;
+    uint32_t padding;
+};
+
+struct GroupInfo {
+    std::vector<int> members;
+    uint64_t base_addr;
+    uint32_t required_slots;
+    uint32_t allocated_slots;
+};
+
+// Result of every grouping strategy (the name predates the other strategies)
+struct GreedyGroupResult {
+    std::vector<uint64_t> pos_indices;
+    std::vector<GroupInfo> groups;
+    std::vector<std::vector<int>> membership;
+    std::vector<GemmInfo> gemm_list;
+    uint64_t total_slots_allocated;
+};
+
+// Limits on one group: at most max_group_items slots and, unless
+// max_raw_slots is -1, at most max_raw_slots slots before padding. A slot
+// larger than max_raw_slots forms a group of its own. Every group is padded
+// to a multiple of alignment.
+struct GroupingConstraints {
+    int alignment = 4;
+    int max_group_items = 6;
+    int max_raw_slots = -1;
+};
+
+/**
+ * @brief How consecutive slots are packed into GEMM groups (GEMM_GROUPING).
+ *
+ * Groups are contiguous runs of the slot list, so the slots keep their order
+ * in the GEMM buffer.
+ *   - "greedy": fills a group until the next slot breaks a limit (the
+ *     original greedy_group_cpp).
+ *   - "optimal": dynamic program over the group ends that minimizes the
+ *     allocated (padded) slots, ties broken by fewer groups. O(n *
+ *     max_group_items), so 343-offset kernels take microseconds.
+ *   - "lookahead": fixes one group at a time, taking the first group of the
+ *     optimal partition of the next max_group_items + GEMM_LOOKAHEAD slots.
+ */
+class GroupingStrategy {
+public:
+    virtual ~GroupingStrategy() = default;
+
+    virtual const char* name() const = 0;
+
+    // End index (exclusive) of every group, ascending, the last one slots.size()
+    virtual std::vector<size_t> partition(const std::vector<int>& slots,
+                                          const GroupingConstraints& limits) const = 0;
+};
+
+// Throws std::invalid_argument for an unknown strategy name. lookahead is the
+// window of the "lookahead" strategy, in slots.
+std::unique_ptr<GroupingStrategy> make_grouping_strategy(const std::string& name, int lookahead = 8);
+
+// Addresses, groups and GEMM list of a partition of slots
+GreedyGroupResult build_group_result(const std::vector<int>& slots, const std::vector<size_t>& group_ends,
+                                     int alignment);
+
+GreedyGroupResult group_slots_cpp(const std::vector<int>& slots, const GroupingStrategy& strategy,
+                                  const GroupingConstraints& limits);
+
+// Outcome of one strategy on the same slots
+struct GroupingReport {
+    std::string strategy;
+    uint64_t total_slots_allocated;
+    uint64_t padding_slots;  // Allocated slots holding no match
+    double padding_overhead; // padding_slots / required slots
+    size_t num_groups;
+};
+
+// Runs every strategy on slots; nothing is written to disk.
+std::vector<GroupingReport> compare_grouping_strategies(const std::vector<int>& slots,
+                                                        const GroupingConstraints& limits,
+                                                        int lookahead = 8);
+
+uint32_t write_gemm_list_cpp(const std::vector<GemmInfo>& gemm_data_list, const std::string& filename);
+
+// The "greedy" strategy; the caller writes gemm_list with write_gemm_list_cpp.
+GreedyGroupResult greedy_group_cpp(
+    const std::vector<int>& slots,
+    int alignment = 4,
+    int max_group_items = 6,
+    int max_raw_slots = -1
+);
+
+// Groups the rows of the kernel map; slot i is the match count of row i
+GreedyGroupResult greedy_group_cpp(
+    const KernelMapCSR& kernel_map,
+    int alignment = 4,
+    int max_group_items = 6,
+    int max_raw_slots = -1
+);
+
+#endif // GEMM_GROUPING_HPP
@@ -0,0 +1,140 @@
+#ifndef GZ_OUTPUT_HPP
+#define GZ_OUTPUT_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+/**
+ * @brief Process-wide threads that compress and encode output files.
+ *
+ * GzOutput deflates its chunks here and TraceStreamWriter encodes its blocks
+ * here, so the number of threads does not grow with the number of files open
+ * at once. A posted task runs on a worker unless the thread that needs its
+ * result claims it first in finish(): a task that waits on another task
+ * therefore never stalls when every worker is busy.
+ */
+class CompressorPool {
+public:
+    class Task {
+    public:
+        explicit Task(std::function<void()> fn) : fn_(std::move(fn)) {}
+        // Exception thrown by the function; valid once finish() returned
+        std::exception_ptr error() const { return error_; }
+
+    private:
+        friend class CompressorPool;
+        std::function<void()> fn_;
+        std::atomic<bool> claimed_{false};
+        bool done_ = false; // Guarded by the pool mutex
+        std::exception_ptr error_;
+    };
+
+    explicit CompressorPool(size_t num_workers);
+    ~CompressorPool();
+    CompressorPool(const CompressorPool&) = delete;
+    CompressorPool& operator=(const CompressorPool&) = delete;
+
+    void post(std::shared_ptr<Task> task);
+    // Runs the task on the calling thread if no worker has started it,
+    // otherwise waits for it to end.
+    void finish(Task& task);
+    // Drops the task if no worker has started it, otherwise waits for it.
+    void discard(Task& task);
+
+    // One worker per hardware thread
+    static CompressorPool& shared();
+
+private:
+    void worker_loop();
+    void run(Task& task);
+    void wait(Task& task);
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::deque<std::shared_ptr<Task>> queue_;
+    bool stopping_ = false;
+};
+
+/**
+ * @brief gzip file writer shared by all output files.
+ *
+ * Writes are staged into CHUNK_BYTES chunks. With one thread each chunk goes
+ * through gzwrite. With more, chunks are deflated independently on the
+ * CompressorPool (pigz style), at most 2 * threads of them in flight per
+ * file: every chunk is raw deflate primed with the last 32 KB of the
+ * previous chunk and ends on a sync flush, so the concatenation is one
+ * valid deflate stream inside a single gzip member. The chunk CRCs are
+ * combined with crc32_combine, so any gzip reader (gzread, Python's gzip)
+ * accepts the file and close() returns the same CRC32 in both modes.
+ * With compressed = false the bytes are stored as is (memory-mapped traces).
+ */
+class GzOutput {
+public:
+    static constexpr size_t CHUNK_BYTES = 256 * 1024;
+
+    explicit GzOutput(const std::string& filename, int threads = 1, bool compressed = true);
+    ~GzOutput();
+    GzOutput(const GzOutput&) = delete;
+    GzOutput& operator=(const GzOutput&) = delete;
+
+    // Throws std::runtime_error if the data cannot be written.
+    void write(const void* data, size_t len);
+
+    template <typename T>
+    void write_value(const T& value) { write(&value, sizeof(T)); }
+
+    // Finishes the gzip stream and returns the CRC32 of all bytes written.
+    uint32_t close();
+
+    const std::string& filename() const { return filename_; }
+    // Uncompressed bytes written so far
+    uint64_t bytes_written() const { return total_bytes_ + chunk_.size(); }
+
+private:
+    struct Job {
+        std::vector<uint8_t> input;
+        std::vector<uint8_t> dictionary; // Tail of the previous chunk
+        bool last = false;
+        std::vector<uint8_t> output;
+        uLong crc = 0;
+        std::shared_ptr<CompressorPool::Task> task;
+    };
+
+    void flush_chunk(bool last);
+    void retire_oldest();
+    static void deflate_job(Job& job);
+    void write_file(const void* data, size_t len);
+    void discard_pending();
+
+    std::string filename_;
+    int threads_;
+    bool compressed_;
+    bool closed_ = false;
+    std::vector<uint8_t> chunk_;
+    uLong crc_ = 0;
+    uint64_t total_bytes_ = 0;
+
+    // Serial mode
+    gzFile gz_file_ = nullptr;
+
+    // Parallel and uncompressed modes
+    FILE* raw_file_ = nullptr;
+    std::vector<uint8_t> dictionary_;
+    std::deque<std::unique_ptr<Job>> pending_; // Submission order
+};
+
+#endif // GZ_OUTPUT_HPP
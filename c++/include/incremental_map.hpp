@@ -0,0 +1,61 @@
+#ifndef INCREMENTAL_MAP_HPP
+#define INCREMENTAL_MAP_HPP
+
+#include <cstdint>
+#include <vector>
+#include "coord.hpp"
+#include "kernel_map.hpp"
+
+// Next frame of an incremental update (see update_kernel_map).
+template <typename Key>
+struct BasicKernelMapUpdate {
+    std::vector<BasicIndexedCoord<Key>> uniq_coords; // Sorted by key, like compute_unique_sorted_keys
+    KernelMapCSR kernel_map;
+    std::vector<int32_t> renumber; // Previous point index -> next index, -1 if removed
+    uint64_t queries = 0;          // Lookups of the changed neighborhoods
+};
+
+using KernelMapUpdate = BasicKernelMapUpdate<uint32_t>;
+
+/**
+ * @brief Kernel map of the next frame from the previous one and the voxels
+ * that changed.
+ *
+ * prev_uniq and prev_kmap are the sorted inputs and kernel map of the
+ * previous frame, whose point indices must be 0..prev_uniq.size()-1 (as for
+ * any loaded frame or earlier update). The next frame holds the previous
+ * points minus `removed`, in their previous order, followed by `inserted` in
+ * the given order; point indices are renumbered to match. The result is the
+ * kernel map a full RDX/PVT/LKP run would build for that point list.
+ *
+ * Only the neighborhoods of the changed voxels are searched:
+ *   - RDX: the inserted and the removed keys are radix sorted in a delta
+ *     buffer after the previous inputs in the I region.
+ *   - UPD: one merge pass on thread 0 from the first changed position
+ *     streams the previous inputs and the sorted deltas and writes the next
+ *     sorted inputs. The prefix before it stays in place and is not traced.
+ *   - PVT: tiles and pivots of the next inputs, as in a full run.
+ *   - LKP: every changed voxel v queries v + offset and v - offset for all
+ *     offsets through the LOOKUP_ENGINE, batched and threaded like a full
+ *     lookup: 4 x offsets lookups per changed voxel instead of offsets per
+ *     input. A hit on an inserted voxel adds a match, one on a removed voxel
+ *     deletes one; they are written as a patch list from KM slot 0.
+ * Surviving matches are kept and renumbered without lookups, which is host
+ * bookkeeping and not traced. Throws std::invalid_argument if a removed key
+ * is not in the previous frame, an inserted key is already there, or a key
+ * is listed twice.
+ */
+template <typename Key>
+BasicKernelMapUpdate<Key> update_kernel_map(const std::vector<BasicIndexedCoord<Key>>& prev_uniq,
+                                            const KernelMapCSR& prev_kmap, const std::vector<Key>& inserted,
+                                            const std::vector<Key>& removed,
+                                            const std::vector<Coord3D>& off_coords);
+
+// Delta between two frames, computed on the host without tracing: the keys
+// of next_keys (unique, in input order) missing from prev_uniq, in input
+// order, and the keys of prev_uniq missing from next_keys, in key order.
+template <typename Key>
+void diff_frame_keys(const std::vector<BasicIndexedCoord<Key>>& prev_uniq, const std::vector<Key>& next_keys,
+                     std::vector<Key>& inserted, std::vector<Key>& removed);
+
+#endif // INCREMENTAL_MAP_HPP
@@ -0,0 +1,63 @@
+#ifndef KERNEL_MAP_HPP
+#define KERNEL_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Kernel map in compressed sparse row form, as built by the LKP phase.
+ *
+ * Row r covers offset offsets[r] (an index into the offset list). Its matches
+ * are entries [begin[r], begin[r + 1]) of in_idx (index of the input in the
+ * sorted unique coordinates) and out_idx (source point of the query), in query
+ * order. Only offsets with matches have a row, and rows are ordered by match
+ * count, largest first, ties by offset index: the order of Python's
+ * SortedByValueLengthDict(ascending=False).
+ */
+struct KernelMapCSR {
+    std::vector<uint32_t> offsets;
+    std::vector<int64_t> begin{0};
+    std::vector<int32_t> in_idx;
+    std::vector<int32_t> out_idx;
+
+    size_t num_rows() const { return offsets.size(); }
+    size_t num_matches() const { return in_idx.size(); }
+    bool empty() const { return offsets.empty(); }
+    size_t row_size(size_t row) const { return static_cast<size_t>(begin[row + 1] - begin[row]); }
+
+    // Row of an offset index, or -1 when the offset has no matches
+    int find_row(uint32_t off_idx) const {
+        for (size_t row = 0; row < offsets.size(); ++row) {
+            if (offsets[row] == off_idx) return static_cast<int>(row);
+        }
+        return -1;
+    }
+
+    // Match counts of the rows, in row order (the slot sizes of greedy grouping)
+    std::vector<int> row_sizes() const {
+        std::vector<int> sizes(offsets.size());
+        for (size_t row = 0; row < offsets.size(); ++row) sizes[row] = static_cast<int>(row_size(row));
+        return sizes;
+    }
+};
+
+using KernelMapType = KernelMapCSR;
+
+/**
+ * @brief Builds the CSR from matches listed in query order.
+ *
+ * Match i belongs to offset match_off[i] < num_offsets. One counting pass
+ * sizes the rows and a second places every match, so the matches of a row
+ * keep their relative order.
+ */
+KernelMapCSR build_kernel_map_csr(size_t num_offsets, const std::vector<uint32_t>& match_off,
+                                  const std::vector<int32_t>& in_idx, const std::vector<int32_t>& out_idx);
+
+// Shares a kernel map; its match arrays go back to the buffer pool
+// (buffer_pool.hpp) when the last owner releases it.
+std::shared_ptr<const KernelMapCSR> share_kernel_map(KernelMapCSR kmap);
+
+#endif // KERNEL_MAP_HPP
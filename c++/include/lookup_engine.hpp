@@ -0,0 +1,69 @@
+#ifndef LOOKUP_ENGINE_HPP
+#define LOOKUP_ENGINE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "coord.hpp"
+#include "query_view.hpp"
+
+// Data the LKP phase searches, as produced by the earlier mapping phases.
+template <typename Key>
+struct LookupInputs {
+    const std::vector<BasicIndexedCoord<Key>>& uniq_coords; // Sorted by key
+    const BasicQueryView<Key>& queries;
+    const std::vector<BasicCoordSpan<Key>>& tiles; // Spans over uniq_coords
+    const std::vector<BasicIndexedCoord<Key>>& pivs;
+    int tile_size;
+};
+
+/**
+ * @brief Search strategy of the LKP phase (LOOKUP_ENGINE in the config).
+ *
+ *   - "pivot": binary search on the tile pivots, then a linear scan of the
+ *     tile (the original Minuet algorithm).
+ *   - "merge": galloping cursor over the sorted inputs. Queries of one offset
+ *     are sorted, so consecutive queries usually move it by a few elements;
+ *     a smaller key than the previous query repositions it by binary search.
+ *   - "hash": open-addressing table of the input keys (linear probing),
+ *     built at the start of the phase in the HT tensor.
+ *
+ * Lookups work on contiguous query ranges. find() computes the matches
+ * without tracing; trace() records the accesses of exactly the same search,
+ * so the two can run as separate passes over the same portions. Engines are
+ * compiled for uint32_t and uint64_t keys.
+ */
+template <typename Key>
+class LookupEngine {
+public:
+    explicit LookupEngine(const LookupInputs<Key>& in) : in_(in) {}
+    virtual ~LookupEngine() = default;
+
+    virtual const char* name() const = 0;
+
+    // Upper estimate of the trace entries of one lookup, used to size the
+    // trace windows.
+    virtual size_t entries_per_query() const = 0;
+
+    // Builds the engine's index and records its accesses on thread 0.
+    virtual void build() {}
+
+    // Sets match_input[q - begin] to the original index of the input that
+    // matches query q, or -1. Returns the number of matches.
+    virtual uint64_t find(size_t begin, size_t end, int32_t* match_input) const = 0;
+
+    // Records the lookups of queries [begin, end) as simulated thread `tid`;
+    // the i-th match writes KM slot km_slot + i.
+    virtual void trace(size_t begin, size_t end, int tid, uint64_t km_slot) const = 0;
+
+protected:
+    LookupInputs<Key> in_;
+};
+
+// Throws std::invalid_argument for an unknown engine name.
+template <typename Key>
+std::unique_ptr<LookupEngine<Key>> make_lookup_engine(const std::string& name, const LookupInputs<Key>& in);
+
+#endif // LOOKUP_ENGINE_HPP
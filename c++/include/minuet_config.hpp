@@ -3,10 +3,24 @@
 
 #include <string>
 #include <cstdint>
-// #include <vector> // Not used in the struct definition itself
+#include <cstddef>
+#include <utility>  // For std::pair
+#include <vector>   // For the tensor region table
 #include <fstream>  // For std::ifstream
 #include <iostream> // For std::cerr
 #include <ext/json.hpp> // Assuming nlohmann/json is used and located here
+#include "trace.hpp"    // For the Tensor ids
+
+// One sparse convolution of NETWORK. Coordinates at tensor stride t are
+// multiples of t in input voxel units, and the kernel offsets of a layer are
+// scaled by its input tensor stride.
+struct NetworkLayer {
+    std::string name;         // Output subdirectory; "layer<i>" by default
+    uint32_t kernel_size = 3; // Offsets per axis
+    uint32_t stride = 1;      // > 1 downsamples the tensor stride by this factor, or upsamples when transposed
+    uint32_t channels = 0;    // Output channels; 0 keeps the input channels
+    bool transposed = false;
+};
 
 struct MinuetConfig {
     // Number of virtual threads
@@ -28,11 +42,16 @@ struct MinuetConfig {
     uint64_t IV_BASE; // Feature vectors (64-bit)
     uint64_t GM_BASE; // GEMM buffers (64-bit)
     uint64_t WV_BASE; // Weight values (64-bit)
+    uint64_t WV_SIZE; // Extent of the weight value region
+    uint64_t HT_BASE; // Lookup hash table (LOOKUP_ENGINE "hash")
+    uint64_t HT_SIZE; // Extent of the hash table region
 
     // GEMM Parameters
     uint32_t GEMM_ALIGNMENT;
     uint32_t GEMM_WT_GROUP;
     uint32_t GEMM_SIZE;
+    std::string GEMM_GROUPING; // Grouping strategy: "greedy", "optimal" or "lookahead"
+    int GEMM_LOOKAHEAD;        // Slots searched ahead by the "lookahead" strategy
 
     // GATHER PARAMETERS
     uint32_t NUM_TILES;
@@ -40,15 +59,80 @@ struct MinuetConfig {
     uint32_t BULK_FEATS;
     uint32_t N_THREADS_GATHER;
     uint32_t TOTAL_FEATS_PT; // Calculated: NUM_TILES * TILE_FEATS
+    std::string FEATURE_KERNELS; // GTH/SCT feature copies: "vector" or "scalar"
+    std::string METADATA_MASKS; // Masks in metadata.bin.gz: "dense" (version 1) or "compact" (version 2)
+    std::string GATHER_SCHEDULE; // GTH/SCT loop order: "point", "offset" or "blocked"
+    std::string GATHER_PARTITION; // GTH/SCT point ownership: "round_robin" or "contiguous"
+    uint32_t GATHER_BLOCK_POINTS; // Points per block of the "blocked" schedule
 
     bool debug; // Added for debug flag
     std::string output_dir; // Added for output directory
     uint32_t NUM_PIVOTS; // Added NUM_PIVOTS
+    uint32_t LKP_BATCH_SIZE;      // Queries per LKP batch, split across NUM_THREADS
+    std::string LOOKUP_ENGINE;    // LKP search: "pivot", "merge" or "hash"
+    bool STREAM_TRACES;           // Stream traces to disk while the phases run
+    uint64_t TRACE_BUFFER_ENTRIES; // Entries buffered in memory before streaming out
+    uint32_t TRACE_FORMAT;        // Trace file version: 1 (rows), 2 (blocks) or 3 (indexed blocks)
+    bool TRACE_COLUMNAR;          // Version 2: columnar blocks with delta-coded addresses
+    uint32_t COMPRESS_THREADS;    // Chunks of each gzip output deflated in parallel (1: plain gzwrite)
+    double VOXEL_SIZE;            // Quantization of loaded frames (<= 0: 1% of the smallest extent)
+    uint32_t PIPELINE_DEPTH;      // Frames queued between batch pipeline stages
+    uint32_t PIPELINE_LOADERS;    // Threads parsing frames ahead of the batch pipeline
+    uint32_t BUFFER_POOL_MB;      // Scratch buffers kept for reuse across phases and frames (buffer_pool.hpp)
+    uint32_t KEY_BITS;            // Packed coordinate key width: 32 (pack32) or 64 (pack64)
+    bool INCREMENTAL_MAPPING;     // Batch frames: update the previous frame's kernel map (update_kernel_map)
+    std::vector<NetworkLayer> NETWORK; // Layers traced per frame; empty: one 3x3x3 layer at stride 1
+
+    // Recording-time trace selection (see TraceFilter in trace_sink.hpp)
+    std::vector<std::string> TRACE_PHASES;  // Phases to trace; empty traces all
+    std::vector<std::string> TRACE_TENSORS; // Tensors to trace; empty traces all
+    std::vector<std::pair<uint64_t, uint64_t>> TRACE_ADDR_RANGES; // [begin, end) to trace; empty traces all
+    uint32_t TRACE_SAMPLE_RATE;   // Keep 1 in N accesses (or lines)
+    std::string TRACE_SAMPLE_MODE; // "access" or "line"
+    uint32_t TRACE_LINE_BYTES;    // Cache line of line sampling and coalescing
+    bool TRACE_COALESCE;          // Merge consecutive accesses to one line into a counted entry
 
     MinuetConfig(); // Constructor for default values
 
     // Function to load configuration from a JSON file
     bool loadFromFile(const std::string& filepath); // Method declaration
+
+    // --- Address -> tensor classification ---
+    // Rebuilds the region table from the *_BASE fields. Called by the
+    // constructor and loadFromFile; call it again after editing a base.
+    void build_tensor_regions(bool warn = false);
+
+    // Tensor id of the region containing addr.
+    uint8_t classify(uint64_t addr) const {
+        if (use_page_table_) {
+            uint64_t page = addr >> page_shift_;
+            return page < page_table_.size() ? page_table_[page] : tail_tensor_;
+        }
+        // Branchless binary search; region_starts_[0] == 0 covers every address.
+        const uint64_t* base = region_starts_.data();
+        size_t n = region_starts_.size();
+        while (n > 1) {
+            size_t half = n / 2;
+            base = (base[half] <= addr) ? base + half : base;
+            n -= half;
+        }
+        return region_tensors_[base - region_starts_.data()];
+    }
+
+    // Batch form for tracers that classify many addresses at once.
+    void classify(const uint64_t* addrs, size_t count, uint8_t* tensors_out) const;
+
+private:
+    // Disjoint regions sorted by start address; region i covers
+    // [region_starts_[i], region_starts_[i + 1]).
+    std::vector<uint64_t> region_starts_;
+    std::vector<uint8_t> region_tensors_;
+    // Page-granular lookup table, used when every boundary is aligned to
+    // 1 << page_shift_ (the default bases are 256 MB aligned).
+    std::vector<uint8_t> page_table_;
+    uint32_t page_shift_ = 0;
+    uint8_t tail_tensor_ = static_cast<uint8_t>(Tensor::Unknown);
+    bool use_page_table_ = false;
 };
 
 // Declaration of the global config object
@@ -7,48 +7,10 @@
 #include <map>     // For std::map
 #include <utility> // For std::pair
 #include "coord.hpp"        // For Coord3D
-#include "sorted_map.hpp"   // For SortedByValueSizeMap
+#include "kernel_map.hpp"   // For KernelMapCSR
+#include "gemm_grouping.hpp" // For GreedyGroupResult and write_gemm_list_cpp
 #include "trace.hpp"
 
-// Define KernelMapType consistently
-// This is the type for kernel_map, storing matches for each offset key,
-// sorted by the number of matches.
-using KernelMapType = SortedByValueSizeMap<uint32_t, std::vector<std::pair<int, int>>>;
-
-// --- Structs and Functions for Greedy Grouping ---
-struct GemmInfo {
-    uint32_t num_offsets;
-    uint32_t gemm_M;
-    uint32_t slots;
-    uint32_t padding;
-};
-
-struct GroupInfo {
-    std::vector<int> members;
-    uint64_t base_addr;
-    uint32_t required_slots;
-    uint32_t allocated_slots;
-};
-
-struct GreedyGroupResult {
-    std::vector<uint64_t> pos_indices;
-    std::vector<GroupInfo> groups;
-    std::vector<std::vector<int>> membership;
-    std::vector<GemmInfo> gemm_list;
-    uint64_t total_slots_allocated;
-    uint32_t checksum;
-};
-
-uint32_t write_gemm_list_cpp(const std::vector<GemmInfo>& gemm_data_list, const std::string& filename);
-
-GreedyGroupResult greedy_group_cpp(
-    const std::vector<int>& slots,
-    int alignment = 4,
-    int max_group_items = 6,
-    int max_raw_slots = -1
-);
-
-
 // --- Structs for Metadata Reading ---
 struct ActiveOffsetInfo {
     uint32_t offset_key;
@@ -73,8 +35,30 @@ struct MasksResult {
     std::vector<int32_t> in_mask;
 };
 
+// Builds both num_total_system_offsets x num_total_system_sources masks, one
+// offset per task of the shared thread pool. row_bases[r] is the first GEMM
+// slot of kernel map row r (GreedyGroupResult::pos_indices).
 MasksResult create_in_out_masks_cpp(
-    const KernelMapType& kernel_map,
+    const KernelMapCSR& kernel_map,
+    const std::vector<uint64_t>& row_bases,
+    uint32_t num_total_system_offsets,
+    uint32_t num_total_system_sources
+);
+
+// Same for a layer whose inputs and outputs differ (strided or transposed):
+// in_mask is num_total_system_offsets x num_inputs, out_mask
+// num_total_system_offsets x num_outputs.
+MasksResult create_in_out_masks_cpp(
+    const KernelMapCSR& kernel_map,
+    const std::vector<uint64_t>& row_bases,
+    uint32_t num_total_system_offsets,
+    uint32_t num_inputs,
+    uint32_t num_outputs
+);
+
+// Same, with the base slot of each offset index looked up in slot_dict
+MasksResult create_in_out_masks_cpp(
+    const KernelMapCSR& kernel_map,
     const std::map<uint32_t, int>& slot_dict,
     uint32_t num_total_system_offsets,
     uint32_t num_total_system_sources
@@ -83,6 +67,8 @@ MasksResult create_in_out_masks_cpp(
 // --- Function Declarations ---
 MetadataContents read_metadata_cpp(const std::string& filename);
 
+// Writes version 1 (dense int32 masks) or, for METADATA_MASKS "compact",
+// version 2 with bitmap-encoded mask rows; read_metadata_cpp reads both.
 uint32_t write_metadata_cpp(
     const std::vector<int32_t>& out_mask,
     const std::vector<int32_t>& in_mask,
@@ -94,6 +80,32 @@ uint32_t write_metadata_cpp(
 );
 
 // --- Gather and Scatter Operations ---
+// What the gather/scatter workers do, fixed at compile time per mode:
+//   - Full: move the feature data and record the trace.
+//   - TraceOnly: record the trace only; the data path is compiled out.
+//   - ComputeOnly: move the data without recording anything, as a fast
+//     functional reference for the outputs of a hardware model.
+//   - Auto: TraceOnly when the feature vectors are empty, Full otherwise.
+enum class FeatureMode { Auto, Full, TraceOnly, ComputeOnly };
+
+// Loop order of the gather/scatter workers (GATHER_SCHEDULE):
+//   - PointMajor ("point"): each point, then its offsets (the original order).
+//   - OffsetMajor ("offset"): each offset, then the points; mask reads are
+//     contiguous, and gather reads a source again for every match.
+//   - Blocked ("blocked"): blocks of GATHER_BLOCK_POINTS points, each swept
+//     offset by offset; gather reads a block's sources once.
+enum class FeatureSchedule { PointMajor, OffsetMajor, Blocked };
+
+struct FeatureTraversal {
+    FeatureSchedule schedule = FeatureSchedule::PointMajor;
+    bool contiguous = false;     // GATHER_PARTITION: contiguous chunks instead of round robin
+    uint32_t block_points = 64;  // Points per block of the Blocked schedule
+
+    // Reads GATHER_SCHEDULE, GATHER_PARTITION and GATHER_BLOCK_POINTS from
+    // g_config; throws std::invalid_argument for an unknown name.
+    static FeatureTraversal from_config();
+};
+
 void mt_gather_cpp(
     uint32_t num_threads,
     uint32_t num_points,
@@ -103,7 +115,8 @@ void mt_gather_cpp(
     uint32_t bulk_feat_size,
     const std::vector<int32_t>& source_masks, // Assuming int32_t for masks
     const std::vector<float>& sources,       // Assuming float for feature data
-    std::vector<float>& gemm_buffers         // Assuming float for feature data
+    std::vector<float>& gemm_buffers,        // Assuming float for feature data
+    FeatureMode mode = FeatureMode::Auto
 );
 
 void mt_scatter_cpp(
@@ -115,7 +128,8 @@ void mt_scatter_cpp(
     uint32_t bulk_feat_size,
     const std::vector<int32_t>& out_mask,    // Assuming int32_t for masks
     const std::vector<float>& gemm_buffers,  // Assuming float for feature data
-    std::vector<float>& outputs              // Assuming float for feature data
+    std::vector<float>& outputs,             // Assuming float for feature data
+    FeatureMode mode = FeatureMode::Auto
 );
 
 
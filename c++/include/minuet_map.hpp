@@ -17,8 +17,11 @@
 #include <cstring>
 #include "minuet_config.hpp" // Include the new config header
 #include "coord.hpp"         // Include the new coord header
+#include "kernel_map.hpp"
+#include "query_view.hpp"
 #include "sorted_map.hpp"    // Include the new sorted_map header
 #include "trace.hpp"
+#include "trace_context.hpp"
 
 // PHASES, TENSORS, OPS (from minuet_mapping.py)
 // These will be extern bidict<std::string, int> defined in minuet_trace.cpp
@@ -34,14 +37,17 @@ struct BuildQueriesResult {
     std::vector<Coord3D> wt_offsets;    // The actual Coord3D offset used for the query
 };
 
-struct TilesPivotsResult {
-    std::vector<std::vector<IndexedCoord>> tiles;
-    std::vector<IndexedCoord> pivots;
+// Tiles are spans over the uniq_coords passed to create_tiles_and_pivots,
+// which must outlive them; only the pivots are copied.
+template <typename Key>
+struct BasicTilesPivotsResult {
+    std::vector<BasicCoordSpan<Key>> tiles;
+    std::vector<BasicIndexedCoord<Key>> pivots;
 };
 
-// Using KernelMapType from sorted_map.hpp
-// using KernelMapType = SortedByValueSizeMap<uint32_t, std::vector<std::pair<int, int>>>;
-// This is defined in sorted_map.hpp which is included.
+using TilesPivotsResult = BasicTilesPivotsResult<uint32_t>;
+
+// KernelMapType (KernelMapCSR) is defined in kernel_map.hpp, which is included.
 
 struct PerformLookupResult {
     // This is essentially the KernelMapType itself, but let's be explicit if Python side expects a struct
@@ -53,9 +59,9 @@ struct PerformLookupResult {
 };
 
 
-// --- Global Memory Trace Setup ---
-// extern std::vector<MemoryAccessEntry> mem_trace; // Defined in .cpp
-// extern std::string curr_phase; // Defined in .cpp
+// --- Memory Trace Setup ---
+// The trace, the current phase and the open stream belong to the calling
+// thread's TraceContext (trace_context.hpp); the functions below act on it.
 // extern bool debug; // Part of g_config
 // extern const std::string output_dir; // Part of g_config
 
@@ -63,6 +69,7 @@ struct PerformLookupResult {
 std::vector<MemoryAccessEntry> get_mem_trace();
 void clear_mem_trace();
 void set_curr_phase(const std::string& phase_name);
+void set_curr_phase(Phase phase);
 std::string get_curr_phase();
 void set_debug_flag(bool debug_val);
 bool get_debug_flag();
@@ -77,22 +84,77 @@ void clear_global_mem_trace(); // Added to clear the global memory trace
 
 // Memory tracing
 uint8_t addr_to_tensor(uint64_t addr);
+void addr_to_tensor(const uint64_t* addrs, size_t count, uint8_t* tensors_out); // Batch form
 std::string addr_to_tensor_str(uint64_t addr);
 
 // Function to write the global memory trace to a gzipped file
 // Returns a CRC32 checksum of the written data.
 uint32_t write_gmem_trace(const std::string &filename, int sizeof_addr = 4); // Added sizeof_addr parameter with default 4
 
+// Streaming alternative: entries recorded between begin and end are written
+// to `filename` while the phases run (streamed layout, see trace.hpp), keeping
+// at most TRACE_BUFFER_ENTRIES in memory. end returns the CRC32.
+void begin_gmem_trace_stream(const std::string &filename, int sizeof_addr = 4);
+uint32_t end_gmem_trace_stream();
+
+// String-based entry point (Python bindings); converts through the tables.
 void record_access(int thread_id, const std::string &op_str, uint64_t addr);
 
+// Typed recording API used by the C++ phases. Op and tensor are compile-time
+// constants, so a traced access costs no string handling or map lookups.
+// Entries go to the calling thread's trace context, stamped with its phase.
+template <Op op, Tensor tensor>
+inline void record_access(int thread_id, uint64_t addr) {
+    TraceContext& ctx = current_trace_context();
+    ctx.sink.record({ctx.phase_id, static_cast<uint8_t>(thread_id),
+                     static_cast<uint8_t>(op), static_cast<uint8_t>(tensor), 1, addr});
+}
+
+// Records `count` accesses at addr, addr + stride, ... in one call.
+template <Op op, Tensor tensor>
+inline void record_strided_access(int thread_id, uint64_t addr, uint64_t stride, size_t count) {
+    TraceContext& ctx = current_trace_context();
+    ctx.sink.record_strided({ctx.phase_id, static_cast<uint8_t>(thread_id),
+                             static_cast<uint8_t>(op), static_cast<uint8_t>(tensor), 1, addr},
+                            stride, count);
+}
+
+// Same, with the tensor classified from the address.
+template <Op op>
+inline void record_access(int thread_id, uint64_t addr) {
+    TraceContext& ctx = current_trace_context();
+    ctx.sink.record({ctx.phase_id, static_cast<uint8_t>(thread_id),
+                     static_cast<uint8_t>(op), addr_to_tensor(addr), 1, addr});
+}
+
 // --- Algorithm Phases ---
-std::vector<uint32_t> radix_sort_with_memtrace(std::vector<uint32_t>& arr, uint64_t base_addr);
+// The phases from RDX to LKP are templates on the key width (uint32_t for
+// pack32, uint64_t for pack64), compiled for both in minuet_map.cpp. The
+// 32-bit forms keep their plain names (IndexedCoord, QueryView, ...).
+
+// Sorts (key, value) pairs by key in place (stable); with dedup only the
+// first pair of each key is kept. Records its accesses at base_addr, with
+// SIZE_KEY bytes per key.
+template <typename Key>
+void radix_sort_with_memtrace(std::vector<Key>& keys, std::vector<int>& values,
+                              uint64_t base_addr, bool dedup = false);
 
 std::vector<IndexedCoord> compute_unique_sorted_coords(
     const std::vector<Coord3D>& in_coords, // Changed from tuples
     int stride
 );
 
+// Packed keys of the coordinates quantized by stride, in input order
+template <typename Key = uint32_t>
+std::vector<Key> pack_coord_keys(const std::vector<Coord3D>& in_coords, int stride);
+
+// RDX on keys that are already quantized and packed (see read_point_cloud_keys);
+// key i is input point i. Takes the keys by value and sorts them in place.
+template <typename Key>
+std::vector<BasicIndexedCoord<Key>> compute_unique_sorted_keys(std::vector<Key> keys);
+
+// Materializes every query. The C++ pipeline uses a lazy QueryView instead;
+// this stays for the Python bindings.
 BuildQueriesResult build_coordinate_queries(
     const std::vector<IndexedCoord>& uniq_coords,
     int stride, 
@@ -100,23 +162,16 @@ BuildQueriesResult build_coordinate_queries(
 );
 
 // Structure to hold results from create_tiles_and_pivots
-TilesPivotsResult create_tiles_and_pivots(
-    const std::vector<IndexedCoord>& uniq_coords,
+template <typename Key>
+BasicTilesPivotsResult<Key> create_tiles_and_pivots(
+    const std::vector<BasicIndexedCoord<Key>>& uniq_coords,
     int tile_size_param // Renamed to avoid conflict with config
 );
 
-// Kernel Map type (matches Python's kmap structure)
-// Key: offset_key (packed Coord3D of the offset)
-// Value: list of pairs (input_idx from uniq_coords, query_src_orig_idx from qry_keys)
-// using KernelMap = std::map<uint32_t, std::vector<std::pair<int, int>>>;
-// Replace std::map with SortedByValueSizeMap for KernelMap
-// The key is the offset (uint32_t), and the value is a vector of pairs (matches).
-// We want to sort by the size of this vector (number of matches).
-// True for ascending (shortest first), False for descending (longest first).
-// Python's SortedByValueLengthDict defaults to ascending=True, but for kmap processing
-// in minuet_trace.py, it seems to imply a descending sort for offsets_active (longest match list first).
-// Let's assume descending for now, as it's common for processing more significant items first.
-using KernelMapType = SortedByValueSizeMap<uint32_t, std::vector<std::pair<int, int>>>;
+// Kernel map (matches Python's kmap structure): for every offset index, the
+// (input_idx from uniq_coords, query_src_orig_idx) pairs it matched, stored
+// as a KernelMapCSR in descending match-count order (longest match list
+// first, like SortedByValueLengthDict(ascending=False) in minuet_mapping.py).
 
 
 KernelMapType perform_coordinate_lookup( // Renamed from lookup
@@ -130,6 +185,21 @@ KernelMapType perform_coordinate_lookup( // Renamed from lookup
     int tile_size
 );
 
+// Same lookup over a QueryView, lazy or materialized
+template <typename Key>
+KernelMapType perform_coordinate_lookup(
+    const std::vector<BasicIndexedCoord<Key>>& uniq_coords,
+    const BasicQueryView<Key>& queries,
+    const std::vector<BasicCoordSpan<Key>>& tiles,
+    const std::vector<BasicIndexedCoord<Key>>& pivs,
+    int tile_size
+);
+
+// Writes the entry count, then one (packed offset key, input_idx,
+// query_src_orig_idx) record per match. With KEY_BITS 64 the file starts
+// with KERNEL_MAP_WIDE_MARKER and the key size, and the offset keys are
+// pack64 values.
+constexpr uint32_t KERNEL_MAP_WIDE_MARKER = 0xFFFFFFFF;
 uint32_t write_kernel_map_to_gz(
     const KernelMapType& kernel_map,
     const std::string& filename,
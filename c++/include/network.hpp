@@ -0,0 +1,90 @@
+#ifndef NETWORK_HPP
+#define NETWORK_HPP
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "coord.hpp"
+#include "kernel_map.hpp"
+#include "minuet_config.hpp" // NetworkLayer
+#include "minuet_map.hpp"    // BasicTilesPivotsResult
+
+// Offsets of a kernel_size^3 kernel, x outermost, at tensor stride
+// `tensor_stride`. Odd sizes are centered, even sizes span [0, kernel_size).
+std::vector<Coord3D> kernel_offsets(uint32_t kernel_size, uint32_t tensor_stride);
+
+// Kernel map of one layer, as handed out by KernelMapCache::map_layer
+struct LayerMap {
+    std::shared_ptr<const KernelMapCSR> kmap; // in_idx: input point, out_idx: output point
+    std::vector<Coord3D> offsets;             // In input voxel units
+    uint32_t in_stride = 1, out_stride = 1;   // Tensor strides
+    uint32_t num_inputs = 0, num_outputs = 0;
+    std::string source;    // Layer whose lookup built the map
+    bool computed = false; // Looked up for this layer; false when reused
+};
+
+/**
+ * @brief Coordinate sets and kernel maps of one frame, shared by the layers
+ * of a network.
+ *
+ * The set at tensor stride t holds the inputs floored to multiples of t, with
+ * points numbered in key order (stride 1 keeps the input point indices). A
+ * set is sorted (RDX) the first time a layer needs it, from the set the layer
+ * reads, and tiled (PVT) the first time it is searched. Kernel maps are cached
+ * by (hash of the searched set, its tensor stride, layer stride, kernel size,
+ * transposed), so layers that repeat a convolution on the same coordinates
+ * reuse its map without tracing anything:
+ *   - stride 1: inputs + offsets looked up in the inputs (submanifold).
+ *   - stride s: the outputs at tensor stride t*s, each plus the offsets,
+ *     looked up in the inputs at t.
+ *   - transposed, stride s: the map of the stride s layer from t/s to t with
+ *     the inputs and outputs swapped. The set at t/s must already exist.
+ * A layer that misses the cache records its phases into the current trace
+ * context, like a single-layer frame. PVT tiles are spans over their set.
+ */
+template <typename Key>
+class KernelMapCache {
+public:
+    using Coords = std::vector<BasicIndexedCoord<Key>>;
+
+    // `inputs` are the sorted unique inputs (compute_unique_sorted_keys)
+    explicit KernelMapCache(Coords inputs);
+    // Gives the coordinate sets back to the buffer pool
+    ~KernelMapCache();
+
+    // Throws std::invalid_argument when a transposed layer does not land on
+    // an existing tensor stride.
+    LayerMap map_layer(const NetworkLayer& layer, uint32_t in_stride);
+
+    // Moves the stride 1 set out, after the last map_layer
+    Coords release_inputs() { return std::move(sets_.at(1).coords); }
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+private:
+    struct CoordSet {
+        Coords coords;
+        uint64_t hash = 0;
+        std::unique_ptr<BasicTilesPivotsResult<Key>> tiles; // Built on first lookup
+    };
+    // (set hash, tensor stride, layer stride, kernel size, transposed)
+    using MapKey = std::tuple<uint64_t, uint32_t, uint32_t, uint32_t, bool>;
+
+    CoordSet& set_at(uint32_t tensor_stride, uint32_t from_stride);
+    struct CachedMap {
+        std::shared_ptr<const KernelMapCSR> kmap;
+        std::string source;
+    };
+
+    std::shared_ptr<const KernelMapCSR> lookup(CoordSet& queries, const std::vector<Coord3D>& offsets,
+                                               CoordSet& target);
+
+    std::map<uint32_t, CoordSet> sets_; // By tensor stride
+    std::map<MapKey, CachedMap> maps_;
+    size_t hits_ = 0, misses_ = 0;
+};
+
+#endif // NETWORK_HPP
@@ -0,0 +1,42 @@
+#ifndef POINT_CLOUD_HPP
+#define POINT_CLOUD_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "coord.hpp"
+
+/**
+ * @brief Loads one point cloud frame as voxel coordinates.
+ *
+ * Points are quantized like read_pcl.py: each coordinate is divided by
+ * voxel_size and truncated toward zero. voxel_size <= 0 selects 1% of the
+ * smallest non-zero extent of the bounding box. Points with a NaN or infinite
+ * coordinate are dropped. Like read_pcl.py, only the first point of every
+ * voxel is kept, in file order, so the mask and feature indices of the
+ * traced phases stay within the number of points returned.
+ *
+ * Formats, by extension:
+ *   - .bin: KITTI LiDAR scans (float32 x, y, z, intensity per point), or a
+ *     SemanticKITTI voxel grid when the file is exactly 262144 bytes (already
+ *     quantized, voxel_size is ignored).
+ *   - .pcd: PCD with DATA ascii or binary and float or integer x/y/z fields.
+ * Binary data is read straight from a memory mapping of the file, and ascii
+ * values are parsed with std::from_chars, independent of the locale.
+ * Throws std::runtime_error for unreadable or malformed files.
+ */
+std::vector<Coord3D> read_point_cloud(const std::string& path, double voxel_size);
+
+// Same points as read_point_cloud, quantized by stride and packed into keys
+// of width Key (pack32 or pack64) in the same pass, ready for
+// compute_unique_sorted_keys. This skips the intermediate Coord3D list;
+// duplicates are removed by key. A warning reports points whose coordinates
+// do not fit the key fields. Instantiated for uint32_t and uint64_t.
+template <typename Key = uint32_t>
+std::vector<Key> read_point_cloud_keys(const std::string& path, double voxel_size, int stride = 1);
+
+// Frame files named by inputs, in order. A directory adds its .bin and .pcd
+// files sorted by name, and a .txt file lists one path per line.
+std::vector<std::string> list_frame_files(const std::vector<std::string>& inputs);
+
+#endif // POINT_CLOUD_HPP
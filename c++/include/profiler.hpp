@@ -0,0 +1,132 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "buffer_pool.hpp"
+#include "thread_pool.hpp"
+
+// 0 compiles every ProfileScope and pool span out (CMake option
+// MINUET_PROFILING=OFF); no profile.json is written then.
+#ifndef MINUET_PROFILING
+#define MINUET_PROFILING 1
+#endif
+
+/**
+ * @brief Host-side timeline of one frame, written as profile.json.
+ *
+ * A ProfileScope records the wall time of a phase or writer as a Chrome trace
+ * "complete" event on the calling host thread, with the trace entries it
+ * emitted, the bytes it wrote, the heap in use and the BufferPool requests
+ * it served from kept buffers or new allocations. ThreadPool workers record
+ * one span per stretch of tasks they run for a parallel_for, and every scope
+ * sums the busy and idle time of the workers that ran inside it for this
+ * frame, next to the busy time of the whole shared pool, which also covers
+ * the stages of other frames running at the same time. chrome://tracing and
+ * Perfetto open the file directly.
+ *
+ * A thread records into the profile of its TraceContext
+ * (TraceContext::profile), so pool tasks and concurrent frames land in the
+ * right profile. Contexts without a profile, like the default one used by
+ * the Python bindings, record nothing.
+ */
+class Profile {
+public:
+    struct Event {
+        std::string name;
+        const char* category;
+        uint32_t tid;
+        uint64_t start_ns; // Since the profile was created
+        uint64_t dur_ns;
+        std::vector<std::pair<const char*, double>> args;
+    };
+
+    explicit Profile(std::string process_name = "minuet");
+
+    uint64_t now_ns() const;
+    void add(Event event);
+
+    // Busy time of the pool spans inside [start_ns, end_ns], and the idle
+    // time of their workers over the same interval.
+    struct WorkerTime {
+        uint64_t busy_ns = 0;
+        uint64_t idle_ns = 0;
+        uint32_t workers = 0;
+    };
+    WorkerTime worker_time(uint64_t start_ns, uint64_t end_ns) const;
+
+    // Chrome trace JSON ("traceEvents" with thread names). Throws
+    // std::runtime_error if the file cannot be written.
+    void write_chrome_trace(const std::string& filename) const;
+
+private:
+    std::string process_name_;
+    uint64_t epoch_ns_;
+    mutable std::mutex mutex_;
+    std::vector<Event> events_;
+    std::map<uint32_t, std::string> thread_names_;
+};
+
+// High-water mark of the process RSS (VmHWM), 0 if unavailable
+uint64_t peak_rss();
+
+// Small id of the calling host thread, used as the tid of its events.
+uint32_t profile_thread_id();
+
+// Name shown for the calling thread's row in later profiles.
+void set_profile_thread_name(const std::string& name);
+
+// Profile of the calling thread's TraceContext, or nullptr.
+Profile* current_profile();
+
+#if MINUET_PROFILING
+
+// Records [construction, destruction) on the current profile, if any.
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name, const char* category = "phase");
+    ~ProfileScope();
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    // Uncompressed bytes handed to the writer
+    void add_bytes(uint64_t bytes) { bytes_ += bytes; }
+    // File whose size on disk is reported when the scope ends
+    void set_output(const std::string& filename) { output_ = filename; }
+    void set(const char* key, double value) {
+        if (profile_) args_.emplace_back(key, value);
+    }
+
+private:
+    Profile* profile_;
+    const char* name_;
+    const char* category_;
+    uint64_t start_ns_ = 0;
+    uint64_t start_entries_ = 0;
+    int64_t start_heap_ = 0;
+    BufferPool::Stats start_buffers_;
+    ThreadPool::Stats start_pool_;
+    uint64_t bytes_ = 0;
+    std::string output_;
+    std::vector<std::pair<const char*, double>> args_;
+};
+
+#else
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char*, const char* = "phase") {}
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+    void add_bytes(uint64_t) {}
+    void set_output(const std::string&) {}
+    void set(const char*, double) {}
+};
+
+#endif // MINUET_PROFILING
+
+#endif // PROFILER_HPP
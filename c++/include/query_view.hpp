@@ -0,0 +1,69 @@
+#ifndef QUERY_VIEW_HPP
+#define QUERY_VIEW_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "coord.hpp"
+
+/**
+ * @brief The queries of the LKP phase, in build_coordinate_queries order.
+ *
+ * Query q = off_idx * num_inputs + in_idx has the key
+ * uniq_coords[in_idx].coord + off_coords[off_idx] and the source point
+ * uniq_coords[in_idx].orig_idx. The lazy form computes them on demand, so the
+ * num_inputs x num_offsets queries never exist in memory. The materialized
+ * form reads the vectors of a BuildQueriesResult instead (Python bindings).
+ * Key is the packed key width (see KeyTraits).
+ */
+template <typename Key>
+class BasicQueryView {
+public:
+    using Coord = BasicIndexedCoord<Key>;
+
+    BasicQueryView(const std::vector<Coord>& uniq_coords, const std::vector<Coord3D>& off_coords)
+        : uniq_(&uniq_coords), offs_(&off_coords),
+          size_(uniq_coords.size() * off_coords.size()), num_offsets_(off_coords.size()) {}
+
+    BasicQueryView(const std::vector<Coord>& qry_keys, const std::vector<int>& qry_in_idx,
+              const std::vector<int>& qry_off_idx)
+        : keys_(&qry_keys), in_idx_(&qry_in_idx), off_idx_(&qry_off_idx), size_(qry_keys.size()) {
+        for (int off_idx : qry_off_idx) num_offsets_ = std::max<size_t>(num_offsets_, off_idx + 1);
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t num_offsets() const { return num_offsets_; }
+
+    int in_idx(size_t q) const {
+        return keys_ ? (*in_idx_)[q] : static_cast<int>(q % uniq_->size());
+    }
+    int off_idx(size_t q) const {
+        return keys_ ? (*off_idx_)[q] : static_cast<int>(q / uniq_->size());
+    }
+    Coord3D coord(size_t q) const {
+        return keys_ ? (*keys_)[q].coord : (*uniq_)[q % uniq_->size()].coord + (*offs_)[q / uniq_->size()];
+    }
+    Key key(size_t q) const { return coord(q).template to_key<Key>(); }
+    // Original index of the input point the query was generated from
+    int source_idx(size_t q) const {
+        return keys_ ? (*keys_)[q].orig_idx : (*uniq_)[q % uniq_->size()].orig_idx;
+    }
+
+private:
+    // Lazy form
+    const std::vector<Coord>* uniq_ = nullptr;
+    const std::vector<Coord3D>* offs_ = nullptr;
+    // Materialized form
+    const std::vector<Coord>* keys_ = nullptr;
+    const std::vector<int>* in_idx_ = nullptr;
+    const std::vector<int>* off_idx_ = nullptr;
+
+    size_t size_ = 0;
+    size_t num_offsets_ = 0;
+};
+
+using QueryView = BasicQueryView<uint32_t>;
+
+#endif // QUERY_VIEW_HPP
@@ -0,0 +1,119 @@
+#ifndef REUSE_DISTANCE_HPP
+#define REUSE_DISTANCE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief LRU stack (reuse) distances of one address stream at line granularity.
+ *
+ * The distance of an access is the number of distinct other lines touched
+ * since the previous access to its line; a fully associative LRU cache of
+ * N lines hits exactly the accesses with a distance below N. Each line's
+ * last access time is marked in a Fenwick tree, so a distance is one range
+ * count (O(log n)). Times are renumbered once the tree is full, which keeps
+ * memory proportional to the distinct lines, not to the stream length.
+ *
+ * With sample_rate < 1 only the lines whose hash falls below the rate are
+ * analyzed and their distances are scaled by 1 / sample_rate (fixed-rate
+ * SHARDS), which bounds memory and time for very large traces at a small
+ * error in the estimated hit rates.
+ *
+ * A sampled stream can also be split into `partitions` analyzers by line
+ * hash, each one a SHARDS sample at rate sample_rate / partitions that can
+ * run on its own thread; merge() then adds their counts together. Exact
+ * analysis (sample_rate 1) takes a single partition, since the distance of
+ * an access depends on every other line.
+ */
+class ReuseDistance {
+public:
+    // cache_bytes: LRU capacities whose hit counts are tracked; sorted here.
+    // Analyzes the lines of partition `partition` out of `partitions`.
+    ReuseDistance(uint32_t line_bytes, std::vector<uint64_t> cache_bytes, double sample_rate = 1.0,
+                  uint32_t partitions = 1, uint32_t partition = 0);
+
+    // `count` consecutive accesses to the line of addr (coalesced entries)
+    void access(uint64_t addr, uint32_t count = 1) {
+        const uint64_t line = line_of(addr);
+        if (partition_of(line) != partition_) return;
+        record(line, count);
+    }
+    // Same for a line already known to lie in this partition
+    void access_line(uint64_t line, uint32_t count = 1) { record(line, count); }
+
+    uint64_t line_of(uint64_t addr) const { return addr >> line_shift_; }
+    // Partition of a line, or partitions() if the sample skips it
+    uint32_t partition_of(uint64_t line) const {
+        if (sample_threshold_ == 0) return 0;
+        const uint64_t hash = line_hash(line);
+        if (hash >= sample_threshold_) return partitions_;
+        return static_cast<uint32_t>(std::min<uint64_t>(hash / partition_width_, partitions_ - 1));
+    }
+
+    // Adds the counts of another partition of the same stream, once both
+    // have seen all of it.
+    void merge(const ReuseDistance& other);
+
+    uint32_t line_bytes() const { return line_bytes_; }
+    double sample_rate() const { return sample_rate_; }
+    uint32_t partitions() const { return partitions_; }
+    const std::vector<uint64_t>& cache_bytes() const { return cache_bytes_; }
+
+    // Analyzed accesses and lines; scale by 1 / sample_rate for estimates
+    uint64_t accesses() const { return accesses_; }
+    uint64_t lines() const { return last_access_.size() + merged_lines_; } // First accesses (cold misses)
+
+    // Accesses per distance bucket: bucket 0 holds distance 0, bucket b > 0
+    // the (scaled) distances in [2^(b-1), 2^b). Cold misses are not included.
+    const std::vector<uint64_t>& histogram() const { return histogram_; }
+
+    // Hits of each cache_bytes() capacity
+    std::vector<uint64_t> hits() const;
+
+    // Well-mixed hash of a line number (splitmix64 finalizer)
+    static uint64_t line_hash(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+private:
+    void record(uint64_t line, uint32_t count);
+    void add_distance(uint64_t distance, uint64_t count);
+    void renumber();
+
+    // Fenwick tree over access times 1..capacity (1 marks a line's last access)
+    void mark(size_t time, int delta) {
+        for (; time < tree_.size(); time += time & (~time + 1)) tree_[time] += delta;
+    }
+    uint64_t marks_upto(size_t time) const {
+        uint64_t sum = 0;
+        for (; time > 0; time -= time & (~time + 1)) sum += tree_[time];
+        return sum;
+    }
+
+    uint32_t line_bytes_;
+    uint32_t line_shift_ = 0;
+    double sample_rate_;
+    uint32_t partitions_;
+    uint32_t partition_;
+    double partition_rate_;          // sample_rate_ / partitions_, the rate distances are scaled by
+    uint64_t sample_threshold_ = 0; // 0 analyzes every line
+    uint64_t partition_width_ = 0;  // Hash range of each partition below the threshold
+    uint64_t merged_lines_ = 0;
+    std::vector<uint64_t> cache_bytes_;
+    std::vector<double> hit_below_; // Per capacity: sampled distances below this hit
+
+    std::unordered_map<uint64_t, uint64_t> last_access_; // Line -> time of its last access
+    std::vector<int32_t> tree_;
+    uint64_t now_ = 0; // Time of the latest access
+
+    uint64_t accesses_ = 0;
+    std::vector<uint64_t> histogram_;
+    std::vector<uint64_t> first_hit_; // Accesses whose smallest hitting capacity is i
+};
+
+#endif // REUSE_DISTANCE_HPP
@@ -2,7 +2,10 @@
 #ifndef SORTED_MAP_HPP
 #define SORTED_MAP_HPP
 
+#include <cstddef>
+#include <iterator>
 #include <map>
+#include <utility>
 #include <vector>
 #include <algorithm> // For std::sort
 #include <functional> // For std::function, if needed for more complex comparators
@@ -40,121 +43,125 @@ public:
     }
 };
 
+/**
+ * @brief std::map whose entries can also be walked in order of value size.
+ *
+ * The size order is cached with the size each entry had when it was placed.
+ * Inserting or erasing an entry, or changing a value through operator[],
+ * at() or an iterator, does not discard it: the next sorted access re-sorts
+ * only the new entries and those whose size changed, and merges them back
+ * in. sorted() (and get_sorted_items()) is a view over the cache that yields
+ * references to the stored pairs, so nothing is copied. Ties are ordered by
+ * ascending key.
+ */
 template<typename Key, typename ValueContainer>
 class SortedByValueSizeMap {
 public:
     using key_type = Key;
     using mapped_type = ValueContainer;
     using value_type = std::pair<const Key, ValueContainer>; // For compatibility with map-like interfaces
-    // Assuming ValueContainer has a size() method and size_type.
-    // If ValueContainer could be a raw array, this would need adjustment.
-    // For std::vector, this is fine.
     using container_size_type = decltype(std::declval<ValueContainer>().size());
 
-    void _invalidate_cache() const {
-        cache_valid_ = false;
-        // Clearing the cache vector might be too aggressive if it causes frequent reallocations.
-        // For now, just marking as invalid is enough, _build_cache will clear and refill.
-        // sorted_keys_cache_.clear(); 
-    }
 private:
-    std::map<Key, ValueContainer> data_;
-    bool ascending_; // True for ascending size, false for descending
-
-    mutable std::vector<Key> sorted_keys_cache_;
-    mutable bool cache_valid_ = false;
-
-
-
-    void _build_cache() const {
-        if (cache_valid_) return;
-        
-        sorted_keys_cache_.clear(); // Clear before refilling
-        for (const auto& pair : data_) {
-            sorted_keys_cache_.push_back(pair.first);
-        }
-
-        std::sort(sorted_keys_cache_.begin(), sorted_keys_cache_.end(),
-            [this](const Key& a_key, const Key& b_key) {
-                // Ensure keys exist before accessing, though they should if they are in sorted_keys_cache_
-                // and came from data_.
-                const auto& a_val_container = data_.at(a_key);
-                const auto& b_val_container = data_.at(b_key);
-                
-                container_size_type a_size = a_val_container.size();
-                container_size_type b_size = b_val_container.size();
-
-                if (a_size == b_size) {
-                    return a_key < b_key; // Tie-breaking: sort by key (ascending)
-                }
-                return ascending_ ? (a_size < b_size) : (a_size > b_size);
-            });
-        cache_valid_ = true;
-    }
+    // A stored pair (map nodes do not move) and the size it was sorted by
+    struct Entry {
+        const value_type* item;
+        container_size_type size;
+    };
 
 public:
+    // Iterates the entries in value-size order
+    class sorted_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = typename SortedByValueSizeMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        explicit sorted_iterator(const Entry* pos) : pos_(pos) {}
+        reference operator*() const { return *pos_->item; }
+        pointer operator->() const { return pos_->item; }
+        sorted_iterator& operator++() { ++pos_; return *this; }
+        bool operator==(const sorted_iterator& other) const { return pos_ == other.pos_; }
+        bool operator!=(const sorted_iterator& other) const { return pos_ != other.pos_; }
+
+    private:
+        const Entry* pos_;
+    };
+
+    // Size-ordered range; valid until the map is next modified
+    class SortedView {
+    public:
+        sorted_iterator begin() const { return sorted_iterator(order_->data()); }
+        sorted_iterator end() const { return sorted_iterator(order_->data() + order_->size()); }
+        size_t size() const { return order_->size(); }
+        bool empty() const { return order_->empty(); }
+
+    private:
+        friend class SortedByValueSizeMap;
+        explicit SortedView(const std::vector<Entry>* order) : order_(order) {}
+        const std::vector<Entry>* order_;
+    };
+
     // Constructor: specifies sort order
     explicit SortedByValueSizeMap(bool ascending = true) : ascending_(ascending) {}
 
     // Modifiers
     ValueContainer& operator[](const Key& key) {
-        _invalidate_cache();
         // This will default-construct ValueContainer if key doesn't exist.
-        return data_[key]; 
+        auto [it, inserted] = data_.try_emplace(key);
+        if (inserted) added_.push_back(&*it);
+        return it->second;
     }
 
     ValueContainer& operator[](Key&& key) {
-        _invalidate_cache();
-        return data_[std::move(key)];
+        auto [it, inserted] = data_.try_emplace(std::move(key));
+        if (inserted) added_.push_back(&*it);
+        return it->second;
     }
-    
+
     void insert(const Key& key, const ValueContainer& value) {
-        _invalidate_cache();
-        data_[key] = value;
+        (*this)[key] = value;
     }
 
     void insert(Key&& key, ValueContainer&& value) {
-        _invalidate_cache();
-        data_[std::move(key)] = std::move(value);
+        (*this)[std::move(key)] = std::move(value);
     }
 
     size_t erase(const Key& key) {
-        auto num_erased = data_.erase(key);
-        if (num_erased > 0) {
-            _invalidate_cache();
-        }
-        return num_erased;
+        auto it = data_.find(key);
+        if (it == data_.end()) return 0;
+        const value_type* item = &*it;
+        // Drop its cache entry before the node goes away
+        order_.erase(std::remove_if(order_.begin(), order_.end(), [item](const Entry& e) { return e.item == item; }),
+                     order_.end());
+        added_.erase(std::remove(added_.begin(), added_.end(), item), added_.end());
+        data_.erase(it);
+        return 1;
     }
 
     void clear() {
-        if (!data_.empty()) {
-            _invalidate_cache();
-            data_.clear();
-        }
+        data_.clear();
+        order_.clear();
+        added_.clear();
     }
 
-    // Accessors
+    // Accessors. A size changed through the returned reference is picked up
+    // by the next sorted access.
     ValueContainer& at(const Key& key) {
-        // .at() is non-const on std::map if map is non-const, allows modification.
-        // If modification through at() should invalidate cache, this needs thought.
-        // However, typical use of at() is for access. If it modifies the ValueContainer
-        // in a way that changes its size, the cache would be stale.
-        // For simplicity, assume .at() is for read or for modifications that don't change size.
-        // If ValueContainer size can change via its reference, cache could become invalid.
-        // This is a general problem with caching based on mutable sub-object properties.
-        // A safer approach might be to always rebuild cache on access if non-const, or provide const_at.
-        return data_.at(key); 
+        return data_.at(key);
     }
 
     const ValueContainer& at(const Key& key) const {
         return data_.at(key);
     }
 
-    bool empty() const noexcept { // Added noexcept
+    bool empty() const noexcept {
         return data_.empty();
     }
 
-    size_t size() const noexcept { // Added noexcept
+    size_t size() const noexcept {
         return data_.size();
     }
     
@@ -163,24 +170,22 @@ public:
     }
 
     // Sorted access methods
+    SortedView sorted() const {
+        update_order();
+        return SortedView(&order_);
+    }
+
     std::vector<Key> get_sorted_keys() const {
-        _build_cache();
-        return sorted_keys_cache_;
-    }
-
-    std::vector<value_type> get_sorted_items() const {
-        _build_cache();
-        std::vector<value_type> items;
-        items.reserve(sorted_keys_cache_.size());
-        for (const auto& key : sorted_keys_cache_) {
-            // Use find to get a const iterator, then construct the pair for items.
-            // This ensures we don't accidentally create new entries if a key was in cache but somehow gone from data.
-            auto it = data_.find(key);
-            if (it != data_.end()) { // Should always be true if cache is consistent
-                 items.emplace_back(it->first, it->second);
-            }
-        }
-        return items;
+        update_order();
+        std::vector<Key> keys;
+        keys.reserve(order_.size());
+        for (const Entry& entry : order_) keys.push_back(entry.item->first);
+        return keys;
+    }
+
+    // Same as sorted(): references to the stored pairs, not copies
+    SortedView get_sorted_items() const {
+        return sorted();
     }
     
     // Provide map-like find, begin, end for convenience. These operate on the underlying std::map
@@ -195,11 +200,43 @@ public:
     
     typename std::map<Key, ValueContainer>::iterator begin() { return data_.begin(); }
     typename std::map<Key, ValueContainer>::const_iterator begin() const { return data_.begin(); }
-    typename std::map<Key, ValueContainer>::const_iterator cbegin() const { return data_.cbegin(); } // Added cbegin
+    typename std::map<Key, ValueContainer>::const_iterator cbegin() const { return data_.cbegin(); }
 
     typename std::map<Key, ValueContainer>::iterator end() { return data_.end(); }
     typename std::map<Key, ValueContainer>::const_iterator end() const { return data_.end(); }
-    typename std::map<Key, ValueContainer>::const_iterator cend() const { return data_.cend(); } // Added cend
+    typename std::map<Key, ValueContainer>::const_iterator cend() const { return data_.cend(); }
+
+private:
+    bool before(const Entry& a, const Entry& b) const {
+        if (a.size == b.size) {
+            return a.item->first < b.item->first; // Tie-breaking: sort by key (ascending)
+        }
+        return ascending_ ? (a.size < b.size) : (a.size > b.size);
+    }
+
+    void update_order() const {
+        // Entries whose size is unchanged keep their relative order; move the
+        // rest to the back, add the new ones, sort those by their current size
+        // and merge them back in
+        auto stale = std::stable_partition(order_.begin(), order_.end(), [](const Entry& e) {
+            return e.size == e.item->second.size();
+        });
+        const size_t kept = static_cast<size_t>(stale - order_.begin());
+        for (const value_type* item : added_) order_.push_back({item, 0});
+        added_.clear();
+        if (kept == order_.size()) return;
+        for (auto it = order_.begin() + kept; it != order_.end(); ++it) it->size = it->item->second.size();
+        auto less = [this](const Entry& a, const Entry& b) { return before(a, b); };
+        std::sort(order_.begin() + kept, order_.end(), less);
+        std::inplace_merge(order_.begin(), order_.begin() + kept, order_.end(), less);
+    }
+
+    std::map<Key, ValueContainer> data_;
+    bool ascending_; // True for ascending size, false for descending
+
+    // Size order, and entries inserted since it was last brought up to date
+    mutable std::vector<Entry> order_;
+    mutable std::vector<const value_type*> added_;
 };
 
 #endif // SORTED_MAP_HPP
@@ -0,0 +1,101 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct TraceContext;
+
+/**
+ * @brief Persistent worker threads for the RDX, LKP, GTH and SCT phases.
+ *
+ * parallel_for(n, fn) runs fn(task) for every task in [0, n) and blocks until
+ * all of them finished. The task range is split into one contiguous slice per
+ * worker; a worker pops tasks from the front of its slice and, once it runs
+ * dry, steals the upper half of the largest remaining slice. Slices are a
+ * packed (begin, end) pair updated with CAS, so scheduling takes no lock.
+ *
+ * Concurrent callers (the pipeline stages of different frames) each get
+ * their own job with its own slices, and the workers are shared between the
+ * jobs that still have tasks: an idle worker joins the job with the fewest
+ * workers, and when a job arrives or finishes, a worker whose job has more
+ * than its fair share (workers / jobs, rounded up) moves on after its
+ * current task.
+ *
+ * Which OS thread runs a task is not deterministic. Callers that record
+ * traces therefore derive the simulated tid and the trace lane from the task
+ * index, never from the worker. Tasks record into the caller's trace context
+ * (trace_context.hpp). parallel_for must not be called from inside a task.
+ * When that context has a profile, every stretch of tasks a worker runs for
+ * a job adds a busy span to it (profiler.hpp).
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t num_workers);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    // Rethrows the first exception thrown by a task; remaining tasks are skipped.
+    void parallel_for(size_t num_tasks, const std::function<void(size_t)>& fn);
+
+    // Pool shared by all phases, one worker per hardware thread.
+    static ThreadPool& shared();
+
+    // Totals over all jobs since the pool started. Busy time is only counted
+    // with MINUET_PROFILING, and when a worker leaves a job.
+    struct Stats {
+        uint64_t jobs = 0;    // parallel_for calls
+        uint64_t busy_ns = 0; // Worker time spent running tasks
+    };
+    Stats stats() const;
+
+private:
+    struct alignas(64) Slice {
+        std::atomic<uint64_t> bounds{0}; // begin << 32 | end
+    };
+
+    // One parallel_for call, owned by the caller's stack frame
+    struct Job {
+        explicit Job(size_t num_workers) : slices(std::make_unique<Slice[]>(num_workers)) {}
+        std::unique_ptr<Slice[]> slices; // One per worker
+        const std::function<void(size_t)>* fn = nullptr;
+        TraceContext* context = nullptr; // Caller's trace context
+        std::atomic<size_t> unfinished{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error; // Guarded by mutex_
+        size_t participants = 0;  // Workers inside run_job, guarded by mutex_
+    };
+
+    void worker_loop(size_t worker);
+    void run_job(size_t worker, Job& job, std::unique_lock<std::mutex>& lock);
+    Job* pick_job() const;
+    size_t fair_share() const;
+    bool has_tasks(const Job& job) const;
+    bool pop_task(Job& job, size_t worker, size_t& task);
+    bool steal_task(Job& job, size_t worker, size_t& task);
+
+    std::vector<std::thread> workers_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    std::vector<Job*> jobs_;                  // Submitted and not yet returned
+    std::atomic<uint64_t> jobs_version_{0};   // Bumped when jobs_ changes
+    bool stopping_ = false;
+
+    std::atomic<uint64_t> submitted_{0};
+    std::atomic<uint64_t> busy_ns_{0};
+};
+
+#endif // THREAD_POOL_HPP
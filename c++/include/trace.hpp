@@ -10,19 +10,73 @@
 // Helper function to convert value to hex string
 std::string to_hex_string(uint64_t val); // Forward declaration
 
+// --- Integer IDs stored in trace entries ---
+// These must match the PHASES / OPS / TENSORS string tables in minuet_map.cpp,
+// which are only used for I/O (printing, Python bindings, trace readers).
+enum class Phase : uint8_t { RDX = 0, QRY = 1, SRT = 2, PVT = 3, LKP = 4, GTH = 5, SCT = 6, UPD = 7 };
+enum class Op : uint8_t { R = 0, W = 1 };
+enum class Tensor : uint8_t {
+    I = 0, QK = 1, QI = 2, QO = 3, PIV = 4, KM = 5, WC = 6, TILE = 7,
+    IV = 8, GM = 9, WV = 10, HT = 11, Unknown = 255
+};
+
+// Phase id recorded while no phase is set
+constexpr uint8_t NO_PHASE_ID = 0xFF;
+
+// --- Trace file layout ---
+// Version 1 rows: each entry is u8 phase, tid, op, tensor followed by a 4- or
+// 8-byte address. Batch files start with a u32 entry count followed by the
+// entries. Streamed files put TRACE_STREAM_MARKER where the count would be,
+// then frames of [u32 count][entries], a zero-count frame and a u64 total.
+//
+// Version 2 starts with TRACE_V2_MARKER and a 4-byte header (u8 version,
+// u8 sizeof_addr, u8 flags, u8 reserved), followed by blocks of
+// [u32 count][payload], a zero-count block and a u64 total. Without
+// TRACE_FLAG_COLUMNAR a payload is version 1 rows; with it, the payload holds
+// the phase, tid, op and tensor columns (count bytes each) and then the
+// addresses as deltas from the previous address of the block (the first
+// from 0), stored in sizeof_addr bytes with wrap-around. With
+// TRACE_FLAG_COUNTS (coalesced traces), every row ends with a u32 access
+// count, and a columnar payload ends with a u32 count column.
+//
+// Version 3 is version 2 (header version byte 3) stored without gzip, so it
+// can be memory-mapped, with a block index after the u64 total: one
+// TraceBlockIndex per block, then the u64 file offset of the index, the u32
+// block count and TRACE_INDEX_MAGIC.
+constexpr uint32_t TRACE_STREAM_MARKER = 0xFFFFFFFF;
+constexpr uint32_t TRACE_V2_MARKER = 0xFFFFFFFE;
+constexpr uint8_t TRACE_FLAG_COLUMNAR = 0x1;
+constexpr uint8_t TRACE_FLAG_COUNTS = 0x2;
+constexpr uint32_t TRACE_INDEX_MAGIC = 0x5849544D; // "MTIX"
+
+// Index entry of one version 3 block. The masks have bit min(id, 63) set for
+// every phase / tensor id in the block, so readers can skip whole blocks.
+struct TraceBlockIndex {
+    uint64_t offset;      // File offset of the block's u32 count
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t phase_mask;
+    uint64_t tensor_mask;
+};
+static_assert(sizeof(TraceBlockIndex) == 32, "TraceBlockIndex is stored as is");
+
+inline uint64_t trace_id_bit(uint8_t id) { return uint64_t{1} << (id < 63 ? id : 63); }
+
 // --- Structs for function results (matching Python for clarity) ---
 struct MemoryAccessEntry { // Renamed from mem_trace_entry_t
     uint8_t phase;
     uint8_t thread_id;
     uint8_t op;
     uint8_t tensor;
+    uint32_t count;  // Accesses merged into this entry (TRACE_COALESCE), else 1
     uint64_t addr;
 
     // For pybind11, if you want to print it easily from Python or use __repr__
     std::string toString() const {
         std::ostringstream oss;
         oss << "MemoryAccessEntry(phase=" << phase << ", thread_id=" << thread_id
-            << ", op=" << op << ", tensor=" << tensor << ", addr=" << to_hex_string(addr) << ")";
+            << ", op=" << op << ", tensor=" << tensor << ", count=" << count
+            << ", addr=" << to_hex_string(addr) << ")";
         return oss.str();
     }
 };
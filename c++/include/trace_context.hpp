@@ -0,0 +1,64 @@
+#ifndef TRACE_CONTEXT_HPP
+#define TRACE_CONTEXT_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "trace.hpp"
+#include "trace_sink.hpp"
+
+class Profile;
+class TraceStreamWriter;
+
+/**
+ * @brief Recording state of one trace: the sink, the current phase and the
+ * open trace stream (see begin_gmem_trace_stream).
+ *
+ * Each thread records into its current context: the default context, unless a
+ * TraceContextScope selects another. ThreadPool tasks run in the context of
+ * the thread that called parallel_for. Separate contexts can therefore
+ * record at the same time, as the stages of different frames do in the batch
+ * driver. Only one phase sequence may use a context at a time.
+ */
+struct TraceContext {
+    TraceSink sink;
+    std::string phase;                          // Current phase name, "" for none
+    uint8_t phase_id = NO_PHASE_ID;             // Phase id stamped on every entry
+    std::unique_ptr<TraceStreamWriter> stream;  // Open trace stream, if any
+    Profile* profile = nullptr;                 // Host-side profile (profiler.hpp), if any
+
+    TraceContext();
+    ~TraceContext();
+    TraceContext(const TraceContext&) = delete;
+    TraceContext& operator=(const TraceContext&) = delete;
+};
+
+namespace trace_context_detail {
+extern thread_local TraceContext* current; // nullptr selects the default context
+}
+
+// Context used by threads without a TraceContextScope.
+TraceContext& default_trace_context();
+
+inline TraceContext& current_trace_context() {
+    TraceContext* ctx = trace_context_detail::current;
+    return ctx ? *ctx : default_trace_context();
+}
+
+inline TraceSink& current_trace_sink() { return current_trace_context().sink; }
+
+// Makes ctx the calling thread's context until the scope ends.
+class TraceContextScope {
+public:
+    explicit TraceContextScope(TraceContext& ctx) : prev_(trace_context_detail::current) {
+        trace_context_detail::current = &ctx;
+    }
+    ~TraceContextScope() { trace_context_detail::current = prev_; }
+    TraceContextScope(const TraceContextScope&) = delete;
+    TraceContextScope& operator=(const TraceContextScope&) = delete;
+
+private:
+    TraceContext* prev_;
+};
+
+#endif // TRACE_CONTEXT_HPP
@@ -0,0 +1,293 @@
+#ifndef TRACE_SINK_HPP
+#define TRACE_SINK_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "trace.hpp"
+
+/**
+ * @brief Recording-time selection of the entries a TraceSink keeps.
+ *
+ * Entries are dropped unless their tensor is in tensor_mask and their
+ * address in one of addr_ranges (all addresses when empty). Sampling keeps
+ * every sample_rate-th access of a run, or with sample_lines every access to
+ * the lines whose hash is a multiple of sample_rate, so a line is either
+ * traced completely or not at all. With coalesce, an access to the same
+ * line_bytes line as the previous entry of its run (same phase, thread, op
+ * and tensor) increments that entry's count instead of adding an entry.
+ */
+struct TraceFilter {
+    uint64_t tensor_mask = ~uint64_t{0}; // trace_id_bit of the kept tensors; 0 drops everything
+    std::vector<std::pair<uint64_t, uint64_t>> addr_ranges; // [begin, end)
+    uint32_t sample_rate = 1;
+    bool sample_lines = false;
+    uint32_t line_bytes = 64; // Power of two
+    bool coalesce = false;
+
+    // False when every entry is recorded as is
+    bool active() const {
+        return tensor_mask != ~uint64_t{0} || !addr_ranges.empty() || sample_rate > 1 || coalesce;
+    }
+};
+
+/**
+ * @brief Collection point for MemoryAccessEntry records without a global lock.
+ *
+ * Every OS thread that records into a sink owns one chunked, append-only
+ * buffer. The buffer is handed out once per thread (the only place a mutex is
+ * taken) and cached in thread-local storage, so recording is a store into
+ * the current chunk. Buffers of exited threads go back to a free list and are
+ * reused, so spawning threads per batch does not grow the number of buffers.
+ *
+ * Entries are grouped into runs tagged with an ordering key, which makes the
+ * merged trace independent of OS scheduling:
+ *   - the epoch advances on every phase change (see set_curr_phase),
+ *   - the lane is chosen by the worker (batch * NUM_THREADS + tid in LKP,
+ *     the gather thread id in GTH/SCT); serial code records on lane 0.
+ * The merged order is (epoch, lane, program order).
+ *
+ * With a TraceStreamWriter attached, buffered entries are streamed out in
+ * merged order at every epoch change and at commit() points once they exceed
+ * the buffer budget, so memory stays bounded by the budget instead of the
+ * trace length.
+ *
+ * An active TraceFilter (set_filter) is applied as entries are recorded;
+ * without one, record() only pays for a single flag test. Sampling counters
+ * and coalescing restart whenever the (epoch, lane) of a thread changes, and
+ * coalescing never merges across a commit() point, so filtering adds no
+ * dependence on scheduling or on whether the trace is streamed.
+ *
+ * record() may be called concurrently from any number of threads. All other
+ * members must only be called while no thread is recording.
+ */
+class TraceStreamWriter;
+
+class TraceSink {
+public:
+    static constexpr size_t CHUNK_ENTRIES = 1 << 14; // 16K entries (256 KB) per chunk
+
+    TraceSink();
+    ~TraceSink();
+    TraceSink(const TraceSink&) = delete;
+    TraceSink& operator=(const TraceSink&) = delete;
+
+    // Fast path: append one entry to the calling thread's buffer.
+    void record(const MemoryAccessEntry& entry) {
+        if (filtered_) {
+            record_filtered(entry);
+            return;
+        }
+        Buffer& buf = local_buffer();
+        if (buf.run_epoch != epoch_.load(std::memory_order_relaxed)) {
+            start_run(buf);
+        }
+        if (buf.cursor == buf.chunk_end) {
+            grow(buf);
+        }
+        *buf.cursor++ = entry;
+    }
+
+    // Appends `count` copies of `entry` whose address advances by `stride`,
+    // filling whole chunk spans at a time.
+    void record_strided(MemoryAccessEntry entry, uint64_t stride, size_t count) {
+        if (count == 0) return;
+        if (filtered_) {
+            if (!(filter_.tensor_mask & trace_id_bit(entry.tensor))) return;
+            for (; count > 0; --count, entry.addr += stride) record_filtered(entry);
+            return;
+        }
+        Buffer& buf = local_buffer();
+        if (buf.run_epoch != epoch_.load(std::memory_order_relaxed)) {
+            start_run(buf);
+        }
+        while (count > 0) {
+            if (buf.cursor == buf.chunk_end) {
+                grow(buf);
+            }
+            size_t n = std::min(count, static_cast<size_t>(buf.chunk_end - buf.cursor));
+            for (MemoryAccessEntry* end = buf.cursor + n; buf.cursor != end; ++buf.cursor) {
+                *buf.cursor = entry;
+                entry.addr += stride;
+            }
+            count -= n;
+        }
+    }
+
+    // Applies `filter` to the entries recorded from now on.
+    void set_filter(const TraceFilter& filter);
+    const TraceFilter& filter() const { return filter_; }
+
+    // Sets the lane of the calling thread for the rest of the current epoch.
+    void set_lane(uint64_t lane);
+
+    // Closes the current epoch; entries recorded afterwards sort after it.
+    void next_epoch();
+
+    // Streams entries to `writer` from now on, buffering up to
+    // `budget_entries` between commit() points. Pass nullptr to detach.
+    void attach(TraceStreamWriter* writer, size_t budget_entries);
+    // Budget of the attached writer, 0 when recording into memory only.
+    size_t stream_budget() const { return writer_ ? stream_budget_ : 0; }
+
+    // Marks a point where everything recorded so far sorts before anything
+    // recorded later (e.g. after joining a batch of workers). Streams the
+    // buffered entries out if they exceed the budget.
+    void commit();
+
+    // Streams all buffered entries to the attached writer and clears them.
+    void drain();
+
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+
+    // Visits the trace in merged order as contiguous spans of entries.
+    template <typename Fn>
+    void for_each_span(Fn&& fn) const {
+        for (const RunSpan& run : merged_runs()) {
+            const Buffer& buf = *run.buf;
+            size_t pos = run.begin;
+            while (pos < run.end) {
+                size_t in_chunk = pos % CHUNK_ENTRIES;
+                size_t len = std::min(CHUNK_ENTRIES - in_chunk, run.end - pos);
+                fn(buf.chunks[pos / CHUNK_ENTRIES].get() + in_chunk, len);
+                pos += len;
+            }
+        }
+    }
+
+    // Visits the trace in merged order, one entry at a time.
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for_each_span([&](const MemoryAccessEntry* data, size_t len) {
+            for (size_t i = 0; i < len; ++i) fn(data[i]);
+        });
+    }
+
+    // Copies the merged trace into a single vector.
+    std::vector<MemoryAccessEntry> collect() const;
+
+    // Drops all entries; buffers stay registered with their owning threads.
+    void clear();
+
+private:
+    struct Run {
+        uint32_t epoch;
+        uint64_t lane;
+        uint64_t seq;   // Global start order, tie-break for equal (epoch, lane)
+        size_t begin;   // Index of the first entry in the owning buffer
+    };
+
+    struct Buffer {
+        std::vector<std::unique_ptr<MemoryAccessEntry[]>> chunks;
+        MemoryAccessEntry* cursor = nullptr;
+        MemoryAccessEntry* chunk_end = nullptr;
+        std::vector<Run> runs;
+        uint32_t run_epoch = UINT32_MAX; // Epoch of the open run
+        uint32_t lane_epoch = UINT32_MAX; // Epoch in which `lane` was set
+        uint64_t lane = 0;
+        // Filtered recording: last entry of the open run (coalescing) and
+        // the accesses seen on the sampled (epoch, lane)
+        MemoryAccessEntry* last = nullptr;
+        uint64_t sample_seen = 0;
+        uint32_t sample_epoch = UINT32_MAX;
+        uint64_t sample_lane = 0;
+
+        size_t size() const {
+            if (chunks.empty()) return 0;
+            return (chunks.size() - 1) * CHUNK_ENTRIES +
+                   static_cast<size_t>(cursor - chunks.back().get());
+        }
+    };
+
+    struct RunSpan {
+        const Buffer* buf;
+        size_t begin;
+        size_t end;
+    };
+
+    Buffer& local_buffer() {
+        if (tls_cache_.sink_id == id_) return *tls_cache_.buf;
+        return acquire_buffer();
+    }
+
+    // Filtered path of record(): drops, merges or appends the entry.
+    void record_filtered(const MemoryAccessEntry& entry) {
+        if (!(filter_.tensor_mask & trace_id_bit(entry.tensor))) return;
+        if (!filter_.addr_ranges.empty() && !in_addr_ranges(entry.addr)) return;
+        Buffer& buf = local_buffer();
+        if (buf.run_epoch != epoch_.load(std::memory_order_relaxed)) {
+            start_run(buf);
+        }
+        const uint64_t line = entry.addr >> line_shift_;
+        if (filter_.sample_rate > 1) {
+            if (filter_.sample_lines ? sample_hash(line) % filter_.sample_rate != 0
+                                     : buf.sample_seen++ % filter_.sample_rate != 0) {
+                return;
+            }
+        }
+        MemoryAccessEntry* last = buf.last;
+        if (filter_.coalesce && last && (last->addr >> line_shift_) == line && last->phase == entry.phase &&
+            last->thread_id == entry.thread_id && last->op == entry.op && last->tensor == entry.tensor &&
+            last->count != UINT32_MAX) {
+            ++last->count;
+            return;
+        }
+        if (buf.cursor == buf.chunk_end) {
+            grow(buf);
+        }
+        buf.last = buf.cursor;
+        *buf.cursor++ = entry;
+    }
+
+    bool in_addr_ranges(uint64_t addr) const {
+        for (const auto& range : filter_.addr_ranges) {
+            if (addr >= range.first && addr < range.second) return true;
+        }
+        return false;
+    }
+
+    // Well-mixed hash of a line number (splitmix64 finalizer)
+    static uint64_t sample_hash(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    Buffer& acquire_buffer();
+    void release_buffer(Buffer* buf);
+    void start_run(Buffer& buf);
+    void grow(Buffer& buf);
+    std::vector<RunSpan> merged_runs() const;
+
+    // Per-thread cache of the last buffer used; the full list of buffers a
+    // thread holds lives in the ThreadBuffers object in trace_sink.cpp.
+    struct TlsCache {
+        uint64_t sink_id = 0;
+        Buffer* buf = nullptr;
+    };
+    static thread_local TlsCache tls_cache_;
+    friend struct ThreadBuffers;
+
+    const uint64_t id_;
+    std::atomic<uint32_t> epoch_{0};
+    std::atomic<uint64_t> run_seq_{0};
+
+    TraceStreamWriter* writer_ = nullptr;
+    size_t stream_budget_ = 0;
+
+    TraceFilter filter_;
+    bool filtered_ = false; // filter_.active()
+    uint32_t line_shift_ = 6;
+
+    mutable std::mutex registry_mutex_;
+    std::vector<std::unique_ptr<Buffer>> buffers_; // All buffers ever handed out
+    std::vector<Buffer*> free_buffers_;            // Buffers of exited threads
+};
+
+#endif // TRACE_SINK_HPP
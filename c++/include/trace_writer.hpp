@@ -0,0 +1,112 @@
+#ifndef TRACE_WRITER_HPP
+#define TRACE_WRITER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "gz_output.hpp"
+#include "trace.hpp"
+
+// On-disk layout of a memory trace (see trace.hpp).
+struct TraceFormat {
+    int sizeof_addr = 4;
+    uint8_t version = 2;  // 1: legacy rows, 2: block format, 3: indexed uncompressed blocks
+    bool columnar = true; // Version 2 and 3: column blocks with delta-coded addresses
+    bool counts = false;  // Version 2 and 3: store the access count of every entry
+
+    // Version 3 is written without gzip so that it can be memory-mapped
+    bool compressed() const { return version != 3; }
+};
+
+namespace trace_format {
+
+// Entries per block (version 2) or frame (streamed version 1).
+constexpr size_t BLOCK_ENTRIES = 1 << 16;
+
+// Throws std::invalid_argument for an unsupported format.
+void validate(const TraceFormat& fmt);
+
+// Bytes before the first block of a streamed or version 2 file.
+std::vector<uint8_t> stream_header(const TraceFormat& fmt);
+
+// Appends one block ([u32 count][payload]) to `out`.
+void append_block(const MemoryAccessEntry* entries, size_t count,
+                  const TraceFormat& fmt, std::vector<uint8_t>& out);
+
+// Appends `count` rows without a count prefix; with `counts`, each row ends
+// with the entry's u32 access count.
+void append_rows(const MemoryAccessEntry* entries, size_t count, int sizeof_addr,
+                 std::vector<uint8_t>& out, bool counts = false);
+
+// Zero-count block followed by the u64 total entry count.
+std::vector<uint8_t> stream_footer(uint64_t total_entries);
+
+// Index entry of a block whose count starts `offset` bytes into the file.
+TraceBlockIndex index_block(const MemoryAccessEntry* entries, size_t count, uint64_t offset);
+
+// Version 3 index and trailer; `index_offset` is the file offset of the index.
+std::vector<uint8_t> index_trailer(const std::vector<TraceBlockIndex>& index, uint64_t index_offset);
+
+} // namespace trace_format
+
+/**
+ * @brief Writes a memory trace to a gzip file while it is being recorded.
+ *
+ * Entries are copied into fixed-size blocks on the calling thread; full
+ * blocks are queued for an encoder task on the CompressorPool that writes
+ * them in order into a GzOutput (whose chunks are deflated on the same pool).
+ * At most one encoder task per stream is posted at a time. The queue is
+ * bounded: a producer that fills it finishes the encoder, on its own thread
+ * if no worker has picked it up, instead of growing memory. The file uses the streamed
+ * version 1 layout or version 2 / 3, since the entry count is only known once
+ * the trace is complete.
+ */
+class TraceStreamWriter {
+public:
+    static constexpr size_t MAX_QUEUED_BLOCKS = 4; // Blocks waiting for compression
+
+    TraceStreamWriter(const std::string& filename, const TraceFormat& fmt, int compress_threads = 1);
+    ~TraceStreamWriter();
+    TraceStreamWriter(const TraceStreamWriter&) = delete;
+    TraceStreamWriter& operator=(const TraceStreamWriter&) = delete;
+
+    // Appends entries in order. Not thread-safe; called by the trace sink.
+    void append(const MemoryAccessEntry* entries, size_t count);
+
+    // Flushes the last block, writes the footer and closes the file.
+    // Returns the CRC32 of the uncompressed stream.
+    uint32_t close();
+
+    const std::string& filename() const { return filename_; }
+    uint64_t entries_written() const { return total_entries_; }
+
+private:
+    void push_block();
+    void encode_queued();
+    void finish_encoder();
+    void write_bytes(const std::vector<uint8_t>& bytes);
+    void rethrow_worker_error();
+
+    std::string filename_;
+    TraceFormat fmt_;
+    std::unique_ptr<GzOutput> out_;
+    bool closed_ = false;
+
+    std::vector<MemoryAccessEntry> block_; // Block being filled by the producer
+    uint64_t total_entries_ = 0;
+    std::vector<TraceBlockIndex> index_;   // Version 3, filled by the compressor
+
+    // Producer -> encoder hand-off
+    std::mutex queue_mutex_;
+    std::deque<std::vector<MemoryAccessEntry>> queue_;
+    bool encoding_ = false; // An encoder task is posted and has not yet found the queue empty
+    std::exception_ptr worker_error_;
+    std::shared_ptr<CompressorPool::Task> encoder_; // Latest encoder task, set by the producer
+};
+
+#endif // TRACE_WRITER_HPP
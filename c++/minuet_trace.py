@@ -78,7 +78,7 @@ try:
     # These Python-side configs might now be redundant if C++ config is the source of truth
     # Or they might be used for Python-specific parts of the script
     from minuet_mapping import PHASES as PY_PHASES, OPS as PY_OPS, TENSORS as PY_TENSORS #, output_dir as PY_output_dir, debug as PY_debug, NUM_THREADS as PY_NUM_THREADS, I_BASE as PY_I_BASE, TILE_BASE as PY_TILE_BASE, QK_BASE as PY_QK_BASE, QI_BASE as PY_QI_BASE, QO_BASE as PY_QO_BASE, PIV_BASE as PY_PIV_BASE, KM_BASE as PY_KM_BASE, WO_BASE as PY_WO_BASE, SIZE_KEY as PY_SIZE_KEY, SIZE_INT as PY_SIZE_INT
-    from minuet_gather import create_in_out_masks, compact_bar_chart # Removed write_metadata import from minuet_gather
+    from minuet_gather import compact_bar_chart # Masks come from create_in_out_masks_cpp
     # from minuet_config import GEMM_ALIGNMENT, GEMM_WT_GROUP, GEMM_SIZE, NUM_TILES, TILE_FEATS, BULK_FEATS, TOTAL_FEATS_PT
 except ImportError as e:
     print(f"Failed to import Minuet Python utility modules (minuet_mapping, etc.): {e}")
@@ -164,22 +164,24 @@ def main():
         print("\nKernel Map from C++:")
         if not kernel_map_result_cpp: # kernel_map_result_cpp is a map
             print("  Kernel map is empty.")
-        for offset_key_int, matches_list in kernel_map_result_cpp.items():
+        debug_csr = kernel_map_result_cpp # CSR arrays, viewed without copying
+        for i, offset_key_int in enumerate(debug_csr.offsets):
             # Convert offset_key (uint32_t) back to Coord3D for display
-            # Find the original Python tuple offset for display if needed, or use from_signed_key
+            offset_key_int = int(offset_key_int)
             offset_as_coord_cpp = minuet_cpp.Coord3D.from_signed_key(offset_key_int)
             print(f"  Offset {offset_as_coord_cpp} (Key: {hex(offset_key_int)}):")
-            if not matches_list:
+            b, e = debug_csr.begin[i], debug_csr.begin[i + 1]
+            if b == e:
                 print("    No matches")
-            else:
-                for match_pair in matches_list: # match_pair is std::pair<int, int>
-                    print(f"    Match: Input original_idx: {match_pair[0]} -> Query source_original_idx: {match_pair[1]}")
+            for in_idx, out_idx in zip(debug_csr.in_idx[b:e], debug_csr.out_idx[b:e]):
+                print(f"    Match: Input original_idx: {in_idx} -> Query source_original_idx: {out_idx}")
     
     # --- Retrieve and Write Memory Trace ---
-    mem_trace_cpp = minuet_cpp.get_mem_trace()
+    # Structured array (phase, thread_id, op, tensor, addr); no per-entry objects
+    mem_trace_cpp = minuet_cpp.get_mem_trace_array()
     print(f"\nMemory Trace Entries from C++ ({len(mem_trace_cpp)} total):")
     for i in range(min(len(mem_trace_cpp), 10)):
-        print(f"  {mem_trace_cpp[i]}") 
+        print(f"  {mem_trace_cpp[i]}")
     if len(mem_trace_cpp) > 10:
         print(f"... and {len(mem_trace_cpp) - 10} more entries")
 
@@ -214,22 +216,19 @@ def main():
     print("\nC++ Minuet mapping trace generation (via Python) complete.")
 
     ####################### Phase 2 Gather/Scatter (Python side) 
-    offsets_active = []
-    slot_array = []
-    # The .items() from the bound C++ map (kernel_map_result_cpp) 
-    # should respect the C++ map's iteration order.
-    for offset_key_int, matches_list in kernel_map_result_cpp.items():
-        # matches_list is a list of std::pair<int, int> from C++ (bound as list of pair-like objects)
-        if matches_list: # Only include if there are matches (i.e., list is not empty)
-            offsets_active.append(offset_key_int)
-            slot_array.append(len(matches_list))
+    # CSR view of the kernel map, in the C++ map's size order
+    kmap_csr = kernel_map_result_cpp
+    match_counts = np.diff(kmap_csr.begin)
+    active = match_counts > 0 # Only include offsets with matches
+    offsets_active = [int(o) for o in kmap_csr.offsets[active]]
+    slot_array = [int(c) for c in match_counts[active]]
         
     print("\\n--- Phase: Gather/Scatter Metadata (Python using C++ KMap order) ---")
     if cpp_global_config.debug: 
         print("Offsets active (derived from C++ KernelMapType iteration order):")
         for o_idx, o_key in enumerate(offsets_active):
             # Accessing kernel_map_result_cpp[o_key] to get length for debug print
-            print(f"  [{o_idx}] {hex(o_key)} (Matches: {len(kernel_map_result_cpp[o_key])})")
+            print(f"  [{o_idx}] {hex(o_key)} (Matches: {slot_array[o_idx]})")
         print("Slot array (derived from C++ KernelMapType iteration order):", slot_array)
 
     cpp_slots_arg = sorted(slot_array, reverse=True)
@@ -257,7 +256,8 @@ def main():
     membership = greedy_group_result_cpp.membership
     gemm_list_cpp = greedy_group_result_cpp.gemm_list # List of GemmInfo objects
     total_slots = greedy_group_result_cpp.total_slots_allocated
-    gemm_checksum_cpp = greedy_group_result_cpp.checksum # Checksum from C++ write_gemm_list_cpp
+    gemm_checksum_cpp = minuet_cpp.write_gemm_list_cpp(
+        gemm_list_cpp, os.path.join(current_output_dir, "gemms.bin.gz"))
 
     # Adapt groups_cpp_objects if necessary for compact_bar_chart or other Python consumers
     # compact_bar_chart expects: list of (se, addr, req, alloc)
@@ -322,12 +322,14 @@ def main():
     # Generate masks with global idx.
     num_total_system_offsets = len(offset_coords_tuples_raw)
     num_total_system_sources = len(unique_indexed_coords_cpp)
-    out_mask, in_mask = create_in_out_masks(
-        kernel_map_result_cpp, 
+    masks_cpp = minuet_cpp.create_in_out_masks_cpp(
+        kernel_map_result_cpp,
         slot_dict, # slot_dict keys are original offset keys, values are base addresses
-        num_total_system_offsets, 
+        num_total_system_offsets,
         num_total_system_sources
     )
+    # Zero-copy int32 views; each keeps masks_cpp alive
+    out_mask, in_mask = masks_cpp.out_mask_array, masks_cpp.in_mask_array
     
     print(out_mask, in_mask) # Debug print of masks
     
@@ -371,10 +373,7 @@ def main():
         num_matches = cpp_slots_arg[i] # cpp_slots_arg is sorted list of match counts
         active_offset_data_for_cpp.append((offset_key, base_addr, num_matches))
     
-    # Convert numpy masks to lists of int32_t for C++ vector binding
-    # pybind11 can often handle numpy arrays directly if they are C-contiguous and of the correct type.
-    # Let's try passing them directly first. If it fails, convert to .tolist().
-    # out_mask and in_mask are already np.int32.
+    # out_mask and in_mask are int32 NumPy views; pybind11 converts them to std::vector.
     
     metadata_checksum_cpp = minuet_cpp.write_metadata_cpp(
         out_mask, # Pass NumPy array directly
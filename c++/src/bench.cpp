@@ -0,0 +1,777 @@
+// minuet_bench: throughput of the traced phases on synthetic and bundled
+// point clouds. Results are written as JSON in the layout of Google
+// Benchmark's --benchmark_format=json, with trace entries per second and the
+// peak RSS of every case added.
+#include "buffer_pool.hpp"
+#include "feature_kernels.hpp"
+#include "frame_pipeline.hpp"
+#include "gemm_grouping.hpp"
+#include "minuet_config.hpp"
+#include "minuet_gather.hpp"
+#include "minuet_map.hpp"
+#include "point_cloud.hpp"
+#include "trace.hpp"
+#include "trace_context.hpp"
+#include "trace_writer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib> // For std::exit
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <sys/resource.h> // getrusage
+#include <unistd.h>       // getpid
+#include "ext/argparse.hpp"
+
+std::string to_hex_string(uint64_t val) {
+    std::stringstream ss;
+    ss << "0x" << std::hex << val;
+    return ss.str();
+}
+
+namespace {
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The phases log every step to std::cout; benchmarks run with it muted.
+class QuietStdout {
+public:
+    QuietStdout() : prev_(std::cout.rdbuf(nullptr)) {}
+    ~QuietStdout() { std::cout.rdbuf(prev_); }
+    QuietStdout(const QuietStdout&) = delete;
+    QuietStdout& operator=(const QuietStdout&) = delete;
+
+private:
+    std::streambuf* prev_;
+};
+
+// Resets the peak RSS of the process (Linux 4.0+), so it can be read per case
+bool reset_peak_rss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    return static_cast<bool>(clear_refs.flush());
+}
+
+uint64_t peak_rss_bytes() {
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return std::stoull(line.substr(6)) * 1024; // Reported in kB
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+// One timed iteration; the counters are per iteration.
+struct Sample {
+    double seconds = 0;
+    uint64_t items = 0;
+    uint64_t trace_entries = 0;
+    uint64_t bytes = 0;
+};
+
+struct BenchOptions {
+    std::string filter;
+    double min_time = 0.5;
+    uint64_t max_bytes = 1ULL << 30;
+    fs::path scratch;
+};
+
+class BenchRunner {
+public:
+    explicit BenchRunner(BenchOptions options) : options_(std::move(options)) {}
+
+    bool selected(const std::string& name) const {
+        return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+    }
+
+    const BenchOptions& options() const { return options_; }
+
+    // Repeats iteration until min_time has been measured (at least once).
+    // Returns the last sample, or nothing when the case is filtered out.
+    Sample run(const std::string& name, uint64_t points, const std::function<Sample()>& iteration) {
+        Sample last;
+        if (!selected(name)) return last;
+        bool rss_reset = reset_peak_rss();
+        double total = 0;
+        uint64_t iterations = 0;
+        const BufferPool::Stats buffers_before = BufferPool::shared().stats();
+        {
+            QuietStdout quiet;
+            do {
+                last = iteration();
+                total += last.seconds;
+                ++iterations;
+            } while (total < options_.min_time && iterations < 1000000);
+        }
+        double per_iter = total / iterations;
+        nlohmann::ordered_json result;
+        result["name"] = name;
+        result["run_type"] = "iteration";
+        result["points"] = points;
+        result["iterations"] = iterations;
+        result["real_time"] = per_iter * 1e9;
+        result["time_unit"] = "ns";
+        result["items_per_second"] = last.items / per_iter;
+        if (last.trace_entries > 0) {
+            result["trace_entries"] = last.trace_entries;
+            result["trace_entries_per_second"] = last.trace_entries / per_iter;
+        }
+        if (last.bytes > 0) {
+            result["bytes_per_second"] = last.bytes / per_iter;
+        }
+        result["peak_rss_bytes"] = peak_rss_bytes();
+        result["peak_rss_reset"] = rss_reset;
+        // Pooled buffers newly allocated per iteration; 0 once the pool is warm
+        const BufferPool::Stats buffers_after = BufferPool::shared().stats();
+        result["buffer_allocations"] =
+            static_cast<double>(buffers_after.allocations - buffers_before.allocations) / iterations;
+        results_.push_back(result);
+
+        std::cerr << std::left << std::setw(48) << name << std::right << std::setw(12)
+                  << std::fixed << std::setprecision(3) << per_iter * 1e3 << " ms" << std::setw(10)
+                  << iterations << std::setw(14) << std::setprecision(3) << last.items / per_iter / 1e6
+                  << " M items/s" << std::setw(10) << std::setprecision(1)
+                  << result["peak_rss_bytes"].get<uint64_t>() / 1048576.0 << " MB RSS" << std::endl;
+        return last;
+    }
+
+    // Records a case that was not run, like a skipped Google Benchmark.
+    void skip(const std::string& name, const std::string& reason) {
+        if (!selected(name)) return;
+        nlohmann::ordered_json result;
+        result["name"] = name;
+        result["run_type"] = "iteration";
+        result["error_occurred"] = true;
+        result["error_message"] = reason;
+        results_.push_back(result);
+        std::cerr << std::left << std::setw(48) << name << " skipped: " << reason << std::endl;
+    }
+
+    // Records a correctness check; a failed one is reported with
+    // error_occurred and makes minuet_bench exit with status 1.
+    void check(const std::string& name, const std::string& mismatch) {
+        nlohmann::ordered_json result;
+        result["name"] = name;
+        result["run_type"] = "verification";
+        result["error_occurred"] = !mismatch.empty();
+        if (!mismatch.empty()) {
+            result["error_message"] = mismatch;
+            failed_ = true;
+        }
+        results_.push_back(result);
+        std::cerr << std::left << std::setw(48) << name << (mismatch.empty() ? " ok" : " FAILED: " + mismatch)
+                  << std::endl;
+    }
+
+    bool failed() const { return failed_; }
+
+    const std::vector<nlohmann::ordered_json>& results() const { return results_; }
+
+private:
+    BenchOptions options_;
+    std::vector<nlohmann::ordered_json> results_;
+    bool failed_ = false;
+};
+
+// Runs phase in a fresh trace context. With STREAM_TRACES the trace streams
+// to a scratch file as in minuet_trace_cpp, and the stream is part of the
+// measurement; otherwise it stays in memory and is dropped afterwards.
+Sample run_traced(const BenchOptions& options, int sizeof_addr, const std::function<void()>& phase) {
+    TraceContext ctx;
+    TraceContextScope scope(ctx);
+    Sample sample;
+    auto start = Clock::now();
+    if (g_config.STREAM_TRACES) {
+        begin_gmem_trace_stream((options.scratch / "trace.bin").string(), sizeof_addr);
+    }
+    phase();
+    sample.trace_entries = ctx.sink.size() + (ctx.stream ? ctx.stream->entries_written() : 0);
+    if (g_config.STREAM_TRACES) {
+        end_gmem_trace_stream();
+    }
+    sample.seconds = seconds_since(start);
+    return sample;
+}
+
+// n distinct voxels sampled uniformly on a sphere shell of about 2.25 n
+// voxels centered on the origin, so most points have neighbors like in a
+// scan. Like the frame loaders, every voxel appears once, so the input
+// indices stay below the number of unique points.
+std::vector<Coord3D> synthetic_shell(size_t n, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> normal;
+    const double pi = std::acos(-1.0);
+    const double radius = 1.5 * std::sqrt(n / (4.0 * pi)) + 1.0;
+    std::vector<Coord3D> coords;
+    coords.reserve(n);
+    std::unordered_set<uint64_t> seen;
+    while (coords.size() < n) {
+        double x = normal(rng), y = normal(rng), z = normal(rng);
+        double norm = std::sqrt(x * x + y * y + z * z);
+        if (norm == 0) continue;
+        double scale = radius / norm;
+        Coord3D c(static_cast<int>(std::lround(x * scale)), static_cast<int>(std::lround(y * scale)),
+                  static_cast<int>(std::lround(z * scale)));
+        if (seen.insert(c.to_key<uint64_t>()).second) coords.push_back(c);
+    }
+    return coords;
+}
+
+std::vector<Coord3D> kernel_offsets() {
+    std::vector<Coord3D> offsets;
+    for (int dx = -1; dx <= 1; ++dx) {
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dz = -1; dz <= 1; ++dz) {
+                offsets.emplace_back(dx, dy, dz);
+            }
+        }
+    }
+    return offsets;
+}
+
+std::string trace_file_name(const std::string& stem) {
+    return stem + (g_config.TRACE_FORMAT == 3 ? ".bin" : ".bin.gz");
+}
+
+// The microbenchmarks of one synthetic cloud, phase by phase; each phase
+// consumes the result of the previous one.
+template <typename Key>
+void bench_phases(BenchRunner& runner, size_t n) {
+    const BenchOptions& options = runner.options();
+    const std::string suffix = "/" + std::to_string(n);
+    const std::vector<Coord3D> input = synthetic_shell(n, 1);
+    const std::vector<Coord3D> offsets = kernel_offsets();
+
+    // RDX: compute_unique_sorted_coords, for the configured key width
+    std::vector<BasicIndexedCoord<Key>> uniq;
+    auto unique_sorted = [&]() {
+        return run_traced(options, 4, [&] { uniq = compute_unique_sorted_keys(pack_coord_keys<Key>(input, 1)); });
+    };
+    runner.run("BM_ComputeUniqueSortedCoords" + suffix, n, [&] {
+        Sample s = unique_sorted();
+        s.items = n;
+        return s;
+    });
+    if (uniq.empty()) {
+        QuietStdout quiet;
+        unique_sorted(); // Filtered out, but the later phases need its output
+    }
+    const uint64_t num_points = uniq.size();
+
+    // PVT runs once; LKP is measured
+    BasicTilesPivotsResult<Key> tiles_pivots;
+    {
+        QuietStdout quiet;
+        run_traced(options, 4, [&] { tiles_pivots = create_tiles_and_pivots(uniq, g_config.NUM_PIVOTS); });
+    }
+    KernelMapType kmap;
+    auto lookup = [&]() {
+        return run_traced(options, 4, [&] {
+            BasicQueryView<Key> queries(uniq, offsets);
+            kmap = perform_coordinate_lookup(uniq, queries, tiles_pivots.tiles, tiles_pivots.pivots,
+                                             g_config.NUM_TILES);
+        });
+    };
+    Sample lkp = runner.run("BM_PerformCoordinateLookup" + suffix, num_points, [&] {
+        Sample s = lookup();
+        s.items = num_points * offsets.size();
+        return s;
+    });
+    if (lkp.trace_entries == 0) {
+        QuietStdout quiet;
+        lkp = lookup();
+    }
+    const uint64_t num_matches = kmap.num_matches();
+
+    // write_gmem_trace on the LKP trace held in memory
+    const std::string write_name = "BM_WriteGmemTrace" + suffix;
+    if (lkp.trace_entries * sizeof(MemoryAccessEntry) > options.max_bytes) {
+        runner.skip(write_name, "LKP trace of " + std::to_string(lkp.trace_entries) +
+                                    " entries exceeds --max-bytes");
+    } else if (runner.selected(write_name)) {
+        TraceContext ctx;
+        TraceContextScope scope(ctx);
+        {
+            QuietStdout quiet;
+            BasicQueryView<Key> queries(uniq, offsets);
+            perform_coordinate_lookup(uniq, queries, tiles_pivots.tiles, tiles_pivots.pivots, g_config.NUM_TILES);
+        }
+        const std::string path = (options.scratch / trace_file_name("map_trace")).string();
+        runner.run(write_name, num_points, [&] {
+            Sample s;
+            auto start = Clock::now();
+            write_gmem_trace(path, 4);
+            s.seconds = seconds_since(start);
+            s.items = ctx.sink.size();
+            s.trace_entries = ctx.sink.size();
+            s.bytes = fs::file_size(path);
+            return s;
+        });
+    }
+
+    // Metadata: GEMM grouping and masks
+    GreedyGroupResult groups;
+    auto group = [&] {
+        Sample s;
+        auto start = Clock::now();
+        groups = greedy_group_cpp(kmap, static_cast<int>(g_config.GEMM_ALIGNMENT),
+                                  static_cast<int>(g_config.GEMM_WT_GROUP), static_cast<int>(g_config.GEMM_SIZE));
+        s.seconds = seconds_since(start);
+        s.items = num_matches;
+        return s;
+    };
+    runner.run("BM_GreedyGroup" + suffix, num_points, group);
+    if (groups.pos_indices.size() != kmap.num_rows()) {
+        QuietStdout quiet;
+        group();
+    }
+
+    MasksResult masks;
+    auto make_masks = [&] {
+        Sample s;
+        auto start = Clock::now();
+        masks = create_in_out_masks_cpp(kmap, groups.pos_indices, static_cast<uint32_t>(offsets.size()),
+                                        static_cast<uint32_t>(num_points));
+        s.seconds = seconds_since(start);
+        s.items = num_matches;
+        return s;
+    };
+    runner.run("BM_CreateInOutMasks" + suffix, num_points, make_masks);
+    if (masks.in_mask.empty()) {
+        QuietStdout quiet;
+        make_masks();
+    }
+
+    // GTH and SCT: the traces alone (as in minuet_trace_cpp), then the feature data path alone
+    const uint32_t num_threads = g_config.N_THREADS_GATHER;
+    const uint32_t num_offsets = static_cast<uint32_t>(offsets.size());
+    const uint32_t points = static_cast<uint32_t>(num_points);
+    std::vector<float> no_features;
+    runner.run("BM_MtGather/TraceOnly" + suffix, num_points, [&] {
+        Sample s = run_traced(options, 8, [&] {
+            mt_gather_cpp(num_threads, points, num_offsets, g_config.NUM_TILES, g_config.TILE_FEATS,
+                          g_config.BULK_FEATS, masks.in_mask, no_features, no_features, FeatureMode::TraceOnly);
+        });
+        s.items = num_matches;
+        return s;
+    });
+    runner.run("BM_MtScatter/TraceOnly" + suffix, num_points, [&] {
+        Sample s = run_traced(options, 8, [&] {
+            mt_scatter_cpp(num_threads, points, num_offsets, g_config.NUM_TILES, g_config.TILE_FEATS,
+                           g_config.BULK_FEATS, masks.out_mask, no_features, no_features, FeatureMode::TraceOnly);
+        });
+        s.items = num_matches;
+        return s;
+    });
+
+    const uint64_t feats = g_config.TOTAL_FEATS_PT;
+    const uint64_t feature_bytes = (2 * num_points + groups.total_slots_allocated) * feats * sizeof(float);
+    const std::string gather_compute = "BM_MtGather/ComputeOnly" + suffix;
+    const std::string scatter_compute = "BM_MtScatter/ComputeOnly" + suffix;
+    if (feature_bytes > options.max_bytes) {
+        runner.skip(gather_compute, "feature arrays of " + std::to_string(feature_bytes) + " bytes exceed --max-bytes");
+        runner.skip(scatter_compute, "feature arrays of " + std::to_string(feature_bytes) + " bytes exceed --max-bytes");
+        return;
+    }
+    if (!runner.selected(gather_compute) && !runner.selected(scatter_compute)) return;
+    std::vector<float> sources(num_points * feats);
+    for (size_t i = 0; i < sources.size(); ++i) sources[i] = static_cast<float>(i % 1024);
+    std::vector<float> gemm_buffers(groups.total_slots_allocated * feats);
+    std::vector<float> outputs(num_points * feats);
+    const uint64_t moved_bytes = num_matches * feats * sizeof(float);
+    runner.run(gather_compute, num_points, [&] {
+        Sample s;
+        auto start = Clock::now();
+        mt_gather_cpp(num_threads, points, num_offsets, g_config.NUM_TILES, g_config.TILE_FEATS,
+                      g_config.BULK_FEATS, masks.in_mask, sources, gemm_buffers, FeatureMode::ComputeOnly);
+        s.seconds = seconds_since(start);
+        s.items = num_matches;
+        s.bytes = moved_bytes;
+        return s;
+    });
+    runner.run(scatter_compute, num_points, [&] {
+        Sample s;
+        auto start = Clock::now();
+        mt_scatter_cpp(num_threads, points, num_offsets, g_config.NUM_TILES, g_config.TILE_FEATS,
+                       g_config.BULK_FEATS, masks.out_mask, gemm_buffers, outputs, FeatureMode::ComputeOnly);
+        s.seconds = seconds_since(start);
+        s.items = num_matches;
+        s.bytes = moved_bytes;
+        return s;
+    });
+}
+
+// First index where a and b differ bitwise, as a message; empty if equal
+std::string first_difference(const char* what, const std::vector<float>& a, const std::vector<float>& b) {
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (std::memcmp(&a[i], &b[i], sizeof(float)) != 0) {
+            std::ostringstream msg;
+            msg << what << "[" << i << "] is " << a[i] << " with vector kernels, " << b[i] << " with scalar";
+            return msg.str();
+        }
+    }
+    return "";
+}
+
+// Runs mt_gather_cpp and mt_scatter_cpp with FEATURE_KERNELS "vector" and
+// "scalar" on the same random features and compares the GEMM buffers and
+// outputs bit for bit. Bulk sizes 4 to 64 take the accumulate_fixed kernels
+// and the others accumulate_n. Every array is cut short inside its last
+// bulk, so the clamped tail spans are covered too.
+void verify_feature_kernels(BenchRunner& runner) {
+    const uint32_t num_points = 300, num_offsets = 27, num_tiles = 2, num_threads = 4;
+    const std::string saved_kernels = g_config.FEATURE_KERNELS;
+    for (uint32_t bulk : {4u, 8u, 16u, 32u, 64u, 3u, 12u, 20u}) {
+        const std::string name = "BM_VerifyFeatureKernels/bulk" + std::to_string(bulk);
+        if (!runner.selected(name)) continue;
+        const uint32_t tile_feats = 2 * bulk;
+        const uint64_t feats = static_cast<uint64_t>(num_tiles) * tile_feats;
+        const uint64_t cut = bulk / 2 + 1; // Elements missing from the last bulk of each array
+
+        // About half of the (offset, point) pairs match; each match has its own GEMM slot
+        std::mt19937 rng(bulk);
+        std::vector<int32_t> in_mask(static_cast<size_t>(num_offsets) * num_points, -1);
+        std::vector<int32_t> out_mask(in_mask.size(), -1);
+        int32_t slots = 0;
+        for (size_t i = 0; i < in_mask.size(); ++i) {
+            if (rng() & 1) continue;
+            in_mask[i] = slots;
+            out_mask[(i / num_points) * num_points + rng() % num_points] = slots;
+            ++slots;
+        }
+        std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+        std::vector<float> sources(num_points * feats - cut);
+        for (float& v : sources) v = value(rng);
+        std::vector<float> gemm_init(slots * feats - cut, -2.0f);
+        std::vector<float> outputs_init(num_points * feats - cut);
+        for (float& v : outputs_init) v = value(rng);
+
+        std::vector<float> gemm[2], outputs[2];
+        const char* kernels[2] = {"vector", "scalar"};
+        {
+            QuietStdout quiet;
+            for (int k = 0; k < 2; ++k) {
+                g_config.FEATURE_KERNELS = kernels[k];
+                gemm[k] = gemm_init;
+                outputs[k] = outputs_init;
+                mt_gather_cpp(num_threads, num_points, num_offsets, num_tiles, tile_feats, bulk, in_mask, sources,
+                              gemm[k], FeatureMode::ComputeOnly);
+                mt_scatter_cpp(num_threads, num_points, num_offsets, num_tiles, tile_feats, bulk, out_mask, gemm[k],
+                               outputs[k], FeatureMode::ComputeOnly);
+            }
+        }
+        g_config.FEATURE_KERNELS = saved_kernels;
+        std::string mismatch = first_difference("gemm_buffers", gemm[0], gemm[1]);
+        if (mismatch.empty()) mismatch = first_difference("outputs", outputs[0], outputs[1]);
+        runner.check(name, mismatch);
+    }
+}
+
+// Runs every accumulate_n variant the CPU supports (accumulate_kernels) and
+// the accumulate_fixed sizes directly against the scalar loop, for every
+// length up to 80 at every start offset within a 64-byte line, so the ISAs
+// that the gather/scatter check does not select on this CPU are covered too.
+void verify_accumulate_kernels(BenchRunner& runner) {
+    const size_t max_len = 80, max_shift = 16;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+    std::vector<float> src(max_len + max_shift), init(max_len + max_shift);
+    for (float& v : src) v = value(rng);
+    for (float& v : init) v = value(rng);
+
+    // Compares kernel(dst + shift, src + shift, n) with the scalar loop
+    auto compare = [&](const std::function<void(float*, const float*, size_t)>& kernel) -> std::string {
+        for (size_t shift = 0; shift < max_shift; ++shift) {
+            for (size_t n = 0; n <= max_len; ++n) {
+                std::vector<float> got = init, want = init;
+                kernel(got.data() + shift, src.data() + shift, n);
+                feature_kernels::detail::accumulate_scalar(want.data() + shift, src.data() + shift, n);
+                std::string mismatch = first_difference("dst", got, want);
+                if (!mismatch.empty()) {
+                    return mismatch + " (length " + std::to_string(n) + ", offset " + std::to_string(shift) + ")";
+                }
+            }
+        }
+        return "";
+    };
+    for (const auto& [isa, fn] : feature_kernels::accumulate_kernels()) {
+        const std::string name = std::string("BM_VerifyFeatureKernels/accumulate_") + isa;
+        if (runner.selected(name)) runner.check(name, compare(fn));
+    }
+    const std::string name = "BM_VerifyFeatureKernels/accumulate_fixed";
+    if (runner.selected(name)) {
+        runner.check(name, compare([](float* dst, const float* src, size_t n) {
+            // Sizes accumulate() sends to accumulate_fixed take it; the rest the scalar loop
+            if (n == 4 || n == 8 || n == 16 || n == 32 || n == 64) {
+                feature_kernels::accumulate(dst, src, n);
+            } else {
+                feature_kernels::detail::accumulate_scalar(dst, src, n);
+            }
+        }));
+    }
+}
+
+FrameKeys pack_frame_keys(const std::vector<Coord3D>& coords);
+
+// checksums.json of a traced frame, without the map trace, which holds the
+// UPD phase in incremental frames
+nlohmann::json frame_checksums(const fs::path& dir) {
+    std::ifstream file(dir / "checksums.json");
+    nlohmann::json checksums = nlohmann::json::parse(file);
+    checksums.erase("map_trace.bin.gz");
+    checksums.erase("map_trace.bin");
+    return checksums;
+}
+
+// Traces three frames, each a shuffled copy of the last with a few voxels
+// removed and added, twice: once with the later frames mapped incrementally
+// (the third from the update of the second), once with every frame mapped
+// in full. Every output of the later frames but the map trace must have the
+// same checksum in both runs.
+void verify_incremental_mapping(BenchRunner& runner) {
+    const std::string name = "BM_VerifyIncrementalMapping";
+    if (!runner.selected(name)) return;
+    const size_t n = 4000, changed = 40, num_frames = 3;
+    const std::vector<Coord3D> voxels = synthetic_shell(n + (num_frames - 1) * changed, 2);
+    std::vector<std::vector<Coord3D>> frames;
+    for (size_t f = 0; f < num_frames; ++f) {
+        frames.emplace_back(voxels.begin() + f * changed, voxels.begin() + f * changed + n);
+        std::shuffle(frames.back().begin(), frames.back().end(), std::mt19937(3 + f)); // Stored in another order
+    }
+
+    const fs::path root = runner.options().scratch / "incremental";
+    const bool saved_incremental = g_config.INCREMENTAL_MAPPING;
+    std::vector<nlohmann::json> checksums[2];
+    {
+        QuietStdout quiet;
+        for (int incremental = 0; incremental < 2; ++incremental) {
+            g_config.INCREMENTAL_MAPPING = incremental;
+            MappedFrame previous;
+            for (size_t f = 0; f < num_frames; ++f) {
+                const fs::path dir = root / (incremental ? "incremental" : "full") / ("f" + std::to_string(f));
+                FrameTrace frame("f" + std::to_string(f), dir.string(), pack_frame_keys(frames[f]));
+                frame.map(incremental ? &previous : nullptr);
+                frame.gather_scatter();
+                frame.finish();
+                checksums[incremental].push_back(frame_checksums(dir));
+            }
+        }
+    }
+    g_config.INCREMENTAL_MAPPING = saved_incremental;
+
+    std::string mismatch;
+    for (size_t f = 1; f < num_frames && mismatch.empty(); ++f) {
+        const nlohmann::json& full = checksums[0][f];
+        const nlohmann::json& updated = checksums[1][f];
+        for (auto it = full.begin(); it != full.end() && mismatch.empty(); ++it) {
+            if (!updated.contains(it.key()) || updated[it.key()] != it.value()) {
+                mismatch = "frame " + std::to_string(f) + ": " + it.key() +
+                           " differs between the incremental and the full map";
+            }
+        }
+    }
+    runner.check(name, mismatch);
+}
+
+// End to end: load (or pack) the frame, then every FrameTrace stage and its outputs
+void bench_frame(BenchRunner& runner, const std::string& name, const std::function<FrameKeys()>& load) {
+    const std::string bench_name = "BM_FrameTrace/" + name;
+    if (!runner.selected(bench_name)) return;
+    const fs::path out_dir = runner.options().scratch / "frame";
+    uint64_t points;
+    {
+        QuietStdout quiet;
+        points = std::visit([](const auto& k) { return static_cast<uint64_t>(k.size()); }, load());
+    }
+    runner.run(bench_name, points, [&] {
+        Sample s;
+        auto start = Clock::now();
+        FrameTrace frame(name, out_dir.string(), load());
+        frame.map();
+        frame.gather_scatter();
+        frame.finish();
+        s.seconds = seconds_since(start);
+        s.items = points;
+        return s;
+    });
+}
+
+FrameKeys pack_frame_keys(const std::vector<Coord3D>& coords) {
+    return g_config.KEY_BITS == 64 ? FrameKeys(pack_coord_keys<uint64_t>(coords, 1))
+                                   : FrameKeys(pack_coord_keys<uint32_t>(coords, 1));
+}
+
+FrameKeys load_frame_keys(const std::string& path) {
+    return g_config.KEY_BITS == 64 ? FrameKeys(read_point_cloud_keys<uint64_t>(path, g_config.VOXEL_SIZE))
+                                   : FrameKeys(read_point_cloud_keys<uint32_t>(path, g_config.VOXEL_SIZE));
+}
+
+std::vector<size_t> parse_sizes(const std::string& list) {
+    std::vector<size_t> sizes;
+    std::stringstream ss(list);
+    for (std::string item; std::getline(ss, item, ',');) {
+        if (!item.empty()) sizes.push_back(std::stoull(item));
+    }
+    return sizes;
+}
+
+nlohmann::ordered_json bench_context(const std::string& config_path) {
+    char date[64];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+    nlohmann::ordered_json context;
+    context["date"] = date;
+    context["executable"] = "minuet_bench";
+    context["num_cpus"] = std::thread::hardware_concurrency();
+#ifdef NDEBUG
+    context["library_build_type"] = "release";
+#else
+    context["library_build_type"] = "debug";
+#endif
+    context["config"] = config_path;
+    context["NUM_THREADS"] = g_config.NUM_THREADS;
+    context["N_THREADS_GATHER"] = g_config.N_THREADS_GATHER;
+    context["LOOKUP_ENGINE"] = g_config.LOOKUP_ENGINE;
+    context["GATHER_SCHEDULE"] = g_config.GATHER_SCHEDULE;
+    context["KEY_BITS"] = g_config.KEY_BITS;
+    context["STREAM_TRACES"] = g_config.STREAM_TRACES;
+    context["TRACE_FORMAT"] = g_config.TRACE_FORMAT;
+    context["COMPRESS_THREADS"] = g_config.COMPRESS_THREADS;
+    context["accumulate_isa"] = feature_kernels::accumulate_kernels().front().first;
+    return context;
+}
+
+} // namespace
+
+#ifndef MINUET_EXAMPLES_DIR
+#define MINUET_EXAMPLES_DIR "examples"
+#endif
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser program("minuet_bench");
+
+    program.add_argument("--config")
+        .default_value(std::string(""))
+        .help("Configuration file (default: built-in defaults)");
+
+    program.add_argument("--filter")
+        .default_value(std::string(""))
+        .help("Run only the benchmarks whose name contains this string");
+
+    program.add_argument("--out")
+        .default_value(std::string(""))
+        .help("Write the JSON results to this file instead of stdout");
+
+    program.add_argument("--min-time")
+        .default_value(std::string("0.5"))
+        .help("Seconds measured per benchmark (at least one iteration)");
+
+    program.add_argument("--sizes")
+        .default_value(std::string("1000,10000,100000,1000000"))
+        .help("Comma-separated point counts of the synthetic clouds");
+
+    program.add_argument("--examples")
+        .default_value(std::string(MINUET_EXAMPLES_DIR))
+        .help("Directory or .txt list of frame files traced end to end");
+
+    program.add_argument("--verify")
+        .default_value(false)
+        .implicit_value(true)
+        .help("Run only the BM_Verify correctness checks; exit with status 1 on a mismatch");
+
+    program.add_argument("--max-bytes")
+        .default_value(std::string("1073741824"))
+        .help("Largest in-memory trace or feature array a benchmark may allocate");
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::exit(1);
+    }
+
+    const std::string config_path = program.get<std::string>("--config");
+    if (!config_path.empty() && !g_config.loadFromFile(config_path)) {
+        std::cerr << "Failed to load configuration from " << config_path << ". Exiting." << std::endl;
+        return 1;
+    }
+    BufferPool::shared().set_limit(static_cast<size_t>(g_config.BUFFER_POOL_MB) << 20);
+
+    BenchOptions options;
+    options.filter = program.get<std::string>("--filter");
+    options.min_time = std::stod(program.get<std::string>("--min-time"));
+    options.max_bytes = std::stoull(program.get<std::string>("--max-bytes"));
+    options.scratch = fs::temp_directory_path() / ("minuet_bench_" + std::to_string(::getpid()));
+    fs::create_directories(options.scratch);
+    BenchRunner runner(options);
+
+    int status = 0;
+    try {
+        verify_accumulate_kernels(runner);
+        verify_feature_kernels(runner);
+        verify_incremental_mapping(runner);
+        if (!program.get<bool>("--verify")) {
+            for (size_t n : parse_sizes(program.get<std::string>("--sizes"))) {
+                if (g_config.KEY_BITS == 64) {
+                    bench_phases<uint64_t>(runner, n);
+                } else {
+                    bench_phases<uint32_t>(runner, n);
+                }
+            }
+            for (size_t n : parse_sizes(program.get<std::string>("--sizes"))) {
+                const std::vector<Coord3D> coords = synthetic_shell(n, 1);
+                bench_frame(runner, "synthetic/" + std::to_string(n), [&] { return pack_frame_keys(coords); });
+            }
+            const std::string examples = program.get<std::string>("--examples");
+            if (fs::exists(examples)) {
+                for (const std::string& file : list_frame_files({examples})) {
+                    bench_frame(runner, fs::path(file).filename().string(), [&] { return load_frame_keys(file); });
+                }
+            } else {
+                std::cerr << "Warning: examples '" << examples << "' not found; skipping the bundled clouds."
+                          << std::endl;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        status = 1;
+    }
+    fs::remove_all(options.scratch);
+    if (runner.failed()) status = 1;
+
+    nlohmann::ordered_json report;
+    report["context"] = bench_context(config_path);
+    report["benchmarks"] = runner.results();
+    const std::string out_path = program.get<std::string>("--out");
+    if (out_path.empty()) {
+        std::cout << report.dump(2) << std::endl;
+    } else {
+        std::ofstream out(out_path);
+        out << report.dump(2) << std::endl;
+        if (!out) {
+            std::cerr << "Error: could not write " << out_path << std::endl;
+            return 1;
+        }
+    }
+    return status;
+}
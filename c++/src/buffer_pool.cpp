@@ -0,0 +1,36 @@
+#include "buffer_pool.hpp"
+
+BufferPool::BufferPool(size_t limit_bytes) : limit_(limit_bytes) {}
+
+BufferPool& BufferPool::shared() {
+    // Never destroyed, so static trace contexts can give their chunks back at exit
+    static BufferPool* pool = new BufferPool(size_t{256} << 20); // BUFFER_POOL_MB default
+    return *pool;
+}
+
+size_t BufferPool::limit() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return limit_;
+}
+
+void BufferPool::set_limit(size_t limit_bytes) {
+    std::unordered_map<std::type_index, std::unique_ptr<ListBase>> freed;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (limit_bytes < limit_) {
+        freed.swap(lists_);
+        stats_.kept_bytes = 0;
+    }
+    limit_ = limit_bytes;
+}
+
+void BufferPool::clear() {
+    std::unordered_map<std::type_index, std::unique_ptr<ListBase>> freed;
+    std::lock_guard<std::mutex> lock(mutex_);
+    freed.swap(lists_);
+    stats_.kept_bytes = 0;
+}
+
+BufferPool::Stats BufferPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
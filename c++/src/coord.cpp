@@ -10,20 +10,6 @@ Coord3D Coord3D::quantized(int stride) const {
     return Coord3D(x / stride, y / stride, z / stride);
 }
 
-uint32_t Coord3D::to_key() const {
-    return pack32(x, y, z); 
-}
-
-Coord3D Coord3D::from_key(uint32_t key) {
-  auto [ux, uy, uz] = unpack32s(key); // Consistently use signed unpack for from_key
-  return Coord3D(ux, uy, uz);
-}
-
-Coord3D Coord3D::from_signed_key(uint32_t key) {
-  auto [sx, sy, sz] = unpack32s(key);
-  return Coord3D(sx, sy, sz);
-}
-
 Coord3D Coord3D::operator+(const Coord3D& other) const {
     return Coord3D(x + other.x, y + other.y, z + other.z);
 }
@@ -33,23 +19,6 @@ std::ostream& operator<<(std::ostream& os, const Coord3D& c) {
     return os;
 }
 
-// --- IndexedCoord method definitions ---
-IndexedCoord::IndexedCoord(Coord3D c, int idx) : coord(c), orig_idx(idx) {
-    key_val = coord.to_key();
-}
-
-IndexedCoord::IndexedCoord(uint32_t k, int idx) : key_val(k), orig_idx(idx) {
-    coord = Coord3D::from_key(k); // Create Coord3D from key
-}
-
-uint32_t IndexedCoord::to_key() const {
-    return key_val;
-}
-
-IndexedCoord IndexedCoord::from_key_and_index(uint32_t key, int idx) {
-    return IndexedCoord(key, idx); // Use the constructor that takes key and index
-}
-
 // --- Packing/Unpacking (10-bit fields) ---
 
 // Helper function to convert value to hex string (moved from main.cpp for broader use)
@@ -94,3 +63,37 @@ std::tuple<int, int, int> unpack32s(uint32_t key) {
 
   return std::make_tuple(c1_val, c2_val, c3_val);
 }
+
+// --- Packing/Unpacking (21-bit fields) ---
+
+uint64_t pack64(int c1, int c2, int c3) {
+  // Packs three 21-bit integer coordinates into a 63-bit key, in the field
+  // order of pack32: c1 in bits 0-20, c2 in bits 21-41, c3 in bits 42-62.
+  uint64_t key = 0;
+  key = (key << 21) | (static_cast<uint64_t>(static_cast<uint32_t>(c3)) & 0x1FFFFF);
+  key = (key << 21) | (static_cast<uint64_t>(static_cast<uint32_t>(c2)) & 0x1FFFFF);
+  key = (key << 21) | (static_cast<uint64_t>(static_cast<uint32_t>(c1)) & 0x1FFFFF);
+  return key;
+}
+
+std::tuple<int, int, int> unpack64(uint64_t key) {
+  int c1 = static_cast<int>(key & 0x1FFFFF);
+  key >>= 21;
+  int c2 = static_cast<int>(key & 0x1FFFFF);
+  key >>= 21;
+  int c3 = static_cast<int>(key & 0x1FFFFF);
+  return std::make_tuple(c1, c2, c3);
+}
+
+std::tuple<int, int, int> unpack64s(uint64_t key) {
+  // Sign extension for 21-bit numbers: values >= 2^20 are negative.
+  auto field = [&key]() {
+    int v = static_cast<int>(key & 0x1FFFFF);
+    key >>= 21;
+    return v < (1 << 20) ? v : v - (1 << 21);
+  };
+  int c1 = field();
+  int c2 = field();
+  int c3 = field();
+  return std::make_tuple(c1, c2, c3);
+}
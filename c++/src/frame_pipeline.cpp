@@ -0,0 +1,474 @@
+#include "frame_pipeline.hpp"
+#include "buffer_pool.hpp"
+#include "incremental_map.hpp"
+#include "minuet_map.hpp"
+#include "point_cloud.hpp"
+#include "trace.hpp" // to_hex_string
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+// Mask rows of `width` points padded with -1 to `padded` points, in `storage`
+// (a pooled buffer) unless the mask already has that width
+const std::vector<int32_t>& pad_mask_rows(const std::vector<int32_t>& mask, uint32_t num_offsets, uint32_t width,
+                                          uint32_t padded, std::vector<int32_t>& storage) {
+    if (width == padded) return mask;
+    storage = BufferPool::shared().take<int32_t>(static_cast<size_t>(num_offsets) * padded);
+    storage.assign(static_cast<size_t>(num_offsets) * padded, -1);
+    for (size_t off = 0; off < num_offsets; ++off) {
+        std::copy_n(mask.begin() + off * width, width, storage.begin() + off * padded);
+    }
+    return storage;
+}
+
+// Renumbers the points of an incremental update by the position of their key
+// in input_keys (unique, in file order), as a full RDX numbers them, and
+// rewrites the kernel map to match. Match order only depends on sorted
+// positions, so it stays the same. Host bookkeeping, not traced.
+template <typename Key>
+void number_by_input_order(BasicKernelMapUpdate<Key>& update, const std::vector<Key>& input_keys) {
+    std::vector<BasicIndexedCoord<Key>>& coords = update.uniq_coords;
+    const char* mismatch = "Incremental update does not hold the frame's keys once each";
+    if (input_keys.size() != coords.size()) throw std::logic_error(mismatch);
+    std::vector<int32_t> position(coords.size(), -1); // Update index -> input position
+    for (size_t p = 0; p < input_keys.size(); ++p) {
+        auto it = std::lower_bound(coords.begin(), coords.end(), input_keys[p],
+                                   [](const BasicIndexedCoord<Key>& c, Key key) { return c.key_val < key; });
+        if (it == coords.end() || it->key_val != input_keys[p] || position[it->orig_idx] >= 0) {
+            throw std::logic_error(mismatch);
+        }
+        position[it->orig_idx] = static_cast<int32_t>(p);
+    }
+    for (auto& coord : coords) coord.orig_idx = position[coord.orig_idx];
+    for (int32_t& idx : update.kernel_map.in_idx) idx = position[idx];
+    for (int32_t& idx : update.kernel_map.out_idx) idx = position[idx];
+    for (int32_t& idx : update.renumber) {
+        if (idx >= 0) idx = position[idx];
+    }
+}
+
+} // namespace
+
+FrameTrace::FrameTrace(std::string name, std::string output_dir, FrameKeys input_keys)
+    : name_(std::move(name)), output_dir_(std::move(output_dir)), input_keys_(std::move(input_keys)),
+      profile_(name_), map_ctx_(std::make_unique<TraceContext>()), network_(!g_config.NETWORK.empty()) {
+    if (!output_dir_.empty() && output_dir_.back() != '/') output_dir_ += '/';
+#if MINUET_PROFILING
+    map_ctx_->profile = &profile_;
+#endif
+    // Without a NETWORK, one 3x3x3 layer at stride 1 writes to the frame directory
+    std::vector<NetworkLayer> specs = g_config.NETWORK;
+    if (!network_) specs.emplace_back();
+    uint32_t channels = g_config.NUM_TILES * g_config.TILE_FEATS;
+    for (const NetworkLayer& spec : specs) {
+        Layer layer;
+        layer.spec = spec;
+        layer.prefix = network_ ? spec.name + "/" : "";
+        layer.in_channels = channels;
+        if (layer.spec.channels == 0) layer.spec.channels = channels;
+        channels = layer.spec.channels;
+        layer.gather_ctx = std::make_unique<TraceContext>();
+        layer.scatter_ctx = std::make_unique<TraceContext>();
+#if MINUET_PROFILING
+        layer.gather_ctx->profile = layer.scatter_ctx->profile = &profile_;
+#endif
+        layers_.push_back(std::move(layer));
+    }
+}
+
+// Version 3 traces are stored uncompressed, so they do not get a .gz suffix
+std::string FrameTrace::trace_file(const std::string& stem) const {
+    return stem + (g_config.TRACE_FORMAT == 3 ? ".bin" : ".bin.gz");
+}
+
+// With STREAM_TRACES, each trace is written while its phases run
+void FrameTrace::begin_trace(const std::string& prefix, const std::string& stem, int sizeof_addr) {
+    if (g_config.STREAM_TRACES) {
+        begin_gmem_trace_stream(output_dir_ + prefix + trace_file(stem), sizeof_addr);
+    }
+}
+
+uint32_t FrameTrace::end_trace(const std::string& prefix, const std::string& stem, int sizeof_addr) {
+    return g_config.STREAM_TRACES ? end_gmem_trace_stream()
+                                  : write_gmem_trace(output_dir_ + prefix + trace_file(stem), sizeof_addr);
+}
+
+void FrameTrace::close_trace(TraceContext& ctx, const std::string& prefix, const std::string& stem,
+                             int sizeof_addr) {
+    TraceContextScope scope(ctx);
+    uint32_t crc = end_trace(prefix, stem, sizeof_addr);
+    std::cout << "C++ calculated CRC32 for " << prefix << stem << ": " << to_hex_string(crc) << std::endl;
+    checksums_[prefix + trace_file(stem)] = to_hex_string(crc);
+    current_trace_sink().clear();
+}
+
+void FrameTrace::map(MappedFrame* previous) {
+    auto create_dir = [](const std::string& dir) {
+        if (!std::filesystem::exists(dir)) {
+            std::filesystem::create_directories(dir);
+            std::cout << "Created output directory: " << dir << std::endl;
+        }
+    };
+    create_dir(output_dir_);
+    for (const Layer& layer : layers_) create_dir(output_dir_ + layer.prefix);
+    TraceContextScope scope(*map_ctx_);
+    ProfileScope profile("map", "stage");
+    begin_trace("", "map_trace", 4);
+
+    std::visit([&](auto& keys) { map_keys(std::move(keys), previous); }, input_keys_);
+    input_keys_ = FrameKeys(); // Release the moved-from vector
+    set_curr_phase(""); // Clear phase
+
+    if (!g_config.STREAM_TRACES) {
+        std::cout << "... and " << current_trace_sink().size() - 10 << " more entries" << std::endl;
+    }
+    std::cout << "\nC++ Minuet mapping trace generation complete." << std::endl;
+
+    // --- Metadata: GEMM grouping of every layer. Every kernel map row is an
+    // active offset, and its match count is its slot size.
+    std::cout << "\n--- Phase: Metadata  ---" << std::endl;
+    const GroupingConstraints gemm_limits{
+        static_cast<int>(g_config.GEMM_ALIGNMENT),
+        static_cast<int>(g_config.GEMM_WT_GROUP),
+        static_cast<int>(g_config.GEMM_SIZE)
+    };
+    for (Layer& layer : layers_) {
+        const std::vector<int> slot_sizes = layer.map.kmap->row_sizes();
+        for (const GroupingReport& report : compare_grouping_strategies(slot_sizes, gemm_limits, g_config.GEMM_LOOKAHEAD)) {
+            std::cout << layer.prefix << "GEMM grouping '" << report.strategy << "': " << report.total_slots_allocated
+                      << " slots in " << report.num_groups << " groups, " << report.padding_slots
+                      << " padding (" << 100.0 * report.padding_overhead << "%)" << std::endl;
+        }
+        layer.groups = group_slots_cpp(slot_sizes,
+                                       *make_grouping_strategy(g_config.GEMM_GROUPING, g_config.GEMM_LOOKAHEAD),
+                                       gemm_limits);
+    }
+}
+
+// RDX, QRY, PVT and LKP on keys of one width, or an incremental update
+template <typename Key>
+void FrameTrace::map_keys(std::vector<Key> input_keys, MappedFrame* previous) {
+    using Coords = std::vector<BasicIndexedCoord<Key>>;
+    const Coords* prev_uniq = previous ? std::get_if<Coords>(&previous->uniq_coords) : nullptr;
+    if (prev_uniq) {
+        std::vector<Key> inserted, removed;
+        diff_frame_keys(*prev_uniq, input_keys, inserted, removed);
+        // 4 lookups per offset and changed voxel against 1 per offset and point
+        if (4 * (inserted.size() + removed.size()) < input_keys.size()) {
+            std::cout << "\n--- Incremental update from the previous frame ---" << std::endl;
+            // Incremental frames have the single default layer (see INCREMENTAL_MAPPING)
+            LayerMap& map = layers_.front().map;
+            map.offsets = kernel_offsets(layers_.front().spec.kernel_size, 1);
+            BasicKernelMapUpdate<Key> update =
+                update_kernel_map(*prev_uniq, previous->kmap, inserted, removed, map.offsets);
+            number_by_input_order(update, input_keys);
+            map.num_inputs = map.num_outputs = static_cast<uint32_t>(update.uniq_coords.size());
+            map.kmap = share_kernel_map(std::move(update.kernel_map));
+            map.computed = true;
+            map_lookups_ = 1;
+            BufferPool::shared().give(std::move(*std::get_if<Coords>(&previous->uniq_coords)));
+            previous->uniq_coords = std::move(update.uniq_coords);
+            previous->kmap = *map.kmap;
+            return;
+        }
+        std::cout << "\n" << inserted.size() + removed.size()
+                  << " voxels changed; mapping the frame in full." << std::endl;
+    }
+
+    // --- Phase 1: Radix Sort (Unique Sorted Input Coords with Original Indices) ---
+    std::cout << "\n--- Phase: " << PHASES.inverse.at(0) << " with " << g_config.NUM_THREADS << " threads ---" << std::endl;
+    // The inputs were quantized and packed when the frame was loaded
+    KernelMapCache<Key> cache(compute_unique_sorted_keys(std::move(input_keys)));
+
+    // --- Phases 2 to 4 per layer: queries are generated on the fly during
+    // the lookup, and PVT runs once per searched coordinate set.
+    uint32_t tensor_stride = 1;
+    for (Layer& layer : layers_) {
+        if (network_) {
+            std::cout << "\n=== Layer " << layer.spec.name << ": kernel " << layer.spec.kernel_size << ", "
+                      << (layer.spec.transposed ? "transposed " : "") << "stride " << layer.spec.stride
+                      << " at tensor stride " << tensor_stride << " ===" << std::endl;
+        }
+        layer.map = cache.map_layer(layer.spec, tensor_stride);
+        if (!layer.map.computed) {
+            std::cout << "Kernel map of layer " << layer.map.source << " reused." << std::endl;
+        }
+        tensor_stride = layer.map.out_stride;
+    }
+    map_lookups_ = cache.misses();
+    maps_reused_ = cache.hits();
+    if (network_) {
+        std::cout << "\nKernel maps of " << layers_.size() << " layers: " << map_lookups_ << " looked up, "
+                  << maps_reused_ << " reused." << std::endl;
+    }
+    if (previous) {
+        // The last frame's inputs go back to the pool for the next frame's
+        if (Coords* old = std::get_if<Coords>(&previous->uniq_coords)) BufferPool::shared().give(std::move(*old));
+        previous->uniq_coords = cache.release_inputs();
+        previous->kmap = *layers_.front().map.kmap;
+    }
+}
+
+void FrameTrace::gather_scatter() {
+    const uint32_t num_threads = g_config.N_THREADS_GATHER;
+    // Only the traces are needed, so no feature data is passed in
+    std::vector<float> no_features;
+
+    for (size_t i = 0; i < layers_.size(); ++i) {
+        Layer& layer = layers_[i];
+        const uint32_t num_inputs = layer.map.num_inputs;
+        const uint32_t num_outputs = layer.map.num_outputs;
+        const uint32_t num_offsets = static_cast<uint32_t>(layer.map.offsets.size());
+        // A point's features are NUM_TILES tiles of the layer's channels
+        const uint32_t in_tile_feats = layer.in_channels / g_config.NUM_TILES;
+        const uint32_t out_tile_feats = layer.spec.channels / g_config.NUM_TILES;
+        {
+            TraceContextScope scope(*layer.gather_ctx);
+            ProfileScope profile("gather", "stage");
+            layer.masks = create_in_out_masks_cpp(*layer.map.kmap,
+                                                  layer.groups.pos_indices, // Base slot of each kernel map row
+                                                  num_offsets, num_inputs, num_outputs);
+
+            std::cout << "\n--- Minuet Gather (C++) " << layer.prefix << "---" << std::endl;
+            std::cout << "Gather parameters:" << std::endl;
+            std::cout << "  num_threads: " << num_threads << std::endl;
+            std::cout << "  num_points: " << num_inputs << std::endl;
+            std::cout << "  num_offsets: " << num_offsets << std::endl;
+            std::cout << "  num_tiles_per_pt: " << g_config.NUM_TILES << std::endl;
+            std::cout << "  tile_feat_size: " << in_tile_feats << std::endl;
+            std::cout << "  bulk_feat_size: " << g_config.BULK_FEATS << std::endl;
+            std::cout << "  in_mask size: " << layer.masks.in_mask.size() << std::endl;
+            begin_trace(layer.prefix, "gather_trace", 8);
+            mt_gather_cpp(num_threads, num_inputs, num_offsets, g_config.NUM_TILES, in_tile_feats,
+                          g_config.BULK_FEATS, layer.masks.in_mask, no_features, no_features);
+        }
+
+        std::cout << "\n--- Minuet Scatter (C++) " << layer.prefix << "---" << std::endl;
+        std::cout << "  out_mask size: " << layer.masks.out_mask.size() << std::endl;
+        {
+            TraceContextScope scope(*layer.scatter_ctx);
+            ProfileScope profile("scatter", "stage");
+            begin_trace(layer.prefix, "scatter_trace", 8);
+            mt_scatter_cpp(num_threads, num_outputs, num_offsets, g_config.NUM_TILES, out_tile_feats,
+                           g_config.BULK_FEATS, layer.masks.out_mask, no_features, no_features);
+        }
+
+        // The last layer is written by finish(), like a single-layer frame.
+        // The map context is idle once map() returned, and carries the profile.
+        if (i + 1 < layers_.size()) {
+            TraceContextScope scope(*map_ctx_);
+            write_layer_outputs(layer);
+        }
+    }
+}
+
+void FrameTrace::finish() {
+    {
+        // The writers record into the frame's profile through the map context
+        TraceContextScope scope(*map_ctx_);
+        ProfileScope profile("finish", "stage");
+        close_trace(*map_ctx_, "", "map_trace", 4);
+        write_layer_outputs(layers_.back());
+        if (network_) write_network_json(output_dir_ + "network.json");
+
+        std::string checksum_filename = output_dir_ + "checksums.json";
+        std::ofstream checksum_file(checksum_filename);
+        if (!checksum_file) {
+            throw std::runtime_error("Unable to open " + checksum_filename + " for writing.");
+        }
+        checksum_file << std::setw(2) << checksums_ << std::endl;
+        std::cout << "Checksums written to " << checksum_filename << std::endl;
+    }
+#if MINUET_PROFILING
+    std::string profile_filename = output_dir_ + "profile.json";
+    profile_.write_chrome_trace(profile_filename);
+    std::cout << "Profile written to " << profile_filename << std::endl;
+#endif
+}
+
+// Traces, kernel map (if the layer looked it up), gemms and metadata of a
+// layer; its masks and trace contexts are released afterwards.
+void FrameTrace::write_layer_outputs(Layer& layer) {
+    close_trace(*layer.gather_ctx, layer.prefix, "gather_trace", 8);
+    close_trace(*layer.scatter_ctx, layer.prefix, "scatter_trace", 8);
+
+    const std::string dir = output_dir_ + layer.prefix;
+    const KernelMapCSR& kmap = *layer.map.kmap;
+    if (layer.map.computed) {
+        checksums_[layer.prefix + "kernel_map.bin.gz"] =
+            to_hex_string(write_kernel_map_to_gz(kmap, dir + "kernel_map.bin.gz", layer.map.offsets));
+    }
+    checksums_[layer.prefix + "gemms.bin.gz"] =
+        to_hex_string(write_gemm_list_cpp(layer.groups.gemm_list, dir + "gemms.bin.gz"));
+
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> active_offset_data;
+    for (size_t row = 0; row < kmap.num_rows(); ++row) {
+        active_offset_data.emplace_back(kmap.offsets[row], static_cast<uint32_t>(layer.groups.pos_indices[row]),
+                                        static_cast<uint32_t>(kmap.row_size(row)));
+    }
+    // metadata.bin.gz has one point count, so the masks of strided and
+    // transposed layers are padded to the larger one
+    const uint32_t num_offsets = static_cast<uint32_t>(layer.map.offsets.size());
+    const uint32_t num_sources = std::max(layer.map.num_inputs, layer.map.num_outputs);
+    std::string metadata_filename = dir + "metadata.bin.gz";
+    std::cout << "Writing metadata to " << metadata_filename << " using C++ implementation." << std::endl;
+    std::vector<int32_t> padded_out, padded_in;
+    uint32_t metadata_checksum = write_metadata_cpp(
+        pad_mask_rows(layer.masks.out_mask, num_offsets, layer.map.num_outputs, num_sources, padded_out),
+        pad_mask_rows(layer.masks.in_mask, num_offsets, layer.map.num_inputs, num_sources, padded_in),
+        active_offset_data, num_offsets, num_sources,
+        static_cast<uint32_t>(layer.groups.total_slots_allocated), metadata_filename);
+    std::cout << "C++ calculated CRC32 for metadata: " << to_hex_string(metadata_checksum) << std::endl;
+    checksums_[layer.prefix + "metadata.bin.gz"] = to_hex_string(metadata_checksum);
+
+    BufferPool& buffers = BufferPool::shared();
+    buffers.give(std::move(padded_out));
+    buffers.give(std::move(padded_in));
+    buffers.give(std::move(layer.masks.out_mask));
+    buffers.give(std::move(layer.masks.in_mask));
+    layer.masks = MasksResult();
+    layer.gather_ctx.reset();
+    layer.scatter_ctx.reset();
+}
+
+void FrameTrace::write_network_json(const std::string& filename) const {
+    nlohmann::json network;
+    network["kernel_map_lookups"] = map_lookups_;
+    network["kernel_maps_reused"] = maps_reused_;
+    for (const Layer& layer : layers_) {
+        const LayerMap& map = layer.map;
+        // A transposed layer reusing a strided layer's map (or the reverse)
+        // finds it in that layer's kernel_map.bin.gz with in and out swapped
+        auto source = std::find_if(layers_.begin(), layers_.end(),
+                                   [&](const Layer& other) { return other.spec.name == map.source; });
+        network["layers"].push_back({
+            {"name", layer.spec.name},
+            {"kernel_size", layer.spec.kernel_size},
+            {"stride", layer.spec.stride},
+            {"transposed", layer.spec.transposed},
+            {"tensor_stride", {map.in_stride, map.out_stride}},
+            {"points", {map.num_inputs, map.num_outputs}},
+            {"channels", {layer.in_channels, layer.spec.channels}},
+            {"matches", map.kmap->num_matches()},
+            {"kernel_map", map.source},
+            {"kernel_map_swapped", source->spec.transposed != layer.spec.transposed},
+        });
+    }
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Unable to open " + filename + " for writing.");
+    }
+    file << std::setw(2) << network << std::endl;
+    std::cout << "Network summary written to " << filename << std::endl;
+}
+
+size_t run_frame_pipeline(const std::vector<std::string>& frame_files, const std::string& output_root) {
+    const size_t num_frames = frame_files.size();
+    const size_t depth = std::max<uint32_t>(1, g_config.PIPELINE_DEPTH);
+    std::string root = output_root;
+    if (!root.empty() && root.back() != '/') root += '/';
+
+    // A null frame marks one that failed to load or trace
+    using Frame = std::unique_ptr<FrameTrace>;
+    std::atomic<size_t> failed{0};
+    auto fail = [&](const std::string& file, const std::exception& e) {
+        std::cerr << "Error: frame " << file << " failed: " << e.what() << std::endl;
+        ++failed;
+    };
+
+    // Loaders: frame i is parsed once the mapper is less than `depth` frames behind
+    std::vector<std::promise<Frame>> loaded(num_frames);
+    std::vector<std::future<Frame>> pending;
+    for (auto& promise : loaded) pending.push_back(promise.get_future());
+    std::atomic<size_t> next_load{0};
+    std::mutex window_mutex;
+    std::condition_variable window_cv;
+    size_t mapped = 0; // Frames taken by the mapper
+    auto load_frames = [&](uint32_t loader) {
+        set_profile_thread_name("loader " + std::to_string(loader));
+        for (size_t i; (i = next_load.fetch_add(1)) < num_frames;) {
+            {
+                std::unique_lock<std::mutex> lock(window_mutex);
+                window_cv.wait(lock, [&] { return i < mapped + depth; });
+            }
+            const std::string& file = frame_files[i];
+            try {
+                std::string name = std::filesystem::path(file).stem().string();
+                FrameKeys keys = g_config.KEY_BITS == 64
+                                     ? FrameKeys(read_point_cloud_keys<uint64_t>(file, g_config.VOXEL_SIZE))
+                                     : FrameKeys(read_point_cloud_keys<uint32_t>(file, g_config.VOXEL_SIZE));
+                loaded[i].set_value(std::make_unique<FrameTrace>(name, root + name, std::move(keys)));
+            } catch (const std::exception& e) {
+                fail(file, e);
+                loaded[i].set_value(nullptr);
+            }
+        }
+    };
+    std::vector<std::thread> loaders;
+    for (uint32_t t = 0; t < std::max<uint32_t>(1, g_config.PIPELINE_LOADERS); ++t) {
+        loaders.emplace_back(load_frames, t);
+    }
+
+    // Runs `stage` on every frame from `in`, passing frames that succeeded on to `out`
+    auto run_stage = [&](BoundedQueue<Frame>& in, BoundedQueue<Frame>* out, auto stage) {
+        for (Frame frame; in.pop(frame);) {
+            try {
+                stage(*frame);
+            } catch (const std::exception& e) {
+                fail(frame->name(), e);
+                continue;
+            }
+            if (out) out->push(std::move(frame));
+        }
+        if (out) out->close();
+    };
+    BoundedQueue<Frame> to_map(depth), to_gather(depth), to_finish(depth);
+    std::thread mapper([&] {
+        set_profile_thread_name("mapper");
+        MappedFrame previous; // Frames are mapped in input order
+        run_stage(to_map, &to_gather, [&](FrameTrace& f) {
+            f.map(g_config.INCREMENTAL_MAPPING ? &previous : nullptr);
+        });
+    });
+    std::thread gatherer([&] {
+        set_profile_thread_name("gatherer");
+        run_stage(to_gather, &to_finish, [](FrameTrace& f) { f.gather_scatter(); });
+    });
+    std::thread finisher([&] {
+        set_profile_thread_name("finisher");
+        run_stage(to_finish, nullptr, [](FrameTrace& f) { f.finish(); });
+    });
+
+    // Hand loaded frames to the mapper in input order
+    for (size_t i = 0; i < num_frames; ++i) {
+        Frame frame = pending[i].get();
+        {
+            std::lock_guard<std::mutex> lock(window_mutex);
+            ++mapped;
+        }
+        window_cv.notify_all();
+        if (frame) to_map.push(std::move(frame));
+    }
+    to_map.close();
+
+    for (auto& loader : loaders) loader.join();
+    mapper.join();
+    gatherer.join();
+    finisher.join();
+    std::cout << "Traced " << num_frames - failed.load() << " of " << num_frames << " frames into "
+              << output_root << std::endl;
+    const BufferPool::Stats buffers = BufferPool::shared().stats();
+    std::cout << "Buffer pool: " << buffers.reuses << " of " << buffers.requests << " requests reused a kept buffer, "
+              << buffers.allocations << " allocated " << buffers.allocated_bytes / 1048576.0 << " MB, "
+              << buffers.kept_bytes / 1048576.0 << " MB kept; peak RSS " << peak_rss() / 1048576.0 << " MB"
+              << std::endl;
+    return failed.load();
+}
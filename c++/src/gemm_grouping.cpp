@@ -0,0 +1,242 @@
+#include "gemm_grouping.hpp"
+#include "gz_output.hpp"
+#include "minuet_config.hpp" // For g_config
+#include "profiler.hpp"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+uint64_t align_up(uint64_t slots, int alignment) {
+  return (slots + alignment - 1) / alignment * alignment;
+}
+
+size_t max_items(const GroupingConstraints &limits) {
+  return limits.max_group_items < 1 ? 1 : static_cast<size_t>(limits.max_group_items);
+}
+
+// Whether a group of `items` slots summing to `sum` respects the limits
+bool fits(size_t items, uint64_t sum, const GroupingConstraints &limits) {
+  return items <= max_items(limits) &&
+         (items == 1 || limits.max_raw_slots == -1 || sum <= static_cast<uint64_t>(limits.max_raw_slots));
+}
+
+// Allocated slots and groups of a partition, compared lexicographically
+struct PartitionCost {
+  uint64_t allocated = 0;
+  size_t groups = 0;
+
+  bool operator<(const PartitionCost &other) const {
+    return allocated != other.allocated ? allocated < other.allocated : groups < other.groups;
+  }
+  PartitionCost plus_group(uint64_t group_allocated) const {
+    return {allocated + group_allocated, groups + 1};
+  }
+};
+
+// Optimal partition of slots [begin, end). Fills the group ends when ends is
+// not null and returns the cost.
+PartitionCost optimal_partition(const std::vector<int> &slots, size_t begin, size_t end,
+                                const GroupingConstraints &limits, std::vector<size_t> *ends) {
+  const size_t n = end - begin;
+  // best[i]: cheapest partition of [begin, begin + i); start[i]: its last group start
+  std::vector<PartitionCost> best(n + 1);
+  std::vector<size_t> start(n + 1, 0);
+  for (size_t i = 1; i <= n; ++i) {
+    uint64_t sum = 0;
+    bool have = false;
+    for (size_t j = i; j-- > 0;) {
+      sum += static_cast<uint64_t>(slots[begin + j]);
+      if (!fits(i - j, sum, limits)) break;
+      PartitionCost cost = best[j].plus_group(align_up(sum, limits.alignment));
+      if (!have || cost < best[i]) {
+        best[i] = cost;
+        start[i] = j;
+        have = true;
+      }
+    }
+  }
+  if (ends) {
+    std::vector<size_t> reversed;
+    for (size_t i = n; i > 0; i = start[i]) reversed.push_back(begin + i);
+    ends->assign(reversed.rbegin(), reversed.rend());
+  }
+  return best[n];
+}
+
+class GreedyGrouping : public GroupingStrategy {
+public:
+  const char *name() const override { return "greedy"; }
+
+  std::vector<size_t> partition(const std::vector<int> &slots,
+                                const GroupingConstraints &limits) const override {
+    std::vector<size_t> ends;
+    size_t items = 0;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < slots.size(); ++i) {
+      uint64_t slot_size = static_cast<uint64_t>(slots[i]);
+      if (items > 0 && !fits(items + 1, sum + slot_size, limits)) {
+        ends.push_back(i);
+        items = 0;
+        sum = 0;
+      }
+      sum += slot_size;
+      ++items;
+    }
+    if (items > 0) ends.push_back(slots.size());
+    return ends;
+  }
+};
+
+class OptimalGrouping : public GroupingStrategy {
+public:
+  const char *name() const override { return "optimal"; }
+
+  std::vector<size_t> partition(const std::vector<int> &slots,
+                                const GroupingConstraints &limits) const override {
+    std::vector<size_t> ends;
+    optimal_partition(slots, 0, slots.size(), limits, &ends);
+    return ends;
+  }
+};
+
+class LookaheadGrouping : public GroupingStrategy {
+public:
+  explicit LookaheadGrouping(int lookahead) : lookahead_(lookahead < 0 ? 0 : static_cast<size_t>(lookahead)) {}
+
+  const char *name() const override { return "lookahead"; }
+
+  std::vector<size_t> partition(const std::vector<int> &slots,
+                                const GroupingConstraints &limits) const override {
+    // Receding horizon: solve [begin, begin + max group + lookahead)
+    // optimally and keep only its first group. Every candidate end is scored
+    // over the same slots.
+    std::vector<size_t> ends, window_ends;
+    const size_t n = slots.size();
+    for (size_t begin = 0; begin < n; begin = ends.back()) {
+      size_t horizon = std::min(n, begin + max_items(limits) + lookahead_);
+      optimal_partition(slots, begin, horizon, limits, &window_ends);
+      ends.push_back(window_ends.front());
+    }
+    return ends;
+  }
+
+private:
+  size_t lookahead_;
+};
+
+} // namespace
+
+std::unique_ptr<GroupingStrategy> make_grouping_strategy(const std::string &name, int lookahead) {
+  if (name == "greedy") return std::make_unique<GreedyGrouping>();
+  if (name == "optimal") return std::make_unique<OptimalGrouping>();
+  if (name == "lookahead") return std::make_unique<LookaheadGrouping>(lookahead);
+  throw std::invalid_argument("Unknown GEMM_GROUPING: '" + name + "' (expected greedy, optimal or lookahead)");
+}
+
+GreedyGroupResult build_group_result(const std::vector<int> &slots, const std::vector<size_t> &group_ends,
+                                     int alignment) {
+  GreedyGroupResult result;
+  result.pos_indices.resize(slots.size());
+  result.total_slots_allocated = 0;
+
+  uint64_t current_addr = 0;
+  size_t group_begin = 0;
+  for (size_t group_end : group_ends) {
+    if (group_end <= group_begin || group_end > slots.size()) {
+      throw std::invalid_argument("build_group_result: group ends must ascend within the slot list");
+    }
+    GroupInfo group;
+    group.base_addr = current_addr;
+    uint32_t req = 0;
+    for (size_t i = group_begin; i < group_end; ++i) {
+      result.pos_indices[i] = current_addr + req;
+      group.members.push_back(static_cast<int>(i));
+      req += static_cast<uint32_t>(slots[i]);
+    }
+    group.required_slots = req;
+    group.allocated_slots = static_cast<uint32_t>(align_up(req, alignment));
+    current_addr += group.allocated_slots;
+    group_begin = group_end;
+
+    result.membership.push_back(group.members);
+    result.total_slots_allocated += group.allocated_slots;
+
+    GemmInfo gemm_item;
+    gemm_item.num_offsets = static_cast<uint32_t>(group.members.size());
+    gemm_item.gemm_M = group.allocated_slots;
+    gemm_item.slots = group.required_slots;
+    gemm_item.padding = group.allocated_slots - group.required_slots;
+    result.gemm_list.push_back(gemm_item);
+    result.groups.push_back(std::move(group));
+  }
+  if (group_begin != slots.size()) {
+    throw std::invalid_argument("build_group_result: groups do not cover every slot");
+  }
+  return result;
+}
+
+GreedyGroupResult group_slots_cpp(const std::vector<int> &slots, const GroupingStrategy &strategy,
+                                  const GroupingConstraints &limits) {
+  ProfileScope profile("group_slots_cpp");
+  if (limits.alignment < 1) {
+    throw std::invalid_argument("GEMM grouping: alignment must be positive, got " +
+                                std::to_string(limits.alignment));
+  }
+  return build_group_result(slots, strategy.partition(slots, limits), limits.alignment);
+}
+
+std::vector<GroupingReport> compare_grouping_strategies(const std::vector<int> &slots,
+                                                        const GroupingConstraints &limits,
+                                                        int lookahead) {
+  uint64_t required = 0;
+  for (int slot_size : slots) required += static_cast<uint64_t>(slot_size);
+
+  std::vector<GroupingReport> reports;
+  for (const char *name : {"greedy", "optimal", "lookahead"}) {
+    GreedyGroupResult result = group_slots_cpp(slots, *make_grouping_strategy(name, lookahead), limits);
+    GroupingReport report;
+    report.strategy = name;
+    report.total_slots_allocated = result.total_slots_allocated;
+    report.padding_slots = result.total_slots_allocated - required;
+    report.padding_overhead = required > 0 ? static_cast<double>(report.padding_slots) / required : 0.0;
+    report.num_groups = result.groups.size();
+    reports.push_back(report);
+  }
+  return reports;
+}
+
+uint32_t write_gemm_list_cpp(const std::vector<GemmInfo> &gemm_data_list,
+                             const std::string &filename) {
+  ProfileScope profile("write_gemm_list_cpp", "writer");
+  profile.set_output(filename);
+  GzOutput out(filename, g_config.COMPRESS_THREADS);
+
+  for (const auto &gemm : gemm_data_list) {
+    uint32_t num_offsets = gemm.num_offsets;
+    uint32_t gemm_M = gemm.gemm_M;
+    uint32_t padding = gemm.padding;
+
+    out.write_value(num_offsets);
+    out.write_value(gemm_M);
+    out.write_value(padding);
+  }
+
+  profile.add_bytes(out.bytes_written());
+  uint32_t crc = out.close();
+  std::cout << "GEMM list successfully written to " << filename << " with "
+            << gemm_data_list.size() << " entries." << std::endl;
+  return crc;
+}
+
+GreedyGroupResult greedy_group_cpp(const std::vector<int> &slots, int alignment,
+                                   int max_group_items, int max_raw_slots) {
+  return group_slots_cpp(slots, GreedyGrouping(), {alignment, max_group_items, max_raw_slots});
+}
+
+GreedyGroupResult greedy_group_cpp(const KernelMapCSR &kernel_map, int alignment,
+                                   int max_group_items, int max_raw_slots) {
+  return greedy_group_cpp(kernel_map.row_sizes(), alignment, max_group_items,
+                          max_raw_slots);
+}
@@ -0,0 +1,274 @@
+#include "gz_output.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static constexpr size_t DICT_BYTES = 32 * 1024; // Deflate window
+
+CompressorPool::CompressorPool(size_t num_workers) {
+    num_workers = std::max<size_t>(1, num_workers);
+    for (size_t w = 0; w < num_workers; ++w) {
+        workers_.emplace_back(&CompressorPool::worker_loop, this);
+    }
+}
+
+CompressorPool::~CompressorPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+CompressorPool& CompressorPool::shared() {
+    static CompressorPool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+void CompressorPool::post(std::shared_ptr<Task> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(task));
+    }
+    work_cv_.notify_one();
+}
+
+void CompressorPool::worker_loop() {
+    while (true) {
+        std::shared_ptr<Task> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cv_.wait(lock, [&] { return !queue_.empty() || stopping_; });
+            if (queue_.empty()) return;
+            task = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        // Skipped if finish() or discard() claimed it meanwhile
+        if (!task->claimed_.exchange(true)) run(*task);
+    }
+}
+
+void CompressorPool::run(Task& task) {
+    try {
+        task.fn_();
+    } catch (...) {
+        task.error_ = std::current_exception();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task.done_ = true;
+    }
+    done_cv_.notify_all();
+}
+
+void CompressorPool::wait(Task& task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&] { return task.done_; });
+}
+
+void CompressorPool::finish(Task& task) {
+    if (!task.claimed_.exchange(true)) {
+        run(task);
+    } else {
+        wait(task);
+    }
+}
+
+void CompressorPool::discard(Task& task) {
+    if (task.claimed_.exchange(true)) wait(task);
+}
+
+GzOutput::GzOutput(const std::string& filename, int threads, bool compressed)
+    : filename_(filename), threads_(std::max(1, threads)), compressed_(compressed) {
+    crc_ = crc32(0L, Z_NULL, 0);
+    chunk_.reserve(CHUNK_BYTES);
+    if (!compressed_) {
+        raw_file_ = std::fopen(filename.c_str(), "wb");
+        if (!raw_file_) {
+            throw std::runtime_error("Failed to open file for writing: " + filename);
+        }
+        return;
+    }
+    if (threads_ == 1) {
+        gz_file_ = gzopen(filename.c_str(), "wb");
+        if (!gz_file_) {
+            throw std::runtime_error("Failed to open file for writing: " + filename);
+        }
+        return;
+    }
+
+    raw_file_ = std::fopen(filename.c_str(), "wb");
+    if (!raw_file_) {
+        throw std::runtime_error("Failed to open file for writing: " + filename);
+    }
+    // gzip member header: deflate, no flags, no mtime, OS = Unix
+    const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    write_file(header, sizeof(header));
+}
+
+GzOutput::~GzOutput() {
+    if (!closed_) {
+        try {
+            close();
+        } catch (const std::exception&) {
+            // Already reported by the write that failed
+        }
+    }
+    discard_pending();
+}
+
+void GzOutput::write(const void* data, size_t len) {
+    if (closed_) {
+        throw std::runtime_error("Write to closed gzip file: " + filename_);
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+        size_t take = std::min(len, CHUNK_BYTES - chunk_.size());
+        chunk_.insert(chunk_.end(), bytes, bytes + take);
+        bytes += take;
+        len -= take;
+        if (chunk_.size() == CHUNK_BYTES) {
+            flush_chunk(false);
+        }
+    }
+}
+
+void GzOutput::flush_chunk(bool last) {
+    total_bytes_ += chunk_.size();
+    if (gz_file_) {
+        if (!chunk_.empty()) {
+            unsigned int len = static_cast<unsigned int>(chunk_.size());
+            if (gzwrite(gz_file_, chunk_.data(), len) != static_cast<int>(len)) {
+                throw std::runtime_error("Failed to write data to gzip file: " + filename_);
+            }
+            crc_ = crc32(crc_, chunk_.data(), len);
+        }
+        chunk_.clear();
+        return;
+    }
+    if (!compressed_) {
+        write_file(chunk_.data(), chunk_.size());
+        crc_ = crc32(crc_, chunk_.data(), static_cast<uInt>(chunk_.size()));
+        chunk_.clear();
+        return;
+    }
+
+    auto job = std::make_unique<Job>();
+    job->dictionary = dictionary_;
+    job->last = last;
+    size_t tail = std::min(chunk_.size(), DICT_BYTES);
+    dictionary_.assign(chunk_.end() - tail, chunk_.end());
+    job->input.swap(chunk_);
+    chunk_.reserve(CHUNK_BYTES);
+    Job* raw = job.get(); // Outlives the task: retired or discarded first
+    job->task = std::make_shared<CompressorPool::Task>([raw] { deflate_job(*raw); });
+    CompressorPool::shared().post(job->task);
+    pending_.push_back(std::move(job));
+
+    // Bound the memory held by chunks in flight
+    while (pending_.size() > 2 * static_cast<size_t>(threads_)) {
+        retire_oldest();
+    }
+}
+
+void GzOutput::retire_oldest() {
+    Job& job = *pending_.front();
+    CompressorPool::shared().finish(*job.task);
+    if (job.task->error()) {
+        std::rethrow_exception(job.task->error());
+    }
+    write_file(job.output.data(), job.output.size());
+    crc_ = crc32_combine(crc_, job.crc, static_cast<z_off_t>(job.input.size()));
+    pending_.pop_front();
+}
+
+void GzOutput::deflate_job(Job& job) {
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("deflateInit2 failed");
+    }
+    if (!job.dictionary.empty()) {
+        deflateSetDictionary(&zs, job.dictionary.data(), static_cast<uInt>(job.dictionary.size()));
+    }
+
+    // Room for the sync flush marker on top of the deflate bound
+    job.output.resize(deflateBound(&zs, job.input.size()) + 64);
+    zs.next_in = job.input.data();
+    zs.avail_in = static_cast<uInt>(job.input.size());
+    zs.next_out = job.output.data();
+    zs.avail_out = static_cast<uInt>(job.output.size());
+    const int flush = job.last ? Z_FINISH : Z_SYNC_FLUSH;
+    int rc;
+    while (true) {
+        rc = deflate(&zs, flush);
+        if (rc == Z_STREAM_ERROR) {
+            deflateEnd(&zs);
+            throw std::runtime_error("deflate failed");
+        }
+        bool finished = job.last ? (rc == Z_STREAM_END) : (zs.avail_out != 0);
+        if (finished) break;
+        size_t used = job.output.size() - zs.avail_out;
+        job.output.resize(job.output.size() * 2);
+        zs.next_out = job.output.data() + used;
+        zs.avail_out = static_cast<uInt>(job.output.size() - used);
+    }
+    job.output.resize(job.output.size() - zs.avail_out);
+    deflateEnd(&zs);
+
+    job.crc = crc32(crc32(0L, Z_NULL, 0), job.input.data(), static_cast<uInt>(job.input.size()));
+}
+
+void GzOutput::write_file(const void* data, size_t len) {
+    if (len > 0 && std::fwrite(data, 1, len, raw_file_) != len) {
+        throw std::runtime_error("Failed to write data to gzip file: " + filename_);
+    }
+}
+
+void GzOutput::discard_pending() {
+    for (auto& job : pending_) {
+        CompressorPool::shared().discard(*job->task);
+    }
+    pending_.clear();
+}
+
+uint32_t GzOutput::close() {
+    if (closed_) {
+        throw std::runtime_error("gzip file already closed: " + filename_);
+    }
+    closed_ = true;
+    if (gz_file_) {
+        flush_chunk(true);
+        gzclose(gz_file_);
+        gz_file_ = nullptr;
+        return static_cast<uint32_t>(crc_);
+    }
+
+    try {
+        flush_chunk(true); // Final chunk (possibly empty) carries BFINAL
+        while (!pending_.empty()) {
+            retire_oldest();
+        }
+        if (compressed_) {
+            // gzip trailer: CRC32 and input size mod 2^32, little-endian on any host
+            const uint32_t fields[2] = {static_cast<uint32_t>(crc_), static_cast<uint32_t>(total_bytes_)};
+            uint8_t trailer[8];
+            for (int i = 0; i < 8; ++i) trailer[i] = static_cast<uint8_t>(fields[i / 4] >> (8 * (i % 4)));
+            write_file(trailer, sizeof(trailer));
+        }
+    } catch (...) {
+        discard_pending();
+        std::fclose(raw_file_);
+        raw_file_ = nullptr;
+        throw;
+    }
+    if (std::fclose(raw_file_) != 0) {
+        raw_file_ = nullptr;
+        throw std::runtime_error("Failed to close gzip file: " + filename_);
+    }
+    raw_file_ = nullptr;
+    return static_cast<uint32_t>(crc_);
+}
@@ -0,0 +1,256 @@
+#include "incremental_map.hpp"
+#include "minuet_config.hpp"
+#include "minuet_map.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+template <typename Key>
+bool key_below(const BasicIndexedCoord<Key>& coord, Key key) {
+    return coord.key_val < key;
+}
+
+template <typename Key>
+[[noreturn]] void bad_key(const char* what, Key key) {
+    throw std::invalid_argument(std::string("update_kernel_map: ") + what + " " + to_hex_string(key));
+}
+
+// Bytes radix_sort_with_memtrace uses from its base address for n pairs
+uint64_t radix_footprint(size_t n) {
+    const uint64_t threads = std::max<uint32_t>(1, g_config.NUM_THREADS);
+    return 2 * n * (static_cast<uint64_t>(g_config.SIZE_KEY) + g_config.SIZE_INT) +
+           256 * threads * g_config.SIZE_INT;
+}
+
+} // namespace
+
+template <typename Key>
+BasicKernelMapUpdate<Key> update_kernel_map(const std::vector<BasicIndexedCoord<Key>>& prev_uniq,
+                                            const KernelMapCSR& prev_kmap, const std::vector<Key>& inserted,
+                                            const std::vector<Key>& removed,
+                                            const std::vector<Coord3D>& off_coords) {
+    ProfileScope profile("update_kernel_map");
+    profile.set("inserted", static_cast<double>(inserted.size()));
+    profile.set("removed", static_cast<double>(removed.size()));
+    const size_t prev_n = prev_uniq.size();
+    const size_t num_offsets = off_coords.size();
+    const uint64_t key_bytes = g_config.SIZE_KEY;
+
+    std::vector<uint8_t> prev_seen(prev_n, 0);
+    for (const auto& coord : prev_uniq) {
+        if (coord.orig_idx < 0 || static_cast<size_t>(coord.orig_idx) >= prev_n || prev_seen[coord.orig_idx]++) {
+            throw std::invalid_argument("update_kernel_map: previous point indices are not 0.." +
+                                        std::to_string(prev_n) + "-1");
+        }
+    }
+
+    // --- RDX: sort both deltas; values are positions in inserted / removed
+    set_curr_phase(Phase::RDX);
+    std::vector<Key> ins_keys(inserted), rem_keys(removed);
+    std::vector<int> ins_pos(inserted.size()), rem_pos(removed.size());
+    std::iota(ins_pos.begin(), ins_pos.end(), 0);
+    std::iota(rem_pos.begin(), rem_pos.end(), 0);
+    const uint64_t ins_base = g_config.I_BASE + prev_n * key_bytes;
+    const uint64_t rem_base = ins_base + radix_footprint(ins_keys.size());
+    radix_sort_with_memtrace(ins_keys, ins_pos, ins_base);
+    radix_sort_with_memtrace(rem_keys, rem_pos, rem_base);
+    const size_t n_ins = ins_keys.size(), n_rem = rem_keys.size();
+
+    // --- UPD: merge the previous inputs with the deltas. The sorted keys of
+    // both deltas are left at their base (an even number of passes).
+    set_curr_phase(Phase::UPD);
+    BasicKernelMapUpdate<Key> result;
+    std::vector<BasicIndexedCoord<Key>>& next = result.uniq_coords;
+    next.reserve(prev_n + n_ins);
+
+    Key first_delta = 0;
+    if (n_ins > 0) first_delta = ins_keys[0];
+    if (n_rem > 0 && (n_ins == 0 || rem_keys[0] < first_delta)) first_delta = rem_keys[0];
+    size_t i = n_ins + n_rem == 0
+                   ? prev_n
+                   : std::lower_bound(prev_uniq.begin(), prev_uniq.end(), first_delta, key_below<Key>) -
+                         prev_uniq.begin();
+    next.insert(next.end(), prev_uniq.begin(), prev_uniq.begin() + i); // Stays in place
+
+    std::vector<uint8_t> removed_orig(prev_n, 0); // By previous point index
+    auto read_prev = [&](size_t pos) {
+        if (pos < prev_n) record_access<Op::R, Tensor::I>(0, g_config.I_BASE + pos * key_bytes);
+    };
+    auto read_ins = [&](size_t pos) {
+        if (pos < n_ins) record_access<Op::R, Tensor::I>(0, ins_base + pos * key_bytes);
+    };
+    auto read_rem = [&](size_t pos) {
+        if (pos < n_rem) record_access<Op::R, Tensor::I>(0, rem_base + pos * key_bytes);
+    };
+    auto append = [&](const BasicIndexedCoord<Key>& coord) {
+        record_access<Op::W, Tensor::I>(0, g_config.I_BASE + next.size() * key_bytes);
+        next.push_back(coord);
+    };
+    size_t a = 0, r = 0;
+    read_prev(i);
+    read_ins(a);
+    read_rem(r);
+    while (i < prev_n || a < n_ins) {
+        const bool have_prev = i < prev_n;
+        if (r < n_rem && (!have_prev || rem_keys[r] < prev_uniq[i].key_val)) {
+            bad_key("removed key is not in the previous frame or listed twice:", rem_keys[r]);
+        }
+        if (have_prev && r < n_rem && rem_keys[r] == prev_uniq[i].key_val) {
+            removed_orig[prev_uniq[i].orig_idx] = 1;
+            read_prev(++i);
+            read_rem(++r);
+        } else if (a < n_ins && (!have_prev || ins_keys[a] <= prev_uniq[i].key_val)) {
+            if (have_prev && ins_keys[a] == prev_uniq[i].key_val) {
+                bad_key("inserted key is already in the previous frame:", ins_keys[a]);
+            }
+            if (a > 0 && ins_keys[a] == ins_keys[a - 1]) bad_key("inserted key is listed twice:", ins_keys[a]);
+            append(BasicIndexedCoord<Key>(ins_keys[a], -1 - static_cast<int>(a))); // Numbered below
+            read_ins(++a);
+        } else {
+            append(prev_uniq[i]);
+            read_prev(++i);
+        }
+    }
+    if (r < n_rem) bad_key("removed key is not in the previous frame or listed twice:", rem_keys[r]);
+    set_curr_phase(""); // Clear phase
+
+    // Survivors keep their order; inserted points follow in input order
+    result.renumber.assign(prev_n, -1);
+    int32_t survivors = 0;
+    for (size_t p = 0; p < prev_n; ++p) {
+        if (!removed_orig[p]) result.renumber[p] = survivors++;
+    }
+    std::vector<size_t> rank(next.size()); // Sorted position of every next point index
+    for (size_t k = 0; k < next.size(); ++k) {
+        int idx = next[k].orig_idx;
+        next[k].orig_idx = idx >= 0 ? result.renumber[idx] : survivors + ins_pos[-1 - idx];
+        rank[next[k].orig_idx] = k;
+    }
+
+    // --- PVT and LKP over the neighborhoods of the changed voxels. Queries
+    // of group g and offset o get offset index g * num_offsets + o:
+    // inserted + offset, inserted - offset, removed + offset, removed - offset.
+    BasicTilesPivotsResult<Key> tiles_pivots = create_tiles_and_pivots(next, g_config.NUM_PIVOTS);
+
+    std::vector<BasicIndexedCoord<Key>> qry_keys;
+    std::vector<int> qry_in_idx, qry_off_idx;
+    const size_t num_queries = 2 * num_offsets * (n_ins + n_rem);
+    qry_keys.reserve(num_queries);
+    qry_in_idx.reserve(num_queries);
+    qry_off_idx.reserve(num_queries);
+    for (int group = 0; group < 4; ++group) {
+        const std::vector<Key>& keys = group < 2 ? ins_keys : rem_keys;
+        const int sign = group % 2 == 0 ? 1 : -1;
+        for (size_t o = 0; o < num_offsets; ++o) {
+            const Coord3D& off = off_coords[o];
+            for (size_t v = 0; v < keys.size(); ++v) {
+                Coord3D c = Coord3D::from_key<Key>(keys[v]);
+                Coord3D q(c.x + sign * off.x, c.y + sign * off.y, c.z + sign * off.z);
+                qry_keys.emplace_back(q, group < 2 ? survivors + ins_pos[v] : -1);
+                qry_in_idx.push_back(static_cast<int>(v));
+                qry_off_idx.push_back(static_cast<int>(group * num_offsets + o));
+            }
+        }
+    }
+    BasicQueryView<Key> queries(qry_keys, qry_in_idx, qry_off_idx);
+    result.queries = queries.size();
+    KernelMapCSR found = perform_coordinate_lookup(next, queries, tiles_pivots.tiles, tiles_pivots.pivots,
+                                                   g_config.NUM_TILES);
+
+    // New matches per offset as (in, out). A backward hit on an inserted
+    // voxel is the forward hit of that voxel, so it is taken from there.
+    std::vector<std::vector<std::pair<int32_t, int32_t>>> added(num_offsets);
+    for (size_t row = 0; row < found.num_rows(); ++row) {
+        const size_t group = found.offsets[row] / num_offsets, o = found.offsets[row] % num_offsets;
+        for (int64_t m = found.begin[row]; m < found.begin[row + 1]; ++m) {
+            if (group == 0) {
+                added[o].emplace_back(found.in_idx[m], found.out_idx[m]);
+            } else if (group == 1 && found.in_idx[m] < survivors) {
+                added[o].emplace_back(found.out_idx[m], found.in_idx[m]);
+            } // Hits of removed voxels only delete matches, dropped below
+        }
+    }
+
+    // Kernel map rows keep query order: by sorted position of the source
+    std::vector<int64_t> prev_row(num_offsets, -1);
+    for (size_t row = 0; row < prev_kmap.num_rows(); ++row) {
+        if (prev_kmap.offsets[row] >= num_offsets) {
+            throw std::out_of_range("update_kernel_map: offset index " + std::to_string(prev_kmap.offsets[row]) +
+                                    " is out of range for " + std::to_string(num_offsets) + " offsets");
+        }
+        prev_row[prev_kmap.offsets[row]] = static_cast<int64_t>(row);
+    }
+    auto by_rank = [&](const std::pair<int32_t, int32_t>& x, const std::pair<int32_t, int32_t>& y) {
+        return rank[x.second] < rank[y.second];
+    };
+    std::vector<uint32_t> match_off;
+    std::vector<int32_t> match_in, match_out;
+    std::vector<std::pair<int32_t, int32_t>> kept;
+    for (size_t o = 0; o < num_offsets; ++o) {
+        kept.clear();
+        if (prev_row[o] >= 0) {
+            for (int64_t m = prev_kmap.begin[prev_row[o]]; m < prev_kmap.begin[prev_row[o] + 1]; ++m) {
+                const int32_t in = prev_kmap.in_idx[m], out = prev_kmap.out_idx[m];
+                if (in < 0 || out < 0 || static_cast<size_t>(in) >= prev_n || static_cast<size_t>(out) >= prev_n) {
+                    throw std::out_of_range("update_kernel_map: kernel map point index out of range for " +
+                                            std::to_string(prev_n) + " points");
+                }
+                if (result.renumber[in] >= 0 && result.renumber[out] >= 0) {
+                    kept.emplace_back(result.renumber[in], result.renumber[out]);
+                }
+            }
+        }
+        std::sort(added[o].begin(), added[o].end(), by_rank);
+        size_t begin = match_in.size();
+        match_in.resize(begin + kept.size() + added[o].size());
+        match_out.resize(match_in.size());
+        std::vector<std::pair<int32_t, int32_t>> merged(kept.size() + added[o].size());
+        std::merge(kept.begin(), kept.end(), added[o].begin(), added[o].end(), merged.begin(), by_rank);
+        for (size_t m = 0; m < merged.size(); ++m) {
+            match_in[begin + m] = merged[m].first;
+            match_out[begin + m] = merged[m].second;
+        }
+        match_off.resize(match_in.size(), static_cast<uint32_t>(o));
+    }
+    result.kernel_map = build_kernel_map_csr(num_offsets, match_off, match_in, match_out);
+
+    profile.set("queries", static_cast<double>(result.queries));
+    std::cout << "Incremental update: +" << n_ins << " -" << n_rem << " voxels, " << result.queries
+              << " lookups instead of " << next.size() * num_offsets << ", " << result.kernel_map.num_matches()
+              << " matches." << std::endl;
+    return result;
+}
+
+template <typename Key>
+void diff_frame_keys(const std::vector<BasicIndexedCoord<Key>>& prev_uniq, const std::vector<Key>& next_keys,
+                     std::vector<Key>& inserted, std::vector<Key>& removed) {
+    inserted.clear();
+    removed.clear();
+    for (Key key : next_keys) {
+        auto it = std::lower_bound(prev_uniq.begin(), prev_uniq.end(), key, key_below<Key>);
+        if (it == prev_uniq.end() || it->key_val != key) inserted.push_back(key);
+    }
+    std::vector<Key> sorted_next(next_keys);
+    std::sort(sorted_next.begin(), sorted_next.end());
+    for (const auto& coord : prev_uniq) {
+        if (!std::binary_search(sorted_next.begin(), sorted_next.end(), coord.key_val)) {
+            removed.push_back(coord.key_val);
+        }
+    }
+}
+
+template KernelMapUpdate update_kernel_map(const std::vector<IndexedCoord>&, const KernelMapCSR&,
+                                           const std::vector<uint32_t>&, const std::vector<uint32_t>&,
+                                           const std::vector<Coord3D>&);
+template BasicKernelMapUpdate<uint64_t> update_kernel_map(const std::vector<IndexedCoord64>&, const KernelMapCSR&,
+                                                          const std::vector<uint64_t>&, const std::vector<uint64_t>&,
+                                                          const std::vector<Coord3D>&);
+template void diff_frame_keys(const std::vector<IndexedCoord>&, const std::vector<uint32_t>&,
+                              std::vector<uint32_t>&, std::vector<uint32_t>&);
+template void diff_frame_keys(const std::vector<IndexedCoord64>&, const std::vector<uint64_t>&,
+                              std::vector<uint64_t>&, std::vector<uint64_t>&);
@@ -0,0 +1,57 @@
+#include "kernel_map.hpp"
+#include "buffer_pool.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+KernelMapCSR build_kernel_map_csr(size_t num_offsets, const std::vector<uint32_t>& match_off,
+                                  const std::vector<int32_t>& in_idx, const std::vector<int32_t>& out_idx) {
+    if (in_idx.size() != match_off.size() || out_idx.size() != match_off.size()) {
+        throw std::invalid_argument("build_kernel_map_csr: match arrays differ in length");
+    }
+
+    std::vector<int64_t> counts(num_offsets, 0);
+    for (uint32_t off_idx : match_off) {
+        if (off_idx >= num_offsets) {
+            throw std::out_of_range("build_kernel_map_csr: offset index " + std::to_string(off_idx) +
+                                    " is out of range for " + std::to_string(num_offsets) + " offsets");
+        }
+        ++counts[off_idx];
+    }
+
+    KernelMapCSR kmap;
+    for (size_t off_idx = 0; off_idx < num_offsets; ++off_idx) {
+        if (counts[off_idx] > 0) kmap.offsets.push_back(static_cast<uint32_t>(off_idx));
+    }
+    std::sort(kmap.offsets.begin(), kmap.offsets.end(), [&](uint32_t a, uint32_t b) {
+        return counts[a] != counts[b] ? counts[a] > counts[b] : a < b;
+    });
+
+    // Next free position of every offset's row
+    std::vector<int64_t> cursor(num_offsets, 0);
+    kmap.begin.resize(kmap.offsets.size() + 1);
+    for (size_t row = 0; row < kmap.offsets.size(); ++row) {
+        cursor[kmap.offsets[row]] = kmap.begin[row];
+        kmap.begin[row + 1] = kmap.begin[row] + counts[kmap.offsets[row]];
+    }
+
+    BufferPool& buffers = BufferPool::shared();
+    kmap.in_idx = buffers.take<int32_t>(match_off.size());
+    kmap.out_idx = buffers.take<int32_t>(match_off.size());
+    kmap.in_idx.resize(match_off.size());
+    kmap.out_idx.resize(match_off.size());
+    for (size_t i = 0; i < match_off.size(); ++i) {
+        int64_t pos = cursor[match_off[i]]++;
+        kmap.in_idx[pos] = in_idx[i];
+        kmap.out_idx[pos] = out_idx[i];
+    }
+    return kmap;
+}
+
+std::shared_ptr<const KernelMapCSR> share_kernel_map(KernelMapCSR kmap) {
+    return std::shared_ptr<const KernelMapCSR>(new KernelMapCSR(std::move(kmap)), [](const KernelMapCSR* shared) {
+        std::unique_ptr<KernelMapCSR> owned(const_cast<KernelMapCSR*>(shared));
+        BufferPool::shared().give(std::move(owned->in_idx));
+        BufferPool::shared().give(std::move(owned->out_idx));
+    });
+}
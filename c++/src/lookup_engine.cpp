@@ -0,0 +1,268 @@
+#include "lookup_engine.hpp"
+#include "minuet_config.hpp"
+#include "minuet_map.hpp"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+size_t log2_ceil(size_t n) {
+    size_t bits = 0;
+    while ((size_t{1} << bits) < n) ++bits;
+    return bits;
+}
+
+template <bool Trace, Op op, Tensor tensor>
+inline void trace_access(int tid, uint64_t addr) {
+    if constexpr (Trace) record_access<op, tensor>(tid, addr);
+}
+
+// Shared per-query loop: reads the query key, runs `search` (which returns the
+// original index of the matching input or -1) and writes the KM slot of a
+// match. Without tracing, the matches go to match_input instead.
+template <bool Trace, typename Key, typename Search>
+uint64_t for_each_query(const LookupInputs<Key>& in, size_t begin, size_t end, int tid,
+                        int32_t* match_input, uint64_t km_slot, Search&& search) {
+    uint64_t matches = 0;
+    for (size_t q_glob_idx = begin; q_glob_idx < end; ++q_glob_idx) {
+        trace_access<Trace, Op::R, Tensor::QK>(tid, g_config.QK_BASE + q_glob_idx * g_config.SIZE_KEY);
+        int32_t input_idx = search(in.queries.key(q_glob_idx));
+        if constexpr (!Trace) {
+            match_input[q_glob_idx - begin] = input_idx;
+        }
+        if (input_idx >= 0) {
+            trace_access<Trace, Op::W, Tensor::KM>(tid, g_config.KM_BASE + (km_slot + matches) * g_config.SIZE_INT);
+            ++matches;
+        }
+    }
+    return matches;
+}
+
+template <typename Key>
+class PivotLookup : public LookupEngine<Key> {
+public:
+    using LookupEngine<Key>::LookupEngine;
+    using LookupEngine<Key>::in_;
+    const char* name() const override { return "pivot"; }
+
+    size_t entries_per_query() const override {
+        size_t max_tile = 0;
+        for (const auto& tile : in_.tiles) max_tile = std::max(max_tile, tile.size());
+        return 2 + log2_ceil(in_.pivs.size() + 1) + max_tile; // QK, pivot search, tile scan, KM
+    }
+
+    uint64_t find(size_t begin, size_t end, int32_t* match_input) const override {
+        return run<false>(begin, end, 0, match_input, 0);
+    }
+    void trace(size_t begin, size_t end, int tid, uint64_t km_slot) const override {
+        run<true>(begin, end, tid, nullptr, km_slot);
+    }
+
+private:
+    template <bool Trace>
+    uint64_t run(size_t begin, size_t end, int tid, int32_t* match_input, uint64_t km_slot) const {
+        const auto& pivs = in_.pivs;
+        const auto& tiles = in_.tiles;
+        return for_each_query<Trace>(in_, begin, end, tid, match_input, km_slot, [&](Key query_key) {
+            // Python's find_tile_id: binary search on pivs
+            int target_tile_id = -1;
+            if (!pivs.empty()) {
+                int low = 0, high = static_cast<int>(pivs.size()) - 1;
+                target_tile_id = 0;
+                while (low <= high) {
+                    int mid = low + (high - low) / 2;
+                    trace_access<Trace, Op::R, Tensor::PIV>(tid, g_config.PIV_BASE + mid * g_config.SIZE_KEY);
+                    if (pivs[mid].to_key() <= query_key) {
+                        target_tile_id = mid;
+                        low = mid + 1;
+                    } else {
+                        high = mid - 1;
+                    }
+                }
+            }
+            if (target_tile_id == -1 || target_tile_id >= static_cast<int>(tiles.size())) {
+                return -1;
+            }
+
+            // Python's search_in_tile: linear scan, matching its trace
+            const auto& current_tile_vec = tiles[target_tile_id];
+            for (size_t local_idx_in_tile = 0; local_idx_in_tile < current_tile_vec.size(); ++local_idx_in_tile) {
+                size_t approx_tile_element_orig_idx = static_cast<size_t>(target_tile_id * in_.tile_size + local_idx_in_tile);
+                if (approx_tile_element_orig_idx >= in_.uniq_coords.size()) {
+                    approx_tile_element_orig_idx = in_.uniq_coords.size() - 1;
+                }
+                // TILE aliases I_BASE, so tile reads are tagged as I
+                trace_access<Trace, Op::R, Tensor::I>(tid, g_config.TILE_BASE + approx_tile_element_orig_idx * g_config.SIZE_KEY);
+                if (current_tile_vec[local_idx_in_tile].to_key() == query_key) {
+                    return current_tile_vec[local_idx_in_tile].orig_idx;
+                }
+            }
+            return -1;
+        });
+    }
+};
+
+template <typename Key>
+class MergeLookup : public LookupEngine<Key> {
+public:
+    using LookupEngine<Key>::LookupEngine;
+    using LookupEngine<Key>::in_;
+    const char* name() const override { return "merge"; }
+
+    size_t entries_per_query() const override {
+        return 4 + 2 * log2_ceil(in_.uniq_coords.size() + 1); // QK, gallop and search, KM
+    }
+
+    uint64_t find(size_t begin, size_t end, int32_t* match_input) const override {
+        return run<false>(begin, end, 0, match_input, 0);
+    }
+    void trace(size_t begin, size_t end, int tid, uint64_t km_slot) const override {
+        run<true>(begin, end, tid, nullptr, km_slot);
+    }
+
+private:
+    template <bool Trace>
+    uint64_t run(size_t begin, size_t end, int tid, int32_t* match_input, uint64_t km_slot) const {
+        const auto& uniq = in_.uniq_coords;
+        const size_t n = uniq.size();
+        auto key_at = [&](size_t i) {
+            trace_access<Trace, Op::R, Tensor::I>(tid, g_config.I_BASE + i * g_config.SIZE_KEY);
+            return uniq[i].to_key();
+        };
+
+        // Cursor: first input whose key is >= the previous query key
+        size_t cur = 0;
+        Key prev_key = 0;
+        bool positioned = false;
+        return for_each_query<Trace>(in_, begin, end, tid, match_input, km_slot, [&](Key query_key) {
+            // The answer lies in [lo, hi]
+            size_t lo, hi;
+            if (!positioned || query_key < prev_key) {
+                lo = 0;
+                hi = positioned ? cur : n;
+            } else {
+                // Gallop forward: probe cur, cur+1, cur+2, cur+4, ...
+                lo = cur;
+                hi = cur;
+                size_t step = 1;
+                while (hi < n && key_at(hi) < query_key) {
+                    lo = hi + 1;
+                    hi = cur + step;
+                    step <<= 1;
+                }
+                hi = std::min(hi, n);
+            }
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (key_at(mid) < query_key) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            cur = lo;
+            prev_key = query_key;
+            positioned = true;
+            if (cur < n && key_at(cur) == query_key) {
+                return uniq[cur].orig_idx;
+            }
+            return -1;
+        });
+    }
+};
+
+template <typename Key>
+class HashLookup : public LookupEngine<Key> {
+public:
+    using LookupEngine<Key>::LookupEngine;
+    using LookupEngine<Key>::in_;
+    const char* name() const override { return "hash"; }
+
+    size_t entries_per_query() const override { return 6; } // QK, a few probes at load <= 0.5, KM
+
+    void build() override {
+        const auto& uniq = in_.uniq_coords;
+        size_t capacity = 16;
+        bits_ = 4;
+        while (capacity < 2 * uniq.size()) {
+            capacity <<= 1;
+            ++bits_;
+        }
+        mask_ = capacity - 1;
+        slot_keys_.assign(capacity, 0);
+        slot_inputs_.assign(capacity, -1);
+
+        const uint64_t table_bytes = capacity * slot_bytes();
+        if (table_bytes > g_config.HT_SIZE) {
+            std::cerr << "Warning: hash table of " << table_bytes << " bytes exceeds HT_SIZE ("
+                      << g_config.HT_SIZE << "); its accesses spill past the HT region." << std::endl;
+        }
+
+        // Serial build on thread 0: read each input key, probe, claim a slot
+        for (size_t i = 0; i < uniq.size(); ++i) {
+            record_access<Op::R, Tensor::I>(0, g_config.I_BASE + i * g_config.SIZE_KEY);
+            Key key = uniq[i].to_key();
+            size_t slot = home_slot(key);
+            while (true) {
+                record_access<Op::R, Tensor::HT>(0, slot_addr(slot));
+                if (slot_inputs_[slot] < 0) break;
+                slot = (slot + 1) & mask_;
+            }
+            record_access<Op::W, Tensor::HT>(0, slot_addr(slot));
+            slot_keys_[slot] = key;
+            slot_inputs_[slot] = static_cast<int32_t>(i);
+        }
+    }
+
+    uint64_t find(size_t begin, size_t end, int32_t* match_input) const override {
+        return run<false>(begin, end, 0, match_input, 0);
+    }
+    void trace(size_t begin, size_t end, int tid, uint64_t km_slot) const override {
+        run<true>(begin, end, tid, nullptr, km_slot);
+    }
+
+private:
+    uint64_t slot_bytes() const { return g_config.SIZE_KEY + g_config.SIZE_INT; }
+    uint64_t slot_addr(size_t slot) const { return g_config.HT_BASE + slot * slot_bytes(); }
+    size_t home_slot(Key key) const {
+        // Fibonacci hashing
+        if constexpr (sizeof(Key) == 4) {
+            return static_cast<size_t>((key * 2654435761u) >> (32 - bits_));
+        } else {
+            return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits_));
+        }
+    }
+
+    template <bool Trace>
+    uint64_t run(size_t begin, size_t end, int tid, int32_t* match_input, uint64_t km_slot) const {
+        return for_each_query<Trace>(in_, begin, end, tid, match_input, km_slot, [&](Key query_key) {
+            size_t slot = home_slot(query_key);
+            while (true) {
+                trace_access<Trace, Op::R, Tensor::HT>(tid, slot_addr(slot));
+                int32_t input = slot_inputs_[slot];
+                if (input < 0) return -1;
+                if (slot_keys_[slot] == query_key) return in_.uniq_coords[input].orig_idx;
+                slot = (slot + 1) & mask_;
+            }
+        });
+    }
+
+    uint32_t bits_ = 4;
+    size_t mask_ = 0;
+    std::vector<Key> slot_keys_;
+    std::vector<int32_t> slot_inputs_; // Index into uniq_coords, -1 when empty
+};
+
+} // namespace
+
+template <typename Key>
+std::unique_ptr<LookupEngine<Key>> make_lookup_engine(const std::string& name, const LookupInputs<Key>& in) {
+    if (name == "pivot") return std::make_unique<PivotLookup<Key>>(in);
+    if (name == "merge") return std::make_unique<MergeLookup<Key>>(in);
+    if (name == "hash") return std::make_unique<HashLookup<Key>>(in);
+    throw std::invalid_argument("Unknown LOOKUP_ENGINE: '" + name + "' (expected pivot, merge or hash)");
+}
+
+template std::unique_ptr<LookupEngine<uint32_t>> make_lookup_engine(const std::string&, const LookupInputs<uint32_t>&);
+template std::unique_ptr<LookupEngine<uint64_t>> make_lookup_engine(const std::string&, const LookupInputs<uint64_t>&);
@@ -1,20 +1,33 @@
 #include <string>
 #include <algorithm> // For std::transform
 #include <any> // For std::any_cast
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib> // For std::exit
+#include <cstring> // For std::memcpy
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <sstream> // For std::stringstream
 #include <stdexcept>
+#include <thread>
 #include <tuple> // For std::tuple
+#include <unordered_map>
 #include <vector>
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
 #include <zlib.h>
+#include "reuse_distance.hpp"
 #include "sorted_map.hpp"
 #include "trace.hpp"
 #include "ext/argparse.hpp"
+#include "ext/json.hpp"
 
 // It's generally better to have these global maps (PHASES, OPS, TENSORS)
 // accessible if this reader is part of the larger project.
@@ -36,7 +49,7 @@ struct DecodedMemoryAccessEntry {
   std::string op;
   std::string tensor;
   uint64_t addr;
-  uint32_t count; // For aggregated view
+  uint32_t count; // Accesses: aggregated view or coalesced entry
 
   DecodedMemoryAccessEntry(const std::string &p, uint8_t tid,
                            const std::string &o, const std::string &t,
@@ -48,26 +61,111 @@ struct DecodedMemoryAccessEntry {
                                   const DecodedMemoryAccessEntry &entry);
 };
 
+// --reuse: line and LRU cache sizes analyzed per tensor
+struct ReuseOptions {
+  std::vector<uint32_t> line_bytes{64};
+  std::vector<uint64_t> cache_bytes{16 << 10, 64 << 10, 256 << 10, 1 << 20, 4 << 20, 16 << 20};
+  double sample_rate = 1.0; // SHARDS rate, 1 analyzes every line
+  uint32_t partitions = 0;  // Hash partitions per sampled stream; 0: one per thread (1 when exact)
+  std::string json_file;    // Also write the results as JSON
+};
+
+/**
+ * @brief Loads a trace file and prints filtered or aggregated views of it.
+ *
+ * Version 3 files are memory-mapped and decoded block by block; their index
+ * lets a filter skip blocks without the wanted phases or tensors. gzip files
+ * (versions 1 and 2) are decompressed into memory and split into blocks of
+ * the same size. Filters are resolved to integer ids once, blocks are
+ * filtered and aggregated on several threads, and strings are only built for
+ * the printed rows.
+ *
+ * analyze_reuse streams a trace instead, a batch of blocks at a time, and
+ * computes the reuse distances of each tensor (see ReuseDistance) without
+ * keeping the trace in memory. One set of worker threads serves the whole
+ * scan; with SHARDS sampling each tensor's lines are also split into hash
+ * partitions, so the parallelism is not capped by tensors x line sizes.
+ */
 class MemTraceReader {
 public:
+  static constexpr uint32_t BLOCK_ENTRIES = 1 << 16; // Blocks of in-memory traces
+
   MemTraceReader(const bidict<std::string, int> &phases,
                  const bidict<std::string, int> &ops,
                  const bidict<std::string, int> &tensors);
+  ~MemTraceReader();
+  MemTraceReader(const MemTraceReader &) = delete;
+  MemTraceReader &operator=(const MemTraceReader &) = delete;
 
   bool load_trace_file(const std::string &filename, int sizeof_addr = 4);
+  // threads = 0 uses every hardware thread
   void print_trace(const std::string &filter_phase = "",
                    const std::string &filter_op = "",
                    const std::string &filter_tensor = "",
-                   bool aggregate = false, int max_entries = 0);
+                   bool aggregate = false, int max_entries = 0,
+                   int threads = 0);
+
+  // Decodes a memory-mapped trace on first use.
+  const std::vector<MemoryAccessEntry> &get_raw_trace();
 
-  const std::vector<MemoryAccessEntry> &get_raw_trace() const;
+  // Reuse distance histograms and LRU hit rates per tensor and line size of
+  // the entries matching the filters. Returns false if the file cannot be read.
+  bool analyze_reuse(const std::string &filename, int sizeof_addr,
+                     const std::string &filter_phase, const std::string &filter_op,
+                     const std::string &filter_tensor, const ReuseOptions &options,
+                     int threads = 0);
 
 private:
+  using BlockFn = std::function<void(const MemoryAccessEntry *, uint32_t)>;
+
+  struct Block {
+    const uint8_t *payload = nullptr; // Mapped file; nullptr once decoded
+    size_t first = 0;                 // Decoded: first entry in raw_trace_entries
+    uint32_t count = 0;
+    uint64_t phase_mask = ~uint64_t{0};
+    uint64_t tensor_mask = ~uint64_t{0};
+  };
+
+  // Ids accepted by the filter strings, as lookup tables and index masks
+  struct Filter {
+    bool phase[256], op[256], tensor[256];
+    uint64_t phase_mask = 0, tensor_mask = 0;
+  };
+
+  bool load_gz_trace(const std::string &filename, int sizeof_addr);
+  // Decodes the blocks of a gzip trace in order: each into target(count),
+  // which is then passed to consume (if set).
+  bool read_gz_blocks(const std::string &filename, int sizeof_addr,
+                      const std::function<MemoryAccessEntry *(uint32_t)> &target,
+                      const BlockFn &consume) const;
+  // Visits the decoded blocks of any trace file without loading all of it.
+  bool scan_trace_file(const std::string &filename, int sizeof_addr, const BlockFn &fn);
+  bool map_indexed_trace(const std::string &filename);
+  void unmap();
+  void add_decoded_blocks(size_t first, size_t count);
+
+  // Entries of block b; uses `scratch` for mapped blocks
+  const MemoryAccessEntry *block_entries(const Block &block,
+                                         std::vector<MemoryAccessEntry> &scratch) const;
+  Filter make_filter(const std::string &filter_phase, const std::string &filter_op,
+                     const std::string &filter_tensor) const;
+  static std::string id_name(const bidict<std::string, int> &table, uint8_t id,
+                             const char *unknown_prefix);
+
   std::vector<MemoryAccessEntry> raw_trace_entries;
+  std::vector<Block> blocks_;
+  uint64_t total_entries_ = 0;
   const bidict<std::string, int> &PHASES_MAP;
   const bidict<std::string, int> &OPS_MAP;
   const bidict<std::string, int> &TENSORS_MAP;
 
+  // Encoding of mapped blocks
+  bool columnar_ = false;
+  bool counts_ = false;
+  int sizeof_addr_ = 4;
+  void *map_base_ = nullptr;
+  size_t map_size_ = 0;
+
   DecodedMemoryAccessEntry
   decode_entry(const MemoryAccessEntry &raw_entry) const;
 };
@@ -87,50 +185,238 @@ std::ostream &operator<<(std::ostream &os,
   return os;
 }
 
+// Bytes per entry of a payload; coalesced traces add a u32 access count.
+static size_t payload_entry_bytes(int sizeof_addr, bool counts) {
+  return 4 + sizeof_addr + (counts ? sizeof(uint32_t) : 0);
+}
+
+// Decodes `count` version 1 rows or one version 2/3 payload into `out`.
+static void decode_payload(const uint8_t *p, uint32_t count, bool columnar,
+                           int sizeof_addr, bool counts, MemoryAccessEntry *out) {
+  const size_t entry_bytes = payload_entry_bytes(sizeof_addr, counts);
+  uint64_t addr = 0; // Column deltas restart at every block
+  for (uint32_t i = 0; i < count; ++i) {
+    MemoryAccessEntry &entry = out[i];
+    uint64_t value = 0;
+    if (columnar) {
+      entry.phase = p[i];
+      entry.thread_id = p[count + i];
+      entry.op = p[2 * static_cast<size_t>(count) + i];
+      entry.tensor = p[3 * static_cast<size_t>(count) + i];
+      std::memcpy(&value, p + 4 * static_cast<size_t>(count) + i * sizeof_addr, sizeof_addr);
+      addr += value;
+      if (sizeof_addr == 4) addr &= 0xFFFFFFFFULL; // Deltas wrap at the stored width
+      entry.addr = addr;
+      entry.count = 1;
+      if (counts) {
+        std::memcpy(&entry.count, p + (4 + static_cast<size_t>(sizeof_addr)) * count + i * sizeof(uint32_t),
+                    sizeof(uint32_t));
+      }
+    } else {
+      const uint8_t *row = p + i * entry_bytes;
+      entry.phase = row[0];
+      entry.thread_id = row[1];
+      entry.op = row[2];
+      entry.tensor = row[3];
+      std::memcpy(&value, row + 4, sizeof_addr);
+      entry.addr = value;
+      entry.count = 1;
+      if (counts) std::memcpy(&entry.count, row + 4 + sizeof_addr, sizeof(uint32_t));
+    }
+  }
+}
+
+// 1 for an uncompressed version 3 file, 0 for anything else, -1 (after an
+// error message) if the file cannot be opened.
+static int probe_indexed_trace(const std::string &filename) {
+  std::ifstream probe(filename, std::ios::binary);
+  if (!probe) {
+    std::cerr << "Error: Failed to open trace file: " << filename << std::endl;
+    return -1;
+  }
+  uint8_t head[5] = {0};
+  probe.read(reinterpret_cast<char *>(head), sizeof(head));
+  if (probe.gcount() != sizeof(head)) return 0;
+  uint32_t marker;
+  std::memcpy(&marker, head, sizeof(marker));
+  return marker == TRACE_V2_MARKER && head[4] == 3 ? 1 : 0;
+}
+
 // Implementation of MemTraceReader methods
 MemTraceReader::MemTraceReader(const bidict<std::string, int> &phases,
                                const bidict<std::string, int> &ops,
                                const bidict<std::string, int> &tensors)
     : PHASES_MAP(phases), OPS_MAP(ops), TENSORS_MAP(tensors) {}
 
-DecodedMemoryAccessEntry
-MemTraceReader::decode_entry(const MemoryAccessEntry &raw_entry) const {
-  std::string phase_str, op_str, tensor_str;
-  try {
-    phase_str = PHASES_MAP.inverse.at(raw_entry.phase);
-  } catch (const std::out_of_range &) {
-    phase_str = "UNK_PH(" + std::to_string(raw_entry.phase) + ")";
+MemTraceReader::~MemTraceReader() { unmap(); }
+
+void MemTraceReader::unmap() {
+  if (map_base_) {
+    munmap(map_base_, map_size_);
+    map_base_ = nullptr;
+    map_size_ = 0;
   }
-  try {
-    op_str = OPS_MAP.inverse.at(raw_entry.op);
-  } catch (const std::out_of_range &) {
-    op_str = "UNK_OP(" + std::to_string(raw_entry.op) + ")";
+}
+
+std::string MemTraceReader::id_name(const bidict<std::string, int> &table,
+                                    uint8_t id, const char *unknown_prefix) {
+  auto it = table.inverse.find(id);
+  if (it == table.inverse.end()) {
+    return std::string(unknown_prefix) + "(" + std::to_string(id) + ")";
   }
-  try {
-    tensor_str = TENSORS_MAP.inverse.at(raw_entry.tensor);
-  } catch (const std::out_of_range &) {
-    tensor_str = "UNK_TN(" + std::to_string(raw_entry.tensor) + ")";
+  return it->second;
+}
+
+DecodedMemoryAccessEntry
+MemTraceReader::decode_entry(const MemoryAccessEntry &raw_entry) const {
+  return DecodedMemoryAccessEntry(id_name(PHASES_MAP, raw_entry.phase, "UNK_PH"),
+                                  raw_entry.thread_id,
+                                  id_name(OPS_MAP, raw_entry.op, "UNK_OP"),
+                                  id_name(TENSORS_MAP, raw_entry.tensor, "UNK_TN"),
+                                  raw_entry.addr, raw_entry.count);
+}
+
+void MemTraceReader::add_decoded_blocks(size_t first, size_t count) {
+  for (size_t begin = first; begin < first + count; begin += BLOCK_ENTRIES) {
+    Block block;
+    block.first = begin;
+    block.count = static_cast<uint32_t>(std::min<size_t>(BLOCK_ENTRIES, first + count - begin));
+    block.phase_mask = block.tensor_mask = 0;
+    for (size_t i = begin; i < begin + block.count; ++i) {
+      block.phase_mask |= trace_id_bit(raw_trace_entries[i].phase);
+      block.tensor_mask |= trace_id_bit(raw_trace_entries[i].tensor);
+    }
+    blocks_.push_back(block);
   }
-  return DecodedMemoryAccessEntry(phase_str, raw_entry.thread_id, op_str,
-                                  tensor_str, raw_entry.addr);
 }
 
 bool MemTraceReader::load_trace_file(const std::string &filename,
                                      int sizeof_addr /*= 4*/) {
   raw_trace_entries.clear();
-  gzFile inFile = gzopen(filename.c_str(), "rb");
-  if (!inFile) {
-    std::cerr << "Error: Failed to open trace file: " << filename << std::endl;
-    return false;
-  }
+  blocks_.clear();
+  total_entries_ = 0;
+  unmap();
 
   if (sizeof_addr != 4 && sizeof_addr != 8) {
     std::cerr << "Error: sizeof_addr must be 4 or 8, got: " << sizeof_addr
               << std::endl;
-    gzclose(inFile);
     return false;
   }
 
+  // Uncompressed version 3 files are mapped; everything else goes through zlib
+  const int indexed = probe_indexed_trace(filename);
+  if (indexed < 0) return false;
+  return indexed ? map_indexed_trace(filename) : load_gz_trace(filename, sizeof_addr);
+}
+
+bool MemTraceReader::map_indexed_trace(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Error: Failed to open trace file: " << filename << std::endl;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    std::cerr << "Error: Failed to stat trace file: " << filename << std::endl;
+    return false;
+  }
+  map_size_ = static_cast<size_t>(st.st_size);
+  void *base = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    map_size_ = 0;
+    std::cerr << "Error: Failed to map trace file: " << filename << std::endl;
+    return false;
+  }
+  map_base_ = base;
+  const uint8_t *data = static_cast<const uint8_t *>(base);
+  auto fail = [&](const std::string &what) {
+    std::cerr << "Error: " << what << " in " << filename << std::endl;
+    unmap();
+    blocks_.clear();
+    return false;
+  };
+
+  // Header: marker, version, sizeof_addr, flags, reserved
+  if (map_size_ < 8 + 16 || (data[5] != 4 && data[5] != 8)) {
+    return fail("Unsupported trace header");
+  }
+  sizeof_addr_ = data[5];
+  columnar_ = (data[6] & TRACE_FLAG_COLUMNAR) != 0;
+  counts_ = (data[6] & TRACE_FLAG_COUNTS) != 0;
+
+  // Trailer: u64 index offset, u32 block count, u32 magic
+  uint64_t index_offset;
+  uint32_t num_blocks, magic;
+  const uint8_t *trailer = data + map_size_ - 16;
+  std::memcpy(&index_offset, trailer, sizeof(index_offset));
+  std::memcpy(&num_blocks, trailer + 8, sizeof(num_blocks));
+  std::memcpy(&magic, trailer + 12, sizeof(magic));
+  // The fields are untrusted, so every bound is checked by subtraction from
+  // a value already known to be in range, never by an addition that could wrap
+  if (magic != TRACE_INDEX_MAGIC || index_offset < 8 || index_offset > map_size_ - 16 ||
+      num_blocks > (map_size_ - 16 - index_offset) / sizeof(TraceBlockIndex) ||
+      num_blocks * sizeof(TraceBlockIndex) != map_size_ - 16 - index_offset) {
+    return fail("Missing or corrupt block index");
+  }
+
+  const size_t entry_bytes = payload_entry_bytes(sizeof_addr_, counts_);
+  blocks_.reserve(num_blocks);
+  for (uint32_t b = 0; b < num_blocks; ++b) {
+    TraceBlockIndex index;
+    std::memcpy(&index, data + index_offset + b * sizeof(TraceBlockIndex), sizeof(index));
+    uint32_t stored_count = 0;
+    if (index.offset < 8 || index.offset > index_offset - 4 ||
+        index.count > (index_offset - 4 - index.offset) / entry_bytes) {
+      return fail("Block " + std::to_string(b) + " lies outside the data");
+    }
+    std::memcpy(&stored_count, data + index.offset, sizeof(stored_count));
+    if (stored_count != index.count) {
+      return fail("Block " + std::to_string(b) + " does not match its index");
+    }
+    Block block;
+    block.payload = data + index.offset + 4;
+    block.count = index.count;
+    block.phase_mask = index.phase_mask;
+    block.tensor_mask = index.tensor_mask;
+    blocks_.push_back(block);
+    total_entries_ += index.count;
+  }
+
+  std::cout << "Mapped " << total_entries_ << " entries in " << blocks_.size()
+            << " indexed blocks from " << filename << std::endl;
+  return true;
+}
+
+bool MemTraceReader::load_gz_trace(const std::string &filename, int sizeof_addr) {
+  auto target = [&](uint32_t count) {
+    size_t first = raw_trace_entries.size();
+    raw_trace_entries.resize(first + count);
+    return raw_trace_entries.data() + first;
+  };
+  if (!read_gz_blocks(filename, sizeof_addr, target, nullptr)) {
+    raw_trace_entries.clear();
+    return false;
+  }
+
+  total_entries_ = raw_trace_entries.size();
+  add_decoded_blocks(0, raw_trace_entries.size());
+  std::cout << "Successfully loaded " << raw_trace_entries.size()
+            << " entries from " << filename << std::endl;
+  return true;
+}
+
+bool MemTraceReader::read_gz_blocks(const std::string &filename, int sizeof_addr,
+                                    const std::function<MemoryAccessEntry *(uint32_t)> &target,
+                                    const BlockFn &consume) const {
+  gzFile inFile = gzopen(filename.c_str(), "rb");
+  if (!inFile) {
+    std::cerr << "Error: Failed to open trace file: " << filename << std::endl;
+    return false;
+  }
+  gzbuffer(inFile, 1 << 20);
+
   uint32_t num_entries;
   if (gzread(inFile, &num_entries, sizeof(num_entries)) !=
       sizeof(num_entries)) {
@@ -140,137 +426,286 @@ bool MemTraceReader::load_trace_file(const std::string &filename,
     return false;
   }
 
-  raw_trace_entries.reserve(num_entries);
+  // Reads and decodes `count` entries of one block or frame at once.
+  std::vector<uint8_t> payload;
+  uint64_t decoded = 0;
+  auto read_block = [&](uint32_t count, bool columnar, int addr_bytes, bool counts) {
+    payload.resize(static_cast<size_t>(count) * payload_entry_bytes(addr_bytes, counts));
+    if (!payload.empty() &&
+        gzread(inFile, payload.data(), static_cast<unsigned>(payload.size())) !=
+            static_cast<int>(payload.size())) {
+      std::cerr << "Error: Truncated block of " << count << " entries after entry "
+                << decoded << " in " << filename << std::endl;
+      return false;
+    }
+    MemoryAccessEntry *out = target(count);
+    decode_payload(payload.data(), count, columnar, addr_bytes, counts, out);
+    if (consume) consume(out, count);
+    decoded += count;
+    return true;
+  };
 
-  for (uint32_t i = 0; i < num_entries; ++i) {
-    MemoryAccessEntry entry;
-    if (gzread(inFile, &entry.phase, sizeof(entry.phase)) !=
-            sizeof(entry.phase) ||
-        gzread(inFile, &entry.thread_id, sizeof(entry.thread_id)) !=
-            sizeof(entry.thread_id) ||
-        gzread(inFile, &entry.op, sizeof(entry.op)) != sizeof(entry.op) ||
-        gzread(inFile, &entry.tensor, sizeof(entry.tensor)) !=
-            sizeof(entry.tensor)) {
-      std::cerr << "Error: Failed to read entry " << i << " (fields) from "
-                << filename << std::endl;
-      gzclose(inFile);
+  // Reads the u64 total that closes a streamed or version 2 file.
+  auto check_footer = [&]() {
+    uint64_t total_entries = 0;
+    if (gzread(inFile, &total_entries, sizeof(total_entries)) !=
+            sizeof(total_entries) ||
+        total_entries != decoded) {
+      std::cerr << "Error: Trace stream footer of " << filename
+                << " does not match the " << decoded
+                << " entries read" << std::endl;
       return false;
     }
-    if (sizeof_addr == 4) {
-      uint32_t addr32;
-      if (gzread(inFile, &addr32, sizeof(addr32)) != sizeof(addr32)) {
-        std::cerr << "Error: Failed to read 4-byte address for entry " << i
-                  << " from " << filename << std::endl;
-        gzclose(inFile);
-        return false;
-      }
-      entry.addr = addr32;
-    } else { // sizeof_addr == 8
-      uint64_t addr64;
-      if (gzread(inFile, &addr64, sizeof(addr64)) != sizeof(addr64)) {
-        std::cerr << "Error: Failed to read 8-byte address for entry " << i
-                  << " from " << filename << std::endl;
-        gzclose(inFile);
+    return true;
+  };
+
+  // Streamed and block layouts: [count][payload] until a zero count
+  auto read_blocks = [&](bool columnar, int addr_bytes, bool counts) {
+    uint32_t block_count = 0;
+    while (true) {
+      if (gzread(inFile, &block_count, sizeof(block_count)) !=
+          sizeof(block_count)) {
+        std::cerr << "Error: Truncated trace stream in " << filename
+                  << std::endl;
         return false;
       }
-      entry.addr = addr64;
+      if (block_count == 0) return check_footer();
+      if (!read_block(block_count, columnar, addr_bytes, counts)) return false;
     }
-    raw_trace_entries.push_back(entry);
-  }
+  };
 
+  bool ok;
+  if (num_entries == TRACE_V2_MARKER) {
+    // Version 2 (or a compressed version 3, whose index is not needed)
+    uint8_t header[4];
+    if (gzread(inFile, header, sizeof(header)) != sizeof(header) ||
+        (header[0] != 2 && header[0] != 3) || (header[1] != 4 && header[1] != 8)) {
+      std::cerr << "Error: Unsupported trace header in " << filename
+                << std::endl;
+      gzclose(inFile);
+      return false;
+    }
+    if (header[1] != sizeof_addr) {
+      std::cerr << "Warning: " << filename << " stores "
+                << static_cast<int>(header[1]) << "-byte addresses; ignoring "
+                << "sizeof_addr=" << sizeof_addr << std::endl;
+    }
+    ok = read_blocks((header[2] & TRACE_FLAG_COLUMNAR) != 0, header[1],
+                     (header[2] & TRACE_FLAG_COUNTS) != 0);
+  } else if (num_entries != TRACE_STREAM_MARKER) {
+    // Batch layout: the count is known up front
+    ok = true;
+    for (uint32_t done = 0; ok && done < num_entries; done += BLOCK_ENTRIES) {
+      ok = read_block(std::min(BLOCK_ENTRIES, num_entries - done), false, sizeof_addr, false);
+    }
+  } else {
+    ok = read_blocks(false, sizeof_addr, false);
+  }
   gzclose(inFile);
-  std::cout << "Successfully loaded " << raw_trace_entries.size()
-            << " entries from " << filename << std::endl;
+  return ok;
+}
+
+bool MemTraceReader::scan_trace_file(const std::string &filename, int sizeof_addr,
+                                     const BlockFn &fn) {
+  raw_trace_entries.clear();
+  blocks_.clear();
+  total_entries_ = 0;
+  unmap();
+
+  if (sizeof_addr != 4 && sizeof_addr != 8) {
+    std::cerr << "Error: sizeof_addr must be 4 or 8, got: " << sizeof_addr
+              << std::endl;
+    return false;
+  }
+  const int indexed = probe_indexed_trace(filename);
+  if (indexed < 0) return false;
+
+  std::vector<MemoryAccessEntry> scratch;
+  if (!indexed) {
+    auto target = [&](uint32_t count) {
+      scratch.resize(count);
+      return scratch.data();
+    };
+    return read_gz_blocks(filename, sizeof_addr, target, fn);
+  }
+  if (!map_indexed_trace(filename)) return false;
+  for (const Block &block : blocks_) fn(block_entries(block, scratch), block.count);
+  unmap();
+  blocks_.clear();
+  total_entries_ = 0;
   return true;
 }
 
+const MemoryAccessEntry *
+MemTraceReader::block_entries(const Block &block,
+                              std::vector<MemoryAccessEntry> &scratch) const {
+  if (!block.payload) return raw_trace_entries.data() + block.first;
+  scratch.resize(block.count);
+  decode_payload(block.payload, block.count, columnar_, sizeof_addr_, counts_, scratch.data());
+  return scratch.data();
+}
+
+const std::vector<MemoryAccessEntry> &MemTraceReader::get_raw_trace() {
+  if (map_base_ && raw_trace_entries.size() != total_entries_) {
+    raw_trace_entries.resize(total_entries_);
+    size_t first = 0;
+    for (Block &block : blocks_) {
+      decode_payload(block.payload, block.count, columnar_, sizeof_addr_, counts_,
+                     raw_trace_entries.data() + first);
+      block.payload = nullptr;
+      block.first = first;
+      first += block.count;
+    }
+    unmap();
+  }
+  return raw_trace_entries;
+}
+
+MemTraceReader::Filter
+MemTraceReader::make_filter(const std::string &filter_phase,
+                            const std::string &filter_op,
+                            const std::string &filter_tensor) const {
+  auto lower = [](std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return s;
+  };
+  // Case-insensitive substring match against the name of every id
+  auto resolve = [&](const bidict<std::string, int> &table, const char *prefix,
+                     const std::string &pattern, bool *accepted, uint64_t *mask) {
+    const std::string needle = lower(pattern);
+    for (int id = 0; id < 256; ++id) {
+      accepted[id] = pattern.empty() ||
+                     lower(id_name(table, static_cast<uint8_t>(id), prefix)).find(needle) != std::string::npos;
+      if (accepted[id] && mask) *mask |= trace_id_bit(static_cast<uint8_t>(id));
+    }
+  };
+  Filter filter;
+  resolve(PHASES_MAP, "UNK_PH", filter_phase, filter.phase, &filter.phase_mask);
+  resolve(OPS_MAP, "UNK_OP", filter_op, filter.op, nullptr);
+  resolve(TENSORS_MAP, "UNK_TN", filter_tensor, filter.tensor, &filter.tensor_mask);
+  return filter;
+}
+
+namespace {
+
+// Identity of an aggregated row
+struct AggKey {
+  uint64_t addr;
+  uint32_t ids; // phase | tid << 8 | op << 16 | tensor << 24
+
+  bool operator==(const AggKey &other) const { return addr == other.addr && ids == other.ids; }
+  bool operator<(const AggKey &other) const {
+    return ids != other.ids ? ids < other.ids : addr < other.addr;
+  }
+};
+
+struct AggKeyHash {
+  size_t operator()(const AggKey &key) const {
+    return std::hash<uint64_t>()(key.addr * 0x9E3779B97F4A7C15ULL ^ key.ids);
+  }
+};
+
+uint32_t pack_ids(const MemoryAccessEntry &e) {
+  return e.phase | (uint32_t{e.thread_id} << 8) | (uint32_t{e.op} << 16) | (uint32_t{e.tensor} << 24);
+}
+
+MemoryAccessEntry unpack_key(const AggKey &key) {
+  MemoryAccessEntry e;
+  e.phase = key.ids & 0xFF;
+  e.thread_id = (key.ids >> 8) & 0xFF;
+  e.op = (key.ids >> 16) & 0xFF;
+  e.tensor = key.ids >> 24;
+  e.count = 1;
+  e.addr = key.addr;
+  return e;
+}
+
+} // namespace
+
 void MemTraceReader::print_trace(const std::string &filter_phase,
                                  const std::string &filter_op,
                                  const std::string &filter_tensor,
-                                 bool aggregate, int max_entries) {
-  if (raw_trace_entries.empty()) {
+                                 bool aggregate, int max_entries, int threads) {
+  if (total_entries_ == 0) {
     std::cout << "No trace entries loaded." << std::endl;
     return;
   }
 
-  std::string lower_filter_phase = filter_phase;
-  std::transform(lower_filter_phase.begin(), lower_filter_phase.end(),
-                 lower_filter_phase.begin(),
-                 [](unsigned char c) { return std::tolower(c); });
-  std::string lower_filter_op = filter_op;
-  std::transform(lower_filter_op.begin(), lower_filter_op.end(),
-                 lower_filter_op.begin(),
-                 [](unsigned char c) { return std::tolower(c); });
-  std::string lower_filter_tensor = filter_tensor;
-  std::transform(lower_filter_tensor.begin(), lower_filter_tensor.end(),
-                 lower_filter_tensor.begin(),
-                 [](unsigned char c) { return std::tolower(c); });
-
-  std::vector<DecodedMemoryAccessEntry> filtered_decoded_entries;
+  const Filter filter = make_filter(filter_phase, filter_op, filter_tensor);
+  auto accepted = [&](const MemoryAccessEntry &e) {
+    return filter.phase[e.phase] && filter.op[e.op] && filter.tensor[e.tensor];
+  };
+  const size_t keep_per_block = max_entries > 0 ? static_cast<size_t>(max_entries) : SIZE_MAX;
 
-  for (const auto &raw_entry : raw_trace_entries) {
-    DecodedMemoryAccessEntry decoded = decode_entry(raw_entry);
+  // Per block: matching entries (at most keep_per_block) and their total
+  std::vector<std::vector<MemoryAccessEntry>> block_matches(aggregate ? 0 : blocks_.size());
+  std::vector<uint64_t> block_match_count(blocks_.size(), 0);
 
-    std::string current_phase_lower = decoded.phase;
-    std::transform(current_phase_lower.begin(), current_phase_lower.end(),
-                   current_phase_lower.begin(),
-                   [](unsigned char c) { return std::tolower(c); });
-    std::string current_op_lower = decoded.op;
-    std::transform(current_op_lower.begin(), current_op_lower.end(),
-                   current_op_lower.begin(),
-                   [](unsigned char c) { return std::tolower(c); });
-    std::string current_tensor_lower = decoded.tensor;
-    std::transform(current_tensor_lower.begin(), current_tensor_lower.end(),
-                   current_tensor_lower.begin(),
-                   [](unsigned char c) { return std::tolower(c); });
+  size_t num_workers = threads > 0 ? static_cast<size_t>(threads)
+                                   : std::max(1u, std::thread::hardware_concurrency());
+  num_workers = std::max<size_t>(1, std::min(num_workers, blocks_.size()));
+  std::vector<std::unordered_map<AggKey, uint32_t, AggKeyHash>> worker_counts(aggregate ? num_workers : 0);
+  std::atomic<size_t> next_block{0};
 
-    if (!filter_phase.empty() &&
-        current_phase_lower.find(lower_filter_phase) == std::string::npos)
-      continue;
-    if (!filter_op.empty() &&
-        current_op_lower.find(lower_filter_op) == std::string::npos)
-      continue;
-    if (!filter_tensor.empty() &&
-        current_tensor_lower.find(lower_filter_tensor) == std::string::npos)
-      continue;
+  auto work = [&](size_t worker) {
+    std::vector<MemoryAccessEntry> scratch;
+    for (size_t b = next_block++; b < blocks_.size(); b = next_block++) {
+      const Block &block = blocks_[b];
+      if (!(block.phase_mask & filter.phase_mask) || !(block.tensor_mask & filter.tensor_mask)) {
+        continue; // The index rules the whole block out
+      }
+      const MemoryAccessEntry *entries = block_entries(block, scratch);
+      uint64_t matches = 0;
+      for (uint32_t i = 0; i < block.count; ++i) {
+        const MemoryAccessEntry &e = entries[i];
+        if (!accepted(e)) continue;
+        ++matches;
+        if (aggregate) {
+          worker_counts[worker][AggKey{e.addr, pack_ids(e)}] += e.count; // Coalesced entries count every access
+        } else if (block_matches[b].size() < keep_per_block) {
+          block_matches[b].push_back(e);
+        }
+      }
+      block_match_count[b] = matches;
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t w = 1; w < num_workers; ++w) workers.emplace_back(work, w);
+  work(0);
+  for (auto &worker : workers) worker.join();
 
-    filtered_decoded_entries.push_back(decoded);
-  }
+  uint64_t total_matches = 0;
+  for (uint64_t n : block_match_count) total_matches += n;
 
   if (aggregate) {
-    if (filtered_decoded_entries.empty()) {
+    if (total_matches == 0) {
       std::cout << "No entries match filter criteria for aggregation."
                 << std::endl;
       return;
     }
-    std::map<
-        std::tuple<std::string, uint8_t, std::string, std::string, uint64_t>,
-        uint32_t>
-        aggregated_counts;
-    for (const auto &entry : filtered_decoded_entries) {
-      aggregated_counts[{entry.phase, entry.thread_id, entry.op, entry.tensor,
-                         entry.addr}]++;
+    auto &aggregated_counts = worker_counts[0];
+    for (size_t w = 1; w < worker_counts.size(); ++w) {
+      for (const auto &pair : worker_counts[w]) aggregated_counts[pair.first] += pair.second;
+      worker_counts[w].clear();
     }
 
-    std::vector<DecodedMemoryAccessEntry> final_aggregated_list;
-    for (const auto &pair : aggregated_counts) {
-      final_aggregated_list.emplace_back(
-          std::get<0>(pair.first), std::get<1>(pair.first),
-          std::get<2>(pair.first), std::get<3>(pair.first),
-          std::get<4>(pair.first), pair.second);
-    }
+    std::vector<std::pair<AggKey, uint32_t>> final_aggregated_list(aggregated_counts.begin(),
+                                                                   aggregated_counts.end());
     std::sort(final_aggregated_list.begin(), final_aggregated_list.end(),
-              [](const DecodedMemoryAccessEntry &a,
-                 const DecodedMemoryAccessEntry &b) {
-                return a.count > b.count; // Sort by count descending
+              [](const auto &a, const auto &b) {
+                if (a.second != b.second) return a.second > b.second; // Sort by count descending
+                return a.first < b.first;
               });
 
-    int count = 0;
-    for (const auto &entry : final_aggregated_list) {
+    size_t count = 0;
+    for (const auto &pair : final_aggregated_list) {
+      DecodedMemoryAccessEntry entry = decode_entry(unpack_key(pair.first));
+      entry.count = pair.second;
       std::cout << entry << std::endl;
       count++;
-      if (max_entries > 0 && count >= max_entries) {
-        if (final_aggregated_list.size() - count > 0) {
+      if (max_entries > 0 && count >= static_cast<size_t>(max_entries)) {
+        if (final_aggregated_list.size() > count) {
           std::cout << "... and " << (final_aggregated_list.size() - count)
                     << " more aggregated entries." << std::endl;
         }
@@ -281,24 +716,276 @@ void MemTraceReader::print_trace(const std::string &filter_phase,
               << std::endl;
 
   } else {
-    int count = 0;
-    for (const auto &entry : filtered_decoded_entries) {
-      std::cout << entry << std::endl;
-      count++;
-      if (max_entries > 0 && count >= max_entries) {
-        if (filtered_decoded_entries.size() - count > 0) {
-          std::cout << "... and " << (filtered_decoded_entries.size() - count)
-                    << " more entries." << std::endl;
-        }
-        break;
+    uint64_t count = 0;
+    for (const auto &matches : block_matches) {
+      for (const auto &raw_entry : matches) {
+        if (max_entries > 0 && count >= static_cast<uint64_t>(max_entries)) break;
+        std::cout << decode_entry(raw_entry) << std::endl;
+        count++;
       }
     }
+    if (total_matches > count) {
+      std::cout << "... and " << (total_matches - count)
+                << " more entries." << std::endl;
+    }
     std::cout << "Total entries printed: " << count << std::endl;
   }
 }
 
-const std::vector<MemoryAccessEntry> &MemTraceReader::get_raw_trace() const {
-  return raw_trace_entries;
+namespace {
+
+// 16384 -> "16 KB"
+std::string format_bytes(uint64_t bytes) {
+  if (bytes >= (1u << 30) && bytes % (1u << 30) == 0) return std::to_string(bytes >> 30) + " GB";
+  if (bytes >= (1u << 20) && bytes % (1u << 20) == 0) return std::to_string(bytes >> 20) + " MB";
+  if (bytes >= (1u << 10) && bytes % (1u << 10) == 0) return std::to_string(bytes >> 10) + " KB";
+  return std::to_string(bytes) + " B";
+}
+
+// Distances of ReuseDistance::histogram() bucket b, e.g. "4-7"
+std::string bucket_label(size_t b) {
+  if (b == 0) return "0";
+  const uint64_t lo = uint64_t{1} << (b - 1), hi = (uint64_t{1} << b) - 1;
+  return lo == hi ? std::to_string(lo) : std::to_string(lo) + "-" + std::to_string(hi);
+}
+
+// Worker threads kept for a whole scan. run() spreads tasks [0, n) over them
+// and the calling thread, and returns once every task is done.
+class ScanWorkers {
+public:
+  explicit ScanWorkers(size_t num_threads) { // Including the caller
+    for (size_t t = 1; t < num_threads; ++t) threads_.emplace_back(&ScanWorkers::loop, this);
+  }
+  ~ScanWorkers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    start_cv_.notify_all();
+    for (auto &thread : threads_) thread.join();
+  }
+  ScanWorkers(const ScanWorkers &) = delete;
+  ScanWorkers &operator=(const ScanWorkers &) = delete;
+
+  size_t size() const { return threads_.size() + 1; }
+
+  void run(size_t num_tasks, const std::function<void(size_t)> &fn) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      fn_ = &fn;
+      num_tasks_ = num_tasks;
+      next_task_ = 0;
+      running_ = threads_.size();
+      ++generation_;
+    }
+    start_cv_.notify_all();
+    work();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&] { return running_ == 0; });
+  }
+
+private:
+  void loop() {
+    uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_cv_.wait(lock, [&] { return generation_ != seen || stopping_; });
+        if (stopping_) return;
+        seen = generation_;
+      }
+      work();
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--running_ == 0) done_cv_.notify_all();
+    }
+  }
+
+  void work() {
+    for (size_t task = next_task_++; task < num_tasks_; task = next_task_++) (*fn_)(task);
+  }
+
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_, done_cv_;
+  const std::function<void(size_t)> *fn_ = nullptr;
+  size_t num_tasks_ = 0;
+  std::atomic<size_t> next_task_{0};
+  uint64_t generation_ = 0;
+  size_t running_ = 0;
+  bool stopping_ = false;
+};
+
+} // namespace
+
+bool MemTraceReader::analyze_reuse(const std::string &filename, int sizeof_addr,
+                                   const std::string &filter_phase,
+                                   const std::string &filter_op,
+                                   const std::string &filter_tensor,
+                                   const ReuseOptions &options, int threads) {
+  // Entries buffered before the analyzers run over them in parallel
+  constexpr size_t REUSE_BATCH = 16 * static_cast<size_t>(BLOCK_ENTRIES);
+
+  const Filter filter = make_filter(filter_phase, filter_op, filter_tensor);
+  ScanWorkers workers(threads > 0 ? static_cast<size_t>(threads)
+                                  : std::max(1u, std::thread::hardware_concurrency()));
+  const bool sampled = options.sample_rate < 1.0;
+  const uint32_t partitions =
+      !sampled ? 1 : options.partitions > 0 ? options.partitions : static_cast<uint32_t>(workers.size());
+  const size_t num_lines = options.line_bytes.size();
+
+  // Per tensor id, once the tensor shows up: partitions x line sizes
+  // analyzers, indexed [line * partitions + partition]. Each analyzer sees
+  // the accesses of its lines in trace order and is independent of the
+  // others, so one task runs per analyzer.
+  std::vector<std::vector<ReuseDistance>> analyzers(256);
+  std::vector<uint8_t> tensors; // Ids with analyzers, in order of appearance
+  std::vector<int> tensor_slot(256, -1);
+  std::vector<MemoryAccessEntry> batch;
+  batch.reserve(REUSE_BATCH);
+
+  // The batch is split into chunks; a chunk's sampled accesses are sorted
+  // into one list per analyzer, in trace order, so the analyzer tasks only
+  // read their own accesses. Indexed [chunk][slot * analyzers per tensor + analyzer].
+  struct LineAccess {
+    uint64_t line;
+    uint32_t count;
+  };
+  const size_t num_chunks = workers.size();
+  const size_t per_tensor = num_lines * partitions;
+  std::vector<std::vector<std::vector<LineAccess>>> buckets(num_chunks);
+
+  auto analyze_batch = [&]() {
+    for (const MemoryAccessEntry &e : batch) {
+      if (tensor_slot[e.tensor] >= 0) continue;
+      tensor_slot[e.tensor] = static_cast<int>(tensors.size());
+      tensors.push_back(e.tensor);
+      for (uint32_t line : options.line_bytes) {
+        for (uint32_t p = 0; p < partitions; ++p) {
+          analyzers[e.tensor].emplace_back(line, options.cache_bytes, options.sample_rate, partitions, p);
+        }
+      }
+    }
+    const size_t num_tasks = tensors.size() * per_tensor;
+
+    workers.run(num_chunks, [&](size_t chunk) {
+      std::vector<std::vector<LineAccess>> &lists = buckets[chunk];
+      lists.resize(num_tasks);
+      for (auto &list : lists) list.clear();
+      const size_t begin = batch.size() * chunk / num_chunks, end = batch.size() * (chunk + 1) / num_chunks;
+      for (size_t i = begin; i < end; ++i) {
+        const MemoryAccessEntry &e = batch[i];
+        const size_t base = tensor_slot[e.tensor] * per_tensor;
+        const std::vector<ReuseDistance> &tensor_analyzers = analyzers[e.tensor];
+        for (size_t l = 0; l < num_lines; ++l) {
+          const ReuseDistance &first = tensor_analyzers[l * partitions];
+          const uint64_t line = first.line_of(e.addr);
+          const uint32_t p = first.partition_of(line);
+          if (p < partitions) lists[base + l * partitions + p].push_back({line, e.count});
+        }
+      }
+    });
+    workers.run(num_tasks, [&](size_t task) {
+      ReuseDistance &analyzer = analyzers[tensors[task / per_tensor]][task % per_tensor];
+      for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
+        for (const LineAccess &access : buckets[chunk][task]) analyzer.access_line(access.line, access.count);
+      }
+    });
+    batch.clear();
+  };
+
+  uint64_t scanned = 0;
+  bool ok = scan_trace_file(filename, sizeof_addr, [&](const MemoryAccessEntry *entries, uint32_t count) {
+    scanned += count;
+    for (uint32_t i = 0; i < count; ++i) {
+      const MemoryAccessEntry &e = entries[i];
+      if (!filter.phase[e.phase] || !filter.op[e.op] || !filter.tensor[e.tensor]) continue;
+      batch.push_back(e);
+      if (batch.size() == REUSE_BATCH) analyze_batch();
+    }
+  });
+  if (!ok) return false;
+  analyze_batch();
+
+  // Fold the partitions of each stream into its first analyzer
+  for (uint8_t t : tensors) {
+    for (size_t l = 0; l < num_lines; ++l) {
+      for (uint32_t p = 1; p < partitions; ++p) {
+        analyzers[t][l * partitions].merge(analyzers[t][l * partitions + p]);
+      }
+    }
+  }
+
+  std::cout << "Scanned " << scanned << " entries from " << filename << std::endl;
+  const double scale = 1.0 / options.sample_rate; // Sampled counts -> estimates
+  if (sampled) {
+    std::cout << "SHARDS sampling at rate " << options.sample_rate << " in " << partitions
+              << " partitions; counts are estimates" << std::endl;
+  }
+
+  nlohmann::json results = nlohmann::json::array();
+  bool any = false;
+  for (int t = 0; t < 256; ++t) {
+    for (size_t l = 0; l < analyzers[t].size(); l += partitions) {
+      const ReuseDistance &analyzer = analyzers[t][l];
+      any = true;
+      const std::string tensor = id_name(TENSORS_MAP, static_cast<uint8_t>(t), "UNK_TN");
+      const double accesses = analyzer.accesses() * scale;
+      const double lines = analyzer.lines() * scale;
+      std::cout << "\n--- Tensor " << tensor << ", " << analyzer.line_bytes()
+                << "-byte lines ---" << std::endl;
+      std::cout << std::fixed << std::setprecision(0) << "Accesses: " << accesses
+                << "  Lines (cold misses): " << lines << std::endl;
+
+      std::cout << std::left << std::setw(18) << "Distance" << "Accesses" << std::endl;
+      const std::vector<uint64_t> &histogram = analyzer.histogram();
+      nlohmann::json json_histogram = nlohmann::json::array();
+      for (size_t b = 0; b < histogram.size(); ++b) {
+        if (histogram[b] == 0) continue;
+        std::cout << std::setw(18) << bucket_label(b) << histogram[b] * scale << std::endl;
+        const uint64_t lo = b == 0 ? 0 : uint64_t{1} << (b - 1);
+        const uint64_t hi = b == 0 ? 0 : (uint64_t{1} << b) - 1;
+        json_histogram.push_back({{"min", lo}, {"max", hi}, {"accesses", histogram[b] * scale}});
+      }
+      std::cout << std::setw(18) << "cold" << lines << std::endl;
+
+      std::cout << std::setw(18) << "LRU size" << "Hit rate" << std::endl;
+      const std::vector<uint64_t> hits = analyzer.hits();
+      nlohmann::json json_hits = nlohmann::json::array();
+      for (size_t c = 0; c < hits.size(); ++c) {
+        const double rate = analyzer.accesses() ? static_cast<double>(hits[c]) / analyzer.accesses() : 0.0;
+        std::cout << std::setw(18) << format_bytes(analyzer.cache_bytes()[c]) << std::setprecision(2)
+                  << rate * 100 << "%" << std::setprecision(0) << std::endl;
+        json_hits.push_back({{"cache_bytes", analyzer.cache_bytes()[c]}, {"hit_rate", rate}});
+      }
+      std::cout << std::defaultfloat << std::right;
+
+      results.push_back({{"tensor", tensor},
+                         {"line_bytes", analyzer.line_bytes()},
+                         {"accesses", accesses},
+                         {"lines", lines},
+                         {"histogram", json_histogram},
+                         {"lru", json_hits}});
+    }
+  }
+  if (!any) {
+    std::cout << "No entries match filter criteria for reuse analysis." << std::endl;
+  }
+
+  if (!options.json_file.empty()) {
+    std::ofstream out(options.json_file);
+    out << nlohmann::json{{"trace_file", filename},
+                          {"sample_rate", options.sample_rate},
+                          {"partitions", partitions},
+                          {"tensors", results}}
+               .dump(2)
+        << std::endl;
+    if (!out) {
+      std::cerr << "Error: Failed to write " << options.json_file << std::endl;
+      return false;
+    }
+    std::cout << "Reuse results written to " << options.json_file << std::endl;
+  }
+  return true;
 }
 
 // Example main for testing the reader (compile separately or include in a test
@@ -335,6 +1022,35 @@ int main(int argc, char *argv[]) {
     .help("Maximum number of trace entries to print (0 for all)")
     .default_value("0");
 
+  program.add_argument("--threads")
+    .help("Threads that filter and aggregate blocks (0 for all hardware threads)")
+    .default_value("0");
+
+  program.add_argument("--reuse")
+    .help("Report reuse distances and LRU hit rates per tensor instead of entries")
+    .default_value(false)
+    .implicit_value(true);
+
+  program.add_argument("--line-sizes")
+    .help("Comma-separated cache line sizes in bytes for --reuse")
+    .default_value(std::string("64"));
+
+  program.add_argument("--cache-sizes")
+    .help("Comma-separated LRU capacities for --reuse (K, M, G suffixes)")
+    .default_value(std::string("16K,64K,256K,1M,4M,16M"));
+
+  program.add_argument("--shards-rate")
+    .help("Fraction of lines sampled by --reuse (1 for exact distances)")
+    .default_value(std::string("1.0"));
+
+  program.add_argument("--reuse-partitions")
+    .help("Hash partitions per tensor and line size analyzed in parallel with --shards-rate below 1 (0: one per thread)")
+    .default_value(std::string("0"));
+
+  program.add_argument("--reuse-json")
+    .help("Also write the --reuse results to this JSON file")
+    .default_value(std::string(""));
+
   try {
     program.parse_args(argc, argv);
   } catch (const std::runtime_error& err) {
@@ -349,6 +1065,7 @@ int main(int argc, char *argv[]) {
   std::string filter_tensor = program.get<std::string>("--filter-tensor");
   bool aggregate = program.get<bool>("--aggregate");
   int max_entries = std::stoi(program.get<std::string>("--max-entries"));
+  int threads = std::stoi(program.get<std::string>("--threads"));
 
   // For true standalone compilation, define PHASES, OPS, TENSORS locally.
   // These definitions should match those in minuet_trace.cpp
@@ -359,7 +1076,8 @@ int main(int argc, char *argv[]) {
                                    {"PVT", 3},
                                    {"LKP", 4},
                                    {"GTH", 5},
-                                   {"SCT", 6}});
+                                   {"SCT", 6},
+                                   {"UPD", 7}});
 
   bidict<std::string, int> TENSORS({
       {"I", 0},
@@ -373,6 +1091,7 @@ int main(int argc, char *argv[]) {
       {"IV", 8},       // IV_BASE is not in TENSORS, handled as string
       {"GM", 9},       // GM_BASE is not in TENSORS, handled as string
       {"WV", 10},      // WV_BASE is not in TENSORS, handled as string
+      {"HT", 11},      // Lookup hash table
       {"Unknown", 255} // Default case for unknown tensors
   });
 
@@ -392,12 +1111,56 @@ int main(int argc, char *argv[]) {
   // Using local maps for this standalone example:
   MemTraceReader reader(PHASES, OPS, TENSORS);
 
+  if (program.get<bool>("--reuse")) {
+    // "16K,1M" -> {16384, 1048576}
+    auto parse_sizes = [](const std::string &list) {
+      std::vector<uint64_t> sizes;
+      std::stringstream ss(list);
+      for (std::string item; std::getline(ss, item, ',');) {
+        size_t end = 0;
+        uint64_t value = std::stoull(item, &end);
+        const std::string suffix = item.substr(end);
+        if (suffix == "K" || suffix == "k") value <<= 10;
+        else if (suffix == "M" || suffix == "m") value <<= 20;
+        else if (suffix == "G" || suffix == "g") value <<= 30;
+        else if (!suffix.empty()) throw std::invalid_argument("Bad size '" + item + "'");
+        sizes.push_back(value);
+      }
+      return sizes;
+    };
+    ReuseOptions options;
+    try {
+      options.line_bytes.clear();
+      for (uint64_t line : parse_sizes(program.get<std::string>("--line-sizes"))) {
+        options.line_bytes.push_back(static_cast<uint32_t>(line));
+      }
+      options.cache_bytes = parse_sizes(program.get<std::string>("--cache-sizes"));
+      options.sample_rate = std::stod(program.get<std::string>("--shards-rate"));
+      options.partitions = static_cast<uint32_t>(std::stoul(program.get<std::string>("--reuse-partitions")));
+      options.json_file = program.get<std::string>("--reuse-json");
+      if (options.partitions > 1 && options.sample_rate >= 1.0) {
+        throw std::invalid_argument("--reuse-partitions needs --shards-rate below 1");
+      }
+      // Rejects bad line sizes and rates before the trace is read
+      for (uint32_t line : options.line_bytes) {
+        ReuseDistance(line, options.cache_bytes, options.sample_rate, std::max(1u, options.partitions));
+      }
+    } catch (const std::exception &err) {
+      std::cerr << "Error: " << err.what() << std::endl;
+      return 1;
+    }
+    return reader.analyze_reuse(trace_file, sizeof_addr, filter_phase, filter_op,
+                                filter_tensor, options, threads)
+               ? 0
+               : 1;
+  }
+
   if (!reader.load_trace_file(trace_file, sizeof_addr)) {
     return 1;
   }
 
   reader.print_trace(filter_phase, filter_op, filter_tensor, aggregate,
-                     max_entries);
+                     max_entries, threads);
 
   return 0;
 }
@@ -1,24 +1,35 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <pybind11/numpy.h> // Buffer views of traces, masks and kernel maps
 #include <pybind11/operators.h> // For operator overloading
 #include "minuet_map.hpp"     // Your main header
 #include "minuet_config.hpp"    // Include the config header for g_config
 #include "minuet_gather.hpp"    // Include the gather header
+#include "point_cloud.hpp"      // Native frame loaders
+#include "incremental_map.hpp"  // Incremental kernel map updates
 
 namespace py = pybind11;
 
-// Helper to bind KernelMapType (SortedByValueSizeMap) to a Python dict-like object
-// This allows Python to treat it somewhat like a dictionary, though true
-// dict behavior (e.g., direct item assignment from Python) is complex to replicate fully.
-// For now, we expose it as an opaque type or provide specific accessors.
-// Since pybind11/stl.h handles std::map well, and our SortedByValueSizeMap wraps one,
-// we might not need a custom binding if we just expose its contents or specific methods.
-// However, if we want Python to see it as a dict sorted by value size, that's more involved.
+// KernelMapType (KernelMapCSR) is bound as a Python "KernelMap" class. Its
+// CSR arrays are exposed as read-only NumPy views, plus dict-like accessors
+// that build Python lists on demand.
+
+// Read-only NumPy view of `vec`. Nothing is copied: the array keeps `owner`,
+// the Python object that holds vec, alive.
+template <typename T>
+py::array_t<T> vector_view(const std::vector<T>& vec, py::handle owner) {
+    py::array_t<T> arr({static_cast<py::ssize_t>(vec.size())}, {static_cast<py::ssize_t>(sizeof(T))},
+                       vec.data(), owner);
+    arr.attr("setflags")(py::arg("write") = false);
+    return arr;
+}
 
-// For now, let KernelMapType be handled by pybind11's default STL conversions
-// where possible, or expose specific methods like get_sorted_items().
-// If direct dict-like access is needed from Python, a custom type caster
-// or a wrapper class in C++ exposed to Python would be required.
+// Python's TilesPivotsResult: the tiles are copied into lists, since the
+// C++ spans point into the uniq_coords converted for the call
+struct PyTilesPivotsResult {
+    std::vector<std::vector<IndexedCoord>> tiles;
+    std::vector<IndexedCoord> pivots;
+};
 
 PYBIND11_MODULE(minuet_cpp_module, m) {
     m.doc() = "Pybind11 bindings for Minuet C++ trace and mapping functions";
@@ -30,9 +41,12 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
         .def_readwrite("y", &Coord3D::y)
         .def_readwrite("z", &Coord3D::z)
         .def("quantized", &Coord3D::quantized, py::arg("stride"))
-        .def("to_key", &Coord3D::to_key)
-        .def_static("from_key", &Coord3D::from_key, py::arg("key"))
-        .def_static("from_signed_key", &Coord3D::from_signed_key, py::arg("key"))
+        .def("to_key", &Coord3D::to_key<uint32_t>)
+        .def_static("from_key", &Coord3D::from_key<uint32_t>, py::arg("key"))
+        .def_static("from_signed_key", &Coord3D::from_signed_key<uint32_t>, py::arg("key"))
+        .def("to_key64", &Coord3D::to_key<uint64_t>)
+        .def_static("from_key64", &Coord3D::from_key<uint64_t>, py::arg("key"))
+        .def_static("from_signed_key64", &Coord3D::from_signed_key<uint64_t>, py::arg("key"))
         .def(py::self + py::self)
         .def("__repr__", [](const Coord3D &c) {
             return "<Coord3D (" + std::to_string(c.x) + ", " + std::to_string(c.y) + ", " + std::to_string(c.z) + ")>";
@@ -58,11 +72,12 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
 
     // Bind MemoryAccessEntry
     py::class_<MemoryAccessEntry>(m, "MemoryAccessEntry")
-        .def(py::init<>())
+        .def(py::init([]() { return MemoryAccessEntry{0, 0, 0, 0, 1, 0}; }))
         .def_readwrite("phase", &MemoryAccessEntry::phase)
         .def_readwrite("thread_id", &MemoryAccessEntry::thread_id)
         .def_readwrite("op", &MemoryAccessEntry::op)
         .def_readwrite("tensor", &MemoryAccessEntry::tensor)
+        .def_readwrite("count", &MemoryAccessEntry::count)
         .def_readwrite("addr", &MemoryAccessEntry::addr)
         .def("__repr__", [](const MemoryAccessEntry &e) {
             std::stringstream ss;
@@ -70,10 +85,14 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
                << ", tid=" << e.thread_id
                << ", op=" << e.op
                << ", tensor=" << e.tensor
+               << ", count=" << e.count
                << ", addr=0x" << std::hex << e.addr << ">";
             return ss.str();
         });
 
+    // Structured dtype matching MemoryAccessEntry (16 bytes, count at offset 4, addr at 8)
+    PYBIND11_NUMPY_DTYPE(MemoryAccessEntry, phase, thread_id, op, tensor, count, addr);
+
     // Bind BuildQueriesResult
     py::class_<BuildQueriesResult>(m, "BuildQueriesResult")
         .def(py::init<>())
@@ -83,70 +102,73 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
         .def_readwrite("wt_offsets", &BuildQueriesResult::wt_offsets);
 
     // Bind TilesPivotsResult
-    py::class_<TilesPivotsResult>(m, "TilesPivotsResult")
+    py::class_<PyTilesPivotsResult>(m, "TilesPivotsResult")
         .def(py::init<>())
-        .def_readwrite("tiles", &TilesPivotsResult::tiles)
-        .def_readwrite("pivots", &TilesPivotsResult::pivots);
-
-    // Bind KernelMapType (SortedByValueSizeMap<uint32_t, std::vector<std::pair<int, int>>>)
-    // Expose it as an opaque type for now, or bind specific methods if needed.
-    // py::bind_map<KernelMapType>(m, "KernelMap"); // This won't work directly for custom types
-    // Instead, let's expose it as a class and bind methods to access its data if Python needs to inspect it.
-    // For functions that return KernelMapType, pybind11 will try to convert if possible.
-    // If it's just passed around, it might work as an opaque type.
-    // Given its usage, Python side likely needs to iterate it or look up items.
-    // A simple way is to provide a method that converts it to a Python dictionary.
-    py::class_<KernelMapType>(m, "KernelMap") // Keep Python name "KernelMap" for consistency
-        .def(py::init<bool>(), py::arg("ascending") = true)
-        .def("get_sorted_items", [](const KernelMapType &kmap) {
+        .def_readwrite("tiles", &PyTilesPivotsResult::tiles)
+        .def_readwrite("pivots", &PyTilesPivotsResult::pivots);
+
+    // Bind KernelMapType (KernelMapCSR). Row r holds the matches of offsets[r]:
+    // in_idx/out_idx[begin[r]:begin[r + 1]], rows in descending match count.
+    py::class_<KernelMapCSR>(m, "KernelMap") // Keep Python name "KernelMap" for consistency
+        .def(py::init<>())
+        .def_property_readonly("offsets", [](py::object self) {
+            return vector_view(self.cast<const KernelMapCSR&>().offsets, self);
+        })
+        .def_property_readonly("begin", [](py::object self) {
+            return vector_view(self.cast<const KernelMapCSR&>().begin, self);
+        })
+        .def_property_readonly("in_idx", [](py::object self) {
+            return vector_view(self.cast<const KernelMapCSR&>().in_idx, self);
+        })
+        .def_property_readonly("out_idx", [](py::object self) {
+            return vector_view(self.cast<const KernelMapCSR&>().out_idx, self);
+        })
+        .def("num_matches", &KernelMapCSR::num_matches)
+        .def("get_sorted_items", [](const KernelMapCSR &kmap) {
             // Convert to a Python list of tuples (key, value_list_of_pairs)
             py::list items;
-            auto sorted_cpp_items = kmap.get_sorted_items();
-            for (const auto& cpp_item : sorted_cpp_items) {
-                // cpp_item is std::pair<const uint32_t, std::vector<std::pair<int, int>>>
+            for (size_t row = 0; row < kmap.num_rows(); ++row) {
                 py::list val_list;
-                for (const auto& p : cpp_item.second) {
-                    val_list.append(py::make_tuple(p.first, p.second));
+                for (int64_t i = kmap.begin[row]; i < kmap.begin[row + 1]; ++i) {
+                    val_list.append(py::make_tuple(kmap.in_idx[i], kmap.out_idx[i]));
                 }
-                items.append(py::make_tuple(cpp_item.first, val_list));
+                items.append(py::make_tuple(kmap.offsets[row], val_list));
             }
             return items;
         })
-        .def("__getitem__", [](const KernelMapType &kmap, uint32_t key) {
+        .def("__getitem__", [](const KernelMapCSR &kmap, uint32_t key) {
             // This provides kmap[key] access from Python (read-only)
-            try {
-                const auto& val_vec = kmap.at(key);
-                py::list val_list;
-                for (const auto& p : val_vec) {
-                    val_list.append(py::make_tuple(p.first, p.second));
-                }
-                return val_list;
-            } catch (const std::out_of_range& e) {
+            int row = kmap.find_row(key);
+            if (row < 0) {
                 throw py::key_error("key not found");
             }
+            py::list val_list;
+            for (int64_t i = kmap.begin[row]; i < kmap.begin[row + 1]; ++i) {
+                val_list.append(py::make_tuple(kmap.in_idx[i], kmap.out_idx[i]));
+            }
+            return val_list;
         })
-        .def("__contains__", [](const KernelMapType &kmap, uint32_t key) {
-            return kmap.count(key) > 0;
+        .def("__contains__", [](const KernelMapCSR &kmap, uint32_t key) {
+            return kmap.find_row(key) >= 0;
         })
-        .def("__len__", &KernelMapType::size)
-        .def("empty", &KernelMapType::empty)
-        .def("items", [](const KernelMapType &kmap) { // Mimics dict.items() based on sorted order
-            py::list items_list;
-            auto sorted_cpp_items = kmap.get_sorted_items();
-            for (const auto& cpp_item : sorted_cpp_items) {
-                py::list val_list;
-                for (const auto& p : cpp_item.second) {
-                    val_list.append(py::make_tuple(p.first, p.second));
-                }
-                items_list.append(py::make_tuple(cpp_item.first, val_list));
-            }
-            return items_list;
+        .def("__len__", &KernelMapCSR::num_rows)
+        .def("empty", &KernelMapCSR::empty)
+        .def("items", [](py::object self) { // Mimics dict.items() based on sorted order
+            return self.attr("get_sorted_items")();
         });
 
     // Bind global state accessors
     m.def("get_mem_trace", &get_mem_trace, py::return_value_policy::reference_internal); // Or copy
+    m.def("get_mem_trace_array", []() {
+        // The per-thread buffers are merged once into a vector owned by the array
+        auto* entries = new std::vector<MemoryAccessEntry>(current_trace_sink().collect());
+        py::capsule owner(entries, [](void* p) { delete static_cast<std::vector<MemoryAccessEntry>*>(p); });
+        return py::array_t<MemoryAccessEntry>({static_cast<py::ssize_t>(entries->size())},
+                                              {static_cast<py::ssize_t>(sizeof(MemoryAccessEntry))},
+                                              entries->data(), owner);
+    }, "Returns the memory trace as a structured NumPy array (phase, thread_id, op, tensor, count, addr).");
     m.def("clear_mem_trace", &clear_mem_trace);
-    m.def("set_curr_phase", &set_curr_phase, py::arg("phase_name"));
+    m.def("set_curr_phase", py::overload_cast<const std::string&>(&set_curr_phase), py::arg("phase_name"));
     m.def("get_curr_phase", &get_curr_phase);
     m.def("set_debug_flag", &set_debug_flag, py::arg("debug_val"));
     m.def("get_debug_flag", &get_debug_flag);
@@ -161,6 +183,13 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
     // For now, Python can see the values loaded by C++ main().
     // If Python needs to *set* these, a dedicated function in C++ should handle it
     // and update g_config, then Python can re-read.
+    py::class_<NetworkLayer>(m, "NetworkLayer")
+        .def_readonly("name", &NetworkLayer::name)
+        .def_readonly("kernel_size", &NetworkLayer::kernel_size)
+        .def_readonly("stride", &NetworkLayer::stride)
+        .def_readonly("channels", &NetworkLayer::channels)
+        .def_readonly("transposed", &NetworkLayer::transposed);
+
     py::class_<MinuetConfig>(m, "MinuetConfigReader") // Expose as a read-only view
         .def_property_readonly("NUM_THREADS", [](const MinuetConfig& c){ return c.NUM_THREADS; })
         .def_property_readonly("SIZE_KEY", [](const MinuetConfig& c){ return c.SIZE_KEY; })
@@ -176,15 +205,46 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
         .def_property_readonly("WO_BASE", [](const MinuetConfig& c){ return c.WO_BASE; })
         .def_property_readonly("IV_BASE", [](const MinuetConfig& c){ return c.IV_BASE; })
         .def_property_readonly("WV_BASE", [](const MinuetConfig& c){ return c.WV_BASE; })
+        .def_property_readonly("WV_SIZE", [](const MinuetConfig& c){ return c.WV_SIZE; })
+        .def_property_readonly("HT_BASE", [](const MinuetConfig& c){ return c.HT_BASE; })
+        .def_property_readonly("HT_SIZE", [](const MinuetConfig& c){ return c.HT_SIZE; })
         .def_property_readonly("GEMM_ALIGNMENT", [](const MinuetConfig& c){ return c.GEMM_ALIGNMENT; })
         .def_property_readonly("GEMM_WT_GROUP", [](const MinuetConfig& c){ return c.GEMM_WT_GROUP; })
         .def_property_readonly("GEMM_SIZE", [](const MinuetConfig& c){ return c.GEMM_SIZE; })
+        .def_property_readonly("GEMM_GROUPING", [](const MinuetConfig& c){ return c.GEMM_GROUPING; })
+        .def_property_readonly("GEMM_LOOKAHEAD", [](const MinuetConfig& c){ return c.GEMM_LOOKAHEAD; })
         .def_property_readonly("NUM_TILES", [](const MinuetConfig& c){ return c.NUM_TILES; })
         .def_property_readonly("NUM_PIVOTS", [](const MinuetConfig& c){ return c.NUM_PIVOTS; })
+        .def_property_readonly("LKP_BATCH_SIZE", [](const MinuetConfig& c){ return c.LKP_BATCH_SIZE; })
+        .def_property_readonly("LOOKUP_ENGINE", [](const MinuetConfig& c){ return c.LOOKUP_ENGINE; })
         .def_property_readonly("TILE_FEATS", [](const MinuetConfig& c){ return c.TILE_FEATS; })
         .def_property_readonly("BULK_FEATS", [](const MinuetConfig& c){ return c.BULK_FEATS; })
         .def_property_readonly("N_THREADS_GATHER", [](const MinuetConfig& c){ return c.N_THREADS_GATHER; })
         .def_property_readonly("TOTAL_FEATS_PT", [](const MinuetConfig& c){ return c.TOTAL_FEATS_PT; })
+        .def_property_readonly("FEATURE_KERNELS", [](const MinuetConfig& c){ return c.FEATURE_KERNELS; })
+        .def_property_readonly("METADATA_MASKS", [](const MinuetConfig& c){ return c.METADATA_MASKS; })
+        .def_property_readonly("GATHER_SCHEDULE", [](const MinuetConfig& c){ return c.GATHER_SCHEDULE; })
+        .def_property_readonly("GATHER_PARTITION", [](const MinuetConfig& c){ return c.GATHER_PARTITION; })
+        .def_property_readonly("GATHER_BLOCK_POINTS", [](const MinuetConfig& c){ return c.GATHER_BLOCK_POINTS; })
+        .def_property_readonly("STREAM_TRACES", [](const MinuetConfig& c){ return c.STREAM_TRACES; })
+        .def_property_readonly("TRACE_BUFFER_ENTRIES", [](const MinuetConfig& c){ return c.TRACE_BUFFER_ENTRIES; })
+        .def_property_readonly("TRACE_FORMAT", [](const MinuetConfig& c){ return c.TRACE_FORMAT; })
+        .def_property_readonly("TRACE_COLUMNAR", [](const MinuetConfig& c){ return c.TRACE_COLUMNAR; })
+        .def_property_readonly("COMPRESS_THREADS", [](const MinuetConfig& c){ return c.COMPRESS_THREADS; })
+        .def_property_readonly("VOXEL_SIZE", [](const MinuetConfig& c){ return c.VOXEL_SIZE; })
+        .def_property_readonly("PIPELINE_DEPTH", [](const MinuetConfig& c){ return c.PIPELINE_DEPTH; })
+        .def_property_readonly("PIPELINE_LOADERS", [](const MinuetConfig& c){ return c.PIPELINE_LOADERS; })
+        .def_property_readonly("BUFFER_POOL_MB", [](const MinuetConfig& c){ return c.BUFFER_POOL_MB; })
+        .def_property_readonly("KEY_BITS", [](const MinuetConfig& c){ return c.KEY_BITS; })
+        .def_property_readonly("INCREMENTAL_MAPPING", [](const MinuetConfig& c){ return c.INCREMENTAL_MAPPING; })
+        .def_property_readonly("NETWORK", [](const MinuetConfig& c){ return c.NETWORK; })
+        .def_property_readonly("TRACE_PHASES", [](const MinuetConfig& c){ return c.TRACE_PHASES; })
+        .def_property_readonly("TRACE_TENSORS", [](const MinuetConfig& c){ return c.TRACE_TENSORS; })
+        .def_property_readonly("TRACE_ADDR_RANGES", [](const MinuetConfig& c){ return c.TRACE_ADDR_RANGES; })
+        .def_property_readonly("TRACE_SAMPLE_RATE", [](const MinuetConfig& c){ return c.TRACE_SAMPLE_RATE; })
+        .def_property_readonly("TRACE_SAMPLE_MODE", [](const MinuetConfig& c){ return c.TRACE_SAMPLE_MODE; })
+        .def_property_readonly("TRACE_LINE_BYTES", [](const MinuetConfig& c){ return c.TRACE_LINE_BYTES; })
+        .def_property_readonly("TRACE_COALESCE", [](const MinuetConfig& c){ return c.TRACE_COALESCE; })
         .def_property_readonly("debug", [](const MinuetConfig& c){ return c.debug; }) // Added
         .def_property_readonly("output_dir", [](const MinuetConfig& c){ return c.output_dir; }); // Added
 
@@ -195,26 +255,59 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
 
     // Bind functions
     // m.def("addr_to_tensor", &addr_to_tensor, py::arg("addr")); // Internal, not typically bound
-    m.def("record_access", &record_access, py::arg("thread_id"), py::arg("op"), py::arg("addr"));
+    m.def("record_access", py::overload_cast<int, const std::string&, uint64_t>(&record_access),
+          py::arg("thread_id"), py::arg("op"), py::arg("addr"));
     m.def("write_gmem_trace", &write_gmem_trace, py::arg("filename"),
           py::arg("sizeof_addr") = 4, // Add sizeof_addr argument with default
           "Writes the memory trace to a gzipped file and returns its CRC32 checksum.");
+    m.def("begin_gmem_trace_stream", &begin_gmem_trace_stream, py::arg("filename"),
+          py::arg("sizeof_addr") = 4,
+          "Streams the memory trace to a gzipped file while it is recorded.");
+    m.def("end_gmem_trace_stream", &end_gmem_trace_stream,
+          "Finishes the open trace stream and returns its CRC32 checksum.");
     
     m.def("compute_unique_sorted_coords", &compute_unique_sorted_coords, 
           py::arg("in_coords"), py::arg("stride"));
+    m.def("pack_coord_keys", &pack_coord_keys<uint32_t>, py::arg("in_coords"), py::arg("stride"));
+    m.def("compute_unique_sorted_keys", &compute_unique_sorted_keys<uint32_t>, py::arg("keys"));
+    m.def("read_point_cloud", &read_point_cloud, py::arg("path"), py::arg("voxel_size") = 0.0);
+    m.def("read_point_cloud_keys", &read_point_cloud_keys<uint32_t>, py::arg("path"), py::arg("voxel_size") = 0.0,
+          py::arg("stride") = 1);
+    m.def("list_frame_files", &list_frame_files, py::arg("inputs"));
     
     m.def("build_coordinate_queries", &build_coordinate_queries,
           py::arg("uniq_coords"), py::arg("stride"), py::arg("off_coords"));
 
-    m.def("create_tiles_and_pivots", &create_tiles_and_pivots,
+    m.def("create_tiles_and_pivots",
+          [](const std::vector<IndexedCoord>& uniq_coords, int tile_size) {
+              TilesPivotsResult result = create_tiles_and_pivots(uniq_coords, tile_size);
+              PyTilesPivotsResult copied;
+              for (const CoordSpan& tile : result.tiles) copied.tiles.emplace_back(tile.begin(), tile.end());
+              copied.pivots = std::move(result.pivots);
+              return copied;
+          },
           py::arg("uniq_coords"), py::arg("tile_size"));
 
-    m.def("perform_coordinate_lookup", &perform_coordinate_lookup,
+    m.def("perform_coordinate_lookup",
+          py::overload_cast<const std::vector<IndexedCoord>&, const std::vector<IndexedCoord>&,
+                            const std::vector<int>&, const std::vector<int>&, const std::vector<Coord3D>&,
+                            const std::vector<std::vector<IndexedCoord>>&, const std::vector<IndexedCoord>&,
+                            int>(&perform_coordinate_lookup),
           py::arg("uniq_coords"), py::arg("qry_keys"), py::arg("qry_in_idx"),
           py::arg("qry_off_idx"), py::arg("wt_offsets"), py::arg("tiles"),
           py::arg("pivs"), py::arg("num_tiles_config"), // Corrected arg name to match C++
           py::return_value_policy::move); // KernelMapType is returned by value
 
+    py::class_<KernelMapUpdate>(m, "KernelMapUpdate")
+        .def_readonly("uniq_coords", &KernelMapUpdate::uniq_coords)
+        .def_readonly("kernel_map", &KernelMapUpdate::kernel_map)
+        .def_readonly("renumber", &KernelMapUpdate::renumber)
+        .def_readonly("queries", &KernelMapUpdate::queries);
+
+    m.def("update_kernel_map", &update_kernel_map<uint32_t>, py::arg("prev_uniq_coords"),
+          py::arg("prev_kernel_map"), py::arg("inserted_keys"), py::arg("removed_keys"), py::arg("off_coords"),
+          "Kernel map of the next frame from the previous one and the inserted and removed voxel keys.");
+
     m.def("write_kernel_map_to_gz", &write_kernel_map_to_gz,
           py::arg("kmap_data"), py::arg("filename"), py::arg("off_list"),
           "Writes the kernel map to a gzipped file and returns its CRC32 checksum.");
@@ -259,23 +352,67 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
         .def_readwrite("membership", &GreedyGroupResult::membership)
         .def_readwrite("gemm_list", &GreedyGroupResult::gemm_list)
         .def_readwrite("total_slots_allocated", &GreedyGroupResult::total_slots_allocated)
-        .def_readwrite("checksum", &GreedyGroupResult::checksum)
         .def("__repr__", [](const GreedyGroupResult &ggr) {
             return "<GreedyGroupResult groups_count=" + std::to_string(ggr.groups.size()) +
                    ", gemm_list_count=" + std::to_string(ggr.gemm_list.size()) +
-                   ", total_slots_allocated=" + std::to_string(ggr.total_slots_allocated) +
-                   ", checksum=" + std::to_string(ggr.checksum) + ">";
+                   ", total_slots_allocated=" + std::to_string(ggr.total_slots_allocated) + ">";
         });
 
-    m.def("greedy_group_cpp", &greedy_group_cpp,
+    m.def("greedy_group_cpp",
+          py::overload_cast<const KernelMapCSR&, int, int, int>(&greedy_group_cpp),
+          py::arg("kernel_map"),
+          py::arg("alignment") = 4,
+          py::arg("max_group_items") = 6,
+          py::arg("max_raw_slots") = -1, // -1 for None
+          "Groups the rows of a kernel map, using their match counts as slot sizes.");
+    m.def("greedy_group_cpp",
+          py::overload_cast<const std::vector<int>&, int, int, int>(&greedy_group_cpp),
           py::arg("slots"),
           py::arg("alignment") = 4,
           py::arg("max_group_items") = 6,
           py::arg("max_raw_slots") = -1, // -1 for None
           "Performs greedy grouping of slots, similar to Python's greedy_group.");
 
-    // Bind write_gemm_list_cpp separately if direct access is desired from Python
-    // This is already called by greedy_group_cpp, but can be exposed for flexibility/testing.
+    m.def("group_slots_cpp",
+          [](const std::vector<int>& slots, const std::string& strategy, int alignment,
+             int max_group_items, int max_raw_slots, int lookahead) {
+              return group_slots_cpp(slots, *make_grouping_strategy(strategy, lookahead),
+                                     {alignment, max_group_items, max_raw_slots});
+          },
+          py::arg("slots"),
+          py::arg("strategy") = "greedy", // "greedy", "optimal" or "lookahead"
+          py::arg("alignment") = 4,
+          py::arg("max_group_items") = 6,
+          py::arg("max_raw_slots") = -1, // -1 for None
+          py::arg("lookahead") = 8,
+          "Groups slots with the named strategy; nothing is written to disk.");
+
+    py::class_<GroupingReport>(m, "GroupingReport")
+        .def_readonly("strategy", &GroupingReport::strategy)
+        .def_readonly("total_slots_allocated", &GroupingReport::total_slots_allocated)
+        .def_readonly("padding_slots", &GroupingReport::padding_slots)
+        .def_readonly("padding_overhead", &GroupingReport::padding_overhead)
+        .def_readonly("num_groups", &GroupingReport::num_groups)
+        .def("__repr__", [](const GroupingReport &r) {
+            return "<GroupingReport strategy=" + r.strategy +
+                   ", total_slots_allocated=" + std::to_string(r.total_slots_allocated) +
+                   ", padding_slots=" + std::to_string(r.padding_slots) +
+                   ", num_groups=" + std::to_string(r.num_groups) + ">";
+        });
+
+    m.def("compare_grouping_strategies",
+          [](const std::vector<int>& slots, int alignment, int max_group_items, int max_raw_slots,
+             int lookahead) {
+              return compare_grouping_strategies(slots, {alignment, max_group_items, max_raw_slots}, lookahead);
+          },
+          py::arg("slots"),
+          py::arg("alignment") = 4,
+          py::arg("max_group_items") = 6,
+          py::arg("max_raw_slots") = -1, // -1 for None
+          py::arg("lookahead") = 8,
+          "Reports allocated and padding slots of every grouping strategy.");
+
+    // Grouping never writes gemms.bin.gz; callers write the chosen gemm_list.
     m.def("write_gemm_list_cpp", &write_gemm_list_cpp,
         py::arg("gemm_data_list"), py::arg("filename"),
         "Writes a list of GemmInfo to a gzipped file and returns its CRC32 checksum.");
@@ -303,6 +440,12 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
         .def_readwrite("active_offsets_details", &MetadataContents::active_offsets_details)
         .def_readwrite("out_mask", &MetadataContents::out_mask)
         .def_readwrite("in_mask", &MetadataContents::in_mask)
+        .def_property_readonly("out_mask_array", [](py::object self) {
+            return vector_view(self.cast<const MetadataContents&>().out_mask, self);
+        })
+        .def_property_readonly("in_mask_array", [](py::object self) {
+            return vector_view(self.cast<const MetadataContents&>().in_mask, self);
+        })
         .def("__repr__", [](const MetadataContents& mc) {
             return "<MetadataContents version=" + std::to_string(mc.version) +
                    ", num_sys_offsets=" + std::to_string(mc.num_total_system_offsets) +
@@ -329,6 +472,12 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
           "Writes metadata to a gzipped binary file and returns its CRC32 checksum.");
 
     // Bind Gather/Scatter functions
+    py::enum_<FeatureMode>(m, "FeatureMode")
+        .value("Auto", FeatureMode::Auto)
+        .value("Full", FeatureMode::Full)
+        .value("TraceOnly", FeatureMode::TraceOnly)
+        .value("ComputeOnly", FeatureMode::ComputeOnly);
+
     m.def("mt_gather_cpp", &mt_gather_cpp,
           py::arg("num_threads"),
           py::arg("num_points"),
@@ -339,6 +488,7 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
           py::arg("source_masks"),
           py::arg("sources"),
           py::arg("gemm_buffers"),
+          py::arg("mode") = FeatureMode::Auto,
           "Performs the gather operation using C++ implementation.");
 
     m.def("mt_scatter_cpp", &mt_scatter_cpp,
@@ -351,21 +501,36 @@ PYBIND11_MODULE(minuet_cpp_module, m) {
           py::arg("out_mask"),
           py::arg("gemm_buffers"),
           py::arg("outputs"),
+          py::arg("mode") = FeatureMode::Auto,
           "Performs the scatter operation using C++ implementation.");
 
     // Bind MasksResult struct
     py::class_<MasksResult>(m, "MasksResult")
         .def(py::init<>())
         .def_readwrite("out_mask", &MasksResult::out_mask)
-        .def_readwrite("in_mask", &MasksResult::in_mask);
+        .def_readwrite("in_mask", &MasksResult::in_mask)
+        .def_property_readonly("out_mask_array", [](py::object self) {
+            return vector_view(self.cast<const MasksResult&>().out_mask, self);
+        })
+        .def_property_readonly("in_mask_array", [](py::object self) {
+            return vector_view(self.cast<const MasksResult&>().in_mask, self);
+        });
 
     // Bind create_in_out_masks_cpp
-    m.def("create_in_out_masks_cpp", &create_in_out_masks_cpp,
+    m.def("create_in_out_masks_cpp",
+          py::overload_cast<const KernelMapCSR&, const std::map<uint32_t, int>&, uint32_t, uint32_t>(&create_in_out_masks_cpp),
           py::arg("kernel_map"),
           py::arg("slot_dict"), // std::map<uint32_t, int>
           py::arg("num_total_system_offsets"),
           py::arg("num_total_system_sources"),
           "Creates input and output masks for gather/scatter operations.");
+    m.def("create_in_out_masks_cpp",
+          py::overload_cast<const KernelMapCSR&, const std::vector<uint64_t>&, uint32_t, uint32_t>(&create_in_out_masks_cpp),
+          py::arg("kernel_map"),
+          py::arg("row_bases"), // First GEMM slot of each kernel map row
+          py::arg("num_total_system_offsets"),
+          py::arg("num_total_system_sources"),
+          "Creates input and output masks from the base slot of each kernel map row.");
 
 
 }
@@ -2,6 +2,9 @@
 #include <fstream>
 #include <iostream>
 #include <ext/json.hpp> // Assuming nlohmann/json is used
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
 
 // Definition of the global config object
 MinuetConfig g_config;
@@ -24,18 +27,47 @@ MinuetConfig::MinuetConfig() :
     IV_BASE(0x100000000),
     GM_BASE(0x800000000), // GEMM buffers (64-bit)
     WV_BASE(0xF00000000),
+    WV_SIZE(2ULL << 32),
+    HT_BASE(0x1100000000), // Right after the default WV region
+    HT_SIZE(1ULL << 32),
     GEMM_ALIGNMENT(4),
     GEMM_WT_GROUP(2),
     GEMM_SIZE(4),
+    GEMM_GROUPING("greedy"),
+    GEMM_LOOKAHEAD(8),
     NUM_TILES(4),
     TILE_FEATS(16), // Changed default value
     BULK_FEATS(4), // Changed default value
     N_THREADS_GATHER(8), // Changed default value
     TOTAL_FEATS_PT(256), // Changed default value
+    FEATURE_KERNELS("vector"),
+    METADATA_MASKS("dense"),
+    GATHER_SCHEDULE("point"),
+    GATHER_PARTITION("round_robin"),
+    GATHER_BLOCK_POINTS(64),
     debug(false), // Initialize debug flag
     output_dir("./trace_out"), // Initialize output_dir
-    NUM_PIVOTS(2) // Default value for NUM_PIVOTS
-{}
+    NUM_PIVOTS(2), // Default value for NUM_PIVOTS
+    LKP_BATCH_SIZE(128),
+    LOOKUP_ENGINE("pivot"),
+    STREAM_TRACES(true),
+    TRACE_BUFFER_ENTRIES(1 << 20), // 16 MB of entries
+    TRACE_FORMAT(2),
+    TRACE_COLUMNAR(true),
+    COMPRESS_THREADS(1),
+    VOXEL_SIZE(0.0),
+    PIPELINE_DEPTH(2),
+    PIPELINE_LOADERS(2),
+    BUFFER_POOL_MB(256),
+    KEY_BITS(32),
+    INCREMENTAL_MAPPING(false),
+    TRACE_SAMPLE_RATE(1),
+    TRACE_SAMPLE_MODE("access"),
+    TRACE_LINE_BYTES(64),
+    TRACE_COALESCE(false)
+{
+    build_tensor_regions();
+}
 
 // Function to load configuration from a JSON file
 bool MinuetConfig::loadFromFile(const std::string& filepath) {
@@ -86,20 +118,139 @@ bool MinuetConfig::loadFromFile(const std::string& filepath) {
         load_base_address(KM_BASE, "KM_BASE");
         load_base_address(WO_BASE, "WO_BASE");
         load_base_address(IV_BASE, "IV_BASE");
+        load_base_address(GM_BASE, "GM_BASE");
         load_base_address(WV_BASE, "WV_BASE");
+        load_base_address(WV_SIZE, "WV_SIZE");
+        load_base_address(HT_BASE, "HT_BASE");
+        load_base_address(HT_SIZE, "HT_SIZE");
 
         GEMM_ALIGNMENT = data.value("GEMM_ALIGNMENT", GEMM_ALIGNMENT);
         GEMM_WT_GROUP = data.value("GEMM_WT_GROUP", GEMM_WT_GROUP);
         GEMM_SIZE = data.value("GEMM_SIZE", GEMM_SIZE);
+        GEMM_GROUPING = data.value("GEMM_GROUPING", GEMM_GROUPING);
+        GEMM_LOOKAHEAD = data.value("GEMM_LOOKAHEAD", GEMM_LOOKAHEAD);
 
         NUM_TILES = data.value("NUM_TILES", NUM_TILES);
         TILE_FEATS = data.value("TILE_FEATS", TILE_FEATS);
         BULK_FEATS = data.value("BULK_FEATS", BULK_FEATS);
         N_THREADS_GATHER = data.value("N_THREADS_GATHER", N_THREADS_GATHER);
         TOTAL_FEATS_PT = NUM_TILES * TILE_FEATS; // Recalculate
+        FEATURE_KERNELS = data.value("FEATURE_KERNELS", FEATURE_KERNELS);
+        METADATA_MASKS = data.value("METADATA_MASKS", METADATA_MASKS);
+        GATHER_SCHEDULE = data.value("GATHER_SCHEDULE", GATHER_SCHEDULE);
+        GATHER_PARTITION = data.value("GATHER_PARTITION", GATHER_PARTITION);
+        GATHER_BLOCK_POINTS = data.value("GATHER_BLOCK_POINTS", GATHER_BLOCK_POINTS);
         debug = data.value("debug", debug); // Load debug flag
         output_dir = data.value("output_dir", output_dir); // Load output_dir
         NUM_PIVOTS = data.value("NUM_PIVOTS", NUM_PIVOTS); // Load NUM_PIVOTS
+        LKP_BATCH_SIZE = data.value("LKP_BATCH_SIZE", LKP_BATCH_SIZE);
+        LOOKUP_ENGINE = data.value("LOOKUP_ENGINE", LOOKUP_ENGINE);
+        STREAM_TRACES = data.value("STREAM_TRACES", STREAM_TRACES);
+        TRACE_BUFFER_ENTRIES = data.value("TRACE_BUFFER_ENTRIES", TRACE_BUFFER_ENTRIES);
+        TRACE_FORMAT = data.value("TRACE_FORMAT", TRACE_FORMAT);
+        TRACE_COLUMNAR = data.value("TRACE_COLUMNAR", TRACE_COLUMNAR);
+        COMPRESS_THREADS = data.value("COMPRESS_THREADS", COMPRESS_THREADS);
+        VOXEL_SIZE = data.value("VOXEL_SIZE", VOXEL_SIZE);
+        PIPELINE_DEPTH = data.value("PIPELINE_DEPTH", PIPELINE_DEPTH);
+        PIPELINE_LOADERS = data.value("PIPELINE_LOADERS", PIPELINE_LOADERS);
+        BUFFER_POOL_MB = data.value("BUFFER_POOL_MB", BUFFER_POOL_MB);
+        KEY_BITS = data.value("KEY_BITS", KEY_BITS);
+        INCREMENTAL_MAPPING = data.value("INCREMENTAL_MAPPING", INCREMENTAL_MAPPING);
+        if (KEY_BITS != 32 && KEY_BITS != 64) {
+            std::cerr << "Warning: KEY_BITS must be 32 or 64, got " << KEY_BITS << "; using 32." << std::endl;
+            KEY_BITS = 32;
+        }
+        // Key reads and writes in the traces are SIZE_KEY bytes wide
+        if (!data.contains("SIZE_KEY")) {
+            SIZE_KEY = KEY_BITS / 8;
+        } else if (SIZE_KEY < KEY_BITS / 8) {
+            std::cerr << "Warning: SIZE_KEY " << SIZE_KEY << " is narrower than " << KEY_BITS
+                      << "-bit keys; using " << KEY_BITS / 8 << "." << std::endl;
+            SIZE_KEY = KEY_BITS / 8;
+        }
+
+        if (data.contains("NETWORK")) {
+            // [{"name", "kernel_size", "stride", "channels", "transposed"}, ...]
+            NETWORK.clear();
+            for (const auto& entry : data["NETWORK"]) {
+                NetworkLayer layer;
+                layer.name = entry.value("name", "layer" + std::to_string(NETWORK.size()));
+                layer.kernel_size = entry.value("kernel_size", layer.kernel_size);
+                layer.stride = entry.value("stride", layer.stride);
+                layer.channels = entry.value("channels", layer.channels);
+                layer.transposed = entry.value("transposed", layer.transposed);
+                if (layer.name.empty() || layer.name.find('/') != std::string::npos) {
+                    throw std::invalid_argument("NETWORK layer names must be non-empty and contain no '/': " +
+                                                entry.dump());
+                }
+                for (const NetworkLayer& other : NETWORK) {
+                    if (other.name == layer.name) {
+                        throw std::invalid_argument("NETWORK layer name is used twice: " + layer.name);
+                    }
+                }
+                if (layer.kernel_size == 0 || layer.stride == 0 || (layer.transposed && layer.stride == 1)) {
+                    throw std::invalid_argument("NETWORK layer " + layer.name +
+                                                " needs a kernel_size and stride of at least 1, and a "
+                                                "transposed layer a stride above 1");
+                }
+                // GTH and SCT split a point's features into NUM_TILES tiles of whole bulks
+                if (layer.channels % (NUM_TILES * BULK_FEATS) != 0) {
+                    throw std::invalid_argument("NETWORK layer " + layer.name + " has " +
+                                                std::to_string(layer.channels) +
+                                                " channels, which is not a multiple of NUM_TILES x BULK_FEATS");
+                }
+                NETWORK.push_back(layer);
+            }
+        }
+        if (INCREMENTAL_MAPPING && !NETWORK.empty()) {
+            std::cerr << "Warning: INCREMENTAL_MAPPING updates single-layer kernel maps only; NETWORK frames are "
+                      << "mapped in full." << std::endl;
+            INCREMENTAL_MAPPING = false;
+        }
+
+
+        TRACE_PHASES = data.value("TRACE_PHASES", TRACE_PHASES);
+        TRACE_TENSORS = data.value("TRACE_TENSORS", TRACE_TENSORS);
+        if (data.contains("TRACE_ADDR_RANGES")) {
+            // [[begin, end], ...] with hex strings or numbers, like the bases
+            auto parse_address = [](const nlohmann::json& value) -> uint64_t {
+                return value.is_string() ? std::stoull(value.get<std::string>(), nullptr, 0)
+                                         : value.get<uint64_t>();
+            };
+            TRACE_ADDR_RANGES.clear();
+            for (const auto& range : data["TRACE_ADDR_RANGES"]) {
+                if (!range.is_array() || range.size() != 2) {
+                    throw std::invalid_argument("TRACE_ADDR_RANGES entries must be [begin, end] pairs: " +
+                                                range.dump());
+                }
+                TRACE_ADDR_RANGES.emplace_back(parse_address(range[0]), parse_address(range[1]));
+            }
+        }
+        TRACE_SAMPLE_RATE = data.value("TRACE_SAMPLE_RATE", TRACE_SAMPLE_RATE);
+        if (TRACE_SAMPLE_RATE < 1) {
+            std::cerr << "Warning: TRACE_SAMPLE_RATE must be at least 1; using 1." << std::endl;
+            TRACE_SAMPLE_RATE = 1;
+        }
+        TRACE_SAMPLE_MODE = data.value("TRACE_SAMPLE_MODE", TRACE_SAMPLE_MODE);
+        if (TRACE_SAMPLE_MODE != "access" && TRACE_SAMPLE_MODE != "line") {
+            std::cerr << "Warning: TRACE_SAMPLE_MODE must be \"access\" or \"line\", got \""
+                      << TRACE_SAMPLE_MODE << "\"; using \"access\"." << std::endl;
+            TRACE_SAMPLE_MODE = "access";
+        }
+        TRACE_LINE_BYTES = data.value("TRACE_LINE_BYTES", TRACE_LINE_BYTES);
+        if (TRACE_LINE_BYTES == 0 || (TRACE_LINE_BYTES & (TRACE_LINE_BYTES - 1)) != 0) {
+            std::cerr << "Warning: TRACE_LINE_BYTES must be a power of two, got " << TRACE_LINE_BYTES
+                      << "; using 64." << std::endl;
+            TRACE_LINE_BYTES = 64;
+        }
+        TRACE_COALESCE = data.value("TRACE_COALESCE", TRACE_COALESCE);
+        if (TRACE_COALESCE && TRACE_FORMAT == 1) {
+            std::cerr << "Warning: TRACE_COALESCE needs TRACE_FORMAT 2 or 3 to store the access counts; "
+                      << "coalescing is disabled." << std::endl;
+            TRACE_COALESCE = false;
+        }
+
+        build_tensor_regions(true);
 
     } catch (const nlohmann::json::parse_error& e) {
         std::cerr << "JSON parse error: " << e.what() << std::endl;
@@ -114,3 +265,97 @@ bool MinuetConfig::loadFromFile(const std::string& filepath) {
 
     return true;
 }
+
+void MinuetConfig::build_tensor_regions(bool warn) {
+    // Each tensor owns [its base, next base); the first matching range wins,
+    // exactly like the original chain of comparisons in addr_to_tensor.
+    struct Range {
+        Tensor tensor;
+        const char* name;
+        uint64_t lo, hi;
+    };
+    const Range chain[] = {
+        {Tensor::I, "I", I_BASE, QK_BASE},
+        {Tensor::QK, "QK", QK_BASE, QI_BASE},
+        {Tensor::QI, "QI", QI_BASE, QO_BASE},
+        {Tensor::QO, "QO", QO_BASE, PIV_BASE},
+        {Tensor::PIV, "PIV", PIV_BASE, KM_BASE},
+        {Tensor::KM, "KM", KM_BASE, WO_BASE},
+        {Tensor::WC, "WC", WO_BASE, IV_BASE},
+        {Tensor::IV, "IV", IV_BASE, GM_BASE},
+        {Tensor::GM, "GM", GM_BASE, WV_BASE},
+        {Tensor::WV, "WV", WV_BASE, WV_BASE + WV_SIZE},
+        {Tensor::HT, "HT", HT_BASE, HT_BASE + HT_SIZE},
+    };
+    auto eval_chain = [&](uint64_t addr) {
+        for (const auto& r : chain) {
+            if (addr >= r.lo && addr < r.hi) return static_cast<uint8_t>(r.tensor);
+        }
+        return static_cast<uint8_t>(Tensor::Unknown);
+    };
+
+    // Classification is constant between consecutive boundaries, so evaluate
+    // the chain once per interval and merge neighbours with the same tensor.
+    std::vector<uint64_t> bounds = {0};
+    for (const auto& r : chain) {
+        bounds.push_back(r.lo);
+        bounds.push_back(r.hi);
+        if (warn && r.lo >= r.hi) {
+            std::cerr << "Warning: tensor region " << r.name << " [0x" << std::hex << r.lo
+                      << ", 0x" << r.hi << std::dec << ") is empty; check the *_BASE ordering."
+                      << std::endl;
+        }
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    region_starts_.clear();
+    region_tensors_.clear();
+    for (uint64_t b : bounds) {
+        uint8_t t = eval_chain(b);
+        if (region_tensors_.empty() || region_tensors_.back() != t) {
+            region_starts_.push_back(b);
+            region_tensors_.push_back(t);
+        }
+    }
+    tail_tensor_ = region_tensors_.back();
+
+    // Use a page table when all boundaries share a coarse alignment.
+    uint32_t shift = 63;
+    for (uint64_t b : region_starts_) {
+        if (b != 0) shift = std::min<uint32_t>(shift, __builtin_ctzll(b));
+    }
+    const uint64_t last_start = region_starts_.back();
+    const size_t max_pages = 1 << 16;
+    use_page_table_ = (shift >= 12) && ((last_start >> shift) < max_pages);
+    page_table_.clear();
+    if (use_page_table_) {
+        page_shift_ = shift;
+        page_table_.resize((last_start >> shift) + 1);
+        size_t region = 0;
+        for (size_t page = 0; page < page_table_.size(); ++page) {
+            uint64_t addr = static_cast<uint64_t>(page) << shift;
+            while (region + 1 < region_starts_.size() && region_starts_[region + 1] <= addr) {
+                ++region;
+            }
+            page_table_[page] = region_tensors_[region];
+        }
+    }
+}
+
+void MinuetConfig::classify(const uint64_t* addrs, size_t count, uint8_t* tensors_out) const {
+    if (use_page_table_) {
+        const uint8_t* table = page_table_.data();
+        const uint64_t last_page = page_table_.size() - 1;
+        const uint32_t shift = page_shift_;
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t page = addrs[i] >> shift;
+            // Pages past the table all belong to the last region.
+            tensors_out[i] = table[page < last_page ? page : last_page];
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        tensors_out[i] = classify(addrs[i]);
+    }
+}
@@ -1,7 +1,13 @@
 // minuet_gather.cpp
 #include "minuet_gather.hpp"
+#include "buffer_pool.hpp"
 #include "minuet_map.hpp"
 #include "minuet_config.hpp" // For g_config
+#include "profiler.hpp"
+#include "trace_context.hpp" // For current_trace_sink
+#include "feature_kernels.hpp"
+#include "gz_output.hpp"
+#include "thread_pool.hpp"
 #include <algorithm>         // For std::min if used (not directly used here)
 #include <iomanip>           // Required for std::hex
 #include <iostream>
@@ -19,278 +25,358 @@ static std::string to_hex_string(uint32_t val) {
   return ss.str();
 }
 
-uint32_t write_gemm_list_cpp(const std::vector<GemmInfo> &gemm_data_list,
-                             const std::string &filename) {
-  gzFile outFile = gzopen(filename.c_str(), "wb");
-  if (!outFile) {
-    throw std::runtime_error("Failed to open file for writing: " + filename);
-  }
-
-  uLong crc = crc32(0L, Z_NULL, 0);
-  auto write_and_crc = [&](const void *data, unsigned int len) {
-    if (gzwrite(outFile, data, len) != static_cast<int>(len)) {
-      gzclose(outFile);
-      throw std::runtime_error(
-          "Failed to write data to gzip file during GEMM list writing.");
+// --- Gather and Scatter Thread Worker Functions ---
+// Each call covers the points of [pt_begin, pt_end) owned by thread_id (see
+// OwnedPoints); with round-robin ownership pt_begin is a multiple of
+// num_threads so ownership matches the full range. The traversal picks the
+// loop order. The policy decides at compile time whether the feature data
+// moves (kData) and whether the accesses are traced (kTrace).
+
+namespace {
+
+struct FullPolicy { static constexpr bool kData = true, kTrace = true; };
+struct TraceOnlyPolicy { static constexpr bool kData = false, kTrace = true; };
+struct ComputeOnlyPolicy { static constexpr bool kData = true, kTrace = false; };
+
+// Runs fn with the policy type of a resolved (non-Auto) mode
+template <typename Fn>
+void with_policy(FeatureMode mode, Fn&& fn) {
+    switch (mode) {
+        case FeatureMode::TraceOnly: fn(TraceOnlyPolicy{}); break;
+        case FeatureMode::ComputeOnly: fn(ComputeOnlyPolicy{}); break;
+        default: fn(FullPolicy{}); break;
     }
-    crc = crc32(crc, static_cast<const Bytef *>(data), len);
-  };
-
-  for (const auto &gemm : gemm_data_list) {
-    uint32_t num_offsets = gemm.num_offsets;
-    uint32_t gemm_M = gemm.gemm_M;
-    uint32_t padding = gemm.padding;
-
-    write_and_crc(&num_offsets, sizeof(num_offsets));
-    write_and_crc(&gemm_M, sizeof(gemm_M));
-    write_and_crc(&padding, sizeof(padding));
-  }
-
-  gzclose(outFile);
-  std::cout << "GEMM list successfully written to " << filename << " with "
-            << gemm_data_list.size() << " entries." << std::endl;
-  return static_cast<uint32_t>(crc);
 }
 
-GreedyGroupResult greedy_group_cpp(const std::vector<int> &slots, int alignment,
-                                   int max_group_items, int max_raw_slots) {
-  GreedyGroupResult result; // result is of type GreedyGroupResult
-  int n = slots.size();
-
-  uint64_t current_addr = 0;
-  uint32_t current_sum_slots = 0;
-  int current_item_count = 0;
-  std::vector<int> current_members_indices;
-
-  result.pos_indices.resize(n);
-
-  auto flush_group_lambda = [&]() {
-    if (current_members_indices.empty()) {
-      return;
-    }
-    uint32_t req = current_sum_slots;
-    uint32_t alloc = ((req + alignment - 1) / alignment) * alignment;
-
-    result.groups.push_back(
-        {current_members_indices, current_addr, req, alloc});
-
-    current_addr += alloc;
-    current_sum_slots = 0;
-    current_item_count = 0;
-    current_members_indices.clear();
-  }; // Semicolon for lambda assignment
-
-  for (int i = 0; i < n; ++i) {
-    int slot_size = slots[i];
-    if ((current_item_count >= max_group_items) ||
-        (max_raw_slots != -1 && current_sum_slots + slot_size >
-                                    static_cast<uint32_t>(max_raw_slots))) {
-      flush_group_lambda();
-    }
-    result.pos_indices[i] = current_addr + current_sum_slots;
-    current_members_indices.push_back(i);
-    current_sum_slots += slot_size;
-    current_item_count += 1;
-  } // End of for loop
-
-  flush_group_lambda();
-
-  result.total_slots_allocated = 0;
-  for (const auto &group : result.groups) {
-    result.membership.push_back(group.members);
-    result.total_slots_allocated += group.allocated_slots;
-
-    GemmInfo gemm_item;
-
-    if (group.members.empty()) {
-      throw std::runtime_error(
-          "Group members list is empty unexpectedly for GemmInfo calculation.");
+// Points first, first + step, ... below end
+struct OwnedPoints {
+    uint32_t first;
+    uint32_t end;
+    uint32_t step;
+
+    // The points of [pt_begin, pt_end) that thread_id owns: every
+    // num_threads-th point, or one contiguous chunk of the range.
+    static OwnedPoints of_thread(const FeatureTraversal& traversal, uint32_t thread_id, uint32_t num_threads,
+                                 uint32_t pt_begin, uint32_t pt_end) {
+        if (!traversal.contiguous) {
+            return {pt_begin + thread_id, pt_end, num_threads};
+        }
+        uint32_t chunk = (pt_end - pt_begin + num_threads - 1) / num_threads;
+        uint32_t first = static_cast<uint32_t>(std::min<uint64_t>(pt_end, pt_begin + static_cast<uint64_t>(thread_id) * chunk));
+        return {first, static_cast<uint32_t>(std::min<uint64_t>(pt_end, static_cast<uint64_t>(first) + chunk)), 1};
     }
 
-    if (group.members.size() == 1) {
-      gemm_item.num_offsets = 1;
-    } else {
-      gemm_item.num_offsets = static_cast<uint32_t>(group.members.size());
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (uint64_t pt_idx = first; pt_idx < end; pt_idx += step) fn(static_cast<uint32_t>(pt_idx));
     }
 
-    gemm_item.gemm_M = group.allocated_slots;
-    gemm_item.slots = group.required_slots;
-    gemm_item.padding = group.allocated_slots - group.required_slots;
-    result.gemm_list.push_back(gemm_item);
-  }
-
-  std::string gemm_filename = "gemms.bin.gz";
-  if (g_config.output_dir.empty()) {
-    std::cerr << "Warning: g_config.output_dir is not set. Writing "
-                 "gemms.bin.gz to current directory."
-              << std::endl;
-  } else {
-    gemm_filename = g_config.output_dir + "/gemms.bin.gz";
-  }
-
-  result.checksum = write_gemm_list_cpp(result.gemm_list, gemm_filename);
-  return result;
-}
-
-// --- Gather and Scatter Thread Worker Functions ---
-
-// Thread-local storage for memory traces
-static thread_local std::vector<MemoryAccessEntry> local_mem_trace;
-
-// Mutex for protecting access to the global memory trace
-static std::mutex global_mem_trace_access_mutex;
-
-
-// Helper function to record memory access locally
-void record_local_access_cpp(uint8_t thread_id, const std::string& op_str, uint64_t addr) {
-    uint8_t phase_id = PHASES.forward.at(get_curr_phase()); // Assumes get_curr_phase is accessible
-    uint8_t op_id = OPS.forward.at(op_str); // Assumes OPS is accessible
-    uint8_t tensor_id = addr_to_tensor(addr); // Assumes addr_to_tensor is accessible
-    
-    local_mem_trace.push_back({phase_id, thread_id, op_id, tensor_id, addr});
-}
-
-// Helper function to flush local trace to global trace
-void flush_local_trace_cpp() {
-    if (!local_mem_trace.empty()) {
-        std::lock_guard<std::mutex> lock(global_mem_trace_access_mutex); // Corrected mutex name
-        // Assumes mem_trace is the global trace vector, accessible here
-        // and that MemoryAccessEntry is the correct type.
-        // This might require including "minuet_trace.hpp" for MemoryAccessEntry and mem_trace declaration
-        // For now, assuming mem_trace is a global std::vector<MemoryAccessEntry>
-        // If mem_trace is not directly accessible, a function like append_to_global_trace might be needed.
-         extern std::vector<MemoryAccessEntry> mem_trace; // Make sure this is declared (e.g. in minuet_trace.hpp)
-         mem_trace.insert(mem_trace.end(), local_mem_trace.begin(), local_mem_trace.end());
-        local_mem_trace.clear();
+    // Visits consecutive blocks of up to block_points points
+    template <typename Fn>
+    void for_each_block(uint32_t block_points, Fn&& fn) const {
+        uint64_t span = static_cast<uint64_t>(std::max<uint32_t>(1, block_points)) * step;
+        for (uint64_t b = first; b < end; b += span) {
+            fn(OwnedPoints{static_cast<uint32_t>(b), static_cast<uint32_t>(std::min<uint64_t>(end, b + span)), step});
+        }
     }
-}
-
+};
 
+template <typename Policy>
 void gather_thread_worker_cpp(
     uint32_t thread_id,
     uint32_t num_threads,
+    uint32_t pt_begin,
+    uint32_t pt_end,
+    uint64_t lane,
     uint32_t num_points,
     uint32_t num_offsets,
     uint32_t num_tiles_per_pt,
     uint32_t tile_feat_size,
     uint32_t bulk_feat_size,
+    const FeatureTraversal& traversal,
     const std::vector<int32_t>& source_masks,
     const std::vector<float>& sources,
-    std::vector<float>& gemm_buffers) {
+    std::vector<float>& gemm_buffers,
+    bool scalar_kernels) {
 
-    if (tile_feat_size % bulk_feat_size != 0) {
-        throw std::invalid_argument("tile_feat_size must be divisible by bulk_feat_size");
-    }
     uint32_t num_bulks = tile_feat_size / bulk_feat_size;
     uint64_t total_feats_per_pt = static_cast<uint64_t>(num_tiles_per_pt) * tile_feat_size;
+    const uint64_t bulk_bytes = static_cast<uint64_t>(bulk_feat_size) * g_config.SIZE_FEAT;
+    if constexpr (Policy::kTrace) {
+        current_trace_sink().set_lane(lane); // Merged trace is ordered by (window, worker id)
+    }
 
-    for (uint32_t pt_idx = thread_id; pt_idx < num_points; pt_idx += num_threads) {
-        uint64_t pt_base = static_cast<uint64_t>(pt_idx) * total_feats_per_pt;
-        for (uint32_t tile_idx = 0; tile_idx < num_tiles_per_pt; ++tile_idx) {
-            uint64_t tile_start_in_source = pt_base + static_cast<uint64_t>(tile_idx) * tile_feat_size;
-
-            for (uint32_t b = 0; b < num_bulks; ++b) {
-                uint64_t bulk_start_in_source = tile_start_in_source + b * bulk_feat_size;
-                // Record read from IV_BASE
-                record_local_access_cpp(static_cast<uint8_t>(thread_id), OPS.inverse.at(0), g_config.IV_BASE + bulk_start_in_source * g_config.SIZE_FEAT);
-            }
-
-            for (uint32_t off_idx = 0; off_idx < num_offsets; ++off_idx) {
-                uint32_t mask_idx = off_idx * num_points + pt_idx;
-                int32_t dest_slot = source_masks[mask_idx];
-                if (dest_slot < 0) {
-                    continue;
-                }
+    auto dest_slot_of = [&](uint32_t off_idx, uint32_t pt_idx) {
+        return source_masks[static_cast<size_t>(off_idx) * num_points + pt_idx];
+    };
 
-                uint64_t dest_tile_base_in_gemm = static_cast<uint64_t>(dest_slot) * total_feats_per_pt + static_cast<uint64_t>(tile_idx) * tile_feat_size;
-                for (uint32_t b = 0; b < num_bulks; ++b) {
-                    uint64_t bulk_start_in_source = tile_start_in_source + static_cast<uint64_t>(b) * bulk_feat_size;
-                    uint64_t dest_bulk_start_in_gemm = dest_tile_base_in_gemm + static_cast<uint64_t>(b) * bulk_feat_size;
+    // Reads tile tile_idx of point pt_idx from IV_BASE, one entry per bulk
+    auto read_tile = [&](uint32_t pt_idx, uint32_t tile_idx) {
+        if constexpr (Policy::kTrace) {
+            uint64_t tile_start_in_source = static_cast<uint64_t>(pt_idx) * total_feats_per_pt + static_cast<uint64_t>(tile_idx) * tile_feat_size;
+            record_strided_access<Op::R, Tensor::IV>(thread_id, g_config.IV_BASE + tile_start_in_source * g_config.SIZE_FEAT,
+                                                     bulk_bytes, num_bulks);
+        }
+    };
 
-                    if (!sources.empty()) { // Check if sources has data
-                        for(uint32_t i = 0; i < bulk_feat_size; ++i) {
-                            if ((bulk_start_in_source + i < sources.size()) && (dest_bulk_start_in_gemm + i < gemm_buffers.size())) {
-                                gemm_buffers[dest_bulk_start_in_gemm + i] = sources[bulk_start_in_source + i];
-                            }
+    // Copies that tile into GEMM slot dest_slot and records the writes to GM_BASE
+    auto write_tile = [&](uint32_t pt_idx, uint32_t tile_idx, int32_t dest_slot) {
+        uint64_t tile_start_in_source = static_cast<uint64_t>(pt_idx) * total_feats_per_pt + static_cast<uint64_t>(tile_idx) * tile_feat_size;
+        uint64_t dest_tile_base_in_gemm = static_cast<uint64_t>(dest_slot) * total_feats_per_pt + static_cast<uint64_t>(tile_idx) * tile_feat_size;
+        if constexpr (Policy::kData) {
+            for (uint32_t b = 0; b < num_bulks; ++b) {
+                uint64_t bulk_start_in_source = tile_start_in_source + static_cast<uint64_t>(b) * bulk_feat_size;
+                uint64_t dest_bulk_start_in_gemm = dest_tile_base_in_gemm + static_cast<uint64_t>(b) * bulk_feat_size;
+                if (scalar_kernels) {
+                    for(uint32_t i = 0; i < bulk_feat_size; ++i) {
+                        if ((bulk_start_in_source + i < sources.size()) && (dest_bulk_start_in_gemm + i < gemm_buffers.size())) {
+                            gemm_buffers[dest_bulk_start_in_gemm + i] = sources[bulk_start_in_source + i];
                         }
                     }
-                    // Record write to GM_BASE
-                    record_local_access_cpp(static_cast<uint8_t>(thread_id), OPS.inverse.at(1), g_config.GM_BASE + dest_bulk_start_in_gemm * g_config.SIZE_FEAT);
+                } else {
+                    size_t n = feature_kernels::clamp_span(bulk_start_in_source, sources.size(),
+                                                           dest_bulk_start_in_gemm, gemm_buffers.size(), bulk_feat_size);
+                    feature_kernels::copy(gemm_buffers.data() + dest_bulk_start_in_gemm,
+                                          sources.data() + bulk_start_in_source, n);
                 }
             }
         }
+        if constexpr (Policy::kTrace) {
+            record_strided_access<Op::W, Tensor::GM>(thread_id, g_config.GM_BASE + dest_tile_base_in_gemm * g_config.SIZE_FEAT,
+                                                     bulk_bytes, num_bulks);
+        }
+    };
+
+    OwnedPoints points = OwnedPoints::of_thread(traversal, thread_id, num_threads, pt_begin, pt_end);
+    switch (traversal.schedule) {
+        case FeatureSchedule::PointMajor:
+            // Each tile is read once, then written to the slot of every offset
+            points.for_each([&](uint32_t pt_idx) {
+                for (uint32_t tile_idx = 0; tile_idx < num_tiles_per_pt; ++tile_idx) {
+                    read_tile(pt_idx, tile_idx);
+                    for (uint32_t off_idx = 0; off_idx < num_offsets; ++off_idx) {
+                        int32_t dest_slot = dest_slot_of(off_idx, pt_idx);
+                        if (dest_slot >= 0) write_tile(pt_idx, tile_idx, dest_slot);
+                    }
+                }
+            });
+            break;
+        case FeatureSchedule::OffsetMajor:
+            // One mask row at a time; the source is read again for every match
+            for (uint32_t off_idx = 0; off_idx < num_offsets; ++off_idx) {
+                points.for_each([&](uint32_t pt_idx) {
+                    int32_t dest_slot = dest_slot_of(off_idx, pt_idx);
+                    if (dest_slot < 0) return;
+                    for (uint32_t tile_idx = 0; tile_idx < num_tiles_per_pt; ++tile_idx) {
+                        read_tile(pt_idx, tile_idx);
+                        write_tile(pt_idx, tile_idx, dest_slot);
+                    }
+                });
+            }
+            break;
+        case FeatureSchedule::Blocked:
+            // A block of points is read once, then written offset by offset
+            points.for_each_block(traversal.block_points, [&](const OwnedPoints& block) {
+                block.for_each([&](uint32_t pt_idx) {
+                    for (uint32_t tile_idx = 0; tile_idx < num_tiles_per_pt; ++tile_idx) read_tile(pt_idx, tile_idx);
+                });
+                for (uint32_t off_idx = 0; off_idx < num_offsets; ++off_idx) {
+                    block.for_each([&](uint32_t pt_idx) {
+                        int32_t dest_slot = dest_slot_of(off_idx, pt_idx);
+                        if (dest_slot < 0) return;
+                        for (uint32_t tile_idx = 0; tile_idx < num_tiles_per_pt; ++tile_idx) {
+                            write_tile(pt_idx, tile_idx, dest_slot);
+                        }
+                    });
+                }
+            });
+            break;
     }
-    flush_local_trace_cpp();
 }
 
+template <typename Policy>
 void scatter_thread_worker_cpp(
     uint32_t thread_id,
     uint32_t num_threads,
+    uint32_t pt_begin,
+    uint32_t pt_end,
+    uint64_t lane,
     uint32_t num_points, // Number of *output* points
     uint32_t num_offsets,
     uint32_t num_tiles_per_pt,
     uint32_t tile_feat_size,
     uint32_t bulk_feat_size,
+    const FeatureTraversal& traversal,
     const std::vector<int32_t>& out_mask,
     const std::vector<float>& gemm_buffers,
-    std::vector<float>& outputs) {
+    std::vector<float>& outputs,
+    bool scalar_kernels) {
 
-    if (tile_feat_size % bulk_feat_size != 0) {
-        throw std::invalid_argument("tile_feat_size must be divisible by bulk_feat_size");
-    }
-    int num_bulks = tile_feat_size / bulk_feat_size;
+    uint32_t num_bulks = tile_feat_size / bulk_feat_size;
     uint64_t total_feats_per_pt = static_cast<uint64_t>(num_tiles_per_pt) * tile_feat_size;
-    std::vector<float> tile_data_temp(tile_feat_size); // Temporary buffer for one tile
-
-    for (uint32_t pt_idx = thread_id; pt_idx < num_points; pt_idx += num_threads) { // pt_idx is output point index
-        uint64_t dest_pt_base = static_cast<uint64_t>(pt_idx) * total_feats_per_pt;
+    const uint64_t bulk_bytes = static_cast<uint64_t>(bulk_feat_size) * g_config.SIZE_FEAT;
+    std::vector<float> tile_data_temp(Policy::kData ? tile_feat_size : 0); // Temporary buffer for one tile
+    if constexpr (Policy::kTrace) {
+        current_trace_sink().set_lane(lane); // Merged trace is ordered by (window, worker id)
+    }
 
-        for (int off_idx = 0; off_idx < num_offsets; ++off_idx) {
-            int mask_idx = off_idx * num_points + pt_idx;
-            int32_t source_slot = out_mask[mask_idx];
-            if (source_slot == -1) {
-                continue;
-            }
+    // Accumulates tile tile_idx of GEMM slot source_slot into output point pt_idx
+    auto accumulate_tile = [&](uint32_t pt_idx, uint32_t tile_idx, int32_t source_slot) {
+        uint64_t source_tile_base = static_cast<uint64_t>(source_slot) * total_feats_per_pt + static_cast<uint64_t>(tile_idx) * tile_feat_size;
+        uint64_t dest_tile_base_in_output = static_cast<uint64_t>(pt_idx) * total_feats_per_pt + static_cast<uint64_t>(tile_idx) * tile_feat_size;
 
-            for (int tile_idx = 0; tile_idx < num_tiles_per_pt; ++tile_idx) {
-                uint64_t source_tile_base = static_cast<uint64_t>(source_slot) * total_feats_per_pt + static_cast<uint64_t>(tile_idx) * tile_feat_size;
-                
-                // Phase 1: Read entire source tile from gemm_buffers into tile_data_temp
-                for (int b = 0; b < num_bulks; ++b) {
-                    uint64_t bulk_offset_in_tile = static_cast<uint64_t>(b) * bulk_feat_size;
-                    uint64_t source_bulk_addr_in_gemm = source_tile_base + bulk_offset_in_tile;
-                    record_local_access_cpp(static_cast<uint8_t>(thread_id), OPS.inverse.at(0), g_config.GM_BASE + source_bulk_addr_in_gemm * g_config.SIZE_FEAT);
-                    if (!gemm_buffers.empty()) {
-                         for(int i = 0; i < bulk_feat_size; ++i) {
-                            if ((source_bulk_addr_in_gemm + i < gemm_buffers.size()) && (bulk_offset_in_tile + i < tile_data_temp.size())) {
-                                tile_data_temp[bulk_offset_in_tile + i] = gemm_buffers[source_bulk_addr_in_gemm + i];
-                            }
+        // Phase 1: Read entire source tile from gemm_buffers into tile_data_temp
+        if constexpr (Policy::kTrace) {
+            record_strided_access<Op::R, Tensor::GM>(thread_id, g_config.GM_BASE + source_tile_base * g_config.SIZE_FEAT,
+                                                     bulk_bytes, num_bulks);
+        }
+        if constexpr (Policy::kData) {
+            for (uint32_t b = 0; b < num_bulks; ++b) {
+                uint64_t bulk_offset_in_tile = static_cast<uint64_t>(b) * bulk_feat_size;
+                uint64_t source_bulk_addr_in_gemm = source_tile_base + bulk_offset_in_tile;
+                if (scalar_kernels) {
+                    for(uint32_t i = 0; i < bulk_feat_size; ++i) {
+                        if ((source_bulk_addr_in_gemm + i < gemm_buffers.size()) && (bulk_offset_in_tile + i < tile_data_temp.size())) {
+                            tile_data_temp[bulk_offset_in_tile + i] = gemm_buffers[source_bulk_addr_in_gemm + i];
                         }
                     }
+                } else {
+                    size_t n = feature_kernels::clamp_span(source_bulk_addr_in_gemm, gemm_buffers.size(),
+                                                           bulk_offset_in_tile, tile_data_temp.size(), bulk_feat_size);
+                    feature_kernels::copy(tile_data_temp.data() + bulk_offset_in_tile,
+                                          gemm_buffers.data() + source_bulk_addr_in_gemm, n);
                 }
+            }
+        }
 
-                // Phase 2: Write from tile_data_temp to outputs array
-                uint64_t dest_tile_base_in_output = dest_pt_base + static_cast<uint64_t>(tile_idx) * tile_feat_size;
-                for (int b = 0; b < num_bulks; ++b) {
-                    uint64_t bulk_offset_in_tile = static_cast<uint64_t>(b) * bulk_feat_size;
-                    uint64_t dest_bulk_addr_in_output = dest_tile_base_in_output + bulk_offset_in_tile;
-                    record_local_access_cpp(static_cast<uint8_t>(thread_id), OPS.inverse.at(1), g_config.IV_BASE + dest_bulk_addr_in_output * g_config.SIZE_FEAT);
-                     if (!outputs.empty() && !gemm_buffers.empty()) { // Check if outputs and gemm_buffers (implies tile_data_temp is valid) have data
-                        for(int i = 0; i < bulk_feat_size; ++i) {
-                             if ((dest_bulk_addr_in_output + i < outputs.size()) && (bulk_offset_in_tile + i < tile_data_temp.size())) {
-                                outputs[dest_bulk_addr_in_output + i] += tile_data_temp[bulk_offset_in_tile + i]; // Accumulate
-                            }
+        // Phase 2: Write from tile_data_temp to outputs array
+        if constexpr (Policy::kTrace) {
+            record_strided_access<Op::W, Tensor::IV>(thread_id, g_config.IV_BASE + dest_tile_base_in_output * g_config.SIZE_FEAT,
+                                                     bulk_bytes, num_bulks);
+        }
+        if constexpr (Policy::kData) {
+            for (uint32_t b = 0; b < num_bulks; ++b) {
+                uint64_t bulk_offset_in_tile = static_cast<uint64_t>(b) * bulk_feat_size;
+                uint64_t dest_bulk_addr_in_output = dest_tile_base_in_output + bulk_offset_in_tile;
+                if (scalar_kernels) {
+                    for(uint32_t i = 0; i < bulk_feat_size; ++i) {
+                         if ((dest_bulk_addr_in_output + i < outputs.size()) && (bulk_offset_in_tile + i < tile_data_temp.size())) {
+                            outputs[dest_bulk_addr_in_output + i] += tile_data_temp[bulk_offset_in_tile + i]; // Accumulate
                         }
                     }
+                } else {
+                    size_t n = feature_kernels::clamp_span(bulk_offset_in_tile, tile_data_temp.size(),
+                                                           dest_bulk_addr_in_output, outputs.size(), bulk_feat_size);
+                    feature_kernels::accumulate(outputs.data() + dest_bulk_addr_in_output,
+                                                tile_data_temp.data() + bulk_offset_in_tile, n);
                 }
             }
         }
+    };
+
+    // All tiles of one (output point, offset) match
+    auto visit = [&](uint32_t pt_idx, uint32_t off_idx) {
+        int32_t source_slot = out_mask[static_cast<size_t>(off_idx) * num_points + pt_idx];
+        if (source_slot == -1) return;
+        for (uint32_t tile_idx = 0; tile_idx < num_tiles_per_pt; ++tile_idx) {
+            accumulate_tile(pt_idx, tile_idx, source_slot);
+        }
+    };
+
+    // Every order adds the offsets of an output point in ascending order, so
+    // the outputs do not depend on the schedule.
+    OwnedPoints points = OwnedPoints::of_thread(traversal, thread_id, num_threads, pt_begin, pt_end);
+    switch (traversal.schedule) {
+        case FeatureSchedule::PointMajor:
+            points.for_each([&](uint32_t pt_idx) {
+                for (uint32_t off_idx = 0; off_idx < num_offsets; ++off_idx) visit(pt_idx, off_idx);
+            });
+            break;
+        case FeatureSchedule::OffsetMajor:
+            for (uint32_t off_idx = 0; off_idx < num_offsets; ++off_idx) {
+                points.for_each([&](uint32_t pt_idx) { visit(pt_idx, off_idx); });
+            }
+            break;
+        case FeatureSchedule::Blocked:
+            points.for_each_block(traversal.block_points, [&](const OwnedPoints& block) {
+                for (uint32_t off_idx = 0; off_idx < num_offsets; ++off_idx) {
+                    block.for_each([&](uint32_t pt_idx) { visit(pt_idx, off_idx); });
+                }
+            });
+            break;
+    }
+}
+
+} // namespace
+
+FeatureTraversal FeatureTraversal::from_config() {
+    FeatureTraversal traversal;
+    const std::string& schedule = g_config.GATHER_SCHEDULE;
+    if (schedule == "point") {
+        traversal.schedule = FeatureSchedule::PointMajor;
+    } else if (schedule == "offset") {
+        traversal.schedule = FeatureSchedule::OffsetMajor;
+    } else if (schedule == "blocked") {
+        traversal.schedule = FeatureSchedule::Blocked;
+    } else {
+        throw std::invalid_argument("Unknown GATHER_SCHEDULE: '" + schedule + "' (expected point, offset or blocked)");
+    }
+    const std::string& partition = g_config.GATHER_PARTITION;
+    if (partition == "round_robin") {
+        traversal.contiguous = false;
+    } else if (partition == "contiguous") {
+        traversal.contiguous = true;
+    } else {
+        throw std::invalid_argument("Unknown GATHER_PARTITION: '" + partition + "' (expected round_robin or contiguous)");
     }
-    flush_local_trace_cpp();
+    traversal.block_points = std::max<uint32_t>(1, g_config.GATHER_BLOCK_POINTS);
+    return traversal;
 }
 
 
 // --- Main Gather and Scatter Functions ---
+
+// Points processed between two trace commits. Without a trace stream the
+// whole range is one window; with one, a window holds at most about
+// stream_budget() entries (entries_per_pt is an upper bound per point).
+static uint32_t trace_window_points(uint32_t num_threads, uint32_t num_points,
+                                    uint64_t entries_per_pt) {
+    uint64_t budget = current_trace_sink().stream_budget();
+    if (budget == 0 || num_threads == 0 || entries_per_pt == 0) {
+        return num_points;
+    }
+    uint64_t rounds = std::max<uint64_t>(1, budget / (entries_per_pt * num_threads));
+    return static_cast<uint32_t>(std::min<uint64_t>(rounds * num_threads, num_points));
+}
+
+// Runs `worker(policy, win_begin, win_end, round, thread)` over the points in
+// trace windows on num_threads simulated threads. ComputeOnly records nothing,
+// so it runs as a single window without phase changes or commits.
+template <typename Worker>
+static void run_feature_phase(Phase phase, FeatureMode mode, uint32_t num_threads, uint32_t num_points,
+                              uint64_t entries_per_pt, Worker&& worker) {
+    with_policy(mode, [&](auto policy) {
+        using Policy = decltype(policy);
+        if constexpr (!Policy::kTrace) {
+            ThreadPool::shared().parallel_for(num_threads, [&](size_t i) {
+                worker(policy, 0u, num_points, uint64_t{0}, static_cast<uint32_t>(i));
+            });
+        } else {
+            set_curr_phase(phase);
+            uint32_t window = trace_window_points(num_threads, num_points, entries_per_pt);
+            uint64_t round = 0;
+            for (uint32_t win_begin = 0; win_begin < num_points; win_begin += window, ++round) {
+                uint32_t win_end = std::min(num_points, win_begin + window);
+                ThreadPool::shared().parallel_for(num_threads, [&](size_t i) {
+                    worker(policy, win_begin, win_end, round, static_cast<uint32_t>(i));
+                });
+                current_trace_sink().commit();
+            }
+            set_curr_phase(""); // Clear phase
+        }
+    });
+}
+
 void mt_gather_cpp(
     uint32_t num_threads,
     uint32_t num_points,
@@ -300,24 +386,31 @@ void mt_gather_cpp(
     uint32_t bulk_feat_size,
     const std::vector<int32_t>& source_masks,
     const std::vector<float>& sources,
-    std::vector<float>& gemm_buffers) {
-
-    set_curr_phase(PHASES.inverse.at(5)); // Assuming GTH is 5, needs to be added to PHASES map if not present
-                                          // Or use a new phase string e.g. "GTH_CPP" and add to PHASES
-
-    std::vector<std::thread> threads;
-    for (int i = 0; i < num_threads; ++i) {
-        threads.emplace_back(
-            gather_thread_worker_cpp,
-            i, num_threads, num_points, num_offsets, num_tiles_per_pt,
-            tile_feat_size, bulk_feat_size, std::ref(source_masks),
-            std::ref(sources), std::ref(gemm_buffers));
-    }
+    std::vector<float>& gemm_buffers,
+    FeatureMode mode) {
+    ProfileScope profile("mt_gather_cpp");
 
-    for (auto& t : threads) {
-        t.join();
+    if (bulk_feat_size == 0 || tile_feat_size % bulk_feat_size != 0) {
+        throw std::invalid_argument("tile_feat_size must be divisible by bulk_feat_size");
     }
-    set_curr_phase(""); // Clear phase
+    if (mode == FeatureMode::Auto) {
+        // Without source features the data path has nothing to copy
+        mode = sources.empty() ? FeatureMode::TraceOnly : FeatureMode::Full;
+    }
+    const bool scalar_kernels = feature_kernels::use_scalar(g_config.FEATURE_KERNELS);
+    const FeatureTraversal traversal = FeatureTraversal::from_config();
+
+    // Offset-major reads the source again for every match
+    uint64_t num_bulks = tile_feat_size / bulk_feat_size;
+    uint64_t tile_accesses = traversal.schedule == FeatureSchedule::OffsetMajor ? 2ULL * num_offsets : 1ULL + num_offsets;
+    run_feature_phase(Phase::GTH, mode, num_threads, num_points, num_tiles_per_pt * num_bulks * tile_accesses,
+        [&](auto policy, uint32_t win_begin, uint32_t win_end, uint64_t round, uint32_t i) {
+            gather_thread_worker_cpp<decltype(policy)>(
+                i, num_threads, win_begin, win_end, round * num_threads + i,
+                num_points, num_offsets, num_tiles_per_pt,
+                tile_feat_size, bulk_feat_size, traversal, source_masks,
+                sources, gemm_buffers, scalar_kernels);
+        });
 }
 
 void mt_scatter_cpp(
@@ -329,26 +422,96 @@ void mt_scatter_cpp(
     uint32_t bulk_feat_size,
     const std::vector<int32_t>& out_mask,
     const std::vector<float>& gemm_buffers,
-    std::vector<float>& outputs) {
-
-    set_curr_phase(PHASES.inverse.at(6)); // Assuming SCT is 6, needs to be added to PHASES map
-                                          // Or use a new phase string e.g. "SCT_CPP" and add to PHASES
-
-    std::vector<std::thread> threads;
-    for (int i = 0; i < num_threads; ++i) {
-        threads.emplace_back(
-            scatter_thread_worker_cpp,
-            i, num_threads, num_points, num_offsets, num_tiles_per_pt,
-            tile_feat_size, bulk_feat_size, std::ref(out_mask),
-            std::ref(gemm_buffers), std::ref(outputs));
-    }
+    std::vector<float>& outputs,
+    FeatureMode mode) {
+    ProfileScope profile("mt_scatter_cpp");
 
-    for (auto& t : threads) {
-        t.join();
+    if (bulk_feat_size == 0 || tile_feat_size % bulk_feat_size != 0) {
+        throw std::invalid_argument("tile_feat_size must be divisible by bulk_feat_size");
+    }
+    if (mode == FeatureMode::Auto) {
+        // Without GEMM results or outputs nothing is accumulated
+        mode = (gemm_buffers.empty() || outputs.empty()) ? FeatureMode::TraceOnly : FeatureMode::Full;
     }
-    set_curr_phase(""); // Clear phase
+    const bool scalar_kernels = feature_kernels::use_scalar(g_config.FEATURE_KERNELS);
+    const FeatureTraversal traversal = FeatureTraversal::from_config();
+
+    uint64_t num_bulks = tile_feat_size / bulk_feat_size;
+    run_feature_phase(Phase::SCT, mode, num_threads, num_points, 2ULL * num_offsets * num_tiles_per_pt * num_bulks,
+        [&](auto policy, uint32_t win_begin, uint32_t win_end, uint64_t round, uint32_t i) {
+            scatter_thread_worker_cpp<decltype(policy)>(
+                i, num_threads, win_begin, win_end, round * num_threads + i,
+                num_points, num_offsets, num_tiles_per_pt,
+                tile_feat_size, bulk_feat_size, traversal, out_mask,
+                gemm_buffers, outputs, scalar_kernels);
+        });
+}
+
+// --- Metadata Mask Encoding ---
+// Version 2 (METADATA_MASKS "compact") stores every mask row, out_mask rows
+// first, as one kind byte. Rows that are not empty follow it with an int32
+// base (smallest slot), a uint32 count of valid (non -1) entries, a bitmap of
+// ceil(num_sources / 64) uint64 words marking them, and their slots in
+// position order:
+//   - Prefix: none; the k-th valid entry holds base + k (the usual case,
+//     since matches are placed in query order).
+//   - Delta16: one uint16 slot - base per valid entry.
+//   - Int32: one int32 slot per valid entry.
+namespace {
+
+enum MaskRowKind : uint8_t { kMaskRowEmpty = 0, kMaskRowPrefix = 1, kMaskRowDelta16 = 2, kMaskRowInt32 = 3 };
+
+template <typename T>
+void append_value(std::vector<char> &buf, const T &value) {
+  const char *bytes = reinterpret_cast<const char *>(&value);
+  buf.insert(buf.end(), bytes, bytes + sizeof(T));
 }
 
+std::vector<char> encode_mask_row(const int32_t *row, uint32_t num_sources) {
+  std::vector<uint64_t> bitmap((num_sources + 63) / 64, 0);
+  std::vector<int32_t> values;
+  for (uint32_t p = 0; p < num_sources; ++p) {
+    if (row[p] == -1) continue;
+    bitmap[p >> 6] |= 1ULL << (p & 63);
+    values.push_back(row[p]);
+  }
+  std::vector<char> buf;
+  if (values.empty()) {
+    buf.push_back(static_cast<char>(kMaskRowEmpty));
+    return buf;
+  }
+
+  int32_t base = *std::min_element(values.begin(), values.end());
+  int64_t span = static_cast<int64_t>(*std::max_element(values.begin(), values.end())) - base;
+  bool prefix = true;
+  for (size_t k = 0; k < values.size() && prefix; ++k) {
+    prefix = static_cast<int64_t>(values[k]) == base + static_cast<int64_t>(k);
+  }
+  MaskRowKind kind = prefix ? kMaskRowPrefix : (span <= 0xFFFF ? kMaskRowDelta16 : kMaskRowInt32);
+
+  buf.push_back(static_cast<char>(kind));
+  append_value(buf, base);
+  append_value(buf, static_cast<uint32_t>(values.size()));
+  const char *bitmap_bytes = reinterpret_cast<const char *>(bitmap.data());
+  buf.insert(buf.end(), bitmap_bytes, bitmap_bytes + bitmap.size() * sizeof(uint64_t));
+  if (kind == kMaskRowDelta16) {
+    for (int32_t v : values) append_value(buf, static_cast<uint16_t>(v - base));
+  } else if (kind == kMaskRowInt32) {
+    const char *value_bytes = reinterpret_cast<const char *>(values.data());
+    buf.insert(buf.end(), value_bytes, value_bytes + values.size() * sizeof(int32_t));
+  }
+  return buf;
+}
+
+// True for METADATA_MASKS "compact" (version 2), false for "dense" (version 1)
+bool use_compact_masks(const std::string &name) {
+  if (name == "dense") return false;
+  if (name == "compact") return true;
+  throw std::invalid_argument("Unknown METADATA_MASKS: '" + name + "' (expected dense or compact)");
+}
+
+} // namespace
+
 MetadataContents read_metadata_cpp(const std::string &filename) {
   gzFile inFile = gzopen(filename.c_str(), "rb");
   if (!inFile) {
@@ -379,7 +542,7 @@ MetadataContents read_metadata_cpp(const std::string &filename) {
 
   // Read version
   read_data(&contents.version, sizeof(contents.version));
-  if (contents.version != 1) { // Assuming version 1 for now
+  if (contents.version != 1 && contents.version != 2) {
     gzclose(inFile);
     throw std::runtime_error("Unsupported metadata file version: " +
                              std::to_string(contents.version));
@@ -414,7 +577,7 @@ MetadataContents read_metadata_cpp(const std::string &filename) {
     size_t mask_elements =
         static_cast<size_t>(contents.num_total_system_offsets) *
         contents.num_total_system_sources;
-    if (mask_elements > 0) {
+    if (mask_elements > 0 && contents.version == 1) {
       contents.out_mask.resize(mask_elements);
       read_data(contents.out_mask.data(),
                 static_cast<unsigned int>(mask_elements * sizeof(int32_t)));
@@ -422,6 +585,56 @@ MetadataContents read_metadata_cpp(const std::string &filename) {
       contents.in_mask.resize(mask_elements);
       read_data(contents.in_mask.data(),
                 static_cast<unsigned int>(mask_elements * sizeof(int32_t)));
+    } else if (mask_elements > 0) {
+      // Compact rows (see encode_mask_row)
+      const uint32_t num_sources = contents.num_total_system_sources;
+      std::vector<uint64_t> bitmap((num_sources + 63) / 64);
+      std::vector<uint16_t> deltas;
+      std::vector<int32_t> values;
+      auto read_mask = [&](std::vector<int32_t> &mask) {
+        mask.assign(mask_elements, -1);
+        for (uint32_t off_idx = 0; off_idx < contents.num_total_system_offsets; ++off_idx) {
+          uint8_t kind;
+          read_data(&kind, sizeof(kind));
+          if (kind == kMaskRowEmpty) continue;
+          if (kind > kMaskRowInt32) {
+            gzclose(inFile);
+            throw std::runtime_error("Invalid metadata mask row kind: " + std::to_string(kind));
+          }
+          int32_t base;
+          uint32_t count;
+          read_data(&base, sizeof(base));
+          read_data(&count, sizeof(count));
+          read_data(bitmap.data(), static_cast<unsigned int>(bitmap.size() * sizeof(uint64_t)));
+          // The row holds one value per set bit, and no bit is set past num_sources
+          uint64_t set_bits = 0;
+          for (uint64_t word : bitmap) set_bits += __builtin_popcountll(word);
+          const bool padding_set = num_sources % 64 != 0 && (bitmap.back() >> (num_sources % 64)) != 0;
+          if (count > num_sources || set_bits != count || padding_set) {
+            gzclose(inFile);
+            throw std::runtime_error("Invalid metadata mask row: count " + std::to_string(count) +
+                                     " does not match its bitmap of " + std::to_string(num_sources) + " sources");
+          }
+          if (kind == kMaskRowDelta16) {
+            deltas.resize(count);
+            read_data(deltas.data(), static_cast<unsigned int>(count * sizeof(uint16_t)));
+          } else if (kind == kMaskRowInt32) {
+            values.resize(count);
+            read_data(values.data(), static_cast<unsigned int>(count * sizeof(int32_t)));
+          }
+          int32_t *row = mask.data() + static_cast<size_t>(off_idx) * num_sources;
+          uint32_t k = 0;
+          for (uint32_t p = 0; p < num_sources && k < count; ++p) {
+            if (!((bitmap[p >> 6] >> (p & 63)) & 1)) continue;
+            row[p] = kind == kMaskRowPrefix ? base + static_cast<int32_t>(k)
+                   : kind == kMaskRowDelta16 ? base + static_cast<int32_t>(deltas[k])
+                   : values[k];
+            ++k;
+          }
+        }
+      };
+      read_mask(contents.out_mask);
+      read_mask(contents.in_mask);
     }
   } else {
     // Handle cases where masks might be empty if num_total_system_offsets or
@@ -439,41 +652,34 @@ uint32_t write_metadata_cpp(
         &active_offset_data,
     uint32_t num_total_system_offsets, uint32_t num_total_system_sources,
     uint32_t total_slots_in_gemm_buffer, const std::string &filename) {
-  gzFile outFile = gzopen(filename.c_str(), "wb");
-  if (!outFile) {
-    throw std::runtime_error("Failed to open metadata file for writing: " +
-                             filename);
+  const bool compact = use_compact_masks(g_config.METADATA_MASKS);
+  const size_t mask_elements =
+      static_cast<size_t>(num_total_system_offsets) * num_total_system_sources;
+  if (compact && (out_mask.size() != mask_elements || in_mask.size() != mask_elements)) {
+    throw std::invalid_argument("write_metadata_cpp: masks must hold num_total_system_offsets x "
+                                "num_total_system_sources entries");
   }
+  ProfileScope profile("write_metadata_cpp", "writer");
+  profile.set_output(filename);
+  GzOutput out(filename, g_config.COMPRESS_THREADS);
 
-  uLong crc = crc32(0L, Z_NULL, 0);
-  auto write_data_and_crc = [&](const void *data, unsigned int size) {
-    if (gzwrite(outFile, data, size) != static_cast<int>(size)) {
-      gzclose(outFile);
-      throw std::runtime_error("Failed to write data to metadata gzip file.");
-    }
-    crc = crc32(crc, static_cast<const Bytef *>(data), size);
-  };
-
-  // Magic number "MINU" and version (1) - Little-endian
+  // Magic number "MINU" and version (1 dense, 2 compact masks) - Little-endian
   char magic[4] = {'M', 'I', 'N', 'U'};
-  uint32_t version = 1;
-  write_data_and_crc(magic, sizeof(magic));
-  write_data_and_crc(&version, sizeof(version));
+  uint32_t version = compact ? 2 : 1;
+  out.write(magic, sizeof(magic));
+  out.write_value(version);
 
   // Number of total system offsets and sources - Little-endian
-  write_data_and_crc(&num_total_system_offsets,
-                     sizeof(num_total_system_offsets));
-  write_data_and_crc(&num_total_system_sources,
-                     sizeof(num_total_system_sources));
+  out.write_value(num_total_system_offsets);
+  out.write_value(num_total_system_sources);
 
   // Total slots allocated for gemm buffer - Little-endian
-  write_data_and_crc(&total_slots_in_gemm_buffer,
-                     sizeof(total_slots_in_gemm_buffer));
+  out.write_value(total_slots_in_gemm_buffer);
 
   // Number of active offsets in map - Little-endian
   uint32_t num_active_offsets =
       static_cast<uint32_t>(active_offset_data.size());
-  write_data_and_crc(&num_active_offsets, sizeof(num_active_offsets));
+  out.write_value(num_active_offsets);
 
   // For each active offset: Offset key, Base address, Number of matches -
   // Little-endian
@@ -481,58 +687,104 @@ uint32_t write_metadata_cpp(
     uint32_t offset_key = std::get<0>(offset_tuple);
     uint32_t base_address = std::get<1>(offset_tuple);
     uint32_t num_matches = std::get<2>(offset_tuple);
-    write_data_and_crc(&offset_key, sizeof(offset_key));
-    write_data_and_crc(&base_address, sizeof(base_address));
-    write_data_and_crc(&num_matches, sizeof(num_matches));
+    out.write_value(offset_key);
+    out.write_value(base_address);
+    out.write_value(num_matches);
   }
   std::cout << out_mask.size() << " out_mask elements, "
             << in_mask.size() << " in_mask elements." << std::endl;
+  if (compact) {
+    // Rows are encoded independently; out_mask rows first, then in_mask rows
+    std::vector<std::vector<char>> rows(2 * static_cast<size_t>(num_total_system_offsets));
+    ThreadPool::shared().parallel_for(rows.size(), [&](size_t r) {
+      const std::vector<int32_t> &mask = r < num_total_system_offsets ? out_mask : in_mask;
+      size_t off_idx = r % num_total_system_offsets;
+      rows[r] = encode_mask_row(mask.data() + off_idx * num_total_system_sources,
+                                num_total_system_sources);
+    });
+    for (const auto &row : rows) out.write(row.data(), row.size());
+    profile.add_bytes(out.bytes_written());
+    return out.close();
+  }
+
   // Masks: Output mask, Input mask (bytes from int32 vector)
   if (!out_mask.empty()) {
-    write_data_and_crc(out_mask.data(), static_cast<unsigned int>(
-                                            out_mask.size() * sizeof(int32_t)));
+    out.write(out_mask.data(), out_mask.size() * sizeof(int32_t));
   }
   if (!in_mask.empty()) {
-    write_data_and_crc(in_mask.data(), static_cast<unsigned int>(
-                                           in_mask.size() * sizeof(int32_t)));
+    out.write(in_mask.data(), in_mask.size() * sizeof(int32_t));
   }
 
-  gzclose(outFile);
-  return static_cast<uint32_t>(crc);
+  profile.add_bytes(out.bytes_written());
+  return out.close();
 }
 
-MasksResult create_in_out_masks_cpp(const KernelMapType &kernel_map,
-                                    const std::map<uint32_t, int> &slot_dict,
+MasksResult create_in_out_masks_cpp(const KernelMapCSR &kernel_map,
+                                    const std::vector<uint64_t> &row_bases,
                                     uint32_t num_total_system_offsets,
                                     uint32_t num_total_system_sources) {
-  MasksResult result;
+  return create_in_out_masks_cpp(kernel_map, row_bases, num_total_system_offsets,
+                                 num_total_system_sources, num_total_system_sources);
+}
 
-  result.out_mask.assign(static_cast<size_t>(num_total_system_offsets) *
-                             num_total_system_sources,
-                         -1);
-  result.in_mask.assign(static_cast<size_t>(num_total_system_offsets) *
-                            num_total_system_sources,
-                        -1);
-
-  auto sorted_kmap_items =
-      kernel_map.get_sorted_items(); // Respects internal sort order
-
-  for (const auto &k_item : sorted_kmap_items) {
-    uint32_t off_idx = k_item.first;
-    const auto &matches_list =
-        k_item.second; // std::vector<std::pair<int, int>>: list of (in_idx,
-                       // q_src_idx)
-    if (matches_list.empty())
-      continue;
-
-    for (size_t match = 0; match < matches_list.size(); ++match) {
-      int in_idx = matches_list[match].first;
-      result.in_mask[off_idx * num_total_system_sources + in_idx] =
-          slot_dict.find(off_idx)->second + match;
-      int out_idx = matches_list[match].second;
-      result.out_mask[off_idx * num_total_system_sources + out_idx] =
-          slot_dict.find(off_idx)->second + match;
+MasksResult create_in_out_masks_cpp(const KernelMapCSR &kernel_map,
+                                    const std::vector<uint64_t> &row_bases,
+                                    uint32_t num_total_system_offsets,
+                                    uint32_t num_inputs, uint32_t num_outputs) {
+  ProfileScope profile("create_in_out_masks_cpp");
+  if (row_bases.size() != kernel_map.num_rows()) {
+    throw std::invalid_argument("create_in_out_masks_cpp: expected one base slot per kernel map row");
+  }
+  // Kernel map row of every offset index, -1 for offsets without matches
+  std::vector<int64_t> row_of_offset(num_total_system_offsets, -1);
+  for (size_t row = 0; row < kernel_map.num_rows(); ++row) {
+    uint32_t off_idx = kernel_map.offsets[row];
+    if (off_idx >= num_total_system_offsets) {
+      throw std::out_of_range("create_in_out_masks_cpp: offset index " + std::to_string(off_idx) +
+                              " is out of range for " + std::to_string(num_total_system_offsets) + " offsets");
     }
+    row_of_offset[off_idx] = static_cast<int64_t>(row);
   }
+
+  // Pooled; FrameTrace gives the masks back once the metadata is written
+  MasksResult result;
+  result.out_mask = BufferPool::shared().take<int32_t>(static_cast<size_t>(num_total_system_offsets) * num_outputs);
+  result.in_mask = BufferPool::shared().take<int32_t>(static_cast<size_t>(num_total_system_offsets) * num_inputs);
+  result.out_mask.resize(static_cast<size_t>(num_total_system_offsets) * num_outputs);
+  result.in_mask.resize(static_cast<size_t>(num_total_system_offsets) * num_inputs);
+
+  // One task per offset: each owns its mask rows, so tasks share no writes
+  ThreadPool::shared().parallel_for(num_total_system_offsets, [&](size_t off_idx) {
+    int32_t *out_row = result.out_mask.data() + off_idx * num_outputs;
+    int32_t *in_row = result.in_mask.data() + off_idx * num_inputs;
+    std::fill_n(out_row, num_outputs, -1);
+    std::fill_n(in_row, num_inputs, -1);
+    int64_t row = row_of_offset[off_idx];
+    if (row < 0) return;
+    int32_t base = static_cast<int32_t>(row_bases[row]);
+    // Matches are (in_idx, q_src_idx) pairs of the row's CSR range
+    for (int64_t m = kernel_map.begin[row]; m < kernel_map.begin[row + 1]; ++m) {
+      int32_t slot = base + static_cast<int32_t>(m - kernel_map.begin[row]);
+      in_row[kernel_map.in_idx[m]] = slot;
+      out_row[kernel_map.out_idx[m]] = slot;
+    }
+  });
   return result;
 }
+
+MasksResult create_in_out_masks_cpp(const KernelMapCSR &kernel_map,
+                                    const std::map<uint32_t, int> &slot_dict,
+                                    uint32_t num_total_system_offsets,
+                                    uint32_t num_total_system_sources) {
+  std::vector<uint64_t> row_bases(kernel_map.num_rows());
+  for (size_t row = 0; row < kernel_map.num_rows(); ++row) {
+    auto it = slot_dict.find(kernel_map.offsets[row]);
+    if (it == slot_dict.end()) {
+      throw std::invalid_argument("create_in_out_masks_cpp: slot_dict has no base for offset " +
+                                  std::to_string(kernel_map.offsets[row]));
+    }
+    row_bases[row] = static_cast<uint64_t>(it->second);
+  }
+  return create_in_out_masks_cpp(kernel_map, row_bases, num_total_system_offsets,
+                                 num_total_system_sources);
+}
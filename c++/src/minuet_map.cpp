@@ -1,6 +1,14 @@
 #include "minuet_map.hpp"
+#include "buffer_pool.hpp"
+#include "gz_output.hpp"
+#include "lookup_engine.hpp"
+#include "profiler.hpp"
+#include "thread_pool.hpp"
+#include "trace_context.hpp"
+#include "trace_writer.hpp"
 #include <algorithm>
 #include <cmath> // For std::ceil in progress reporting
+#include <cstring> // For std::memcpy
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -13,30 +21,68 @@
 #include <thread> // For std::thread
 #include <mutex>  // For std::mutex
 #include <atomic> // For std::atomic
+#include <memory> // For std::unique_ptr
 
-// --- Global Variable Definitions ---
-std::vector<MemoryAccessEntry> mem_trace; // Updated name
-std::string curr_phase = "";              // Updated name
-
-// --- Mutexes for threaded operations ---
-static std::mutex kmap_update_mutex;
-static std::mutex global_mem_trace_mutex;
+// The memory trace, the current phase and the open trace stream live in the
+// calling thread's TraceContext (trace_context.hpp).
 
 // --- Getter/Setter for global state and mem_trace management ---
 std::vector<MemoryAccessEntry> get_mem_trace() {
-    return mem_trace;
+    return current_trace_sink().collect();
 }
 
 void clear_mem_trace() {
-    mem_trace.clear();
+    current_trace_sink().clear();
+}
+
+// Recording filter of one phase from the TRACE_* settings. Entries without
+// a phase are only kept when TRACE_PHASES is empty.
+static TraceFilter trace_filter_for_phase(uint8_t phase_id) {
+    auto id_of = [](const bidict<std::string, int>& table, const std::string& name, const char* key) {
+        auto it = table.forward.find(name);
+        if (it == table.forward.end()) {
+            throw std::invalid_argument(std::string(key) + ": unknown name '" + name + "'");
+        }
+        return static_cast<uint8_t>(it->second);
+    };
+    TraceFilter filter;
+    if (!g_config.TRACE_TENSORS.empty()) {
+        filter.tensor_mask = 0;
+        for (const std::string& name : g_config.TRACE_TENSORS) {
+            filter.tensor_mask |= trace_id_bit(id_of(TENSORS, name, "TRACE_TENSORS"));
+        }
+    }
+    if (!g_config.TRACE_PHASES.empty()) {
+        bool traced = false;
+        for (const std::string& name : g_config.TRACE_PHASES) {
+            traced |= id_of(PHASES, name, "TRACE_PHASES") == phase_id;
+        }
+        if (!traced) filter.tensor_mask = 0;
+    }
+    filter.addr_ranges = g_config.TRACE_ADDR_RANGES;
+    filter.sample_rate = g_config.TRACE_SAMPLE_RATE;
+    filter.sample_lines = g_config.TRACE_SAMPLE_MODE == "line";
+    filter.line_bytes = g_config.TRACE_LINE_BYTES;
+    filter.coalesce = g_config.TRACE_COALESCE;
+    return filter;
 }
 
 void set_curr_phase(const std::string& phase_name) {
-    curr_phase = phase_name;
+    TraceContext& ctx = current_trace_context();
+    ctx.phase = phase_name;
+    ctx.phase_id = phase_name.empty()
+                       ? NO_PHASE_ID
+                       : static_cast<uint8_t>(PHASES.forward.at(phase_name));
+    ctx.sink.next_epoch(); // Entries of the new phase sort after the old one
+    ctx.sink.set_filter(trace_filter_for_phase(ctx.phase_id));
+}
+
+void set_curr_phase(Phase phase) {
+    set_curr_phase(PHASES.inverse.at(static_cast<int>(phase)));
 }
 
 std::string get_curr_phase() {
-    return curr_phase;
+    return current_trace_context().phase;
 }
 
 void set_debug_flag(bool debug_val) {
@@ -52,7 +98,8 @@ bool get_debug_flag() {
 // Global constant maps (matching Python names for clarity)
 // Using the bidict class defined in the header
 bidict<std::string, int>
-    PHASES({{"RDX", 0}, {"QRY", 1}, {"SRT", 2}, {"PVT", 3}, {"LKP", 4}, {"GTH", 5}, {"SCT", 6}});
+    PHASES({{"RDX", 0}, {"QRY", 1}, {"SRT", 2}, {"PVT", 3}, {"LKP", 4}, {"GTH", 5}, {"SCT", 6},
+            {"UPD", 7}}); // UPD: merge of an incremental update (update_kernel_map)
 
 bidict<std::string, int> TENSORS({
     {"I", 0},
@@ -66,6 +113,7 @@ bidict<std::string, int> TENSORS({
     {"IV", 8}, // IV_BASE is not in TENSORS, handled as string
     {"GM", 9}, // GM_BASE is not in TENSORS, handled as string
     {"WV", 10}, // WV_BASE is not in TENSORS, handled as string
+    {"HT", 11}, // Lookup hash table
     {"Unknown", 255} // Default case for unknown tensors
 });
 
@@ -79,30 +127,12 @@ bidict<std::string, int> OPS({{"R", 0}, {"W", 1}});
 
 // --- Memory Tracing Functions ---
 uint8_t addr_to_tensor(uint64_t addr) { // Renamed and return type changed
-  if (addr >= g_config.I_BASE && addr < g_config.QK_BASE)
-    return TENSORS.forward.at("I");
-  if (addr >= g_config.QK_BASE && addr < g_config.QI_BASE)
-    return TENSORS.forward.at("QK");
-  if (addr >= g_config.QI_BASE && addr < g_config.QO_BASE)
-    return TENSORS.forward.at("QI");
-  if (addr >= g_config.QO_BASE && addr < g_config.PIV_BASE)
-    return TENSORS.forward.at("QO");
-  if (addr >= g_config.PIV_BASE && addr < g_config.KM_BASE)
-    return TENSORS.forward.at("PIV");
-  if (addr >= g_config.KM_BASE && addr < g_config.WO_BASE)
-    return TENSORS.forward.at("KM");
-  if (addr >= g_config.WO_BASE && addr < g_config.IV_BASE) // Assuming WO_BASE is for "WC" (Weight Cache/Compatible)
-    return TENSORS.forward.at("WC");
-  if (addr >= g_config.IV_BASE && addr < g_config.GM_BASE)
-    return TENSORS.forward.at("IV");
-  if (addr >= g_config.GM_BASE && addr < g_config.WV_BASE)
-    return TENSORS.forward.at("GM");
-  // Ensure WV_BASE range check is appropriate, e.g., WV_BASE + some_size
-  // Using a large enough range for WV as an example.
-  if (addr >= g_config.WV_BASE && (addr < g_config.WV_BASE + (2ULL << 32))) // Example range for WV
-    return TENSORS.forward.at("WV");
-  
-  return TENSORS.forward.at("Unknown"); // Default if no range matches
+  // Region table is built from the *_BASE fields by MinuetConfig
+  return g_config.classify(addr);
+}
+
+void addr_to_tensor(const uint64_t *addrs, size_t count, uint8_t *tensors_out) {
+  g_config.classify(addrs, count, tensors_out);
 }
 
 std::string addr_to_tensor_str(uint64_t addr) {
@@ -115,178 +145,316 @@ std::string addr_to_tensor_str(uint64_t addr) {
 }
 
 
-uint32_t write_gmem_trace(const std::string &filename, int sizeof_addr /* = 4 */) { // Added sizeof_addr parameter
-  gzFile outFile = gzopen(filename.c_str(), "wb");
-  if (!outFile) {
-    throw std::runtime_error("Failed to open file for writing: " + filename);
-  }
+// Trace layout selected by TRACE_FORMAT / TRACE_COLUMNAR
+static TraceFormat gmem_trace_format(int sizeof_addr) {
+  TraceFormat fmt;
+  fmt.sizeof_addr = sizeof_addr;
+  fmt.version = static_cast<uint8_t>(g_config.TRACE_FORMAT);
+  fmt.columnar = g_config.TRACE_COLUMNAR;
+  fmt.counts = g_config.TRACE_COALESCE; // Coalesced entries carry their access count
+  return fmt;
+}
 
-  if (sizeof_addr != 4 && sizeof_addr != 8) {
-    gzclose(outFile);
-    throw std::invalid_argument("sizeof_addr must be 4 or 8, got: " + std::to_string(sizeof_addr));
+uint32_t write_gmem_trace(const std::string &filename, int sizeof_addr /* = 4 */) { // Added sizeof_addr parameter
+  ProfileScope profile("write_gmem_trace", "writer");
+  profile.set_output(filename);
+  TraceFormat fmt = gmem_trace_format(sizeof_addr);
+  trace_format::validate(fmt);
+
+  GzOutput out(filename, g_config.COMPRESS_THREADS, fmt.compressed());
+  auto write_bytes = [&](const std::vector<uint8_t> &bytes) {
+      out.write(bytes.data(), bytes.size());
+  };
+  std::vector<TraceBlockIndex> index; // Version 3
+
+  const size_t total_entries = current_trace_sink().size();
+  std::vector<uint8_t> bytes;
+  if (fmt.version == 1) {
+    uint32_t num_entries = static_cast<uint32_t>(total_entries);
+    bytes.resize(sizeof(num_entries));
+    std::memcpy(bytes.data(), &num_entries, sizeof(num_entries));
+  } else {
+    bytes = trace_format::stream_header(fmt);
   }
-
-  uLong crc = crc32(0L, Z_NULL, 0);
-  auto write_and_crc = [&](const void* data, unsigned int len) {
-      if (gzwrite(outFile, data, len) != static_cast<int>(len)) {
-          gzclose(outFile);
-          throw std::runtime_error("Failed to write data to gzip file during gmem trace.");
-      }
-      crc = crc32(crc, static_cast<const Bytef*>(data), len);
+  write_bytes(bytes);
+
+  // Entries are staged into fixed-size blocks, so the bytes match a streamed file of the same format.
+  std::vector<MemoryAccessEntry> block;
+  block.reserve(trace_format::BLOCK_ENTRIES);
+  auto flush_block = [&]() {
+    bytes.clear();
+    if (fmt.version == 1) {
+      trace_format::append_rows(block.data(), block.size(), sizeof_addr, bytes);
+    } else {
+      trace_format::append_block(block.data(), block.size(), fmt, bytes);
+    }
+    if (fmt.version == 3) {
+      index.push_back(trace_format::index_block(block.data(), block.size(), out.bytes_written()));
+    }
+    write_bytes(bytes);
+    block.clear();
   };
-
-  uint32_t num_entries = static_cast<uint32_t>(mem_trace.size());
-  write_and_crc(&num_entries, sizeof(num_entries));
-
-  for (const auto &entry : mem_trace) {
-    // Directly use the uint8_t fields from MemoryAccessEntry
-    uint8_t phase_val = entry.phase;
-    uint8_t tid_val = entry.thread_id;
-    uint8_t op_val = entry.op;
-    uint8_t tensor_val = entry.tensor;
-    // Cast address to uint32_t for writing, as per original compressed format
-    // uint32_t addr_val = static_cast<uint32_t>(entry.addr); 
-
-    write_and_crc(&phase_val, sizeof(phase_val));
-    write_and_crc(&tid_val, sizeof(tid_val));
-    write_and_crc(&op_val, sizeof(op_val));
-    write_and_crc(&tensor_val, sizeof(tensor_val));
-    // write_and_crc(&addr_val, sizeof(addr_val));
-    if (sizeof_addr == 4) {
-        uint32_t addr_val_32 = static_cast<uint32_t>(entry.addr);
-        write_and_crc(&addr_val_32, sizeof(addr_val_32));
-    } else { // sizeof_addr == 8
-        uint64_t addr_val_64 = entry.addr;
-        write_and_crc(&addr_val_64, sizeof(addr_val_64));
+  current_trace_sink().for_each_span([&](const MemoryAccessEntry *data, size_t len) {
+    while (len > 0) {
+      size_t take = std::min(len, trace_format::BLOCK_ENTRIES - block.size());
+      block.insert(block.end(), data, data + take);
+      data += take;
+      len -= take;
+      if (block.size() == trace_format::BLOCK_ENTRIES) flush_block();
     }
+  });
+  if (!block.empty()) flush_block();
+  if (fmt.version >= 2) {
+    write_bytes(trace_format::stream_footer(total_entries));
   }
-  gzclose(outFile);
+  if (fmt.version == 3) {
+    write_bytes(trace_format::index_trailer(index, out.bytes_written()));
+  }
+  profile.add_bytes(out.bytes_written());
+  uint32_t crc = out.close();
 
   std::cout << "Memory trace written to " << filename << std::endl;
-  std::cout << "Collected " << mem_trace.size() << " entries" << std::endl; 
-  return static_cast<uint32_t>(crc);
+  std::cout << "Collected " << total_entries << " entries" << std::endl; 
+  return crc;
+}
+
+void begin_gmem_trace_stream(const std::string &filename, int sizeof_addr /* = 4 */) {
+  TraceContext &ctx = current_trace_context();
+  if (ctx.stream) {
+    throw std::runtime_error("A gmem trace stream is already open: " + ctx.stream->filename());
+  }
+  ctx.stream = std::make_unique<TraceStreamWriter>(filename, gmem_trace_format(sizeof_addr),
+                                                   g_config.COMPRESS_THREADS);
+  ctx.sink.attach(ctx.stream.get(), g_config.TRACE_BUFFER_ENTRIES);
+}
+
+uint32_t end_gmem_trace_stream() {
+  TraceContext &ctx = current_trace_context();
+  if (!ctx.stream) {
+    throw std::runtime_error("No gmem trace stream is open.");
+  }
+  ctx.sink.drain(); // Entries recorded since the last phase change
+  ctx.sink.attach(nullptr, 0);
+  std::unique_ptr<TraceStreamWriter> stream = std::move(ctx.stream);
+  ProfileScope profile("end_gmem_trace_stream", "writer");
+  profile.set_output(stream->filename());
+  profile.set("trace_entries", static_cast<double>(stream->entries_written()));
+  return stream->close();
 }
 
 void clear_global_mem_trace() {
-    mem_trace.clear();
+    current_trace_sink().clear();
 }
 
 void record_access(int thread_id, const std::string &op_str, uint64_t addr) {
-  std::lock_guard<std::mutex> lock(global_mem_trace_mutex);
-  uint8_t phase_id = PHASES.forward.at(curr_phase);
+  TraceContext &ctx = current_trace_context();
+  uint8_t phase_id = ctx.phase_id;
   uint8_t op_id = OPS.forward.at(op_str);
   uint8_t tensor_id = addr_to_tensor(addr); // Use the new function returning uint8_t
   
-  mem_trace.push_back({phase_id, static_cast<uint8_t>(thread_id), op_id, tensor_id, addr});
+  ctx.sink.record({phase_id, static_cast<uint8_t>(thread_id), op_id, tensor_id, 1, addr});
 }
 
 // --- Algorithm Phases ---
-// Radix Sort (Simplified: only records accesses, actual sort not fully
-// implemented for brevity) Matches Python's radix_sort_with_memtrace which
-// focuses on memory access patterns.
-std::vector<uint32_t> radix_sort_with_memtrace(std::vector<uint32_t> &arr,
-                                               uint64_t base_addr) {
-  const int passes = 4;
-  size_t N = arr.size();
-  if (N == 0)
-    return arr;
-
-  // std::vector<uint32_t> aux(N); // Conceptually for sorting
+// Stable LSD radix sort of (key, value) pairs: one 8-bit pass per key byte
+// (four for uint32_t keys, eight for uint64_t), each split
+// into NUM_THREADS contiguous chunks that run on the thread pool. Chunk t is
+// simulated thread t in every stage. Per pass:
+//   1. histogram: chunk t reads its keys and writes its 256 digit counts,
+//   2. scan: thread 0 turns the counts into output offsets (digit-major),
+//   3. scatter: chunk t reads its offsets, then moves each pair.
+// The arrays live at base_addr: keys, alternate keys, values, alternate
+// values, then the 256 x NUM_THREADS counters, all tagged I. An even number
+// of passes leaves the result in the first key array. With dedup, the final
+// scatter only writes the first pair of every key (first in input order).
+template <typename Key>
+void radix_sort_with_memtrace(std::vector<Key> &keys, std::vector<int> &values,
+                              uint64_t base_addr, bool dedup) {
+  constexpr int passes = sizeof(Key);
+  constexpr size_t RADIX = 256;
+  const size_t N = keys.size();
+  if (values.size() != N) {
+    throw std::invalid_argument("radix_sort_with_memtrace: keys and values differ in size");
+  }
+  if (N == 0) return;
+
+  const size_t T = std::max<uint32_t>(1, g_config.NUM_THREADS);
+  const uint64_t key_bytes = g_config.SIZE_KEY, int_bytes = g_config.SIZE_INT;
+  const uint64_t key_addr[2] = {base_addr, base_addr + N * key_bytes};
+  const uint64_t val_addr[2] = {base_addr + 2 * N * key_bytes,
+                                base_addr + 2 * N * key_bytes + N * int_bytes};
+  const uint64_t hist_addr = val_addr[1] + N * int_bytes;
+  auto chunk_begin = [&](size_t t) { return N * t / T; };
+
+  // The alternate arrays come from the buffer pool and go back to it
+  BufferPool &buffers = BufferPool::shared();
+  std::vector<Key> key_buf[2] = {std::move(keys), buffers.take<Key>(N)};
+  std::vector<int> val_buf[2] = {std::move(values), buffers.take<int>(N)};
+  key_buf[1].resize(N);
+  val_buf[1].resize(N);
+  // Per (chunk, digit): element count, then output offset
+  std::vector<uint64_t> counts(T * RADIX);
+  // Final pass with dedup: first / last key of each (chunk, digit) and
+  // whether the first one repeats the last key of an earlier chunk
+  std::vector<Key> first_key, last_key;
+  std::vector<uint8_t> first_dup;
+  ThreadPool &pool = ThreadPool::shared();
+  size_t out_count = N;
 
   for (int p = 0; p < passes; ++p) {
-    // Simulate the part of radix sort that builds the auxiliary array.
-    // Python's version:
-    // for i in range(N - 1, -1, -1):
-    //     record_access(t_id, "R", base + i*SIZE_KEY) // First read
-    //     val = arr[i]
-    //     # ... logic to get byte_val and target aux_idx using counts ...
-    //     record_access(t_id, "R", base + i*SIZE_KEY) // Second read (of arr[i]
-    //     / val) aux[aux_idx] = val record_access(t_id, 'W', base +
-    //     aux_idx*SIZE_KEY) // Write to aux
-
-    // We simulate N elements being processed.
-    for (size_t i = 0; i < N; ++i) {
-      int t_id = static_cast<int>(i % g_config.NUM_THREADS);
-      // First read of an element from arr
-      record_access(t_id,
-        "R", base_addr + i * g_config.SIZE_KEY); // "R"
+    const int shift = 8 * p;
+    const int src = p & 1, dst = src ^ 1;
+    const bool fuse_dedup = dedup && p == passes - 1;
+    const uint64_t lane_base = static_cast<uint64_t>(p) * 3 * T;
+    auto digit = [shift](Key key) { return static_cast<size_t>(key >> shift) & (RADIX - 1); };
+    if (fuse_dedup) {
+      first_key.assign(T * RADIX, 0);
+      last_key.assign(T * RADIX, 0);
+      first_dup.assign(T * RADIX, 0);
     }
-    for (size_t i = 0; i < N; ++i) {
-      int t_id = static_cast<int>(i % g_config.NUM_THREADS);
-      // Second read of the same element from arr
-      record_access(t_id, 
-        "R", base_addr + i * g_config.SIZE_KEY); // "R"
-
-      // Write to auxiliary array (simulated position)
-      // In a real sort, this write would be to aux[calculated_pos]
-      // For simulation, we record a write to a conceptual 'aux' region,
-      // using 'i' as a proxy for calculated_pos to ensure N writes.
-      // The base address for aux is assumed to be the same as arr for this
-      // trace.
-      record_access(t_id, OPS.inverse.at(1), base_addr + i * g_config.SIZE_KEY); // "W"
+
+    // 1. Histogram
+    pool.parallel_for(T, [&](size_t t) {
+      current_trace_sink().set_lane(lane_base + t);
+      uint64_t *count = &counts[t * RADIX];
+      std::fill(count, count + RADIX, 0);
+      for (size_t i = chunk_begin(t); i < chunk_begin(t + 1); ++i) {
+        record_access<Op::R, Tensor::I>(static_cast<int>(t), key_addr[src] + i * key_bytes);
+        Key key = key_buf[src][i];
+        size_t d = digit(key);
+        if (fuse_dedup) {
+          // Count only the first of each run of equal keys within the digit
+          size_t cell = t * RADIX + d;
+          if (count[d] == 0) {
+            first_key[cell] = key;
+          } else if (last_key[cell] == key) {
+            continue;
+          }
+          last_key[cell] = key;
+        }
+        ++count[d];
+      }
+      for (size_t d = 0; d < RADIX; ++d) {
+        record_access<Op::W, Tensor::I>(static_cast<int>(t), hist_addr + (d * T + t) * int_bytes);
+      }
+    });
+    current_trace_sink().commit();
+
+    // 2. Exclusive scan in (digit, chunk) order
+    current_trace_sink().set_lane(lane_base + T);
+    uint64_t running = 0;
+    for (size_t d = 0; d < RADIX; ++d) {
+      bool have_last = false;
+      Key prev_key = 0;
+      for (size_t t = 0; t < T; ++t) {
+        size_t cell = t * RADIX + d;
+        record_access<Op::R, Tensor::I>(0, hist_addr + (d * T + t) * int_bytes);
+        uint64_t n = counts[cell];
+        if (fuse_dedup && n > 0) {
+          if (have_last && first_key[cell] == prev_key) {
+            first_dup[cell] = 1;
+            --n;
+          }
+          have_last = true;
+          prev_key = last_key[cell];
+        }
+        counts[cell] = running;
+        running += n;
+        record_access<Op::W, Tensor::I>(0, hist_addr + (d * T + t) * int_bytes);
+      }
     }
-    // arr, aux = aux, arr // Conceptually, data is swapped or copied back
-    // If arr is swapped with aux, the next pass reads from what was aux.
-    // The base address remains 'base_addr' for tracing purposes of this logical
-    // array.
+    if (fuse_dedup) out_count = running;
+    current_trace_sink().commit();
+
+    // 3. Scatter
+    pool.parallel_for(T, [&](size_t t) {
+      current_trace_sink().set_lane(lane_base + 2 * T + t);
+      const int tid = static_cast<int>(t);
+      for (size_t d = 0; d < RADIX; ++d) {
+        record_access<Op::R, Tensor::I>(tid, hist_addr + (d * T + t) * int_bytes);
+      }
+      uint64_t *offset = &counts[t * RADIX];
+      std::vector<uint8_t> seen(fuse_dedup ? RADIX : 0);
+      std::vector<Key> prev(fuse_dedup ? RADIX : 0);
+      for (size_t i = chunk_begin(t); i < chunk_begin(t + 1); ++i) {
+        record_access<Op::R, Tensor::I>(tid, key_addr[src] + i * key_bytes);
+        Key key = key_buf[src][i];
+        size_t d = digit(key);
+        if (fuse_dedup) {
+          bool dup = seen[d] ? (prev[d] == key) : (first_dup[t * RADIX + d] != 0);
+          seen[d] = 1;
+          prev[d] = key;
+          if (dup) continue;
+        }
+        record_access<Op::R, Tensor::I>(tid, val_addr[src] + i * int_bytes);
+        uint64_t pos = offset[d]++;
+        key_buf[dst][pos] = key;
+        val_buf[dst][pos] = val_buf[src][i];
+        record_access<Op::W, Tensor::I>(tid, key_addr[dst] + pos * key_bytes);
+        record_access<Op::W, Tensor::I>(tid, val_addr[dst] + pos * int_bytes);
+      }
+    });
+    current_trace_sink().commit();
   }
-  return arr;
+
+  keys = std::move(key_buf[passes & 1]);
+  values = std::move(val_buf[passes & 1]);
+  keys.resize(out_count);
+  values.resize(out_count);
+  buffers.give(std::move(key_buf[1 - (passes & 1)]));
+  buffers.give(std::move(val_buf[1 - (passes & 1)]));
 }
 
+template void radix_sort_with_memtrace(std::vector<uint32_t> &, std::vector<int> &, uint64_t, bool);
+template void radix_sort_with_memtrace(std::vector<uint64_t> &, std::vector<int> &, uint64_t, bool);
+
 std::vector<IndexedCoord>
 compute_unique_sorted_coords(const std::vector<Coord3D> &in_coords,
                              int stride) {
-  curr_phase = PHASES.inverse.at(0); // "RDX"
-
-  std::vector<std::pair<uint32_t, int>>
-      idx_keys_pairs; // Stores (key, original_index)
-  idx_keys_pairs.reserve(in_coords.size());
-
-  for (size_t idx = 0; idx < in_coords.size(); ++idx) {
-    const auto &coord = in_coords[idx];
-    // Python: record_access(idx % NUM_THREADS, 'W', I_BASE + idx * SIZE_KEY)
-    // This write is for the initial list of idx_keys before sorting.
-    // Let's assume I_BASE is the start of a conceptual array for these packed
-    // keys. record_access(static_cast<int>(idx % NUM_THREADS),
-    // OPS.inverse.at(1), g_config.I_BASE + idx * g_config.SIZE_KEY); // "W"
-    Coord3D qtz_coord = coord.quantized(stride);
-    idx_keys_pairs.emplace_back(qtz_coord.to_key(), static_cast<int>(idx));
-  }
+  ProfileScope profile("compute_unique_sorted_coords");
+  return compute_unique_sorted_keys(pack_coord_keys(in_coords, stride));
+}
 
-  // Extract raw keys for memory trace simulation of radix sort
-  std::vector<uint32_t> raw_keys;
-  raw_keys.reserve(idx_keys_pairs.size());
-  for (const auto &pair : idx_keys_pairs) {
-    raw_keys.push_back(pair.first);
-  }
-  // The base address for radix sort in Python is I_BASE.
-  radix_sort_with_memtrace(raw_keys, g_config.I_BASE);
-
-  // Sort idx_keys_pairs by key, preserving original index for tie-breaking
-  // (std::stable_sort if needed) Python's `sorted(idx_keys, key=lambda item:
-  // item[0])` is stable.
-  std::stable_sort(
-      idx_keys_pairs.begin(), idx_keys_pairs.end(),
-      [](const auto &a, const auto &b) { return a.first < b.first; });
-
-  std::vector<IndexedCoord> uniq_coords_vec; // Renamed from uniq_coords
-  if (idx_keys_pairs.empty()) {
-    return uniq_coords_vec;
+template <typename Key>
+std::vector<Key> pack_coord_keys(const std::vector<Coord3D> &in_coords,
+                                 int stride) {
+  // Python: record_access(idx % NUM_THREADS, 'W', I_BASE + idx * SIZE_KEY)
+  // This write is for the initial list of idx_keys before sorting; it is
+  // not recorded.
+  std::vector<Key> keys = BufferPool::shared().take<Key>(in_coords.size());
+  for (const auto &coord : in_coords) {
+    keys.push_back(coord.quantized(stride).to_key<Key>());
   }
+  return keys;
+}
 
-  uint32_t last_key = idx_keys_pairs[0].first;
-  int orig_idx_from_input = idx_keys_pairs[0].second;
-  uniq_coords_vec.emplace_back(Coord3D::from_key(last_key),
-                               orig_idx_from_input);
-
-  for (size_t i = 1; i < idx_keys_pairs.size(); ++i) {
-    if (idx_keys_pairs[i].first != last_key) {
-      last_key = idx_keys_pairs[i].first;
-      orig_idx_from_input = idx_keys_pairs[i].second;
-      uniq_coords_vec.emplace_back(Coord3D::from_key(last_key),
-                                   orig_idx_from_input);
-    }
+template std::vector<uint32_t> pack_coord_keys(const std::vector<Coord3D> &, int);
+template std::vector<uint64_t> pack_coord_keys(const std::vector<Coord3D> &, int);
+
+template <typename Key>
+std::vector<BasicIndexedCoord<Key>>
+compute_unique_sorted_keys(std::vector<Key> sorted_keys) {
+  ProfileScope profile("compute_unique_sorted_keys");
+  profile.set("points", static_cast<double>(sorted_keys.size()));
+  set_curr_phase(Phase::RDX);
+
+  // Radix sort the (key, original index) pairs by key; the fused dedup keeps
+  // the first occurrence of each key, like Python's stable sorted() followed
+  // by its dedup loop. The base address for radix sort in Python is I_BASE.
+  BufferPool &buffers = BufferPool::shared();
+  std::vector<int> sorted_idx = buffers.take<int>(sorted_keys.size());
+  sorted_idx.resize(sorted_keys.size());
+  std::iota(sorted_idx.begin(), sorted_idx.end(), 0);
+  radix_sort_with_memtrace(sorted_keys, sorted_idx, g_config.I_BASE, true);
+
+  // Owners give the result back to the pool when done (see KernelMapCache)
+  std::vector<BasicIndexedCoord<Key>> uniq_coords_vec = // Renamed from uniq_coords
+      buffers.take<BasicIndexedCoord<Key>>(sorted_keys.size());
+  for (size_t i = 0; i < sorted_keys.size(); ++i) {
+    uniq_coords_vec.emplace_back(sorted_keys[i], sorted_idx[i]);
   }
+  buffers.give(std::move(sorted_keys));
+  buffers.give(std::move(sorted_idx));
 
   if (g_config.debug) {
     std::cout << "Unique sorted coordinates (count: " << uniq_coords_vec.size()
@@ -300,11 +468,15 @@ compute_unique_sorted_coords(const std::vector<Coord3D> &in_coords,
   return uniq_coords_vec;
 }
 
+template std::vector<IndexedCoord> compute_unique_sorted_keys(std::vector<uint32_t>);
+template std::vector<IndexedCoord64> compute_unique_sorted_keys(std::vector<uint64_t>);
+
 BuildQueriesResult
 build_coordinate_queries(const std::vector<IndexedCoord> &uniq_coords,
                          int stride, // stride is not used in python version
                          const std::vector<Coord3D> &off_coords) {
-  curr_phase = PHASES.inverse.at(1); // "QRY"
+  ProfileScope profile("build_coordinate_queries");
+  set_curr_phase(Phase::QRY);
   size_t num_inputs = uniq_coords.size();
   size_t num_offsets = off_coords.size();
   size_t total_queries = num_inputs * num_offsets;
@@ -349,13 +521,15 @@ build_coordinate_queries(const std::vector<IndexedCoord> &uniq_coords,
   return result;
 }
 
-TilesPivotsResult
-create_tiles_and_pivots(const std::vector<IndexedCoord> &uniq_coords,
+template <typename Key>
+BasicTilesPivotsResult<Key>
+create_tiles_and_pivots(const std::vector<BasicIndexedCoord<Key>> &uniq_coords,
                         int tile_size_param) // Renamed from tile_size to avoid
                                              // conflict with local var
 {
-  curr_phase = PHASES.inverse.at(3); // "PVT"
-  TilesPivotsResult result;
+  ProfileScope profile("create_tiles_and_pivots");
+  set_curr_phase(Phase::PVT);
+  BasicTilesPivotsResult<Key> result;
   int current_tile_size = tile_size_param;
 
   if (uniq_coords.empty()) {
@@ -381,11 +555,8 @@ create_tiles_and_pivots(const std::vector<IndexedCoord> &uniq_coords,
   for (size_t start = 0; start < uniq_coords.size();
        start += current_tile_size) {
     size_t end = std::min(start + current_tile_size, uniq_coords.size());
-    std::vector<IndexedCoord> current_tile;
-    current_tile.reserve(end - start);
-    for (size_t i = start; i < end; ++i) {
-      current_tile.push_back(uniq_coords[i]);
-   }
+    // A tile is a span of the sorted inputs; nothing is copied but the pivot
+    BasicCoordSpan<Key> current_tile(uniq_coords.data() + start, end - start);
     result.tiles.push_back(current_tile);
 
     // Pivot selection (simplified: first element of the tile)
@@ -393,7 +564,7 @@ create_tiles_and_pivots(const std::vector<IndexedCoord> &uniq_coords,
       result.pivots.push_back(current_tile[0]);
       // Write pivot to PIV_BASE (simulated)
       // Python: record_access(start % NUM_THREADS, 'W', PIV_BASE + (result.pivots.size()-1) * SIZE_KEY)
-      record_access(0, "W", g_config.PIV_BASE + (result.pivots.size() - 1) * g_config.SIZE_KEY); // "W"
+      record_access<Op::W, Tensor::PIV>(0, g_config.PIV_BASE + (result.pivots.size() - 1) * g_config.SIZE_KEY);
     }
   }
 
@@ -413,6 +584,10 @@ create_tiles_and_pivots(const std::vector<IndexedCoord> &uniq_coords,
   }
   return result;
 }
+
+template TilesPivotsResult create_tiles_and_pivots(const std::vector<IndexedCoord> &, int);
+template BasicTilesPivotsResult<uint64_t> create_tiles_and_pivots(const std::vector<IndexedCoord64> &, int);
+
 KernelMapType perform_coordinate_lookup(
     const std::vector<IndexedCoord> &uniq_coords,
     const std::vector<IndexedCoord> &qry_keys,
@@ -420,180 +595,212 @@ KernelMapType perform_coordinate_lookup(
     const std::vector<Coord3D> &wt_offsets, // wt_offsets is not directly used in Python lookup logic for kmap values
     const std::vector<std::vector<IndexedCoord>> &tiles,
     const std::vector<IndexedCoord> &pivs, int tile_size_param) {
+    // Tiles passed from Python are separate lists; the spans point into them
+    std::vector<CoordSpan> tile_spans(tiles.begin(), tiles.end());
+    return perform_coordinate_lookup(uniq_coords, QueryView(qry_keys, qry_in_idx, qry_off_idx),
+                                     tile_spans, pivs, tile_size_param);
+}
 
-    set_curr_phase(PHASES.inverse.at(4)); // "LKP"
-    KernelMapType kmap(false); // false for descending order (longest match list first)
-    
-    if (uniq_coords.empty() || qry_keys.empty()) {
-        return kmap;
+template <typename Key>
+KernelMapType perform_coordinate_lookup(
+    const std::vector<BasicIndexedCoord<Key>> &uniq_coords, const BasicQueryView<Key> &queries,
+    const std::vector<BasicCoordSpan<Key>> &tiles,
+    const std::vector<BasicIndexedCoord<Key>> &pivs, int tile_size_param) {
+    ProfileScope profile("perform_coordinate_lookup");
+    profile.set("queries", static_cast<double>(queries.size()));
+    set_curr_phase(Phase::LKP);
+
+    if (uniq_coords.empty() || queries.empty()) {
+        return KernelMapCSR();
     }
 
-    std::atomic<uint64_t> kmap_write_idx_atomic{0}; // Atomic counter for KM write simulation
-
-    const size_t qry_count = qry_keys.size();
-    const int BATCH_SIZE = 128; // As in Python
+    const size_t qry_count = queries.size();
+    const size_t BATCH_SIZE = std::max<uint32_t>(1, g_config.LKP_BATCH_SIZE);
     const size_t num_batches = (qry_count + BATCH_SIZE - 1) / BATCH_SIZE;
     unsigned int num_hw_threads = g_config.NUM_THREADS; // Use configured NUM_THREADS
+    ThreadPool &pool = ThreadPool::shared();
 
-    std::cout << "Starting LKP phase with " << num_hw_threads << " threads, "
-              << num_batches << " batches." << std::endl;
+    LookupInputs<Key> lookup_inputs{uniq_coords, queries, tiles, pivs, tile_size_param};
+    std::unique_ptr<LookupEngine<Key>> engine = make_lookup_engine(g_config.LOOKUP_ENGINE, lookup_inputs);
 
-    for (size_t batch_idx = 0; batch_idx < num_batches; ++batch_idx) {
-        size_t batch_start = batch_idx * BATCH_SIZE;
-        size_t current_batch_size = std::min(static_cast<size_t>(BATCH_SIZE), qry_count - batch_start);
+    // Batches per pool dispatch. Without a trace stream all batches go in one
+    // dispatch; with one, a window records about stream_budget() entries.
+    size_t window_batches = num_batches;
+    if (size_t budget = current_trace_sink().stream_budget()) {
+        size_t entries_per_batch = BATCH_SIZE * engine->entries_per_query();
+        window_batches = std::min(num_batches, std::max<size_t>(1, budget / entries_per_batch));
+    }
 
-        if (current_batch_size <= 0) break;
+    std::cout << "Starting LKP phase (" << engine->name() << " engine) with " << num_hw_threads
+              << " threads, " << num_batches << " batches on " << pool.size() << " workers." << std::endl;
+    engine->build(); // Recorded on lane 0, before every batch
+    current_trace_sink().commit();
 
-        std::vector<std::thread> threads_pool;
+    // Query range of the (batch, tid) portion; empty when the batch has
+    // fewer queries than threads.
+    auto portion_range = [&](size_t batch_idx, unsigned int tid) {
+        size_t batch_start = batch_idx * BATCH_SIZE;
+        size_t current_batch_size = std::min(BATCH_SIZE, qry_count - batch_start);
         size_t portion_size = (current_batch_size + num_hw_threads - 1) / num_hw_threads;
-
-        for (unsigned int tid = 0; tid < num_hw_threads; ++tid) {
-            size_t thread_start_in_batch = tid * portion_size;
-            size_t thread_end_in_batch = std::min(thread_start_in_batch + portion_size, current_batch_size);
-
-            if (thread_start_in_batch < current_batch_size) {
-                threads_pool.emplace_back([&, batch_start, tid, thread_start_in_batch, thread_end_in_batch]() {
-                    std::vector<MemoryAccessEntry> local_thread_mem_trace;
-                    auto record_access_local = 
-                        [&](int t_id, const std::string& op_str, uint64_t addr_val) {
-                        uint8_t phase_id = PHASES.forward.at(get_curr_phase());
-                        uint8_t op_id = OPS.forward.at(op_str);
-                        uint8_t tensor_id = addr_to_tensor(addr_val);
-                        local_thread_mem_trace.push_back({phase_id, static_cast<uint8_t>(t_id), op_id, tensor_id, addr_val});
-                    };
-
-                    for (size_t qry_offset_in_batch = thread_start_in_batch; qry_offset_in_batch < thread_end_in_batch; ++qry_offset_in_batch) {
-                        size_t q_glob_idx = batch_start + qry_offset_in_batch;
-                        if (q_glob_idx >= qry_count) continue;
-
-                        const auto &q_key_item = qry_keys[q_glob_idx];
-                        uint32_t current_query_key = q_key_item.to_key();
-                        int query_original_src_idx = q_key_item.orig_idx; // Original index of the source point that generated this query
-                        int current_query_offset_list_idx = qry_off_idx[q_glob_idx]; // Index into the original off_coords list
-
-                        // 1. Read query key
-                        record_access_local(tid, 
-                          "R", // "R"
-                                      g_config.QK_BASE + q_glob_idx * g_config.SIZE_KEY);
-
-                        // 2. Simulate Python's find_tile_id (binary search on pivs)
-                        int target_tile_id = -1;
-                        if (!pivs.empty()) {
-                            int low = 0, high = static_cast<int>(pivs.size()) - 1;
-                            target_tile_id = 0; 
-                            while (low <= high) {
-                                int mid = low + (high - low) / 2;
-                                record_access_local(tid, 
-                                  "R", // "R" pivot
-                                              g_config.PIV_BASE + mid * g_config.SIZE_KEY);
-                                if (pivs[mid].to_key() <= current_query_key) {
-                                    target_tile_id = mid;
-                                    low = mid + 1;
-                                } else {
-                                    high = mid - 1;
-                                }
-                            }
-                        }
-                        
-                        // 3. Simulate Python's search_in_tile
-                        if (target_tile_id != -1 && target_tile_id < static_cast<int>(tiles.size())) {
-                            const auto &current_tile_vec = tiles[target_tile_id];
-                            // Python version does linear scan in tile; C++ can do binary search if tile is sorted
-                            // For now, matching Python's linear scan for trace consistency
-                            for (size_t local_idx_in_tile = 0; local_idx_in_tile < current_tile_vec.size(); ++local_idx_in_tile) {
-                                const auto& tile_indexed_coord = current_tile_vec[local_idx_in_tile];
-                                size_t approx_tile_element_orig_idx = static_cast<size_t>(target_tile_id * tile_size_param + local_idx_in_tile);
-                                if (approx_tile_element_orig_idx >= uniq_coords.size()) {
-                                     approx_tile_element_orig_idx = uniq_coords.empty() ? 0 : uniq_coords.size() - 1;
-                                }
-                                record_access_local(tid, 
-                                  "R", // "R" from TILE
-                                              g_config.TILE_BASE + approx_tile_element_orig_idx * g_config.SIZE_KEY);
-
-                                if (tile_indexed_coord.to_key() == current_query_key) {
-                                    // Match found
-                                    int input_idx_from_uniq_coords = tile_indexed_coord.orig_idx; // This is the original index from the initial input coordinates
-
-                                    { // Lock kmap for update
-                                        std::lock_guard<std::mutex> lock(kmap_update_mutex);
-                                        kmap[current_query_offset_list_idx].emplace_back(input_idx_from_uniq_coords, query_original_src_idx);
-                                    }
-                                    
-                                    // Record write to kernel map simulation
-                                    uint64_t current_kmap_write_offset = kmap_write_idx_atomic.fetch_add(1);
-                                    record_access_local(tid, OPS.inverse.at(1), // "W"
-                                                  g_config.KM_BASE + current_kmap_write_offset * g_config.SIZE_INT);
-                                    break; 
-                                }
-                            }
-                        }
-                    } // end for qry_offset_in_batch
-
-                    // Merge local trace to global trace
-                    if (!local_thread_mem_trace.empty()) {
-                        std::lock_guard<std::mutex> lock(global_mem_trace_mutex);
-                        mem_trace.insert(mem_trace.end(), local_thread_mem_trace.begin(), local_thread_mem_trace.end());
-                    }
-                }); // end lambda
-            } // end if thread_start_in_batch
-        } // end for tid
-
-        for (auto &th : threads_pool) {
-            if (th.joinable()) {
-                th.join();
-            }
+        size_t begin = std::min(tid * portion_size, current_batch_size);
+        size_t end = std::min(begin + portion_size, current_batch_size);
+        return std::make_pair(batch_start + begin, batch_start + end);
+    };
+
+    // Matches are collected in query order and placed into the CSR rows once
+    // at the end, so the kernel map does not depend on thread scheduling.
+    // They and the per-window state below are pooled scratch buffers.
+    BufferPool &buffers = BufferPool::shared();
+    std::vector<uint32_t> match_off;
+    std::vector<int32_t> match_in, match_out;
+
+    // Per-window state: the matching input of every query (-1 for none) and
+    // the number of matches of every portion.
+    std::vector<int32_t> match_input = buffers.take<int32_t>(std::min(qry_count, window_batches * BATCH_SIZE));
+    std::vector<uint64_t> portion_km_base;
+    uint64_t km_entries = 0; // KM slots written by earlier windows
+
+    for (size_t win_begin = 0; win_begin < num_batches; win_begin += window_batches) {
+        size_t win_end = std::min(num_batches, win_begin + window_batches);
+        size_t win_qry_begin = win_begin * BATCH_SIZE;
+        size_t win_qry_end = std::min(qry_count, win_end * BATCH_SIZE);
+        size_t num_portions = (win_end - win_begin) * num_hw_threads;
+        match_input.assign(win_qry_end - win_qry_begin, -1);
+        portion_km_base.assign(num_portions + 1, 0);
+
+        // 1. Find the match of every query, without tracing.
+        pool.parallel_for(num_portions, [&](size_t task) {
+            auto range = portion_range(win_begin + task / num_hw_threads,
+                                       static_cast<unsigned int>(task % num_hw_threads));
+            portion_km_base[task + 1] = engine->find(range.first, range.second,
+                                                     match_input.data() + (range.first - win_qry_begin));
+        });
+
+        // KM slots are handed out in (batch, tid) order, as a serial run would.
+        portion_km_base[0] = km_entries;
+        for (size_t t = 0; t < num_portions; ++t) {
+            portion_km_base[t + 1] += portion_km_base[t];
         }
-        if ((batch_idx + 1) % 10 == 0 || (batch_idx + 1) == num_batches) { // Print progress
-             std::cout << "LKP Progress: Batch " << (batch_idx + 1) << "/" << num_batches << " processed." << std::endl;
+        km_entries = portion_km_base[num_portions];
+        buffers.reserve(match_off, km_entries);
+        buffers.reserve(match_in, km_entries);
+        buffers.reserve(match_out, km_entries);
+
+        // 2. Replay every portion into the trace.
+        pool.parallel_for(num_portions, [&](size_t task) {
+            size_t batch_idx = win_begin + task / num_hw_threads;
+            unsigned int tid = static_cast<unsigned int>(task % num_hw_threads);
+            auto range = portion_range(batch_idx, tid);
+            if (range.first == range.second) return;
+
+            // Lane keeps the merged trace in (batch, tid) order regardless of scheduling
+            current_trace_sink().set_lane(static_cast<uint64_t>(batch_idx) * num_hw_threads + tid);
+            engine->trace(range.first, range.second, static_cast<int>(tid), portion_km_base[task]);
+        });
+        current_trace_sink().commit(); // Later windows only add higher lanes
+
+        // (input index, source point of the query) in query order
+        for (size_t q_glob_idx = win_qry_begin; q_glob_idx < win_qry_end; ++q_glob_idx) {
+            int32_t input_idx = match_input[q_glob_idx - win_qry_begin];
+            if (input_idx < 0) continue;
+            match_off.push_back(static_cast<uint32_t>(queries.off_idx(q_glob_idx)));
+            match_in.push_back(input_idx);
+            match_out.push_back(queries.source_idx(q_glob_idx));
         }
-    } // end for batch_idx
-    
+
+        // Printing the progress is costly on long runs; profile.json has the timeline
+        if (g_config.debug && (win_end / 10 != win_begin / 10 || win_end == num_batches)) {
+             std::cout << "LKP Progress: Batch " << win_end << "/" << num_batches << " processed." << std::endl;
+        }
+    }
+
+    KernelMapCSR kmap = build_kernel_map_csr(queries.num_offsets(), match_off, match_in, match_out);
+    buffers.give(std::move(match_off));
+    buffers.give(std::move(match_in));
+    buffers.give(std::move(match_out));
+    buffers.give(std::move(match_input));
+
     set_curr_phase(""); // Clear phase
     std::cout << "LKP phase complete." << std::endl;
     return kmap;
 }
 
+template KernelMapType perform_coordinate_lookup(const std::vector<IndexedCoord> &, const QueryView &,
+                                                 const std::vector<CoordSpan> &,
+                                                 const std::vector<IndexedCoord> &, int);
+template KernelMapType perform_coordinate_lookup(const std::vector<IndexedCoord64> &,
+                                                 const BasicQueryView<uint64_t> &,
+                                                 const std::vector<BasicCoordSpan<uint64_t>> &,
+                                                 const std::vector<IndexedCoord64> &, int);
+
+// KEY_BITS 64 layout: marker, key size and entry count, then one
+// (uint64 pack64 offset key, uint32 input_idx, uint32 query_src_orig_idx)
+// record per match, rows in the same order as the 32-bit layout
+static uint32_t write_wide_kernel_map(GzOutput &out, const KernelMapType &kmap_data,
+                                      const std::vector<Coord3D> &off_list,
+                                      const std::string &filename) {
+  ProfileScope profile("write_kernel_map_to_gz", "writer");
+  profile.set_output(filename);
+  const uint32_t key_bytes = sizeof(uint64_t);
+  const uint32_t num_total_entries = static_cast<uint32_t>(kmap_data.num_matches());
+  out.write_value(KERNEL_MAP_WIDE_MARKER);
+  out.write_value(key_bytes);
+  out.write_value(num_total_entries);
+
+  std::vector<uint32_t> body; // Keys as two native-order words, like a uint64 store
+  body.reserve(4 * kmap_data.num_matches());
+  for (size_t row = 0; row < kmap_data.num_rows(); ++row) {
+    uint32_t offset_idx = kmap_data.offsets[row];
+    if (offset_idx >= off_list.size()) {
+        std::cerr << "Error in write_kernel_map_to_gz: offset_idx " << offset_idx
+                  << " is out of bounds for off_list (size " << off_list.size()
+                  << "). Skipping this kmap entry." << std::endl;
+        continue;
+    }
+    uint32_t key_words[2];
+    const uint64_t packed_offset_key = off_list[offset_idx].to_key<uint64_t>();
+    std::memcpy(key_words, &packed_offset_key, sizeof(packed_offset_key));
+
+    for (int64_t m = kmap_data.begin[row]; m < kmap_data.begin[row + 1]; ++m) {
+      body.push_back(key_words[0]);
+      body.push_back(key_words[1]);
+      body.push_back(static_cast<uint32_t>(kmap_data.in_idx[m]));
+      body.push_back(static_cast<uint32_t>(kmap_data.out_idx[m]));
+    }
+  }
+  if (!body.empty()) {
+    out.write(body.data(), body.size() * sizeof(uint32_t));
+  }
+
+  profile.add_bytes(out.bytes_written());
+  uint32_t crc = out.close();
+  std::cout << "Kernel map successfully written to " << filename << " with "
+            << num_total_entries << " entries (64-bit keys)." << std::endl;
+  return crc;
+}
+
 uint32_t write_kernel_map_to_gz(
     const KernelMapType &kmap_data, const std::string &filename,
     const std::vector<Coord3D>
         &off_list 
 ) {
-  gzFile outFile = gzopen(filename.c_str(), "wb");
-  if (!outFile) {
-    throw std::runtime_error("Failed to open file for writing: " + filename);
-  }
-
-  uLong crc = crc32(0L, Z_NULL, 0);
-  auto write_and_crc = [&](const void* data, unsigned int len) {
-      if (gzwrite(outFile, data, len) != static_cast<int>(len)) {
-          gzclose(outFile);
-          throw std::runtime_error("Failed to write data to gzip file during kernel map writing.");
-      }
-      crc = crc32(crc, static_cast<const Bytef*>(data), len);
-  };
+  GzOutput out(filename, g_config.COMPRESS_THREADS);
 
-  // Calculate total number of entries (pairs) across all offsets
-  uint32_t num_total_entries = 0;
-  for (const auto &pair : kmap_data) {
-    num_total_entries += static_cast<uint32_t>(pair.second.size());
+  uint32_t num_total_entries = static_cast<uint32_t>(kmap_data.num_matches());
+  if (g_config.KEY_BITS == 64) {
+    return write_wide_kernel_map(out, kmap_data, off_list, filename);
   }
-
-  // if (gzwrite(outFile, &num_total_entries, sizeof(num_total_entries)) !=
-  //     sizeof(num_total_entries)) {
-  //   gzclose(outFile);
-  //   throw std::runtime_error(
-  //       "Failed to write number of entries to kernel map gzip file.");
-  // }
-  write_and_crc(&num_total_entries, sizeof(num_total_entries));
-
-  // Iterate through the map (sorted by offset_idx due to std::map)
-  // For SortedByValueSizeMap, we need to get the items in its sorted order if that's desired for writing.
-  // However, the Python version writes based on iterating kmap.items(), which for a standard dict
-  // is insertion order (or arbitrary in older Pythons). For SortedByValueLengthDict, it's value-length order.
-  // The C++ std::map iterates by key. If we want to write in value-size-sorted order:
-  auto sorted_items = kmap_data.get_sorted_items();
-  for (const auto &pair : sorted_items) { // Iterate sorted items
-    uint32_t offset_idx = pair.first; // This is the integer index for off_list
+  ProfileScope profile("write_kernel_map_to_gz", "writer");
+  profile.set_output(filename);
+  out.write_value(num_total_entries);
+
+  // Rows are in value-length order, as Python writes kmap.items() of a
+  // SortedByValueLengthDict. Each match is written as (packed offset key,
+  // input_idx, query_src_orig_idx); the whole body goes out in one write.
+  std::vector<uint32_t> body;
+  body.reserve(3 * kmap_data.num_matches());
+  for (size_t row = 0; row < kmap_data.num_rows(); ++row) {
+    uint32_t offset_idx = kmap_data.offsets[row]; // This is the integer index for off_list
 
     if (offset_idx >= off_list.size()) {
         std::cerr << "Error in write_kernel_map_to_gz: offset_idx " << offset_idx 
@@ -601,38 +808,24 @@ uint32_t write_kernel_map_to_gz(
                   << "). Skipping this kmap entry." << std::endl;
         continue;
     }
-    const Coord3D& actual_offset_coord = off_list[offset_idx];
-    uint32_t packed_offset_key_to_write = actual_offset_coord.to_key(); 
-
-    const auto &matches =
-        pair.second; // vector of (input_idx, query_src_orig_idx)
-
-    for (const auto &match : matches) {
-      uint32_t input_idx = static_cast<uint32_t>(match.first);
-      uint32_t query_src_orig_idx = static_cast<uint32_t>(match.second);
-
-      // Write: packed_offset_key_to_write, input_idx, query_src_orig_idx
-      // if (gzwrite(outFile, &packed_offset_key_to_write, sizeof(packed_offset_key_to_write)) !=
-      //         sizeof(packed_offset_key_to_write) ||
-      //     gzwrite(outFile, &input_idx, sizeof(input_idx)) !=
-      //         sizeof(input_idx) ||
-      //     gzwrite(outFile, &query_src_orig_idx, sizeof(query_src_orig_idx)) !=
-      //         sizeof(query_src_orig_idx)) {
-      //   gzclose(outFile);
-      //   throw std::runtime_error(
-      //       "Failed to write kernel map entry to gzip file.");
-      // }
-      write_and_crc(&packed_offset_key_to_write, sizeof(packed_offset_key_to_write));
-      write_and_crc(&input_idx, sizeof(input_idx));
-      write_and_crc(&query_src_orig_idx, sizeof(query_src_orig_idx));
+    uint32_t packed_offset_key_to_write = off_list[offset_idx].to_key();
+
+    for (int64_t m = kmap_data.begin[row]; m < kmap_data.begin[row + 1]; ++m) {
+      body.push_back(packed_offset_key_to_write);
+      body.push_back(static_cast<uint32_t>(kmap_data.in_idx[m]));
+      body.push_back(static_cast<uint32_t>(kmap_data.out_idx[m]));
     }
   }
+  if (!body.empty()) {
+    out.write(body.data(), body.size() * sizeof(uint32_t));
+  }
 
-  gzclose(outFile);
+  profile.add_bytes(out.bytes_written());
+  uint32_t crc = out.close();
   std::cout << "Kernel map successfully written to " << filename << " with "
             << num_total_entries << " entries." << std::endl;
 
-            return static_cast<uint32_t>(crc);
+  return crc;
 }
 
 // --- New Structs and Functions for Greedy Grouping ---
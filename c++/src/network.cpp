@@ -0,0 +1,174 @@
+#include "network.hpp"
+#include "buffer_pool.hpp"
+#include "minuet_config.hpp"
+#include "minuet_map.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Largest multiple of t not above v
+int floor_to_multiple(int v, uint32_t t) {
+    const int step = static_cast<int>(t);
+    int q = v / step;
+    if (v % step != 0 && v < 0) --q;
+    return q * step;
+}
+
+// FNV-1a over the sorted keys: equal sets hash equal
+template <typename Key>
+uint64_t hash_coords(const std::vector<BasicIndexedCoord<Key>>& coords) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const auto& coord : coords) {
+        hash = (hash ^ static_cast<uint64_t>(coord.key_val)) * 1099511628211ULL;
+    }
+    return (hash ^ coords.size()) * 1099511628211ULL;
+}
+
+// The same matches with inputs and outputs swapped
+KernelMapCSR transpose_kernel_map(const KernelMapCSR& kmap) {
+    KernelMapCSR transposed;
+    transposed.offsets = kmap.offsets;
+    transposed.begin = kmap.begin;
+    BufferPool& buffers = BufferPool::shared();
+    transposed.in_idx = buffers.take<int32_t>(kmap.num_matches());
+    transposed.out_idx = buffers.take<int32_t>(kmap.num_matches());
+    transposed.in_idx.assign(kmap.out_idx.begin(), kmap.out_idx.end());
+    transposed.out_idx.assign(kmap.in_idx.begin(), kmap.in_idx.end());
+    return transposed;
+}
+
+} // namespace
+
+std::vector<Coord3D> kernel_offsets(uint32_t kernel_size, uint32_t tensor_stride) {
+    const int lo = kernel_size % 2 ? -static_cast<int>(kernel_size / 2) : 0;
+    const int hi = lo + static_cast<int>(kernel_size);
+    const int t = static_cast<int>(tensor_stride);
+    std::vector<Coord3D> offsets;
+    offsets.reserve(static_cast<size_t>(kernel_size) * kernel_size * kernel_size);
+    for (int dx = lo; dx < hi; ++dx) {
+        for (int dy = lo; dy < hi; ++dy) {
+            for (int dz = lo; dz < hi; ++dz) {
+                offsets.emplace_back(dx * t, dy * t, dz * t);
+            }
+        }
+    }
+    return offsets;
+}
+
+template <typename Key>
+KernelMapCache<Key>::KernelMapCache(Coords inputs) {
+    CoordSet& set = sets_[1];
+    set.coords = std::move(inputs);
+    set.hash = hash_coords(set.coords);
+}
+
+template <typename Key>
+KernelMapCache<Key>::~KernelMapCache() {
+    for (auto& [tensor_stride, set] : sets_) BufferPool::shared().give(std::move(set.coords));
+}
+
+// Downsamples the set at from_stride on first use; RDX sorts and dedups it
+template <typename Key>
+typename KernelMapCache<Key>::CoordSet& KernelMapCache<Key>::set_at(uint32_t tensor_stride, uint32_t from_stride) {
+    auto it = sets_.find(tensor_stride);
+    if (it != sets_.end()) return it->second;
+
+    const Coords& from = sets_.at(from_stride).coords;
+    std::vector<Key> keys = BufferPool::shared().take<Key>(from.size());
+    for (const auto& coord : from) {
+        keys.push_back(Coord3D(floor_to_multiple(coord.coord.x, tensor_stride),
+                               floor_to_multiple(coord.coord.y, tensor_stride),
+                               floor_to_multiple(coord.coord.z, tensor_stride))
+                           .template to_key<Key>());
+    }
+    std::cout << "\n--- Phase: " << PHASES.inverse.at(0) << " of tensor stride " << tensor_stride << " ---"
+              << std::endl;
+    CoordSet& set = sets_[tensor_stride];
+    set.coords = compute_unique_sorted_keys(std::move(keys));
+    // Points of a downsampled set are numbered in key order
+    for (size_t i = 0; i < set.coords.size(); ++i) set.coords[i].orig_idx = static_cast<int>(i);
+    set.hash = hash_coords(set.coords);
+    return set;
+}
+
+template <typename Key>
+std::shared_ptr<const KernelMapCSR> KernelMapCache<Key>::lookup(CoordSet& queries,
+                                                                const std::vector<Coord3D>& offsets,
+                                                                CoordSet& target) {
+    ++misses_;
+    std::cout << "--- Phase: " << PHASES.inverse.at(1) << " ---" << std::endl;
+    BasicQueryView<Key> view(queries.coords, offsets);
+    if (!target.tiles) {
+        std::cout << "--- Phase: " << PHASES.inverse.at(3) << " ---" << std::endl;
+        target.tiles = std::make_unique<BasicTilesPivotsResult<Key>>(
+            create_tiles_and_pivots(target.coords, g_config.NUM_PIVOTS));
+    }
+    std::cout << "--- Phase: " << PHASES.inverse.at(4) << " ---" << std::endl;
+    return share_kernel_map(perform_coordinate_lookup(target.coords, view, target.tiles->tiles,
+                                                      target.tiles->pivots, g_config.NUM_TILES));
+}
+
+template <typename Key>
+LayerMap KernelMapCache<Key>::map_layer(const NetworkLayer& layer, uint32_t in_stride) {
+    const uint32_t s = layer.stride;
+    const uint32_t k = layer.kernel_size;
+    LayerMap result;
+    result.in_stride = in_stride;
+
+    if (layer.transposed) {
+        if (in_stride % s != 0 || !sets_.count(in_stride / s)) {
+            throw std::invalid_argument("Layer " + layer.name + " upsamples tensor stride " +
+                                        std::to_string(in_stride) + " by " + std::to_string(s) +
+                                        ", which is not the tensor stride of an earlier layer");
+        }
+        const uint32_t fine_stride = in_stride / s;
+        CoordSet& fine = sets_.at(fine_stride);
+        CoordSet& coarse = sets_.at(in_stride);
+        result.out_stride = fine_stride;
+        result.num_inputs = static_cast<uint32_t>(coarse.coords.size());
+        result.num_outputs = static_cast<uint32_t>(fine.coords.size());
+        result.offsets = kernel_offsets(k, fine_stride);
+
+        CachedMap& cached = maps_[MapKey(fine.hash, fine_stride, s, k, true)];
+        if (cached.kmap) {
+            ++hits_;
+        } else {
+            // Transpose of the strided layer from fine_stride to in_stride
+            CachedMap& strided = maps_[MapKey(fine.hash, fine_stride, s, k, false)];
+            if (strided.kmap) {
+                ++hits_;
+            } else {
+                strided = {lookup(coarse, result.offsets, fine), layer.name};
+                result.computed = true;
+            }
+            cached = {share_kernel_map(transpose_kernel_map(*strided.kmap)), strided.source};
+        }
+        result.kmap = cached.kmap;
+        result.source = cached.source;
+        return result;
+    }
+
+    const uint32_t out_stride = in_stride * s;
+    CoordSet& in = sets_.at(in_stride);
+    CoordSet& out = s == 1 ? in : set_at(out_stride, in_stride);
+    result.out_stride = out_stride;
+    result.num_inputs = static_cast<uint32_t>(in.coords.size());
+    result.num_outputs = static_cast<uint32_t>(out.coords.size());
+    result.offsets = kernel_offsets(k, in_stride);
+
+    CachedMap& cached = maps_[MapKey(in.hash, in_stride, s, k, false)];
+    if (cached.kmap) {
+        ++hits_;
+    } else {
+        cached = {lookup(out, result.offsets, in), layer.name};
+        result.computed = true;
+    }
+    result.kmap = cached.kmap;
+    result.source = cached.source;
+    return result;
+}
+
+template class KernelMapCache<uint32_t>;
+template class KernelMapCache<uint64_t>;
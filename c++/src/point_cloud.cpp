@@ -0,0 +1,411 @@
+#include "point_cloud.hpp"
+#include "buffer_pool.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>    // open
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+
+namespace {
+
+constexpr size_t SEMANTIC_KITTI_VOXEL_BYTES = 262144; // 256 x 256 x 32 bit grid
+
+std::string lower_extension(const std::string& path) {
+    std::string ext = std::filesystem::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return ext;
+}
+
+// Read-only mapping of a whole file; empty files map to no bytes.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open point cloud: " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Failed to stat point cloud: " + path);
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* base = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Failed to map point cloud: " + path);
+            }
+            madvise(base, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(base);
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (data_) munmap(const_cast<char*>(data_), size_);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Keeps the first occurrence of every item in order, like the dedup of
+// read_pcl.py. Open addressing over the indices of the items kept so far.
+template <typename T, typename Hash>
+void keep_first_occurrences(std::vector<T>& items, Hash hash) {
+    size_t capacity = 16;
+    while (capacity < 2 * items.size()) capacity *= 2;
+    std::vector<uint32_t> table = BufferPool::shared().take<uint32_t>(capacity);
+    table.assign(capacity, UINT32_MAX);
+    size_t kept = 0;
+    for (size_t i = 0; i < items.size(); ++i) {
+        size_t slot = hash(items[i]) & (capacity - 1);
+        while (table[slot] != UINT32_MAX && !(items[table[slot]] == items[i])) slot = (slot + 1) & (capacity - 1);
+        if (table[slot] != UINT32_MAX) continue;
+        table[slot] = static_cast<uint32_t>(kept);
+        items[kept++] = items[i];
+    }
+    items.resize(kept);
+    BufferPool::shared().give(std::move(table));
+}
+
+uint64_t mix64(uint64_t v) { return (v * 0x9E3779B97F4A7C15ULL) >> 17; }
+
+// Receives the quantized points of a frame as Coord3D
+struct CoordSink {
+    struct Point {
+        Coord3D c;
+        bool operator==(const Point& o) const { return c.x == o.c.x && c.y == o.c.y && c.z == o.c.z; }
+    };
+    std::vector<Point> points;
+    void reserve(size_t n) { points.reserve(n); }
+    void operator()(int x, int y, int z) { points.push_back({Coord3D(x, y, z)}); }
+    std::vector<Coord3D> finish() {
+        keep_first_occurrences(points, [](const Point& p) {
+            return mix64((static_cast<uint64_t>(static_cast<uint32_t>(p.c.x)) << 32 | static_cast<uint32_t>(p.c.y)) ^
+                         mix64(static_cast<uint32_t>(p.c.z)));
+        });
+        std::vector<Coord3D> coords;
+        coords.reserve(points.size());
+        for (const Point& p : points) coords.push_back(p.c);
+        return coords;
+    }
+};
+
+// Receives the quantized points of a frame as packed keys of width Key,
+// applying the stride like Coord3D::quantized
+template <typename Key>
+struct KeySink {
+    std::vector<Key> keys;
+    int stride;
+    size_t wrapped = 0; // Points with a coordinate outside the key fields
+    void reserve(size_t n) { keys = BufferPool::shared().take<Key>(n); } // Given back after RDX
+    void operator()(int x, int y, int z) {
+        if (stride != 0) {
+            x /= stride;
+            y /= stride;
+            z /= stride;
+        }
+        if (!fits_key_field<Key>(x) || !fits_key_field<Key>(y) || !fits_key_field<Key>(z)) {
+            ++wrapped;
+        }
+        keys.push_back(KeyTraits<Key>::pack(x, y, z));
+    }
+    std::vector<Key> finish() {
+        keep_first_occurrences(keys, [](Key key) { return mix64(key); });
+        return std::move(keys);
+    }
+};
+
+// Quantizes points 0..n-1, whose coordinates are point(i, axis), into sink
+// (see read_point_cloud)
+template <typename Point, typename Sink>
+void quantize(size_t n, double voxel_size, Point&& point, Sink& sink) {
+    if (voxel_size <= 0) {
+        double lo[3], hi[3];
+        bool any = false;
+        for (size_t i = 0; i < n; ++i) {
+            double p[3] = {point(i, 0), point(i, 1), point(i, 2)};
+            if (!std::isfinite(p[0]) || !std::isfinite(p[1]) || !std::isfinite(p[2])) continue;
+            for (int axis = 0; axis < 3; ++axis) {
+                lo[axis] = any ? std::min(lo[axis], p[axis]) : p[axis];
+                hi[axis] = any ? std::max(hi[axis], p[axis]) : p[axis];
+            }
+            any = true;
+        }
+        double smallest = 0;
+        for (int axis = 0; axis < 3 && any; ++axis) {
+            if (hi[axis] > lo[axis] && (smallest == 0 || hi[axis] - lo[axis] < smallest)) {
+                smallest = hi[axis] - lo[axis];
+            }
+        }
+        voxel_size = smallest > 0 ? smallest / 100.0 : 0.01;
+        std::cout << "Auto-selected voxel size: " << voxel_size << std::endl;
+    }
+    sink.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        double x = point(i, 0), y = point(i, 1), z = point(i, 2);
+        if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z)) continue;
+        sink(static_cast<int>(x / voxel_size), static_cast<int>(y / voxel_size), static_cast<int>(z / voxel_size));
+    }
+}
+
+template <typename Sink>
+void read_semantic_kitti_voxels(const MappedFile& file, Sink& sink) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(file.data());
+    for (size_t k = 0; k < file.size(); ++k) {
+        for (unsigned byte = bytes[k]; byte != 0;) {
+            int b = __builtin_clz(byte) - 24; // Most significant bit first
+            byte &= ~(0x80u >> b);
+            size_t l = k * 8 + b;
+            sink(static_cast<int>(l / 8192), static_cast<int>((l / 32) % 256), static_cast<int>(l % 32));
+        }
+    }
+}
+
+template <typename Sink>
+void read_kitti_points(const MappedFile& file, const std::string& path, double voxel_size, Sink& sink) {
+    constexpr size_t POINT_BYTES = 4 * sizeof(float);
+    if (file.size() % POINT_BYTES != 0) {
+        throw std::runtime_error("KITTI scan size is not a multiple of 16 bytes: " + path);
+    }
+    const char* data = file.data();
+    quantize(file.size() / POINT_BYTES, voxel_size, [data](size_t i, int axis) {
+        float v;
+        std::memcpy(&v, data + i * POINT_BYTES + axis * sizeof(float), sizeof(v));
+        return static_cast<double>(v);
+    }, sink);
+}
+
+// One scalar of a binary PCD record
+double read_pcd_scalar(const char* data, char type, int size) {
+    if (type == 'F' && size == 4) { float v; std::memcpy(&v, data, 4); return v; }
+    if (type == 'F' && size == 8) { double v; std::memcpy(&v, data, 8); return v; }
+    if (type == 'I' && size == 1) { int8_t v; std::memcpy(&v, data, 1); return v; }
+    if (type == 'I' && size == 2) { int16_t v; std::memcpy(&v, data, 2); return v; }
+    if (type == 'I' && size == 4) { int32_t v; std::memcpy(&v, data, 4); return v; }
+    if (type == 'U' && size == 1) { uint8_t v; std::memcpy(&v, data, 1); return v; }
+    if (type == 'U' && size == 2) { uint16_t v; std::memcpy(&v, data, 2); return v; }
+    if (type == 'U' && size == 4) { uint32_t v; std::memcpy(&v, data, 4); return v; }
+    throw std::runtime_error(std::string("Unsupported PCD field type ") + type + std::to_string(size));
+}
+
+bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// Values of the ascii DATA section of a PCD file. The x, y and z values of
+// each line are parsed into xyz; the other values are only counted.
+std::vector<double> parse_pcd_ascii(const char* begin, const char* end, size_t record_columns,
+                                    const std::vector<int>& axis_of_value, size_t num_points,
+                                    const std::string& path) {
+    std::vector<double> xyz;
+    xyz.reserve(num_points * 3);
+    for (const char* line = begin; line < end && xyz.size() < num_points * 3;) {
+        const char* eol = static_cast<const char*>(std::memchr(line, '\n', end - line));
+        if (!eol) eol = end;
+        const char* c = line;
+        size_t v = 0;
+        double point[3];
+        while (v < record_columns) {
+            while (c < eol && is_blank(*c)) ++c;
+            if (c == eol) break;
+            const char* token = c;
+            while (c < eol && !is_blank(*c)) ++c;
+            if (axis_of_value[v] >= 0) {
+                if (*token == '+') ++token; // from_chars takes no leading '+'
+                auto [parsed_end, ec] = std::from_chars(token, c, point[axis_of_value[v]]);
+                if (ec != std::errc() || parsed_end != c) {
+                    throw std::runtime_error("PCD ascii value '" + std::string(token, c) +
+                                             "' is not a number: " + path);
+                }
+            }
+            ++v;
+        }
+        line = eol + 1;
+        if (v == 0) continue; // Blank line
+        if (v < record_columns) {
+            throw std::runtime_error("PCD ascii line has too few values: " + path);
+        }
+        xyz.insert(xyz.end(), point, point + 3);
+    }
+    return xyz;
+}
+
+template <typename Sink>
+void read_pcd_points(const MappedFile& file, const std::string& path, double voxel_size, Sink& sink) {
+    const char* bytes = file.data();
+    const size_t num_bytes = file.size();
+    std::vector<std::string> fields;
+    std::vector<int> sizes, counts;
+    std::vector<char> types;
+    size_t num_points = 0;
+    std::string data_kind;
+
+    // Header lines up to and including DATA
+    size_t pos = 0;
+    while (data_kind.empty()) {
+        if (pos >= num_bytes) {
+            throw std::runtime_error("PCD header has no DATA line: " + path);
+        }
+        const char* eol = static_cast<const char*>(std::memchr(bytes + pos, '\n', num_bytes - pos));
+        size_t line_end = eol ? static_cast<size_t>(eol - bytes) : num_bytes;
+        std::istringstream line(std::string(bytes + pos, line_end - pos));
+        pos = std::min(num_bytes, line_end + 1);
+        std::string key;
+        if (!(line >> key) || key[0] == '#') continue;
+        if (key == "FIELDS") {
+            for (std::string f; line >> f;) fields.push_back(f);
+        } else if (key == "SIZE") {
+            for (int v; line >> v;) sizes.push_back(v);
+        } else if (key == "TYPE") {
+            for (char t; line >> t;) types.push_back(t);
+        } else if (key == "COUNT") {
+            for (int v; line >> v;) counts.push_back(v);
+        } else if (key == "POINTS") {
+            line >> num_points;
+        } else if (key == "DATA") {
+            line >> data_kind;
+        }
+    }
+    if (counts.empty()) counts.assign(fields.size(), 1);
+    if (sizes.size() != fields.size() || types.size() != fields.size() || counts.size() != fields.size()) {
+        throw std::runtime_error("PCD header fields, sizes, types and counts differ in length: " + path);
+    }
+
+    // Field (binary) and value index (ascii) of x, y and z
+    int column[3] = {-1, -1, -1};
+    size_t byte_offset[3] = {0, 0, 0};
+    std::vector<int> axis_of_value;
+    size_t record_bytes = 0;
+    for (size_t f = 0; f < fields.size(); ++f) {
+        int axis = -1;
+        if (fields[f].size() == 1 && fields[f][0] >= 'x' && fields[f][0] <= 'z') {
+            axis = fields[f][0] - 'x';
+            column[axis] = static_cast<int>(f);
+            byte_offset[axis] = record_bytes;
+        }
+        for (int c = 0; c < counts[f]; ++c) axis_of_value.push_back(c == 0 ? axis : -1);
+        record_bytes += static_cast<size_t>(sizes[f]) * counts[f];
+    }
+    if (column[0] < 0 || column[1] < 0 || column[2] < 0) {
+        throw std::runtime_error("PCD file has no x, y and z fields: " + path);
+    }
+
+    if (data_kind == "binary") {
+        if (num_bytes - pos < num_points * record_bytes) {
+            throw std::runtime_error("PCD binary data is truncated: " + path);
+        }
+        const char* records = bytes + pos;
+        bool all_float = true;
+        for (int axis = 0; axis < 3; ++axis) {
+            all_float = all_float && types[column[axis]] == 'F' && sizes[column[axis]] == 4;
+        }
+        if (all_float) {
+            quantize(num_points, voxel_size, [&](size_t i, int axis) {
+                float v;
+                std::memcpy(&v, records + i * record_bytes + byte_offset[axis], sizeof(v));
+                return static_cast<double>(v);
+            }, sink);
+        } else {
+            for (int axis = 0; axis < 3; ++axis) {
+                read_pcd_scalar(records, types[column[axis]], sizes[column[axis]]); // Validates the type
+            }
+            quantize(num_points, voxel_size, [&](size_t i, int axis) {
+                return read_pcd_scalar(records + i * record_bytes + byte_offset[axis], types[column[axis]],
+                                       sizes[column[axis]]);
+            }, sink);
+        }
+    } else if (data_kind == "ascii") {
+        std::vector<double> xyz = parse_pcd_ascii(bytes + pos, bytes + num_bytes, axis_of_value.size(),
+                                                  axis_of_value, num_points, path);
+        if (xyz.size() != num_points * 3) {
+            throw std::runtime_error("PCD file holds fewer points than its header states: " + path);
+        }
+        quantize(num_points, voxel_size, [&](size_t i, int axis) { return xyz[3 * i + axis]; }, sink);
+    } else {
+        throw std::runtime_error("Unsupported PCD DATA '" + data_kind + "' (expected ascii or binary): " + path);
+    }
+}
+
+template <typename Sink>
+void load_point_cloud(const std::string& path, double voxel_size, Sink& sink) {
+    std::string ext = lower_extension(path);
+    if (ext != ".bin" && ext != ".pcd") {
+        throw std::runtime_error("Unsupported point cloud format '" + ext + "' (expected .bin or .pcd): " + path);
+    }
+    MappedFile file(path);
+    if (ext == ".pcd") {
+        read_pcd_points(file, path, voxel_size, sink);
+    } else if (file.size() == SEMANTIC_KITTI_VOXEL_BYTES) {
+        read_semantic_kitti_voxels(file, sink);
+    } else {
+        read_kitti_points(file, path, voxel_size, sink);
+    }
+}
+
+} // namespace
+
+std::vector<Coord3D> read_point_cloud(const std::string& path, double voxel_size) {
+    CoordSink sink;
+    load_point_cloud(path, voxel_size, sink);
+    return sink.finish();
+}
+
+template <typename Key>
+std::vector<Key> read_point_cloud_keys(const std::string& path, double voxel_size, int stride) {
+    KeySink<Key> sink{{}, stride};
+    load_point_cloud(path, voxel_size, sink);
+    if (sink.wrapped > 0) {
+        std::cerr << "Warning: " << sink.wrapped << " points of " << path << " exceed the "
+                  << KeyTraits<Key>::AXIS_BITS << "-bit key fields and wrap around"
+                  << (sizeof(Key) < 8 ? "; set KEY_BITS to 64 or raise VOXEL_SIZE." : ".")
+                  << std::endl;
+    }
+    return sink.finish();
+}
+
+template std::vector<uint32_t> read_point_cloud_keys(const std::string&, double, int);
+template std::vector<uint64_t> read_point_cloud_keys(const std::string&, double, int);
+
+std::vector<std::string> list_frame_files(const std::vector<std::string>& inputs) {
+    std::vector<std::string> frames;
+    for (const std::string& input : inputs) {
+        if (std::filesystem::is_directory(input)) {
+            std::vector<std::string> found;
+            for (const auto& entry : std::filesystem::directory_iterator(input)) {
+                std::string ext = lower_extension(entry.path().string());
+                if (entry.is_regular_file() && (ext == ".bin" || ext == ".pcd")) {
+                    found.push_back(entry.path().string());
+                }
+            }
+            std::sort(found.begin(), found.end());
+            frames.insert(frames.end(), found.begin(), found.end());
+        } else if (lower_extension(input) == ".txt") {
+            std::ifstream list(input);
+            if (!list) {
+                throw std::runtime_error("Failed to open frame list: " + input);
+            }
+            for (std::string line; std::getline(list, line);) {
+                line.erase(line.find_last_not_of(" \t\r") + 1);
+                if (!line.empty()) frames.push_back(line);
+            }
+        } else {
+            frames.push_back(input);
+        }
+    }
+    return frames;
+}
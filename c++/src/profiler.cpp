@@ -0,0 +1,180 @@
+#include "profiler.hpp"
+#include "trace_context.hpp"
+#include "trace_writer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <ext/json.hpp>
+#if defined(__GLIBC__)
+#include <malloc.h> // mallinfo2
+#endif
+
+namespace {
+
+uint64_t steady_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count());
+}
+
+std::atomic<uint32_t> next_thread_id{0};
+thread_local uint32_t tls_thread_id = UINT32_MAX;
+thread_local std::string tls_thread_name;
+
+// Heap bytes in use, or -1 where the allocator does not report them
+int64_t heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return static_cast<int64_t>(info.uordblks + info.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+// Entries recorded so far in the context, including those already streamed
+uint64_t entries_recorded(TraceContext& ctx) {
+    return ctx.sink.size() + (ctx.stream ? ctx.stream->entries_written() : 0);
+}
+
+} // namespace
+
+uint64_t peak_rss() {
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return std::stoull(line.substr(6)) * 1024; // Reported in kB
+        }
+    }
+    return 0;
+}
+
+uint32_t profile_thread_id() {
+    if (tls_thread_id == UINT32_MAX) {
+        tls_thread_id = next_thread_id.fetch_add(1);
+    }
+    return tls_thread_id;
+}
+
+void set_profile_thread_name(const std::string& name) { tls_thread_name = name; }
+
+Profile* current_profile() { return current_trace_context().profile; }
+
+Profile::Profile(std::string process_name) : process_name_(std::move(process_name)), epoch_ns_(steady_ns()) {}
+
+uint64_t Profile::now_ns() const { return steady_ns() - epoch_ns_; }
+
+void Profile::add(Event event) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_names_.count(event.tid)) {
+        thread_names_[event.tid] =
+            tls_thread_name.empty() ? "thread " + std::to_string(event.tid) : tls_thread_name;
+    }
+    events_.push_back(std::move(event));
+}
+
+Profile::WorkerTime Profile::worker_time(uint64_t start_ns, uint64_t end_ns) const {
+    std::map<uint32_t, uint64_t> busy; // Per worker thread
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const Event& e : events_) {
+            if (std::strcmp(e.category, "pool") == 0 && e.start_ns >= start_ns && e.start_ns + e.dur_ns <= end_ns) {
+                busy[e.tid] += e.dur_ns;
+            }
+        }
+    }
+    WorkerTime time;
+    const uint64_t span = end_ns - start_ns;
+    for (const auto& [tid, ns] : busy) {
+        time.busy_ns += ns;
+        time.idle_ns += span > ns ? span - ns : 0;
+        ++time.workers;
+    }
+    return time;
+}
+
+void Profile::write_chrome_trace(const std::string& filename) const {
+    nlohmann::json events = nlohmann::json::array();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        events.push_back({{"ph", "M"}, {"name", "process_name"}, {"pid", 1}, {"args", {{"name", process_name_}}}});
+        for (const auto& [tid, name] : thread_names_) {
+            events.push_back({{"ph", "M"}, {"name", "thread_name"}, {"pid", 1}, {"tid", tid}, {"args", {{"name", name}}}});
+        }
+        for (const Event& e : events_) {
+            nlohmann::json args = nlohmann::json::object();
+            for (const auto& [key, value] : e.args) args[key] = value;
+            events.push_back({{"ph", "X"}, {"name", e.name}, {"cat", e.category}, {"pid", 1}, {"tid", e.tid},
+                              {"ts", e.start_ns / 1e3}, {"dur", e.dur_ns / 1e3}, {"args", args}});
+        }
+    }
+    std::ofstream out(filename);
+    out << nlohmann::json{{"traceEvents", events}, {"displayTimeUnit", "ms"}}.dump() << std::endl;
+    if (!out) {
+        throw std::runtime_error("Failed to write profile: " + filename);
+    }
+}
+
+#if MINUET_PROFILING
+
+ProfileScope::ProfileScope(const char* name, const char* category)
+    : profile_(current_profile()), name_(name), category_(category) {
+    if (!profile_) return;
+    start_entries_ = entries_recorded(current_trace_context());
+    start_heap_ = heap_in_use();
+    start_buffers_ = BufferPool::shared().stats();
+    start_pool_ = ThreadPool::shared().stats();
+    start_ns_ = profile_->now_ns();
+}
+
+ProfileScope::~ProfileScope() {
+    if (!profile_) return;
+    const uint64_t end_ns = profile_->now_ns();
+    Profile::Event event{name_, category_, profile_thread_id(), start_ns_, end_ns - start_ns_, std::move(args_)};
+
+    const uint64_t entries = entries_recorded(current_trace_context());
+    if (entries > start_entries_) { // Less once a scope closed the stream
+        event.args.emplace_back("trace_entries", static_cast<double>(entries - start_entries_));
+    }
+    if (bytes_ > 0) event.args.emplace_back("bytes_written", static_cast<double>(bytes_));
+    if (!output_.empty()) {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(output_, ec);
+        if (!ec) event.args.emplace_back("file_bytes", static_cast<double>(size));
+    }
+    Profile::WorkerTime workers = profile_->worker_time(start_ns_, end_ns);
+    if (workers.workers > 0) {
+        event.args.emplace_back("workers", workers.workers);
+        event.args.emplace_back("worker_busy_ms", workers.busy_ns / 1e6);
+        event.args.emplace_back("worker_idle_ms", workers.idle_ns / 1e6);
+    }
+    // Process-wide: pool time and parallel_for calls of every frame overlapping
+    // this span. Busy time counts when a worker leaves a job, so a stretch of
+    // tasks is attributed to the span it ends in.
+    const ThreadPool::Stats pool = ThreadPool::shared().stats();
+    if (pool.jobs > start_pool_.jobs || pool.busy_ns > start_pool_.busy_ns) {
+        event.args.emplace_back("pool_jobs", static_cast<double>(pool.jobs - start_pool_.jobs));
+        event.args.emplace_back("pool_busy_ms", (pool.busy_ns - start_pool_.busy_ns) / 1e6);
+    }
+    const int64_t heap = heap_in_use();
+    if (heap >= 0) {
+        event.args.emplace_back("heap_bytes", static_cast<double>(heap));
+        event.args.emplace_back("heap_delta_bytes", static_cast<double>(heap - start_heap_));
+    }
+    event.args.emplace_back("peak_rss_bytes", static_cast<double>(peak_rss()));
+    // Process-wide, so concurrent frames' requests are included
+    const BufferPool::Stats buffers = BufferPool::shared().stats();
+    event.args.emplace_back("buffer_reuses", static_cast<double>(buffers.reuses - start_buffers_.reuses));
+    event.args.emplace_back("buffer_allocations",
+                            static_cast<double>(buffers.allocations - start_buffers_.allocations));
+    event.args.emplace_back("buffer_allocated_bytes",
+                            static_cast<double>(buffers.allocated_bytes - start_buffers_.allocated_bytes));
+    event.args.emplace_back("buffer_kept_bytes", static_cast<double>(buffers.kept_bytes));
+    profile_->add(std::move(event));
+}
+
+#endif // MINUET_PROFILING
@@ -0,0 +1,106 @@
+#include "reuse_distance.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace {
+constexpr size_t MIN_CAPACITY = 1 << 16; // Access times before the first renumbering
+}
+
+ReuseDistance::ReuseDistance(uint32_t line_bytes, std::vector<uint64_t> cache_bytes, double sample_rate,
+                             uint32_t partitions, uint32_t partition)
+    : line_bytes_(line_bytes), sample_rate_(sample_rate), partitions_(partitions), partition_(partition),
+      partition_rate_(sample_rate / partitions), cache_bytes_(std::move(cache_bytes)) {
+    if (line_bytes_ == 0 || (line_bytes_ & (line_bytes_ - 1)) != 0) {
+        throw std::invalid_argument("Line size must be a power of two, got " + std::to_string(line_bytes_));
+    }
+    if (!(sample_rate_ > 0.0 && sample_rate_ <= 1.0)) {
+        throw std::invalid_argument("Sample rate must be in (0, 1], got " + std::to_string(sample_rate_));
+    }
+    if (partitions_ == 0 || partition_ >= partitions_) {
+        throw std::invalid_argument("Partition " + std::to_string(partition_) + " out of " +
+                                    std::to_string(partitions_));
+    }
+    if (partitions_ > 1 && sample_rate_ == 1.0) {
+        throw std::invalid_argument("Exact reuse distances cannot be partitioned; use a sample rate below 1");
+    }
+    while ((1u << line_shift_) < line_bytes_) ++line_shift_;
+    if (sample_rate_ < 1.0) {
+        sample_threshold_ = static_cast<uint64_t>(std::ldexp(sample_rate_, 64));
+        if (sample_threshold_ < partitions_) sample_threshold_ = partitions_;
+        partition_width_ = sample_threshold_ / partitions_;
+    }
+    std::sort(cache_bytes_.begin(), cache_bytes_.end());
+    for (uint64_t bytes : cache_bytes_) {
+        hit_below_.push_back(static_cast<double>(bytes / line_bytes_) * partition_rate_);
+    }
+    first_hit_.assign(cache_bytes_.size() + 1, 0);
+    tree_.assign(MIN_CAPACITY + 1, 0);
+}
+
+void ReuseDistance::record(uint64_t line, uint32_t count) {
+    if (count == 0) return;
+    accesses_ += count;
+    if (now_ + 1 == tree_.size()) renumber();
+    const uint64_t time = ++now_;
+    auto [it, first] = last_access_.try_emplace(line, time);
+    if (!first) { // Else a cold miss
+        // Distinct lines whose last access lies between the two accesses
+        add_distance(marks_upto(time - 1) - marks_upto(it->second), 1);
+        mark(it->second, -1);
+        it->second = time;
+    }
+    mark(time, 1);
+    // The rest of a coalesced entry reuses the line right away
+    add_distance(0, count - 1);
+}
+
+void ReuseDistance::add_distance(uint64_t distance, uint64_t count) {
+    if (count == 0) return;
+    const double scaled = static_cast<double>(distance) / partition_rate_;
+    size_t bucket = 0;
+    if (scaled >= 1.0) bucket = static_cast<size_t>(std::floor(std::log2(scaled))) + 1;
+    if (bucket >= histogram_.size()) histogram_.resize(bucket + 1, 0);
+    histogram_[bucket] += count;
+    // Smallest capacity that holds the line; first_hit_.back() misses in all
+    size_t first = std::upper_bound(hit_below_.begin(), hit_below_.end(), static_cast<double>(distance)) -
+                   hit_below_.begin();
+    first_hit_[first] += count;
+}
+
+std::vector<uint64_t> ReuseDistance::hits() const {
+    std::vector<uint64_t> hits(cache_bytes_.size(), 0);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < hits.size(); ++i) {
+        sum += first_hit_[i];
+        hits[i] = sum;
+    }
+    return hits;
+}
+
+void ReuseDistance::merge(const ReuseDistance& other) {
+    if (other.line_bytes_ != line_bytes_ || other.cache_bytes_ != cache_bytes_) {
+        throw std::invalid_argument("Cannot merge reuse distances of different line or cache sizes");
+    }
+    accesses_ += other.accesses_;
+    merged_lines_ += other.lines();
+    if (other.histogram_.size() > histogram_.size()) histogram_.resize(other.histogram_.size(), 0);
+    for (size_t b = 0; b < other.histogram_.size(); ++b) histogram_[b] += other.histogram_[b];
+    for (size_t i = 0; i < first_hit_.size(); ++i) first_hit_[i] += other.first_hit_[i];
+}
+
+// Packs the live marks into times 1..lines() and doubles the headroom
+void ReuseDistance::renumber() {
+    std::vector<std::pair<uint64_t, uint64_t*>> live; // (time, slot holding it)
+    live.reserve(last_access_.size());
+    for (auto& [line, time] : last_access_) live.emplace_back(time, &time);
+    std::sort(live.begin(), live.end());
+    const size_t capacity = std::max(MIN_CAPACITY, 2 * live.size());
+    tree_.assign(capacity + 1, 0);
+    for (size_t i = 0; i < live.size(); ++i) {
+        *live[i].second = i + 1;
+        mark(i + 1, 1);
+    }
+    now_ = live.size();
+}
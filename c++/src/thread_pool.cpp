@@ -0,0 +1,204 @@
+#include "thread_pool.hpp"
+#include "profiler.hpp"
+#include "trace_context.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+static uint64_t pack_slice(uint64_t begin, uint64_t end) { return (begin << 32) | end; }
+static uint64_t slice_begin(uint64_t bounds) { return bounds >> 32; }
+static uint64_t slice_end(uint64_t bounds) { return bounds & 0xFFFFFFFFULL; }
+
+ThreadPool::ThreadPool(size_t num_workers) {
+    num_workers = std::max<size_t>(1, num_workers);
+    for (size_t w = 0; w < num_workers; ++w) {
+        workers_.emplace_back(&ThreadPool::worker_loop, this, w);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    start_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+ThreadPool::Stats ThreadPool::stats() const {
+    return {submitted_.load(std::memory_order_relaxed), busy_ns_.load(std::memory_order_relaxed)};
+}
+
+void ThreadPool::parallel_for(size_t num_tasks, const std::function<void(size_t)>& fn) {
+    if (num_tasks == 0) return;
+    if (num_tasks > 0xFFFFFFFFULL) {
+        throw std::invalid_argument("ThreadPool::parallel_for: too many tasks: " + std::to_string(num_tasks));
+    }
+
+    const size_t num_workers = workers_.size();
+    Job job(num_workers);
+    for (size_t w = 0; w < num_workers; ++w) {
+        uint64_t begin = num_tasks * w / num_workers;
+        uint64_t end = num_tasks * (w + 1) / num_workers;
+        job.slices[w].bounds.store(pack_slice(begin, end), std::memory_order_relaxed);
+    }
+    job.fn = &fn;
+    job.context = &current_trace_context();
+    job.unfinished.store(num_tasks, std::memory_order_relaxed);
+    submitted_.fetch_add(1, std::memory_order_relaxed);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobs_.push_back(&job);
+    jobs_version_.fetch_add(1, std::memory_order_release);
+    start_cv_.notify_all();
+    done_cv_.wait(lock, [&] { return job.unfinished.load(std::memory_order_acquire) == 0 && job.participants == 0; });
+    jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+    jobs_version_.fetch_add(1, std::memory_order_release);
+    if (job.error) {
+        lock.unlock();
+        std::rethrow_exception(job.error);
+    }
+}
+
+void ThreadPool::worker_loop(size_t worker) {
+    set_profile_thread_name("pool worker " + std::to_string(worker));
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        Job* job = nullptr;
+        start_cv_.wait(lock, [&] { return stopping_ || (job = pick_job()) != nullptr; });
+        if (stopping_) return;
+        run_job(worker, *job, lock);
+    }
+}
+
+bool ThreadPool::has_tasks(const Job& job) const {
+    for (size_t w = 0; w < workers_.size(); ++w) {
+        uint64_t cur = job.slices[w].bounds.load(std::memory_order_acquire);
+        if (slice_begin(cur) < slice_end(cur)) return true;
+    }
+    return false;
+}
+
+ThreadPool::Job* ThreadPool::pick_job() const {
+    // The oldest of the jobs with the fewest workers
+    Job* best = nullptr;
+    for (Job* job : jobs_) {
+        if ((!best || job->participants < best->participants) && has_tasks(*job)) best = job;
+    }
+    return best;
+}
+
+size_t ThreadPool::fair_share() const {
+    size_t busy_jobs = 0;
+    for (const Job* job : jobs_) busy_jobs += has_tasks(*job);
+    busy_jobs = std::max<size_t>(1, busy_jobs);
+    return (workers_.size() + busy_jobs - 1) / busy_jobs;
+}
+
+void ThreadPool::run_job(size_t worker, Job& job, std::unique_lock<std::mutex>& lock) {
+    ++job.participants;
+    uint64_t version = jobs_version_.load(std::memory_order_acquire);
+#if MINUET_PROFILING
+    const size_t concurrent_jobs = jobs_.size();
+    Profile* profile = job.context->profile;
+    const uint64_t start_ns = profile ? profile->now_ns() : 0;
+    const auto start = std::chrono::steady_clock::now();
+    size_t tasks_run = 0;
+#endif
+    bool left = false;
+    lock.unlock();
+    {
+        TraceContextScope context(*job.context);
+        size_t task;
+        while (pop_task(job, worker, task) || steal_task(job, worker, task)) {
+            if (!job.failed.load(std::memory_order_relaxed)) { // Otherwise drain without running
+                try {
+                    (*job.fn)(task);
+                } catch (...) {
+                    std::lock_guard<std::mutex> error_lock(mutex_);
+                    if (!job.error) job.error = std::current_exception();
+                    job.failed.store(true, std::memory_order_relaxed);
+                }
+#if MINUET_PROFILING
+                ++tasks_run;
+#endif
+            }
+            job.unfinished.fetch_sub(1, std::memory_order_acq_rel);
+            if (jobs_version_.load(std::memory_order_acquire) != version) {
+                // A job arrived or finished: move on if this one has more than its share
+                std::lock_guard<std::mutex> share_lock(mutex_);
+                version = jobs_version_.load(std::memory_order_acquire);
+                if (job.participants > fair_share()) {
+                    --job.participants; // Under the lock, so the others see it before they decide
+                    left = true;
+                    break;
+                }
+            }
+        }
+    }
+#if MINUET_PROFILING
+    const uint64_t busy_ns = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    busy_ns_.fetch_add(busy_ns, std::memory_order_relaxed);
+    // One busy span per stretch of tasks; ProfileScope derives idle time from these
+    if (profile && tasks_run > 0) {
+        profile->add({"parallel_for", "pool", profile_thread_id(), start_ns, profile->now_ns() - start_ns,
+                      {{"tasks", static_cast<double>(tasks_run)},
+                       {"concurrent_jobs", static_cast<double>(concurrent_jobs)}}});
+    }
+#endif
+    lock.lock();
+    if (!left) --job.participants;
+    if (job.participants == 0) done_cv_.notify_all();
+}
+
+bool ThreadPool::pop_task(Job& job, size_t worker, size_t& task) {
+    std::atomic<uint64_t>& bounds = job.slices[worker].bounds;
+    uint64_t cur = bounds.load(std::memory_order_acquire);
+    while (slice_begin(cur) < slice_end(cur)) {
+        if (bounds.compare_exchange_weak(cur, pack_slice(slice_begin(cur) + 1, slice_end(cur)),
+                                         std::memory_order_acq_rel)) {
+            task = slice_begin(cur);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::steal_task(Job& job, size_t worker, size_t& task) {
+    const size_t num_workers = workers_.size();
+    while (true) {
+        // Victim with the most remaining tasks
+        size_t victim = num_workers;
+        uint64_t victim_left = 0;
+        for (size_t w = 0; w < num_workers; ++w) {
+            if (w == worker) continue;
+            uint64_t cur = job.slices[w].bounds.load(std::memory_order_acquire);
+            uint64_t left = slice_end(cur) > slice_begin(cur) ? slice_end(cur) - slice_begin(cur) : 0;
+            if (left > victim_left) {
+                victim = w;
+                victim_left = left;
+            }
+        }
+        if (victim == num_workers) return false;
+
+        std::atomic<uint64_t>& bounds = job.slices[victim].bounds;
+        uint64_t cur = bounds.load(std::memory_order_acquire);
+        uint64_t begin = slice_begin(cur), end = slice_end(cur);
+        if (begin >= end) continue; // Drained meanwhile, pick another victim
+        uint64_t mid = begin + (end - begin) / 2; // Victim keeps [begin, mid)
+        if (bounds.compare_exchange_strong(cur, pack_slice(begin, mid), std::memory_order_acq_rel)) {
+            // Own slice is empty, so no thief touches it until this store
+            job.slices[worker].bounds.store(pack_slice(mid + 1, end), std::memory_order_release);
+            task = mid;
+            return true;
+        }
+    }
+}
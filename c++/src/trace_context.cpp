@@ -0,0 +1,14 @@
+#include "trace_context.hpp"
+#include "trace_writer.hpp"
+
+namespace trace_context_detail {
+thread_local TraceContext* current = nullptr;
+}
+
+TraceContext::TraceContext() = default;
+TraceContext::~TraceContext() = default;
+
+TraceContext& default_trace_context() {
+    static TraceContext ctx;
+    return ctx;
+}
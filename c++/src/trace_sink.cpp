@@ -0,0 +1,252 @@
+#include "trace_sink.hpp"
+#include "buffer_pool.hpp"
+#include "trace_writer.hpp"
+#include <algorithm>
+#include <tuple>
+#include <unordered_map>
+
+thread_local TraceSink::TlsCache TraceSink::tls_cache_;
+
+namespace {
+
+// Sinks that are still alive, so exiting threads never touch a destroyed sink.
+struct LiveSinks {
+    std::mutex mutex;
+    std::unordered_map<uint64_t, TraceSink*> sinks;
+};
+
+LiveSinks& live_sinks() {
+    static LiveSinks registry; // Constructed on first use, outlives every static sink
+    return registry;
+}
+
+std::atomic<uint64_t> next_sink_id{1}; // 0 marks an empty TlsCache
+
+} // namespace
+
+// Buffers held by one thread; returned to their sinks when the thread exits.
+struct ThreadBuffers {
+    struct Slot {
+        uint64_t sink_id;
+        TraceSink::Buffer* buf;
+    };
+    std::vector<Slot> slots;
+
+    ~ThreadBuffers() {
+        LiveSinks& registry = live_sinks();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (const auto& slot : slots) {
+            auto it = registry.sinks.find(slot.sink_id);
+            if (it != registry.sinks.end()) {
+                it->second->release_buffer(slot.buf);
+            }
+        }
+    }
+};
+
+static thread_local ThreadBuffers tls_buffers;
+
+TraceSink::TraceSink() : id_(next_sink_id.fetch_add(1)) {
+    LiveSinks& registry = live_sinks();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.sinks[id_] = this;
+}
+
+TraceSink::~TraceSink() {
+    {
+        LiveSinks& registry = live_sinks();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.sinks.erase(id_);
+    }
+    // Chunks go back to the buffer pool for the sinks of later frames
+    for (const auto& buf : buffers_) {
+        for (auto& chunk : buf->chunks) BufferPool::shared().give_block(std::move(chunk), CHUNK_ENTRIES);
+    }
+}
+
+TraceSink::Buffer& TraceSink::acquire_buffer() {
+    for (const auto& slot : tls_buffers.slots) {
+        if (slot.sink_id == id_) {
+            tls_cache_ = {id_, slot.buf};
+            return *slot.buf;
+        }
+    }
+
+    // Pool threads outlive the per-frame sinks; forget the slots of dead ones
+    {
+        LiveSinks& registry = live_sinks();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        auto& slots = tls_buffers.slots;
+        slots.erase(std::remove_if(slots.begin(), slots.end(),
+                                   [&](const ThreadBuffers::Slot& slot) {
+                                       return registry.sinks.count(slot.sink_id) == 0;
+                                   }),
+                    slots.end());
+    }
+
+    Buffer* buf = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex_);
+        if (!free_buffers_.empty()) {
+            buf = free_buffers_.back();
+            free_buffers_.pop_back();
+        } else {
+            buffers_.push_back(std::make_unique<Buffer>());
+            buf = buffers_.back().get();
+        }
+    }
+    tls_buffers.slots.push_back({id_, buf});
+    tls_cache_ = {id_, buf};
+    return *buf;
+}
+
+void TraceSink::release_buffer(Buffer* buf) {
+    // A reused buffer must open a fresh run for its next owner.
+    buf->run_epoch = UINT32_MAX;
+    buf->lane_epoch = UINT32_MAX;
+    buf->lane = 0;
+    buf->sample_epoch = UINT32_MAX;
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    free_buffers_.push_back(buf);
+}
+
+void TraceSink::start_run(Buffer& buf) {
+    uint32_t epoch = epoch_.load(std::memory_order_relaxed);
+    uint64_t lane = (buf.lane_epoch == epoch) ? buf.lane : 0;
+    size_t begin = buf.size();
+    if (!buf.runs.empty() && buf.runs.back().begin == begin) {
+        buf.runs.pop_back(); // Previous run never received an entry
+    }
+    buf.runs.push_back({epoch, lane, run_seq_.fetch_add(1, std::memory_order_relaxed), begin});
+    buf.run_epoch = epoch;
+    buf.last = nullptr;
+    if (buf.sample_epoch != epoch || buf.sample_lane != lane) {
+        buf.sample_seen = 0;
+        buf.sample_epoch = epoch;
+        buf.sample_lane = lane;
+    }
+}
+
+void TraceSink::grow(Buffer& buf) {
+    buf.chunks.push_back(BufferPool::shared().take_block<MemoryAccessEntry>(CHUNK_ENTRIES));
+    buf.cursor = buf.chunks.back().get();
+    buf.chunk_end = buf.cursor + CHUNK_ENTRIES;
+}
+
+void TraceSink::set_filter(const TraceFilter& filter) {
+    filter_ = filter;
+    if (filter_.sample_rate < 1) filter_.sample_rate = 1;
+    uint32_t line_bytes = std::max<uint32_t>(1, filter_.line_bytes);
+    line_shift_ = 0;
+    while ((uint64_t{2} << line_shift_) <= line_bytes && line_shift_ < 63) ++line_shift_;
+    filtered_ = filter_.active();
+}
+
+void TraceSink::set_lane(uint64_t lane) {
+    Buffer& buf = local_buffer();
+    buf.lane = lane;
+    buf.lane_epoch = epoch_.load(std::memory_order_relaxed);
+    buf.run_epoch = UINT32_MAX; // Next record opens a run on the new lane
+}
+
+void TraceSink::next_epoch() {
+    if (writer_) {
+        drain(); // Earlier epochs are complete
+    }
+    epoch_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TraceSink::attach(TraceStreamWriter* writer, size_t budget_entries) {
+    if (writer_ && writer_ != writer) {
+        drain(); // Entries recorded so far belong to the previous writer
+    }
+    writer_ = writer;
+    stream_budget_ = budget_entries;
+}
+
+void TraceSink::commit() {
+    if (filter_.coalesce) {
+        // Entries recorded later never merge into earlier ones, streamed or not
+        std::lock_guard<std::mutex> lock(registry_mutex_);
+        for (const auto& buf : buffers_) buf->last = nullptr;
+    }
+    if (writer_ && size() >= stream_budget_) {
+        drain();
+    }
+}
+
+void TraceSink::drain() {
+    if (!writer_) return;
+    for_each_span([&](const MemoryAccessEntry* data, size_t len) {
+        writer_->append(data, len);
+    });
+    clear();
+}
+
+size_t TraceSink::size() const {
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    size_t total = 0;
+    for (const auto& buf : buffers_) {
+        total += buf->size();
+    }
+    return total;
+}
+
+std::vector<TraceSink::RunSpan> TraceSink::merged_runs() const {
+    struct Keyed {
+        uint32_t epoch;
+        uint64_t lane;
+        uint64_t seq;
+        RunSpan span;
+    };
+    std::vector<Keyed> keyed;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex_);
+        for (const auto& buf : buffers_) {
+            size_t buf_size = buf->size();
+            for (size_t i = 0; i < buf->runs.size(); ++i) {
+                const Run& run = buf->runs[i];
+                size_t end = (i + 1 < buf->runs.size()) ? buf->runs[i + 1].begin : buf_size;
+                if (end > run.begin) {
+                    keyed.push_back({run.epoch, run.lane, run.seq, {buf.get(), run.begin, end}});
+                }
+            }
+        }
+    }
+    std::sort(keyed.begin(), keyed.end(), [](const Keyed& a, const Keyed& b) {
+        return std::tie(a.epoch, a.lane, a.seq) < std::tie(b.epoch, b.lane, b.seq);
+    });
+
+    std::vector<RunSpan> spans;
+    spans.reserve(keyed.size());
+    for (const auto& k : keyed) {
+        spans.push_back(k.span);
+    }
+    return spans;
+}
+
+std::vector<MemoryAccessEntry> TraceSink::collect() const {
+    std::vector<MemoryAccessEntry> merged;
+    merged.reserve(size());
+    for_each_span([&](const MemoryAccessEntry* data, size_t len) {
+        merged.insert(merged.end(), data, data + len);
+    });
+    return merged;
+}
+
+void TraceSink::clear() {
+    std::lock_guard<std::mutex> lock(registry_mutex_);
+    for (const auto& buf : buffers_) {
+        // Keep one chunk around for the next phase
+        for (size_t c = 1; c < buf->chunks.size(); ++c) {
+            BufferPool::shared().give_block(std::move(buf->chunks[c]), CHUNK_ENTRIES);
+        }
+        if (buf->chunks.size() > 1) buf->chunks.resize(1);
+        if (!buf->chunks.empty()) {
+            buf->cursor = buf->chunks[0].get();
+            buf->chunk_end = buf->cursor + CHUNK_ENTRIES;
+        }
+        buf->runs.clear();
+        buf->run_epoch = UINT32_MAX;
+    }
+}
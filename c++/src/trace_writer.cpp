@@ -0,0 +1,272 @@
+#include "trace_writer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace trace_format {
+
+void validate(const TraceFormat& fmt) {
+    if (fmt.sizeof_addr != 4 && fmt.sizeof_addr != 8) {
+        throw std::invalid_argument("sizeof_addr must be 4 or 8, got: " + std::to_string(fmt.sizeof_addr));
+    }
+    if (fmt.version < 1 || fmt.version > 3) {
+        throw std::invalid_argument("Unsupported trace format version: " + std::to_string(fmt.version));
+    }
+    if (fmt.counts && fmt.version == 1) {
+        throw std::invalid_argument("Version 1 traces cannot store access counts");
+    }
+}
+
+template <typename T>
+static void append_pod(std::vector<uint8_t>& out, const T& value) {
+    size_t pos = out.size();
+    out.resize(pos + sizeof(T));
+    std::memcpy(out.data() + pos, &value, sizeof(T));
+}
+
+std::vector<uint8_t> stream_header(const TraceFormat& fmt) {
+    std::vector<uint8_t> header;
+    if (fmt.version == 1) {
+        append_pod(header, TRACE_STREAM_MARKER);
+    } else {
+        append_pod(header, TRACE_V2_MARKER);
+        header.push_back(fmt.version);
+        header.push_back(static_cast<uint8_t>(fmt.sizeof_addr));
+        header.push_back((fmt.columnar ? TRACE_FLAG_COLUMNAR : 0) | (fmt.counts ? TRACE_FLAG_COUNTS : 0));
+        header.push_back(0); // Reserved
+    }
+    return header;
+}
+
+void append_rows(const MemoryAccessEntry* entries, size_t count, int sizeof_addr,
+                 std::vector<uint8_t>& out, bool counts) {
+    const size_t entry_bytes = 4 + sizeof_addr + (counts ? sizeof(uint32_t) : 0);
+    size_t pos = out.size();
+    out.resize(pos + count * entry_bytes);
+    uint8_t* dst = out.data() + pos;
+    for (size_t i = 0; i < count; ++i, dst += entry_bytes) {
+        const MemoryAccessEntry& entry = entries[i];
+        dst[0] = entry.phase;
+        dst[1] = entry.thread_id;
+        dst[2] = entry.op;
+        dst[3] = entry.tensor;
+        if (sizeof_addr == 4) {
+            uint32_t addr_val_32 = static_cast<uint32_t>(entry.addr);
+            std::memcpy(dst + 4, &addr_val_32, sizeof(addr_val_32));
+        } else {
+            std::memcpy(dst + 4, &entry.addr, sizeof(entry.addr));
+        }
+        if (counts) {
+            std::memcpy(dst + 4 + sizeof_addr, &entry.count, sizeof(entry.count));
+        }
+    }
+}
+
+// Column payload: four byte columns, then wrap-around address deltas and,
+// with `counts`, the u32 access counts.
+template <typename Addr>
+static void append_columns(const MemoryAccessEntry* entries, size_t count, bool counts,
+                           std::vector<uint8_t>& out) {
+    size_t pos = out.size();
+    out.resize(pos + count * (4 + sizeof(Addr) + (counts ? sizeof(uint32_t) : 0)));
+    uint8_t* phase = out.data() + pos;
+    uint8_t* tid = phase + count;
+    uint8_t* op = tid + count;
+    uint8_t* tensor = op + count;
+    uint8_t* addr = tensor + count;
+    Addr prev = 0;
+    for (size_t i = 0; i < count; ++i) {
+        phase[i] = entries[i].phase;
+        tid[i] = entries[i].thread_id;
+        op[i] = entries[i].op;
+        tensor[i] = entries[i].tensor;
+        Addr cur = static_cast<Addr>(entries[i].addr);
+        Addr delta = static_cast<Addr>(cur - prev);
+        std::memcpy(addr + i * sizeof(Addr), &delta, sizeof(Addr));
+        prev = cur;
+    }
+    if (counts) {
+        uint8_t* count_col = addr + count * sizeof(Addr);
+        for (size_t i = 0; i < count; ++i) {
+            std::memcpy(count_col + i * sizeof(uint32_t), &entries[i].count, sizeof(uint32_t));
+        }
+    }
+}
+
+void append_block(const MemoryAccessEntry* entries, size_t count,
+                  const TraceFormat& fmt, std::vector<uint8_t>& out) {
+    append_pod(out, static_cast<uint32_t>(count));
+    if (fmt.version >= 2 && fmt.columnar) {
+        if (fmt.sizeof_addr == 4) {
+            append_columns<uint32_t>(entries, count, fmt.counts, out);
+        } else {
+            append_columns<uint64_t>(entries, count, fmt.counts, out);
+        }
+    } else {
+        append_rows(entries, count, fmt.sizeof_addr, out, fmt.counts);
+    }
+}
+
+std::vector<uint8_t> stream_footer(uint64_t total_entries) {
+    std::vector<uint8_t> footer;
+    append_pod(footer, static_cast<uint32_t>(0));
+    append_pod(footer, total_entries);
+    return footer;
+}
+
+TraceBlockIndex index_block(const MemoryAccessEntry* entries, size_t count, uint64_t offset) {
+    TraceBlockIndex index{offset, static_cast<uint32_t>(count), 0, 0, 0};
+    for (size_t i = 0; i < count; ++i) {
+        index.phase_mask |= trace_id_bit(entries[i].phase);
+        index.tensor_mask |= trace_id_bit(entries[i].tensor);
+    }
+    return index;
+}
+
+std::vector<uint8_t> index_trailer(const std::vector<TraceBlockIndex>& index, uint64_t index_offset) {
+    std::vector<uint8_t> out(index.size() * sizeof(TraceBlockIndex));
+    if (!index.empty()) std::memcpy(out.data(), index.data(), out.size());
+    append_pod(out, index_offset);
+    append_pod(out, static_cast<uint32_t>(index.size()));
+    append_pod(out, TRACE_INDEX_MAGIC);
+    return out;
+}
+
+} // namespace trace_format
+
+TraceStreamWriter::TraceStreamWriter(const std::string& filename, const TraceFormat& fmt,
+                                     int compress_threads)
+    : filename_(filename), fmt_(fmt) {
+    trace_format::validate(fmt);
+    out_ = std::make_unique<GzOutput>(filename, compress_threads, fmt.compressed());
+    block_.reserve(trace_format::BLOCK_ENTRIES);
+    write_bytes(trace_format::stream_header(fmt_));
+}
+
+TraceStreamWriter::~TraceStreamWriter() {
+    if (!closed_) {
+        try {
+            close();
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: failed to finish trace stream " << filename_ << ": " << e.what() << std::endl;
+        }
+    }
+    finish_encoder(); // Never leave a task behind that points at this writer
+}
+
+void TraceStreamWriter::append(const MemoryAccessEntry* entries, size_t count) {
+    while (count > 0) {
+        size_t take = std::min(count, trace_format::BLOCK_ENTRIES - block_.size());
+        block_.insert(block_.end(), entries, entries + take);
+        entries += take;
+        count -= take;
+        if (block_.size() == trace_format::BLOCK_ENTRIES) {
+            push_block();
+        }
+    }
+}
+
+void TraceStreamWriter::push_block() {
+    total_entries_ += block_.size();
+    std::vector<MemoryAccessEntry> next;
+    next.reserve(trace_format::BLOCK_ENTRIES);
+
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (!worker_error_) {
+            queue_.push_back(std::move(block_));
+            if (!encoding_) {
+                encoding_ = true;
+                encoder_ = std::make_shared<CompressorPool::Task>([this] { encode_queued(); });
+                CompressorPool::shared().post(encoder_);
+            }
+        }
+        full = queue_.size() >= MAX_QUEUED_BLOCKS || worker_error_;
+    }
+    block_ = std::move(next);
+    if (full) {
+        finish_encoder(); // Empties the queue
+        rethrow_worker_error();
+    }
+}
+
+void TraceStreamWriter::write_bytes(const std::vector<uint8_t>& bytes) {
+    out_->write(bytes.data(), bytes.size());
+}
+
+void TraceStreamWriter::encode_queued() {
+    try {
+        std::vector<uint8_t> bytes;
+        while (true) {
+            std::vector<MemoryAccessEntry> block;
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex_);
+                if (queue_.empty()) {
+                    encoding_ = false; // The next block posts a new task
+                    return;
+                }
+                block = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            bytes.clear();
+            trace_format::append_block(block.data(), block.size(), fmt_, bytes);
+            if (fmt_.version == 3) {
+                index_.push_back(trace_format::index_block(block.data(), block.size(), out_->bytes_written()));
+            }
+            write_bytes(bytes);
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        worker_error_ = std::current_exception();
+        queue_.clear();
+        encoding_ = false;
+    }
+}
+
+void TraceStreamWriter::finish_encoder() {
+    // Only the producer posts encoders, so a finished one leaves the queue empty
+    if (encoder_) CompressorPool::shared().finish(*encoder_);
+}
+
+void TraceStreamWriter::rethrow_worker_error() {
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        error = worker_error_;
+    }
+    if (error) {
+        finish_encoder();
+        out_.reset();
+        closed_ = true;
+        std::rethrow_exception(error);
+    }
+}
+
+uint32_t TraceStreamWriter::close() {
+    if (closed_) {
+        throw std::runtime_error("Trace stream already closed: " + filename_);
+    }
+    if (!block_.empty()) {
+        push_block();
+    }
+    finish_encoder();
+    rethrow_worker_error();
+    closed_ = true;
+    uint32_t crc;
+    try {
+        write_bytes(trace_format::stream_footer(total_entries_));
+        if (fmt_.version == 3) {
+            write_bytes(trace_format::index_trailer(index_, out_->bytes_written()));
+        }
+        crc = out_->close();
+    } catch (...) {
+        out_.reset();
+        throw;
+    }
+
+    std::cout << "Memory trace written to " << filename_ << std::endl;
+    std::cout << "Collected " << total_entries_ << " entries" << std::endl;
+    return crc;
+}
@@ -37,6 +37,22 @@ def unpack32s(key):
     z = z if z < 512 else z - 1024
     return (x, y, z)
 
+# ── Helper: pack/unpack 64-bit keys (KEY_BITS 64, 21-bit fields) ──
+def pack64(*coords):
+    key = coords[2] & 0x1FFFFF
+    key = (key << 21) | coords[1] & 0x1FFFFF
+    key = (key << 21) | coords[0] & 0x1FFFFF
+    return key
+
+def unpack64s(key):
+    """Unpack signed 21 bit integers"""
+    out = []
+    for _ in range(3):
+        v = key & 0x1FFFFF
+        out.append(v if v < (1 << 20) else v - (1 << 21))
+        key >>= 21
+    return tuple(out)
+
 @dataclass
 class Coord3D:
     """Three-dimensional coordinate representation"""
@@ -2,7 +2,10 @@ import gzip
 import struct
 from typing import Dict, List, Tuple
 import argparse
-from coord import Coord3D, unpack32, unpack32s
+from coord import Coord3D, unpack32, unpack32s, unpack64s
+
+# First word of a kernel map written with KEY_BITS 64
+KERNEL_MAP_WIDE_MARKER = 0xFFFFFFFF
 
 def read_kernel_map_from_gz(filename: str) -> Dict[int, List[Tuple[int, int]]]:
     """
@@ -10,6 +13,8 @@ def read_kernel_map_from_gz(filename: str) -> Dict[int, List[Tuple[int, int]]]:
     Returns a dictionary where:
     - Keys are offset indices
     - Values are lists of (input_idx, query_src_orig_idx) tuples
+    Offset keys are pack32 values, or pack64 values when the file starts with
+    KERNEL_MAP_WIDE_MARKER (see kernel_map_key_bytes).
     """
     kernel_map_data: Dict[int, List[Tuple[int, int]]] = {}
     
@@ -21,17 +26,26 @@ def read_kernel_map_from_gz(filename: str) -> Dict[int, List[Tuple[int, int]]]:
                 print(f"Error: Kernel map file '{filename}' is empty or header is missing/incomplete.")
                 return kernel_map_data
             num_total_entries = struct.unpack('I', num_total_entries_bytes)[0]
+            record_format = 'III'
+            if num_total_entries == KERNEL_MAP_WIDE_MARKER:
+                # Wide layout: key size and the real entry count follow the marker
+                key_bytes, num_total_entries = struct.unpack('II', f.read(8))
+                if key_bytes != 8:
+                    print(f"Error: Unsupported kernel map key size {key_bytes} in '{filename}'.")
+                    return kernel_map_data
+                record_format = 'QII'
+            record_size = struct.calcsize(record_format)
             
             print(f"Reading {num_total_entries} entries from {filename}...")
             
             for i in range(num_total_entries):
-                entry_data_bytes = f.read(12)  # III = 4*3 = 12 bytes
-                if len(entry_data_bytes) < 12:
+                entry_data_bytes = f.read(record_size)  # III = 12 bytes, QII = 16 bytes
+                if len(entry_data_bytes) < record_size:
                     print(f"Error: Unexpected end of file while reading entry {i+1}/{num_total_entries}.")
                     break
 
                 # Unpack the three integers: offset_key, input_idx, query_src_orig_idx
-                offset_key, input_idx, query_src_orig_idx = struct.unpack('III', entry_data_bytes)
+                offset_key, input_idx, query_src_orig_idx = struct.unpack(record_format, entry_data_bytes)
 
                 # Use the offset_key as dictionary key
                 if offset_key not in kernel_map_data:
@@ -42,7 +56,7 @@ def read_kernel_map_from_gz(filename: str) -> Dict[int, List[Tuple[int, int]]]:
         
         entries_read = sum(len(v) for v in kernel_map_data.values())
         print(f"Successfully read {entries_read} entries and reconstructed kernel map.")
-        if entries_read != num_total_entries and (not entry_data_bytes or len(entry_data_bytes) >= 12): 
+        if entries_read != num_total_entries and (not entry_data_bytes or len(entry_data_bytes) >= record_size): 
             print(f"Warning: Expected {num_total_entries} entries based on header, but read {entries_read}.")
 
     except FileNotFoundError:
@@ -57,6 +71,14 @@ def read_kernel_map_from_gz(filename: str) -> Dict[int, List[Tuple[int, int]]]:
         
     return kernel_map_data
 
+def kernel_map_key_bytes(filename: str) -> int:
+    """Width of the offset keys in a kernel map file: 4 (pack32) or 8 (pack64)."""
+    with gzip.open(filename, 'rb') as f:
+        header = f.read(8)
+    if len(header) == 8 and struct.unpack('I', header[:4])[0] == KERNEL_MAP_WIDE_MARKER:
+        return struct.unpack('I', header[4:])[0]
+    return 4
+
 if __name__ == '__main__':
     parser = argparse.ArgumentParser(description="Read and display a kernel map from a .gz file.")
     parser.add_argument(
@@ -69,17 +91,18 @@ if __name__ == '__main__':
 
     print(f"--- Reading Kernel Map from File: {args.filepath} ---")
     kernel_map = read_kernel_map_from_gz(args.filepath)
+    unpack_offset = unpack64s if kernel_map_key_bytes(args.filepath) == 8 else unpack32s
     
     if kernel_map:
         print('\n--- Kernel Map Contents ---')
         for offset_key, matches in sorted(kernel_map.items()):
             if matches:
-                offset_coords = unpack32s(offset_key)
+                offset_coords = unpack_offset(offset_key)
                 print(f"  Offset {offset_coords}:")
                 for match_idx, (input_idx, query_src_orig_idx) in enumerate(matches):
                     print(f"    Match {match_idx + 1}: Input idx: {input_idx} -> Source orig idx: {query_src_orig_idx}")
             else:
-                offset_coords = unpack32s(offset_key)
+                offset_coords = unpack_offset(offset_key)
                 print(f"  Offset {offset_coords}: No matches")
     else:
         print("No kernel map data was read or the map is empty.")
\ No newline at end of file
@@ -6,121 +6,212 @@ import struct
 import argparse
 import numpy as np
 import matplotlib.pyplot as plt
-from collections import Counter, defaultdict
 from minuet_mapping import PHASES, OPS, TENSORS
 
+# Written in place of the entry count by streamed C++ traces
+TRACE_STREAM_MARKER = 0xFFFFFFFF
+# First word of a version 2 (block) trace; see c++/include/trace.hpp
+TRACE_V2_MARKER = 0xFFFFFFFE
+TRACE_FLAG_COLUMNAR = 0x1
+TRACE_FLAG_COUNTS = 0x2  # Coalesced traces: every entry carries a u32 access count
+
+# In-memory trace: one structured row per entry. Same fields as the array
+# returned by minuet_cpp_module.get_mem_trace_array(), so both can be analyzed.
+TRACE_DTYPE = np.dtype([('phase', 'u1'), ('thread_id', 'u1'), ('op', 'u1'), ('tensor', 'u1'), ('count', 'u4'),
+                        ('addr', 'u8')])
+
+def id_name(table, value):
+    """Name of a numeric ID in PHASES / OPS / TENSORS."""
+    return table.inverse[value][0] if value in table.inverse else f"Unknown-{value}"
+
+def make_entry(phase_id, thread_id, op_id, tensor_id, addr, count=1):
+    """Convert numeric IDs of one trace entry to strings."""
+    return {
+        'phase': id_name(PHASES, phase_id),
+        'thread_id': thread_id,
+        'op': id_name(OPS, op_id),
+        'tensor': id_name(TENSORS, tensor_id),
+        'addr': addr,
+        'count': count
+    }
+
+def entry_at(entries, i):
+    """String form of row i of a trace array (only built for printed rows)."""
+    row = entries[i]
+    return make_entry(int(row['phase']), int(row['thread_id']), int(row['op']), int(row['tensor']), int(row['addr']),
+                      int(row['count']))
+
+def to_trace_array(phase, thread_id, op, tensor, addr, count=1):
+    """Assemble a trace array from column arrays."""
+    out = np.empty(len(addr), dtype=TRACE_DTYPE)
+    out['phase'], out['thread_id'], out['op'], out['tensor'], out['addr'] = phase, thread_id, op, tensor, addr
+    out['count'] = count
+    return out
+
+def read_v2_blocks(f, filename, parts):
+    """Read the header and blocks of a version 2 or 3 trace (after the marker).
+
+    Version 3 appends a block index after the footer, which is not needed here.
+    """
+    version, sizeof_addr, flags, _ = struct.unpack('<BBBB', f.read(4))
+    if version not in (2, 3) or sizeof_addr not in (4, 8):
+        print(f"Error: Unsupported trace header in {filename}.")
+        return
+    columnar = bool(flags & TRACE_FLAG_COLUMNAR)
+    counts = bool(flags & TRACE_FLAG_COUNTS)
+    addr_dtype = '<u4' if sizeof_addr == 4 else '<u8'
+    row_fields = [('phase', 'u1'), ('tid', 'u1'), ('op', 'u1'), ('tensor', 'u1'), ('addr', addr_dtype)]
+    row_dtype = np.dtype(row_fields + ([('count', '<u4')] if counts else []))
+    entry_bytes = row_dtype.itemsize
+    read = 0
+    while True:
+        count_data = f.read(4)
+        if len(count_data) < 4:
+            print(f"Error: Trace stream {filename} is truncated.")
+            return
+        count = struct.unpack('<I', count_data)[0]
+        if count == 0:
+            total = struct.unpack('<Q', f.read(8))[0]
+            if total != read:
+                print(f"Error: Trace stream footer reports {total} entries, read {read}.")
+            return
+        payload = f.read(count * entry_bytes)
+        if len(payload) < count * entry_bytes:
+            print(f"Error: Trace file {filename} is truncated in a block of {count} entries.")
+            return
+        if columnar:
+            cols = np.frombuffer(payload, dtype=np.uint8, count=4 * count).reshape(4, count)
+            deltas = np.frombuffer(payload, dtype=addr_dtype, count=count, offset=4 * count)
+            addrs = np.cumsum(deltas, dtype=np.uint64)  # Deltas restart at every block
+            if sizeof_addr == 4:
+                addrs &= np.uint64(0xFFFFFFFF)
+            access_counts = (np.frombuffer(payload, dtype='<u4', count=count, offset=(4 + sizeof_addr) * count)
+                             if counts else 1)
+            parts.append(to_trace_array(cols[0], cols[1], cols[2], cols[3], addrs, access_counts))
+        else:
+            rec = np.frombuffer(payload, dtype=row_dtype, count=count)
+            parts.append(to_trace_array(rec['phase'], rec['tid'], rec['op'], rec['tensor'], rec['addr'],
+                                        rec['count'] if counts else 1))
+        read += count
+
 def read_trace(filename,sizeof_addr=4):
-    """Read a compressed memory trace file and return the entries."""
-    entries = []
+    """Read a memory trace file and return the entries as a TRACE_DTYPE array.
+
+    Indexed (version 3) traces are stored uncompressed; every other layout is gzip.
+    """
+    parts = []
     
     try:
-        with gzip.open(filename, 'rb') as f:
+        with open(filename, 'rb') as raw:
+            is_gzip = raw.read(2) == b'\x1f\x8b'
+        with (gzip.open(filename, 'rb') if is_gzip else open(filename, 'rb')) as f:
             # Read number of entries
             num_entries_data = f.read(4)
             if not num_entries_data:
                 print(f"Error: Trace file {filename} appears to be empty or corrupted (could not read num_entries).")
-                return []
+                return np.empty(0, dtype=TRACE_DTYPE)
             num_entries = struct.unpack('I', num_entries_data)[0]
-            print(f"Reading {num_entries} trace entries from {filename}...")
-            
-            # Read each entry
-            for i in range(num_entries):
-                if sizeof_addr == 4:
-                    entry_data = f.read(8) # Read 8 bytes for a <BBBBI structure
-                else:
-                    entry_data = f.read(12) # Read 12 bytes for a <BBBBQ structure
-                if len(entry_data) < 4 + sizeof_addr:
-                    # Corrected expected byte count in the error message
-                    print(f"Error: Trace file {filename} is truncated. Expected {4 + sizeof_addr} bytes for entry {i+1}, got {len(entry_data)}.")
-                    break
-                # Use '<BBBBQ' for little-endian, 12-byte packed structure
-                if sizeof_addr == 4:
-                    entry = struct.unpack('<BBBBI', entry_data)  # Format is <BBBBI (little-endian)
-                else:
-                    entry = struct.unpack('<BBBBQ', entry_data)  # Format is <BBBBQ (little-endian)
-                phase_id, thread_id, op_id, tensor_id, addr = entry
-                                # Convert numeric IDs to strings
-                phase = PHASES.inverse[phase_id][0] if phase_id in PHASES.inverse else f"Unknown-{phase_id}"
-                op = OPS.inverse[op_id][0] if op_id in OPS.inverse else f"Unknown-{op_id}"
-                tensor = TENSORS.inverse[tensor_id][0] if tensor_id in TENSORS.inverse else f"Unknown-{tensor_id}"
-                entries.append({
-                    'phase': phase,
-                    'thread_id': thread_id,
-                    'op': op,
-                    'tensor': tensor,
-                    'addr': addr
-                })
-        return entries
+            packed_dtype = np.dtype([('phase', 'u1'), ('tid', 'u1'), ('op', 'u1'), ('tensor', 'u1'),
+                                     ('addr', '<u4' if sizeof_addr == 4 else '<u8')])
+
+            def read_entries(count):
+                data = f.read(count * packed_dtype.itemsize)
+                if len(data) < count * packed_dtype.itemsize:
+                    print(f"Error: Trace file {filename} is truncated. Expected {count} entries of {packed_dtype.itemsize} bytes, got {len(data)} bytes.")
+                    return False
+                rec = np.frombuffer(data, dtype=packed_dtype, count=count)
+                parts.append(to_trace_array(rec['phase'], rec['tid'], rec['op'], rec['tensor'], rec['addr']))
+                return True
+
+            if num_entries == TRACE_V2_MARKER:
+                print(f"Reading block trace entries from {filename}...")
+                read_v2_blocks(f, filename, parts)
+            elif num_entries != TRACE_STREAM_MARKER:
+                print(f"Reading {num_entries} trace entries from {filename}...")
+                read_entries(num_entries)
+            else:
+                # Streamed layout: [count][entries] frames, a zero frame, then the u64 total
+                print(f"Reading streamed trace entries from {filename}...")
+                read = 0
+                while True:
+                    frame_data = f.read(4)
+                    if len(frame_data) < 4:
+                        print(f"Error: Trace stream {filename} is truncated.")
+                        break
+                    frame_count = struct.unpack('<I', frame_data)[0]
+                    if frame_count == 0:
+                        total = struct.unpack('<Q', f.read(8))[0]
+                        if total != read:
+                            print(f"Error: Trace stream footer reports {total} entries, read {read}.")
+                        break
+                    if not read_entries(frame_count):
+                        break
+                    read += frame_count
+        return np.concatenate(parts) if parts else np.empty(0, dtype=TRACE_DTYPE)
     
     except gzip.BadGzipFile:
         print(f"Error: File {filename} is not a valid GZIP file or is corrupted.")
-        return []
+        return np.empty(0, dtype=TRACE_DTYPE)
     except Exception as e:
         print(f"Error reading trace file: {e}")
-        return []
+        return np.empty(0, dtype=TRACE_DTYPE)
+
+def filter_trace(entries, phase=None, op=None, tensor=None):
+    """Keep the entries matching every given name; unknown names match nothing."""
+    keep = np.ones(len(entries), dtype=bool)
+    for field, table, name in (('phase', PHASES, phase), ('op', OPS, op), ('tensor', TENSORS, tensor)):
+        if name is None:
+            continue
+        if name not in table:
+            keep[:] = False
+        else:
+            keep &= entries[field] == table[name]
+    return entries[keep]
+
+def print_op_counts(title, ids, ops, label):
+    """Print read / write counts per ID, sorted by label."""
+    print(f"\n--- Operations by {title} ---")
+    reads = np.bincount(ids[ops == OPS['R']], minlength=256)
+    writes = np.bincount(ids[ops == OPS['W']], minlength=256)
+    for i in sorted(np.unique(ids).tolist(), key=label):
+        total = reads[i] + writes[i]
+        print(f"{label(i)}: {total} ops ({reads[i]} reads, {writes[i]} writes)")
 
 def analyze_trace(entries):
     """Analyze trace entries and print statistics."""
-    if not entries:
+    if len(entries) == 0:
         print("No trace entries to analyze")
         return
-    
-    # Count operations by phase
-    phase_ops = defaultdict(lambda: {'R': 0, 'W': 0})
-    for entry in entries:  
-        print(entry)
-        # print(entry)
-        # print(entry['phase'], entry['op'])
-        phase_ops[entry['phase']][entry['op']] += 1
-    
-    # Count operations by tensor
-    tensor_ops = defaultdict(lambda: {'R': 0, 'W': 0})
-    for entry in entries:
-        tensor_ops[entry['tensor']][entry['op']] += 1
-    
-    # Count operations by thread
-    thread_entries = defaultdict(list)
-    thread_ops = defaultdict(lambda: {'R': 0, 'W': 0})
-    for entry in entries:
-        thread_ops[entry['thread_id']][entry['op']] += 1
-        thread_entries[entry['thread_id']].append(entry)
-        
+
     # Print statistics
     print("\n===== Memory Trace Statistics =====")
     print(f"Total entries: {len(entries)}")
-    
-    print("\n--- Operations by Phase ---")
-    for phase, ops in sorted(phase_ops.items()):
-        total = ops['R'] + ops['W']
-        print(f"{phase}: {total} ops ({ops['R']} reads, {ops['W']} writes)")
-    
-    print("\n--- Operations by Tensor ---")
-    for tensor, ops in sorted(tensor_ops.items()):
-        total = ops['R'] + ops['W']
-        print(f"{tensor}: {total} ops ({ops['R']} reads, {ops['W']} writes)")
-    
+    accesses = int(entries['count'].sum())
+    if accesses != len(entries):
+        print(f"Total accesses: {accesses} (coalesced entries)")
+
+    ops = entries['op']
+    print_op_counts("Phase", entries['phase'], ops, lambda i: id_name(PHASES, i))
+    print_op_counts("Tensor", entries['tensor'], ops, lambda i: id_name(TENSORS, i))
     print("\n--- Operations by Thread ---")
-    for thread_id, ops in sorted(thread_ops.items()):
-        total = ops['R'] + ops['W']
-        print(f"Thread {thread_id}: {total} ops ({ops['R']} reads, {ops['W']} writes)")
-    # print("\n--- Thread Entries ---")
-    # for thread_id, entries in sorted(thread_entries.items()):
-    #     print(f"Thread {thread_id} has {len(entries)} entries:")
-    #     for entry in entries:
-    #         print(f"  {entry['phase']} - {entry['op']} - {entry['tensor']} - Addr: {entry['addr']}")
+    reads = np.bincount(entries['thread_id'][ops == OPS['R']], minlength=256)
+    writes = np.bincount(entries['thread_id'][ops == OPS['W']], minlength=256)
+    for thread_id in np.unique(entries['thread_id']).tolist():
+        total = reads[thread_id] + writes[thread_id]
+        print(f"Thread {thread_id}: {total} ops ({reads[thread_id]} reads, {writes[thread_id]} writes)")
 
 def plot_memory_access_patterns(entries, output_file=None):
     """Plot memory access patterns from trace entries."""
-    if not entries:
+    if len(entries) == 0:
         print("No trace entries to plot")
         return
     
     plt.figure(figsize=(12, 10))
     
     # Plot memory accesses by address and time
-    addresses = [entry['addr'] for entry in entries]
-    times = range(len(addresses))
-    colors = ['blue' if entry['op'] == 'R' else 'red' for entry in entries]
+    addresses = entries['addr']
+    times = np.arange(len(addresses))
+    colors = np.where(entries['op'] == OPS['R'], 'blue', 'red')
     
     plt.subplot(2, 1, 1)
     plt.scatter(times, addresses, c=colors, s=5, alpha=0.6)
@@ -131,9 +222,10 @@ def plot_memory_access_patterns(entries, output_file=None):
     
     # Plot memory accesses by tensor type
     plt.subplot(2, 1, 2)
-    tensor_counts = Counter([entry['tensor'] for entry in entries])
-    tensors = [tensor for tensor, _ in tensor_counts.most_common()]
-    counts = [count for _, count in tensor_counts.most_common()]
+    tensor_ids, counts = np.unique(entries['tensor'], return_counts=True)
+    order = np.argsort(-counts, kind='stable')
+    tensors = [id_name(TENSORS, int(t)) for t in tensor_ids[order]]
+    counts = counts[order]
     
     plt.bar(tensors, counts)
     plt.title('Memory Accesses by Tensor Type')
@@ -157,22 +249,16 @@ def diff_trace(file1_path, file2_path):
     entries1 = read_trace(file1_path)
     entries2 = read_trace(file2_path)
 
-    if not entries1 and not entries2:
+    if len(entries1) == 0 and len(entries2) == 0:
         print("Both trace files are empty or could not be read.")
         return
-    if not entries1:
+    if len(entries1) == 0:
         print(f"Could not read entries from {file1_path} or it's empty.")
         print(f"{file2_path} contains {len(entries2)} entries.")
-        # Optionally print all entries from file2 if desired
-        # for i, entry in enumerate(entries2):
-        #     print(f"  Entry {i} in {file2_path} (unique): {entry}")
         return
-    if not entries2:
+    if len(entries2) == 0:
         print(f"Could not read entries from {file2_path} or it's empty.")
         print(f"{file1_path} contains {len(entries1)} entries.")
-        # Optionally print all entries from file1 if desired
-        # for i, entry in enumerate(entries1):
-        #     print(f"  Entry {i} in {file1_path} (unique): {entry}")
         return
 
     len1, len2 = len(entries1), len(entries2)
@@ -185,31 +271,30 @@ def diff_trace(file1_path, file2_path):
     common_len = min(len1, len2)
     print(f"\nComparing the first {common_len} entries...")
 
-    for i in range(common_len):
-        entry1 = entries1[i]
-        entry2 = entries2[i]
-        if entry1 != entry2:
-            differences_found = True
-            print(f"\nDifference at entry index {i}:")
-            print(f"  File 1: {entry1}")
-            print(f"  File 2: {entry2}")
-            # Detailed field comparison
-            for key in entry1.keys():
-                if entry1.get(key) != entry2.get(key):
-                    print(f"    Field '{key}': '{entry1.get(key)}' (File 1) vs '{entry2.get(key)}' (File 2)")
-
+    # Rows are compared in bulk; strings are only built for differing rows
+    for i in np.flatnonzero(entries1[:common_len] != entries2[:common_len]).tolist():
+        differences_found = True
+        entry1 = entry_at(entries1, i)
+        entry2 = entry_at(entries2, i)
+        print(f"\nDifference at entry index {i}:")
+        print(f"  File 1: {entry1}")
+        print(f"  File 2: {entry2}")
+        # Detailed field comparison
+        for key in entry1.keys():
+            if entry1.get(key) != entry2.get(key):
+                print(f"    Field '{key}': '{entry1.get(key)}' (File 1) vs '{entry2.get(key)}' (File 2)")
 
     if len1 > common_len:
         print(f"\nEntries unique to File 1 (from index {common_len}):")
+        differences_found = True
         for i in range(common_len, len1):
-            differences_found = True
-            print(f"  Index {i}: {entries1[i]}")
+            print(f"  Index {i}: {entry_at(entries1, i)}")
 
     if len2 > common_len:
         print(f"\nEntries unique to File 2 (from index {common_len}):")
+        differences_found = True
         for i in range(common_len, len2):
-            differences_found = True
-            print(f"  Index {i}: {entries2[i]}")
+            print(f"  Index {i}: {entry_at(entries2, i)}")
 
     if not differences_found:
         print("\nNo differences found between the trace files (up to common length if sizes differ, or full if same size).")
@@ -238,12 +323,7 @@ def main():
         entries = read_trace(args.trace_file, args.sizeof_addr)
         
         # Apply filters if specified
-        if args.filter_phase:
-            entries = [e for e in entries if e['phase'] == args.filter_phase]
-        if args.filter_op:
-            entries = [e for e in entries if e['op'] == args.filter_op]
-        if args.filter_tensor:
-            entries = [e for e in entries if e['tensor'] == args.filter_tensor]
+        entries = filter_trace(entries, args.filter_phase, args.filter_op, args.filter_tensor)
         
         # Print analysis
         analyze_trace(entries)
@@ -131,6 +131,42 @@ def write_metadata(out_mask, in_mask, slot_dict, slot_array, num_offsets, num_so
     return checksum
 
 
+def _read_compact_mask(f, num_offsets, num_sources):
+    """
+    Read one mask of a version 2 metadata file (METADATA_MASKS "compact").
+
+    Each offset row is a kind byte (0 empty, 1 prefix, 2 uint16 deltas,
+    3 int32 slots). Non-empty rows continue with the base slot (int32), the
+    count of valid entries (uint32), a bitmap of ceil(num_sources / 64) uint64
+    words and, for kinds 2 and 3, one value per valid entry.
+    """
+    def read_exact(size):
+        data = f.read(size)
+        if len(data) < size:
+            raise EOFError(f"Unexpected EOF while reading a compact mask row. Expected {size} bytes.")
+        return data
+
+    mask = np.full(num_offsets * num_sources, -1, dtype=np.int32)
+    bitmap_bytes = (num_sources + 63) // 64 * 8
+    for off_idx in range(num_offsets):
+        kind, = struct.unpack('<B', read_exact(1))
+        if kind == 0:
+            continue
+        if kind > 3:
+            raise ValueError(f"Invalid metadata mask row kind: {kind}")
+        base, count = struct.unpack('<iI', read_exact(8))
+        bits = np.unpackbits(np.frombuffer(read_exact(bitmap_bytes), dtype=np.uint8), bitorder='little')
+        positions = np.flatnonzero(bits[:num_sources])[:count]
+        if kind == 1:
+            values = base + np.arange(count, dtype=np.int64)
+        elif kind == 2:
+            values = base + np.frombuffer(read_exact(count * 2), dtype='<u2').astype(np.int64)
+        else:
+            values = np.frombuffer(read_exact(count * 4), dtype='<i4')
+        mask[off_idx * num_sources + positions] = values
+    return mask
+
+
 def read_metadata(filename):
     """
     Read the metadata from a gzipped binary file (Python implementation).
@@ -165,8 +201,8 @@ def read_metadata(filename):
         magic_bytes, version_num = read_unpack('<4sI')
         if magic_bytes != b'MINU':
             raise ValueError(f"Invalid metadata file format: magic number mismatch. Expected b'MINU', got {magic_bytes}")
-        if version_num != 1:
-            raise ValueError(f"Unsupported metadata file version: {version_num}. Expected 1.")
+        if version_num not in (1, 2):
+            raise ValueError(f"Unsupported metadata file version: {version_num}. Expected 1 or 2.")
         contents['version'] = version_num
 
         # Read num_total_system_offsets, num_total_system_sources
@@ -193,7 +229,10 @@ def read_metadata(filename):
         contents['active_offsets_details'] = active_offsets_details_list
 
         # Calculate mask size and read masks
-        if num_sys_offsets > 0 and num_sys_sources > 0:
+        if num_sys_offsets > 0 and num_sys_sources > 0 and version_num == 2:
+            contents['out_mask'] = _read_compact_mask(f, num_sys_offsets, num_sys_sources)
+            contents['in_mask'] = _read_compact_mask(f, num_sys_offsets, num_sys_sources)
+        elif num_sys_offsets > 0 and num_sys_sources > 0:
             mask_elements = num_sys_offsets * num_sys_sources
             mask_bytes = mask_elements * np.dtype(np.int32).itemsize
 
@@ -20,7 +20,8 @@ PHASES = bidict({
     'PVT': 3,
     'LKP': 4,
     'GTH': 5,
-    'SCT': 6
+    'SCT': 6,
+    'UPD': 7
 })
 TENSORS = bidict({
     'I': 0,
@@ -33,7 +34,8 @@ TENSORS = bidict({
     'TILE': 7,
     'IV': 8,
     'GM': 9,
-    'WV': 10
+    'WV': 10,
+    'HT': 11
 })
 
 OPS = bidict({